@@ -0,0 +1,101 @@
+/*
+ * clock.c
+ *
+ * Coarse clock service. clock_start() runs a ticker thread that stores the
+ * monotonic time (milliseconds) and the wall-clock time (seconds) in two
+ * atomics every CLOCK_TICK_MS; clock_coarse_ms() / clock_coarse_sec() are
+ * then plain loads, at most one tick behind. Without a running ticker (the
+ * offline tools) both read the clocks directly.
+ */
+#ifndef CLOCK_C_HEADER
+#define CLOCK_C_HEADER
+
+#include "clock.h"
+
+#endif
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "platform.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+static atomic_llong clock_mono_ms;
+static atomic_llong clock_wall_sec;
+static atomic_int clock_running;
+static pthread_t clock_thread;
+
+/**
+ * Publish the current time.
+ */
+static void clock_publish(void){
+    atomic_store_explicit(&clock_mono_ms, platform_monotonic_ns() / 1000000LL, memory_order_relaxed);
+    atomic_store_explicit(&clock_wall_sec, (long long)time(NULL), memory_order_relaxed);
+}
+
+/**
+ * Ticker thread: publishes the time until clock_stop().
+ *
+ * arg: unused thread argument
+ */
+static void* clock_ticker(void *arg){
+    (void)arg;
+    while(atomic_load_explicit(&clock_running, memory_order_relaxed)){
+#ifdef _WIN32
+        Sleep(CLOCK_TICK_MS);
+#else
+        struct timespec ts = {0, CLOCK_TICK_MS * 1000000L};
+        nanosleep(&ts, NULL);
+#endif
+        clock_publish();
+    }
+    return NULL;
+}
+
+/**
+ * Start the ticker. The time is published once before this returns.
+ *
+ * @return 0 on success (or when already running), -1 when the thread cannot be created
+ */
+int clock_start(void){
+    if(atomic_load(&clock_running)) return 0;
+    clock_publish();
+    atomic_store(&clock_running, 1);
+    if(pthread_create(&clock_thread, NULL, clock_ticker, NULL) != 0){
+        atomic_store(&clock_running, 0);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stop the ticker; later reads fall back to the system clocks.
+ */
+void clock_stop(void){
+    if(!atomic_exchange(&clock_running, 0)) return;
+    pthread_join(clock_thread, NULL);
+}
+
+/**
+ * Read the coarse monotonic clock.
+ *
+ * @return monotonic time in milliseconds (same origin as platform_monotonic_ns())
+ */
+long long clock_coarse_ms(void){
+    if(!atomic_load_explicit(&clock_running, memory_order_relaxed)) return platform_monotonic_ns() / 1000000LL;
+    return atomic_load_explicit(&clock_mono_ms, memory_order_relaxed);
+}
+
+/**
+ * Read the coarse wall clock.
+ *
+ * @return seconds since the epoch, as time(NULL)
+ */
+long long clock_coarse_sec(void){
+    if(!atomic_load_explicit(&clock_running, memory_order_relaxed)) return (long long)time(NULL);
+    return atomic_load_explicit(&clock_wall_sec, memory_order_relaxed);
+}
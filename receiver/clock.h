@@ -0,0 +1,20 @@
+/**
+ * clock.h
+ *
+ * Declarations for the coarse clock service. A ticker thread publishes the
+ * monotonic and the wall-clock time every CLOCK_TICK_MS, so per-record code
+ * reads the time from memory instead of making a system call.
+ */
+
+#ifndef RECEIVER_CLOCK_H
+#define RECEIVER_CLOCK_H
+
+/** Update period of the published time in milliseconds. */
+#define CLOCK_TICK_MS 5
+
+int clock_start(void);
+void clock_stop(void);
+long long clock_coarse_ms(void);
+long long clock_coarse_sec(void);
+
+#endif
@@ -15,6 +15,14 @@
 #include <string.h>
 #include <stdint.h>
 #include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "clock.h"
+#include "sketch.h"
+#include "memstat.h"
 
 /**
  * Initialize a string queue.
@@ -29,6 +37,8 @@ void queue_init(str_queue_t *q){
     pthread_mutex_init(&q->m, NULL);
     pthread_cond_init(&q->c, NULL);
     q->closed = 0;
+    atomic_init(&q->len, 0);
+    atomic_init(&q->hwm, 0);
 }
 
 /**
@@ -41,16 +51,53 @@ void queue_init(str_queue_t *q){
  * @param s NUL-terminated C string to push
  */
 void queue_push(str_queue_t *q, const char *s){
-    str_node_t *n = malloc(sizeof(*n));
+    queue_push_meta(q, s, NULL);
+}
+
+/**
+ * Push a copy of the string together with its record metadata.
+ *
+ * @param q target queue
+ * @param s NUL-terminated C string to push
+ * @param meta metadata stored with the record (NULL stores empty metadata)
+ */
+void queue_push_meta(str_queue_t *q, const char *s, const rec_meta_t *meta){
+    str_node_t *n = mem_alloc(MEM_QUEUE, sizeof(*n));
     n->next = NULL;
     n->line = strdup(s);
+    /* the line is the consumer's to free(), it only counts while queued */
+    n->line_bytes = strlen(s) + 1;
+    mem_charge(MEM_QUEUE, (long long)n->line_bytes);
+    if(meta) n->meta = *meta; else memset(&n->meta, 0, sizeof(n->meta));
     pthread_mutex_lock(&q->m);
     if(q->tail) q->tail->next = n; else q->head = n;
     q->tail = n;
+    int len = atomic_load_explicit(&q->len, memory_order_relaxed) + 1;
+    atomic_store_explicit(&q->len, len, memory_order_relaxed);
+    if(len > atomic_load_explicit(&q->hwm, memory_order_relaxed)) atomic_store_explicit(&q->hwm, len, memory_order_relaxed);
     pthread_cond_signal(&q->c);
     pthread_mutex_unlock(&q->m);
 }
 
+/**
+ * Unlink the head node; the queue mutex must be held and the queue non-empty.
+ *
+ * @param q source queue
+ * @param meta pointer receiving the record metadata or NULL
+ * @return the detached line (owned by the caller)
+ */
+static char* queue_take_locked(str_queue_t *q, rec_meta_t *meta){
+    str_node_t *n = q->head;
+    q->head = n->next;
+    if(!q->head) q->tail = NULL;
+    atomic_store_explicit(&q->len, atomic_load_explicit(&q->len, memory_order_relaxed) - 1, memory_order_relaxed);
+    char *s = n->line;
+    if(meta) *meta = n->meta;
+    mem_charge(MEM_QUEUE, -(long long)n->line_bytes);
+    mem_free(n);
+    return s;
+}
+
 /**
  * Pop a string from the queue.
  *
@@ -63,18 +110,25 @@ void queue_push(str_queue_t *q, const char *s){
  * @return allocated string pointer or NULL
  */
 char* queue_pop(str_queue_t *q){
+    return queue_pop_meta(q, NULL);
+}
+
+/**
+ * Pop a string and its record metadata from the queue (blocking).
+ *
+ * @param q source queue
+ * @param meta pointer receiving the record metadata or NULL
+ * @return allocated string pointer or NULL when the queue is closed and empty
+ */
+char* queue_pop_meta(str_queue_t *q, rec_meta_t *meta){
     pthread_mutex_lock(&q->m);
     while(!q->head && !q->closed) pthread_cond_wait(&q->c, &q->m);
     if(!q->head){
         pthread_mutex_unlock(&q->m);
         return NULL;
     }
-    str_node_t *n = q->head;
-    q->head = n->next;
-    if(!q->head) q->tail = NULL;
+    char *s = queue_take_locked(q, meta);
     pthread_mutex_unlock(&q->m);
-    char *s = n->line;
-    free(n);
     return s;
 }
 
@@ -98,66 +152,327 @@ char* queue_try_pop(str_queue_t *q){
         pthread_mutex_unlock(&q->m);
         return NULL;
     }
-    str_node_t *n = q->head;
-    q->head = n->next;
-    if(!q->head) q->tail = NULL;
+    char *s = queue_take_locked(q, NULL);
+    pthread_mutex_unlock(&q->m);
+    return s;
+}
+
+/**
+ * Pop a string from the queue, waiting at most `timeout_ms` milliseconds.
+ *
+ * Behaves like `queue_pop_meta` but gives up when the deadline passes, which
+ * lets consumers do background work while the queue is idle. A non-positive
+ * timeout only checks the queue once.
+ *
+ * @param q source queue
+ * @param timeout_ms maximum time to wait in milliseconds
+ * @param meta pointer receiving the record metadata or NULL
+ * @return allocated string pointer or NULL on timeout / closed queue
+ */
+char* queue_pop_timed(str_queue_t *q, int timeout_ms, rec_meta_t *meta){
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    if(timeout_ms < 0) timeout_ms = 0;
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L){ deadline.tv_sec++; deadline.tv_nsec -= 1000000000L; }
+    pthread_mutex_lock(&q->m);
+    while(!q->head && !q->closed && timeout_ms > 0){
+        if(pthread_cond_timedwait(&q->c, &q->m, &deadline) == ETIMEDOUT) break;
+    }
+    if(!q->head){
+        pthread_mutex_unlock(&q->m);
+        return NULL;
+    }
+    char *s = queue_take_locked(q, meta);
     pthread_mutex_unlock(&q->m);
-    char *s = n->line;
-    free(n);
     return s;
 }
 
 /**
- * Return the number of items currently queued. This iterates the list under
- * the queue mutex and may be O(n).
+ * Check whether the queue is empty without walking it.
  *
  * @param q queue to inspect
- * @return number of items currently in the queue
+ * @return non-zero when no item is queued
  */
-int queue_length(str_queue_t *q){
-    int cnt = 0;
+int queue_is_empty(str_queue_t *q){
+    pthread_mutex_lock(&q->m);
+    int empty = (q->head == NULL);
+    pthread_mutex_unlock(&q->m);
+    return empty;
+}
+
+/**
+ * Check whether the queue has been closed.
+ *
+ * @param q queue to inspect
+ * @return non-zero when queue_close() was called
+ */
+int queue_is_closed(str_queue_t *q){
     pthread_mutex_lock(&q->m);
-    for(str_node_t *n = q->head; n; n = n->next) ++cnt;
+    int closed = q->closed;
     pthread_mutex_unlock(&q->m);
-    return cnt;
+    return closed;
 }
 
+/**
+ * Return the number of items currently queued. The count is maintained by
+ * push and pop, so readers such as the UI and the metrics endpoint never
+ * contend for the queue mutex.
+ *
+ * @param q queue to inspect
+ * @return number of items currently in the queue
+ */
+int queue_length(str_queue_t *q){
+    return atomic_load_explicit(&q->len, memory_order_relaxed);
+}
+
+/**
+ * Return the high-water mark of the queue.
+ *
+ * @param q queue to inspect
+ * @return largest number of items queued at once since queue_init()
+ */
+int queue_high_water(str_queue_t *q){
+    return atomic_load_explicit(&q->hwm, memory_order_relaxed);
+}
+
+/* Guards the rarely updated counters below and stats_base */
 static pthread_mutex_t stats_m = PTHREAD_MUTEX_INITIALIZER;
-static long long stats_received = 0;
-static long long stats_processed = 0;
-static long long stats_represented = 0;
-
-/* Moving-window buckets (one-second resolution) */
-#define STATS_WINDOW_SECONDS 60
-static time_t bucket_ts[STATS_WINDOW_SECONDS];
-static long long bucket_recv[STATS_WINDOW_SECONDS];
-static long long bucket_proc[STATS_WINDOW_SECONDS];
-static long long bucket_repr[STATS_WINDOW_SECONDS];
-
-/* Simple ring buffer for prediction-error samples */
-#define ERR_RING_SIZE 1024
-static time_t err_ts[ERR_RING_SIZE];
-static double err_val[ERR_RING_SIZE];
-static int err_head = 0;
-
-static void stats_add_to_bucket(long long *buckets, time_t now, long long delta){
+
+/* Columns of the one-second windows */
+#define STATS_WIN_RECV 0
+#define STATS_WIN_PROC 1
+#define STATS_WIN_REPR 2
+#define STATS_WIN_TRAIN_NS 3
+#define STATS_WIN_ERR_N 4
+#define STATS_WIN_ERR_SUM 5 /* bit pattern of a double */
+#define STATS_WIN_COLS 6
+
+/* Per-thread counter shards; threads beyond the last one share stats_base */
+#define STATS_SHARDS 64
+
+/* Rows of the per-series prediction error windows */
+#define STATS_ERR_SLICES (STATS_WINDOW_SECONDS / STATS_ERR_SLICE_SECONDS)
+
+/**
+ * Prediction error windows of one thread, allocated on its first error.
+ * Rows hold STATS_ERR_SLICE_SECONDS slices of the coarse wall clock and,
+ * like the shard rows, are only written by the owning thread.
+ *
+ * slice: slice number (second / STATS_ERR_SLICE_SECONDS) held by each row
+ * n, sum, max: samples, error sum and largest error per row and series (sum / max as double bits)
+ * bins: quantile sketch per row and series
+ */
+typedef struct {
+    atomic_llong slice[STATS_ERR_SLICES];
+    atomic_llong n[STATS_ERR_SLICES][STATS_ERR_SERIES];
+    atomic_llong sum[STATS_ERR_SLICES][STATS_ERR_SERIES];
+    atomic_llong max[STATS_ERR_SLICES][STATS_ERR_SERIES];
+    atomic_uint bins[STATS_ERR_SLICES][STATS_ERR_SERIES][SKETCH_BINS];
+} stats_err_win_t;
+
+/**
+ * Counters of the per-record statistics of one thread. Only the owning
+ * thread writes its shard (a relaxed load and store, no locked instruction)
+ * and readers sum all shards with relaxed loads. Shards start on their own
+ * cache line so two threads never write the same line.
+ *
+ * count: received, processed, represented totals
+ * tiers, alarms: records per routing tier, alarms per detector kind
+ * trained: training steps
+ * sec: wall-clock second held by each window row (coarse clock)
+ * win: one-second window rows, STATS_WIN_* columns
+ * err: per-series prediction error windows (NULL until the first error)
+ */
+typedef struct {
+    _Alignas(64) atomic_llong count[3];
+    atomic_llong tiers[STATS_TIERS];
+    atomic_llong alarms[STATS_DETECTORS];
+    atomic_llong trained;
+    atomic_llong sec[STATS_WINDOW_SECONDS];
+    atomic_llong win[STATS_WINDOW_SECONDS][STATS_WIN_COLS];
+    _Atomic(stats_err_win_t*) err;
+} stats_shard_t;
+
+static stats_shard_t stats_shards[STATS_SHARDS];
+static atomic_int stats_shards_claimed;
+static _Thread_local stats_shard_t *stats_own;
+/* Restored snapshot and the threads without a shard of their own, written under stats_m */
+static stats_shard_t stats_base;
+
+/* Online-training accounting */
+static long long stats_train_deferred = 0;
+static long long stats_train_dropped = 0;
+static int stats_train_backlog[STATS_MAX_SLOTS];
+/* Latest training cost per slot: bit pattern of a double, NaN until published; set without stats_m on every record */
+static atomic_llong stats_train_cost[STATS_MAX_SLOTS];
+
+/* Per-source model cache occupancy (published by each NN stage into its slot) */
+static long long stats_models_resident[STATS_MAX_SLOTS];
+static long long stats_models_bytes[STATS_MAX_SLOTS];
+static long long stats_models_loads[STATS_MAX_SLOTS];
+static long long stats_models_spills[STATS_MAX_SLOTS];
+
+/* Multi-horizon forecast refreshes (see module2/horizon.c) */
+static long long stats_horizon_refreshes = 0;
+static long long stats_horizon_reused = 0;
+static long long stats_horizon_steps = 0;
+
+/* Federated averaging traffic and rounds (see module2/federation.c) */
+static long long stats_fed_sent = 0;
+static long long stats_fed_recv = 0;
+static long long stats_fed_rounds = 0;
+static long long stats_fed_merged = 0;
+static int stats_fed_peers = 0;
+
+/* Write-ahead log group commits (see wal.c) */
+static long long stats_wal_records = 0;
+static long long stats_wal_bytes = 0;
+static long long stats_wal_syncs = 0;
+static long long stats_wal_sync_ns = 0;
+static long long stats_wal_replayed = 0;
+
+/**
+ * Clamp a gauge slot index into the valid range.
+ */
+static int stats_slot(int slot){
+    if(slot < 0) return 0;
+    return slot < STATS_MAX_SLOTS ? slot : STATS_MAX_SLOTS - 1;
+}
+
+static long long stats_double_bits(double d){
+    long long b;
+    memcpy(&b, &d, sizeof(b));
+    return b;
+}
+
+static double stats_bits_double(long long b){
+    double d;
+    memcpy(&d, &b, sizeof(d));
+    return d;
+}
+
+/**
+ * Get the calling thread's shard, claiming one on first use. Threads beyond
+ * STATS_SHARDS get stats_base with stats_m held; stats_shard_release() drops it.
+ */
+static stats_shard_t* stats_shard_acquire(void){
+    if(!stats_own){
+        int i = atomic_fetch_add(&stats_shards_claimed, 1);
+        stats_own = i < STATS_SHARDS ? &stats_shards[i] : &stats_base;
+    }
+    if(stats_own == &stats_base) pthread_mutex_lock(&stats_m);
+    return stats_own;
+}
+
+static void stats_shard_release(stats_shard_t *s){
+    if(s == &stats_base) pthread_mutex_unlock(&stats_m);
+}
+
+/**
+ * Number of claimed shards; readers visit these and stats_base.
+ */
+static int stats_shard_count(void){
+    int n = atomic_load(&stats_shards_claimed);
+    return n < STATS_SHARDS ? n : STATS_SHARDS;
+}
+
+/**
+ * Add to a counter of the caller's own shard.
+ */
+static void stats_shard_add(atomic_llong *c, long long delta){
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+/**
+ * Get the caller's window row of the current second, clearing it when it
+ * still holds an older second. The row is cleared before its second is
+ * published, so a reader that sees the new second never sees old counts.
+ *
+ * @return row index
+ */
+static int stats_shard_row(stats_shard_t *s){
+    long long now = clock_coarse_sec();
     int idx = (int)(now % STATS_WINDOW_SECONDS);
-    if(bucket_ts[idx] != now){
-        bucket_ts[idx] = now;
-        buckets[idx] = 0;
+    if(atomic_load_explicit(&s->sec[idx], memory_order_relaxed) != now){
+        for(int c=0;c<STATS_WIN_COLS;c++) atomic_store_explicit(&s->win[idx][c], 0, memory_order_relaxed);
+        atomic_store_explicit(&s->sec[idx], now, memory_order_release);
+    }
+    return idx;
+}
+
+/**
+ * Count one record of a pipeline stage in the caller's shard.
+ *
+ * @param counter 0 = received, 1 = processed, 2 = represented (also the window column)
+ */
+static void stats_count_record(int counter){
+    stats_shard_t *s = stats_shard_acquire();
+    stats_shard_add(&s->count[counter], 1);
+    stats_shard_add(&s->win[stats_shard_row(s)][counter], 1);
+    stats_shard_release(s);
+}
+
+/**
+ * Sum the window columns of all shards over the last seconds.
+ *
+ * @param window_sec window size in seconds
+ * @param cols receives STATS_WIN_COLS sums (the STATS_WIN_ERR_SUM column as a plain integer 0)
+ * @param err_sum receives the summed prediction errors
+ */
+static void stats_window_sum(int window_sec, long long *cols, double *err_sum){
+    long long now = clock_coarse_sec();
+    int n = stats_shard_count();
+    for(int c=0;c<STATS_WIN_COLS;c++) cols[c] = 0;
+    *err_sum = 0.0;
+    for(int i=0;i<=n;i++){
+        stats_shard_t *s = i < n ? &stats_shards[i] : &stats_base;
+        for(int r=0;r<STATS_WINDOW_SECONDS;r++){
+            if(now - atomic_load_explicit(&s->sec[r], memory_order_acquire) >= window_sec) continue;
+            for(int c=0;c<STATS_WIN_COLS;c++){
+                long long v = atomic_load_explicit(&s->win[r][c], memory_order_relaxed);
+                if(c == STATS_WIN_ERR_SUM) *err_sum += stats_bits_double(v);
+                else cols[c] += v;
+            }
+        }
     }
-    buckets[idx] += delta;
 }
 
 /**
- * Initialize statistics counters to zero.
+ * Sum a counter over all shards.
+ *
+ * @param offset byte offset of the counter in stats_shard_t
+ */
+static long long stats_counter_sum(size_t offset){
+    int n = stats_shard_count();
+    long long v = 0;
+    for(int i=0;i<=n;i++){
+        stats_shard_t *s = i < n ? &stats_shards[i] : &stats_base;
+        v += atomic_load_explicit((atomic_llong*)((char*)s + offset), memory_order_relaxed);
+    }
+    return v;
+}
+
+/**
+ * Initialize statistics counters to zero. Runs before the pipeline threads start.
  */
 void stats_init(void){
     pthread_mutex_lock(&stats_m);
-    stats_received = stats_processed = stats_represented = 0;
-    for(int i=0;i<STATS_WINDOW_SECONDS;i++){ bucket_ts[i] = 0; bucket_recv[i]=bucket_proc[i]=bucket_repr[i]=0; }
-    for(int i=0;i<ERR_RING_SIZE;i++){ err_ts[i]=0; err_val[i]=0.0; }
-    err_head = 0;
+    for(int i=0;i<STATS_SHARDS;i++) mem_free(atomic_load(&stats_shards[i].err));
+    mem_free(atomic_load(&stats_base.err));
+    memset(stats_shards, 0, sizeof(stats_shards));
+    memset(&stats_base, 0, sizeof(stats_base));
+    stats_train_deferred = stats_train_dropped = 0;
+    stats_horizon_refreshes = stats_horizon_reused = stats_horizon_steps = 0;
+    stats_fed_sent = stats_fed_recv = stats_fed_rounds = stats_fed_merged = 0;
+    stats_fed_peers = 0;
+    stats_wal_records = stats_wal_bytes = stats_wal_syncs = stats_wal_sync_ns = stats_wal_replayed = 0;
+    for(int i=0;i<STATS_MAX_SLOTS;i++){
+        stats_train_backlog[i] = 0;
+        atomic_store_explicit(&stats_train_cost[i], stats_double_bits(NAN), memory_order_relaxed);
+        stats_models_resident[i] = stats_models_bytes[i] = stats_models_loads[i] = stats_models_spills[i] = 0;
+    }
     pthread_mutex_unlock(&stats_m);
 }
 
@@ -165,44 +480,132 @@ void stats_init(void){
  * Increment the received messages counter.
  */
 void stats_inc_received(void){
-    pthread_mutex_lock(&stats_m);
-    ++stats_received;
-    stats_add_to_bucket(bucket_recv, time(NULL), 1);
-    pthread_mutex_unlock(&stats_m);
+    stats_count_record(STATS_WIN_RECV);
 }
 
 /**
  * Increment the processed messages counter.
  */
 void stats_inc_processed(void){
-    pthread_mutex_lock(&stats_m);
-    ++stats_processed;
-    stats_add_to_bucket(bucket_proc, time(NULL), 1);
-    pthread_mutex_unlock(&stats_m);
+    stats_count_record(STATS_WIN_PROC);
 }
 
 /**
  * Increment the represented messages counter.
  */
 void stats_inc_represented(void){
-    pthread_mutex_lock(&stats_m);
-    ++stats_represented;
-    stats_add_to_bucket(bucket_repr, time(NULL), 1);
-    pthread_mutex_unlock(&stats_m);
+    stats_count_record(STATS_WIN_REPR);
 }
 
 /**
- * Record a prediction error sample.
+ * Get the caller's error window row of the current slice, clearing it when
+ * it still holds an older slice (see stats_shard_row()).
  *
- * @param abs_err absolute error value to record
+ * @return row index
  */
-void stats_record_prediction_error(double abs_err){
-    pthread_mutex_lock(&stats_m);
-    time_t now = time(NULL);
-    err_ts[err_head] = now;
-    err_val[err_head] = abs_err;
-    err_head = (err_head + 1) % ERR_RING_SIZE;
-    pthread_mutex_unlock(&stats_m);
+static int stats_err_row(stats_err_win_t *w){
+    long long slice = clock_coarse_sec() / STATS_ERR_SLICE_SECONDS;
+    int r = (int)(slice % STATS_ERR_SLICES);
+    if(atomic_load_explicit(&w->slice[r], memory_order_relaxed) != slice){
+        for(int k=0;k<STATS_ERR_SERIES;k++){
+            atomic_store_explicit(&w->n[r][k], 0, memory_order_relaxed);
+            atomic_store_explicit(&w->sum[r][k], 0, memory_order_relaxed);
+            atomic_store_explicit(&w->max[r][k], 0, memory_order_relaxed);
+            for(int b=0;b<SKETCH_BINS;b++) atomic_store_explicit(&w->bins[r][k][b], 0, memory_order_relaxed);
+        }
+        atomic_store_explicit(&w->slice[r], slice, memory_order_release);
+    }
+    return r;
+}
+
+/**
+ * Add an error sample to a series of the caller's error window row.
+ */
+static void stats_err_add(stats_err_win_t *w, int r, int k, double v){
+    if(!(v >= 0.0)) return;
+    stats_shard_add(&w->n[r][k], 1);
+    double sum = stats_bits_double(atomic_load_explicit(&w->sum[r][k], memory_order_relaxed)) + v;
+    atomic_store_explicit(&w->sum[r][k], stats_double_bits(sum), memory_order_relaxed);
+    if(v > stats_bits_double(atomic_load_explicit(&w->max[r][k], memory_order_relaxed)))
+        atomic_store_explicit(&w->max[r][k], stats_double_bits(v), memory_order_relaxed);
+    atomic_uint *bin = &w->bins[r][k][sketch_bin(v)];
+    atomic_store_explicit(bin, atomic_load_explicit(bin, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+/**
+ * Record the absolute prediction errors of one record: every output's
+ * error goes to its series, their average to STATS_ERR_ALL and to the
+ * window read by stats_get_avg_error().
+ *
+ * @param abs_err absolute error per model output
+ * @param n number of outputs (at most N_METRICS are kept per output)
+ */
+void stats_record_prediction_errors(const double *abs_err, int n){
+    if(n <= 0) return;
+    double avg = 0.0;
+    for(int i=0;i<n;i++) avg += abs_err[i];
+    avg /= (double)n;
+    stats_shard_t *s = stats_shard_acquire();
+    int r = stats_shard_row(s);
+    stats_shard_add(&s->win[r][STATS_WIN_ERR_N], 1);
+    double sum = stats_bits_double(atomic_load_explicit(&s->win[r][STATS_WIN_ERR_SUM], memory_order_relaxed)) + avg;
+    atomic_store_explicit(&s->win[r][STATS_WIN_ERR_SUM], stats_double_bits(sum), memory_order_relaxed);
+    stats_err_win_t *w = atomic_load_explicit(&s->err, memory_order_relaxed);
+    if(!w){
+        w = (stats_err_win_t*)mem_calloc(MEM_STATS, 1, sizeof(*w));
+        atomic_store_explicit(&s->err, w, memory_order_release);
+    }
+    if(w){
+        int er = stats_err_row(w);
+        for(int i=0;i<n && i<N_METRICS;i++) stats_err_add(w, er, i, abs_err[i]);
+        stats_err_add(w, er, STATS_ERR_ALL, avg);
+    }
+    stats_shard_release(s);
+}
+
+/**
+ * Get the prediction errors of a series over the specified window. Reads
+ * the window rows of every thread, independent of the number of samples.
+ *
+ * @param window_sec window size in seconds (max STATS_WINDOW_SECONDS, rounded up to STATS_ERR_SLICE_SECONDS)
+ * @param series model output index, or STATS_ERR_ALL for the per-record average
+ * @param out receives the aggregate
+ */
+void stats_get_error_agg(int window_sec, int series, stats_err_agg_t *out){
+    out->count = 0;
+    out->mean = out->max = out->p50 = out->p95 = out->p99 = NAN;
+    if(series < 0 || series >= STATS_ERR_SERIES) return;
+    if(window_sec <= 0) window_sec = 1;
+    if(window_sec > STATS_WINDOW_SECONDS) window_sec = STATS_WINDOW_SECONDS;
+    int slices = (window_sec + STATS_ERR_SLICE_SECONDS - 1) / STATS_ERR_SLICE_SECONDS;
+    long long now = clock_coarse_sec() / STATS_ERR_SLICE_SECONDS;
+    long long bins[SKETCH_BINS];
+    memset(bins, 0, sizeof(bins));
+    long long count = 0;
+    double sum = 0.0, max = 0.0;
+    int n = stats_shard_count();
+    for(int i=0;i<=n;i++){
+        stats_err_win_t *w = atomic_load_explicit(&(i < n ? &stats_shards[i] : &stats_base)->err, memory_order_acquire);
+        if(!w) continue;
+        for(int r=0;r<STATS_ERR_SLICES;r++){
+            if(now - atomic_load_explicit(&w->slice[r], memory_order_acquire) >= slices) continue;
+            count += atomic_load_explicit(&w->n[r][series], memory_order_relaxed);
+            sum += stats_bits_double(atomic_load_explicit(&w->sum[r][series], memory_order_relaxed));
+            double m = stats_bits_double(atomic_load_explicit(&w->max[r][series], memory_order_relaxed));
+            if(m > max) max = m;
+            for(int b=0;b<SKETCH_BINS;b++) bins[b] += atomic_load_explicit(&w->bins[r][series][b], memory_order_relaxed);
+        }
+    }
+    if(count <= 0) return;
+    /* the counts were read one by one while the owners kept writing, take the sketch's own total */
+    long long in_bins = 0;
+    for(int b=0;b<SKETCH_BINS;b++) in_bins += bins[b];
+    out->count = count;
+    out->mean = sum / (double)count;
+    out->max = max;
+    out->p50 = sketch_quantile(bins, in_bins, 0.50);
+    out->p95 = sketch_quantile(bins, in_bins, 0.95);
+    out->p99 = sketch_quantile(bins, in_bins, 0.99);
 }
 
 /**
@@ -216,16 +619,12 @@ void stats_record_prediction_error(double abs_err){
 void stats_get_window_rates(int window_sec, long long *received, long long *processed, long long *represented){
     if(window_sec <= 0) window_sec = 1;
     if(window_sec > STATS_WINDOW_SECONDS) window_sec = STATS_WINDOW_SECONDS;
-    time_t now = time(NULL);
-    pthread_mutex_lock(&stats_m);
-    long long r=0,p=0,rep=0;
-    for(int i=0;i<STATS_WINDOW_SECONDS;i++){
-        if(now - bucket_ts[i] < window_sec){ r += bucket_recv[i]; p += bucket_proc[i]; rep += bucket_repr[i]; }
-    }
-    if(received) *received = r;
-    if(processed) *processed = p;
-    if(represented) *represented = rep;
-    pthread_mutex_unlock(&stats_m);
+    long long cols[STATS_WIN_COLS];
+    double err_sum;
+    stats_window_sum(window_sec, cols, &err_sum);
+    if(received) *received = cols[STATS_WIN_RECV];
+    if(processed) *processed = cols[STATS_WIN_PROC];
+    if(represented) *represented = cols[STATS_WIN_REPR];
 }
 
 /**
@@ -237,15 +636,10 @@ void stats_get_window_rates(int window_sec, long long *received, long long *proc
 void stats_get_avg_error(int window_sec, double *avg){
     if(window_sec <= 0) window_sec = 1;
     if(window_sec > STATS_WINDOW_SECONDS) window_sec = STATS_WINDOW_SECONDS;
-    time_t now = time(NULL);
-    pthread_mutex_lock(&stats_m);
-    double sum = 0.0; int cnt = 0;
-    for(int i=0;i<ERR_RING_SIZE;i++){
-        if(err_ts[i] == 0) continue;
-        if(now - err_ts[i] < window_sec){ sum += err_val[i]; ++cnt; }
-    }
-    if(avg){ if(cnt==0) *avg = NAN; else *avg = sum / (double)cnt; }
-    pthread_mutex_unlock(&stats_m);
+    long long cols[STATS_WIN_COLS];
+    double err_sum;
+    stats_window_sum(window_sec, cols, &err_sum);
+    if(avg) *avg = cols[STATS_WIN_ERR_N] > 0 ? err_sum / (double)cols[STATS_WIN_ERR_N] : NAN;
 }
 
 /**
@@ -256,9 +650,394 @@ void stats_get_avg_error(int window_sec, double *avg){
  * @param represented pointer receiving the represented messages count or NULL
  */
 void stats_get_counts(long long *received, long long *processed, long long *represented){
+    if(received) *received = stats_counter_sum(offsetof(stats_shard_t, count) + 0 * sizeof(atomic_llong));
+    if(processed) *processed = stats_counter_sum(offsetof(stats_shard_t, count) + 1 * sizeof(atomic_llong));
+    if(represented) *represented = stats_counter_sum(offsetof(stats_shard_t, count) + 2 * sizeof(atomic_llong));
+}
+
+/**
+ * Record one completed training step and the CPU time it consumed.
+ *
+ * @param cpu_ns CPU time spent in the training step in nanoseconds
+ */
+void stats_record_train_step(long long cpu_ns){
+    stats_record_train_steps(1, cpu_ns);
+}
+
+/**
+ * Record several completed training steps at once (used by trainers that
+ * batch their updates).
+ *
+ * @param steps number of training steps
+ * @param cpu_ns CPU time spent in those steps in nanoseconds
+ */
+void stats_record_train_steps(long long steps, long long cpu_ns){
+    stats_shard_t *s = stats_shard_acquire();
+    stats_shard_add(&s->win[stats_shard_row(s)][STATS_WIN_TRAIN_NS], cpu_ns);
+    stats_shard_add(&s->trained, steps);
+    stats_shard_release(s);
+}
+
+/**
+ * Count a training sample that was deferred into the backlog because the
+ * CPU budget was exhausted.
+ */
+void stats_inc_train_deferred(void){
+    pthread_mutex_lock(&stats_m);
+    ++stats_train_deferred;
+    pthread_mutex_unlock(&stats_m);
+}
+
+/**
+ * Count a training sample that was discarded because the backlog was full.
+ */
+void stats_inc_train_dropped(void){
+    pthread_mutex_lock(&stats_m);
+    ++stats_train_dropped;
+    pthread_mutex_unlock(&stats_m);
+}
+
+/**
+ * Publish the current number of samples waiting in a training backlog.
+ *
+ * @param slot gauge slot of the publishing NN stage
+ * @param backlog backlog depth
+ */
+void stats_set_train_backlog(int slot, int backlog){
     pthread_mutex_lock(&stats_m);
-    if(received) *received = stats_received;
-    if(processed) *processed = stats_processed;
-    if(represented) *represented = stats_represented;
+    stats_train_backlog[stats_slot(slot)] = backlog;
+    pthread_mutex_unlock(&stats_m);
+}
+
+/**
+ * Publish the cost of the latest training step of an NN stage.
+ *
+ * @param slot gauge slot of the publishing NN stage
+ * @param cost training cost (NaN = none yet)
+ */
+void stats_set_train_cost(int slot, double cost){
+    atomic_store_explicit(&stats_train_cost[stats_slot(slot)], stats_double_bits(cost), memory_order_relaxed);
+}
+
+/**
+ * Get the latest training cost published into a slot.
+ *
+ * @param slot gauge slot
+ * @return cost, NaN when the slot never published one
+ */
+double stats_get_train_cost(int slot){
+    if(slot < 0 || slot >= STATS_MAX_SLOTS) return NAN;
+    return stats_bits_double(atomic_load_explicit(&stats_train_cost[slot], memory_order_relaxed));
+}
+
+/**
+ * Get online-training budget usage.
+ *
+ * @param window_sec window size in seconds (max STATS_WINDOW_SECONDS)
+ * @param core_frac pointer receiving the fraction of one core spent training over the window or NULL
+ * @param trained pointer receiving the total number of training steps or NULL
+ * @param deferred pointer receiving the total number of deferred samples or NULL
+ * @param dropped pointer receiving the total number of dropped samples or NULL
+ * @param backlog pointer receiving the current backlog depth (summed over slots) or NULL
+ */
+void stats_get_train(int window_sec, double *core_frac, long long *trained, long long *deferred, long long *dropped, int *backlog){
+    if(window_sec <= 0) window_sec = 1;
+    if(window_sec > STATS_WINDOW_SECONDS) window_sec = STATS_WINDOW_SECONDS;
+    long long cols[STATS_WIN_COLS];
+    double err_sum;
+    stats_window_sum(window_sec, cols, &err_sum);
+    if(core_frac) *core_frac = (double)cols[STATS_WIN_TRAIN_NS] / ((double)window_sec * 1e9);
+    if(trained) *trained = stats_counter_sum(offsetof(stats_shard_t, trained));
+    pthread_mutex_lock(&stats_m);
+    if(deferred) *deferred = stats_train_deferred;
+    if(dropped) *dropped = stats_train_dropped;
+    if(backlog){ int b = 0; for(int i=0;i<STATS_MAX_SLOTS;i++) b += stats_train_backlog[i]; *backlog = b; }
+    pthread_mutex_unlock(&stats_m);
+}
+
+/**
+ * Publish the occupancy of a per-source model cache.
+ *
+ * @param slot gauge slot of the publishing NN stage
+ * @param resident number of models currently held in memory
+ * @param bytes approximate memory used by resident models
+ * @param loads total number of models loaded back from spill files
+ * @param spills total number of models written out on eviction
+ */
+void stats_set_model_cache(int slot, long long resident, long long bytes, long long loads, long long spills){
+    pthread_mutex_lock(&stats_m);
+    slot = stats_slot(slot);
+    stats_models_resident[slot] = resident;
+    stats_models_bytes[slot] = bytes;
+    stats_models_loads[slot] = loads;
+    stats_models_spills[slot] = spills;
+    pthread_mutex_unlock(&stats_m);
+}
+
+/**
+ * Get the occupancy of the per-source model caches, summed over all slots.
+ *
+ * @param resident pointer receiving the number of resident models or NULL
+ * @param bytes pointer receiving the memory used by resident models or NULL
+ * @param loads pointer receiving the number of models loaded from spill files or NULL
+ * @param spills pointer receiving the number of evicted (spilled) models or NULL
+ */
+void stats_get_model_cache(long long *resident, long long *bytes, long long *loads, long long *spills){
+    long long r = 0, b = 0, l = 0, s = 0;
+    pthread_mutex_lock(&stats_m);
+    for(int i=0;i<STATS_MAX_SLOTS;i++){
+        r += stats_models_resident[i];
+        b += stats_models_bytes[i];
+        l += stats_models_loads[i];
+        s += stats_models_spills[i];
+    }
+    pthread_mutex_unlock(&stats_m);
+    if(resident) *resident = r;
+    if(bytes) *bytes = b;
+    if(loads) *loads = l;
+    if(spills) *spills = s;
+}
+
+/**
+ * Count a record handled by a routing tier.
+ *
+ * @param tier STATS_TIER_* the record was handled by
+ * @param alarms bit i set for every detector kind i that raised an alarm on the record
+ */
+void stats_record_tier(int tier, unsigned alarms){
+    stats_shard_t *s = stats_shard_acquire();
+    if(tier >= 0 && tier < STATS_TIERS) stats_shard_add(&s->tiers[tier], 1);
+    for(int i=0;i<STATS_DETECTORS;i++) if(alarms & (1u << i)) stats_shard_add(&s->alarms[i], 1);
+    stats_shard_release(s);
+}
+
+/**
+ * Read the routing counters. Output arrays may be NULL.
+ *
+ * @param tiers receives STATS_TIERS record counts
+ * @param alarms receives STATS_DETECTORS alarm counts
+ */
+void stats_get_tiers(long long *tiers, long long *alarms){
+    for(int i=0;tiers && i<STATS_TIERS;i++) tiers[i] = stats_counter_sum(offsetof(stats_shard_t, tiers) + (size_t)i * sizeof(atomic_llong));
+    for(int i=0;alarms && i<STATS_DETECTORS;i++) alarms[i] = stats_counter_sum(offsetof(stats_shard_t, alarms) + (size_t)i * sizeof(atomic_llong));
+}
+
+/**
+ * Record one refresh of a source's multi-horizon forecasts.
+ *
+ * @param reused non-zero when the cached rollout was shifted instead of recomputed
+ * @param steps extra model steps the refresh cost
+ */
+void stats_record_horizon(int reused, int steps){
+    pthread_mutex_lock(&stats_m);
+    ++stats_horizon_refreshes;
+    if(reused) ++stats_horizon_reused;
+    stats_horizon_steps += steps;
+    pthread_mutex_unlock(&stats_m);
+}
+
+/**
+ * Read the multi-horizon forecast counters. Output pointers may be NULL.
+ *
+ * @param refreshes forecast refreshes
+ * @param reused refreshes that shifted the cached rollout
+ * @param steps extra model steps spent on rollouts
+ */
+void stats_get_horizon(long long *refreshes, long long *reused, long long *steps){
+    pthread_mutex_lock(&stats_m);
+    if(refreshes) *refreshes = stats_horizon_refreshes;
+    if(reused) *reused = stats_horizon_reused;
+    if(steps) *steps = stats_horizon_steps;
+    pthread_mutex_unlock(&stats_m);
+}
+
+/**
+ * Account federation traffic and rounds.
+ *
+ * @param sent_bytes bytes sent to peers
+ * @param recv_bytes bytes received from peers
+ * @param rounds finished rounds
+ * @param merged peer models averaged in (summed over rounds)
+ * @param live_peers peers currently heard from, or -1 to keep the gauge
+ */
+void stats_record_federation(long long sent_bytes, long long recv_bytes, int rounds, int merged, int live_peers){
+    pthread_mutex_lock(&stats_m);
+    stats_fed_sent += sent_bytes;
+    stats_fed_recv += recv_bytes;
+    stats_fed_rounds += rounds;
+    stats_fed_merged += merged;
+    if(live_peers >= 0) stats_fed_peers = live_peers;
+    pthread_mutex_unlock(&stats_m);
+}
+
+/**
+ * Read the federation counters. Output pointers may be NULL.
+ */
+void stats_get_federation(long long *sent_bytes, long long *recv_bytes, long long *rounds, long long *merged, int *live_peers){
+    pthread_mutex_lock(&stats_m);
+    if(sent_bytes) *sent_bytes = stats_fed_sent;
+    if(recv_bytes) *recv_bytes = stats_fed_recv;
+    if(rounds) *rounds = stats_fed_rounds;
+    if(merged) *merged = stats_fed_merged;
+    if(live_peers) *live_peers = stats_fed_peers;
+    pthread_mutex_unlock(&stats_m);
+}
+
+/**
+ * Account write-ahead log commits and replayed records.
+ *
+ * @param records records committed
+ * @param bytes bytes written
+ * @param syncs group commits (one fdatasync each)
+ * @param sync_ns wall time spent writing and syncing
+ * @param replayed records replayed on start
+ */
+void stats_record_wal(long long records, long long bytes, long long syncs, long long sync_ns, long long replayed){
+    pthread_mutex_lock(&stats_m);
+    stats_wal_records += records;
+    stats_wal_bytes += bytes;
+    stats_wal_syncs += syncs;
+    stats_wal_sync_ns += sync_ns;
+    stats_wal_replayed += replayed;
+    pthread_mutex_unlock(&stats_m);
+}
+
+/**
+ * Read the write-ahead log counters. Output pointers may be NULL.
+ */
+void stats_get_wal(long long *records, long long *bytes, long long *syncs, long long *sync_ns, long long *replayed){
+    pthread_mutex_lock(&stats_m);
+    if(records) *records = stats_wal_records;
+    if(bytes) *bytes = stats_wal_bytes;
+    if(syncs) *syncs = stats_wal_syncs;
+    if(sync_ns) *sync_ns = stats_wal_sync_ns;
+    if(replayed) *replayed = stats_wal_replayed;
+    pthread_mutex_unlock(&stats_m);
+}
+
+#define STATS_SNAPSHOT_MAGIC 0x54535453u /* "STST" */
+#define STATS_SNAPSHOT_VERSION 2u
+#define STATS_SNAPSHOT_BLOCKS 15
+
+/**
+ * Shard counters summed over all shards, as kept in a snapshot.
+ *
+ * count, tiers, alarms, trained: as in stats_shard_t
+ * sec, win: one-second windows, each row holding the newest second any shard has for it
+ */
+typedef struct {
+    long long count[3];
+    long long tiers[STATS_TIERS];
+    long long alarms[STATS_DETECTORS];
+    long long trained;
+    long long sec[STATS_WINDOW_SECONDS];
+    long long win[STATS_WINDOW_SECONDS][STATS_WIN_COLS];
+} stats_totals_t;
+
+/**
+ * Sum the shards into `t`.
+ */
+static void stats_totals_collect(stats_totals_t *t){
+    memset(t, 0, sizeof(*t));
+    for(int i=0;i<3;i++) t->count[i] = stats_counter_sum(offsetof(stats_shard_t, count) + (size_t)i * sizeof(atomic_llong));
+    stats_get_tiers(t->tiers, t->alarms);
+    t->trained = stats_counter_sum(offsetof(stats_shard_t, trained));
+    int n = stats_shard_count();
+    for(int r=0;r<STATS_WINDOW_SECONDS;r++){
+        for(int i=0;i<=n;i++){
+            long long sec = atomic_load_explicit(&(i < n ? &stats_shards[i] : &stats_base)->sec[r], memory_order_acquire);
+            if(sec > t->sec[r]) t->sec[r] = sec;
+        }
+        double err_sum = 0.0;
+        for(int i=0;i<=n && t->sec[r];i++){
+            stats_shard_t *s = i < n ? &stats_shards[i] : &stats_base;
+            if(atomic_load_explicit(&s->sec[r], memory_order_acquire) != t->sec[r]) continue;
+            for(int c=0;c<STATS_WIN_COLS;c++){
+                long long v = atomic_load_explicit(&s->win[r][c], memory_order_relaxed);
+                if(c == STATS_WIN_ERR_SUM) err_sum += stats_bits_double(v);
+                else t->win[r][c] += v;
+            }
+        }
+        t->win[r][STATS_WIN_ERR_SUM] = stats_double_bits(err_sum);
+    }
+}
+
+/**
+ * List the counters and windows that survive a restart, in file order. The
+ * per-slot gauges are left out: their owners publish them again.
+ *
+ * @param t shard totals
+ * @param ptr receives the address of every block
+ * @param len receives the size of every block in bytes
+ */
+static void stats_snapshot_blocks(stats_totals_t *t, void **ptr, size_t *len){
+    int i = 0;
+#define STATS_BLOCK(x) do { ptr[i] = (void*)&(x); len[i] = sizeof(x); i++; } while(0)
+    STATS_BLOCK(t->count); STATS_BLOCK(t->tiers); STATS_BLOCK(t->alarms); STATS_BLOCK(t->trained);
+    STATS_BLOCK(t->sec); STATS_BLOCK(t->win);
+    STATS_BLOCK(stats_train_deferred); STATS_BLOCK(stats_train_dropped);
+    STATS_BLOCK(stats_horizon_refreshes); STATS_BLOCK(stats_horizon_reused); STATS_BLOCK(stats_horizon_steps);
+    STATS_BLOCK(stats_fed_sent); STATS_BLOCK(stats_fed_recv); STATS_BLOCK(stats_fed_rounds); STATS_BLOCK(stats_fed_merged);
+#undef STATS_BLOCK
+}
+
+/**
+ * Write the counters and the one-second windows (summed over the shards).
+ * The windows are stamped with wall-clock seconds, so after a restore they
+ * cover the time the process was down as empty seconds.
+ *
+ * Layout: magic, version, STATS_WINDOW_SECONDS, total size (uint32 each),
+ * then the blocks of stats_snapshot_blocks() as stored in memory.
+ *
+ * @param f file opened for binary writing
+ * @return 0 on success, -1 on a write error
+ */
+int stats_write(FILE *f){
+    stats_totals_t t;
+    void *ptr[STATS_SNAPSHOT_BLOCKS];
+    size_t len[STATS_SNAPSHOT_BLOCKS], total = 0;
+    stats_totals_collect(&t);
+    stats_snapshot_blocks(&t, ptr, len);
+    for(int i=0;i<STATS_SNAPSHOT_BLOCKS;i++) total += len[i];
+    uint32_t hdr[4] = { STATS_SNAPSHOT_MAGIC, STATS_SNAPSHOT_VERSION, (uint32_t)STATS_WINDOW_SECONDS, (uint32_t)total };
+    int ok = fwrite(hdr, sizeof(hdr), 1, f) == 1;
+    pthread_mutex_lock(&stats_m);
+    for(int i=0;i<STATS_SNAPSHOT_BLOCKS && ok;i++) ok = fwrite(ptr[i], len[i], 1, f) == 1;
+    pthread_mutex_unlock(&stats_m);
+    return ok ? 0 : -1;
+}
+
+/**
+ * Restore what stats_write() saved into stats_base. Nothing is changed
+ * unless the whole snapshot matches this build.
+ *
+ * @param f file opened for binary reading
+ * @return 0 on success, -1 when the file is short or was written by an incompatible build
+ */
+int stats_read(FILE *f){
+    stats_totals_t t;
+    void *ptr[STATS_SNAPSHOT_BLOCKS];
+    size_t len[STATS_SNAPSHOT_BLOCKS], total = 0;
+    stats_snapshot_blocks(&t, ptr, len);
+    for(int i=0;i<STATS_SNAPSHOT_BLOCKS;i++) total += len[i];
+    uint32_t hdr[4];
+    if(fread(hdr, sizeof(hdr), 1, f) != 1 || hdr[0] != STATS_SNAPSHOT_MAGIC || hdr[1] != STATS_SNAPSHOT_VERSION
+       || hdr[2] != (uint32_t)STATS_WINDOW_SECONDS || hdr[3] != (uint32_t)total) return -1;
+    unsigned char *buf = (unsigned char*)mem_alloc(MEM_STATS, total);
+    if(!buf) return -1;
+    if(fread(buf, total, 1, f) != 1){ mem_free(buf); return -1; }
+    pthread_mutex_lock(&stats_m);
+    size_t off = 0;
+    for(int i=0;i<STATS_SNAPSHOT_BLOCKS;i++){ memcpy(ptr[i], buf + off, len[i]); off += len[i]; }
+    for(int i=0;i<3;i++) atomic_store_explicit(&stats_base.count[i], t.count[i], memory_order_relaxed);
+    for(int i=0;i<STATS_TIERS;i++) atomic_store_explicit(&stats_base.tiers[i], t.tiers[i], memory_order_relaxed);
+    for(int i=0;i<STATS_DETECTORS;i++) atomic_store_explicit(&stats_base.alarms[i], t.alarms[i], memory_order_relaxed);
+    atomic_store_explicit(&stats_base.trained, t.trained, memory_order_relaxed);
+    for(int r=0;r<STATS_WINDOW_SECONDS;r++){
+        for(int c=0;c<STATS_WIN_COLS;c++) atomic_store_explicit(&stats_base.win[r][c], t.win[r][c], memory_order_relaxed);
+        atomic_store_explicit(&stats_base.sec[r], t.sec[r], memory_order_release);
+    }
     pthread_mutex_unlock(&stats_m);
+    mem_free(buf);
+    return 0;
 }
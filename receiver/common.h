@@ -6,18 +6,56 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <stdio.h>
 #include <pthread.h>
+#include <stdatomic.h>
+
+#include "types.h"
 
 #define PORT 9000
 
+/**
+ * Metadata carried alongside a queued record through the pipeline.
+ *
+ * char src[64]: source address of the datagram the record came from ("" if unknown)
+ * unsigned flags: REC_* routing flags set by the detectors of the feature stage
+ * unsigned long long lsn: write-ahead log sequence number of the record (0 = not logged)
+ * long long ingest_ns: monotonic time the datagram was received (0 = not measured, see latency.c)
+ * long long hop_ns: monotonic time the record left its previous stage
+ * unsigned long long trace_id: trace ID of a sampled record (0 = not traced, see trace.c)
+ */
+typedef struct {
+    char src[64];
+    unsigned flags;
+    unsigned long long lsn;
+    long long ingest_ns;
+    long long hop_ns;
+    unsigned long long trace_id;
+} rec_meta_t;
+
+/* The record lies in a window a statistical detector raised an alarm for. */
+#define REC_SUSPICIOUS 1u
+/* The detectors handled the record alone, it skips the model (`--route=suspicious`). */
+#define REC_BYPASS 2u
+/* Earlier records of the source bypassed the model, so it has no previous sample to pair with. */
+#define REC_RESUMED 4u
+/* Not a record: checkpoint barrier, every stage saves its state when it passes (lsn = last covered record). */
+#define REC_CHECKPOINT 8u
+/* Replayed from the write-ahead log on start: trains the model, produces no output. */
+#define REC_REPLAYED 16u
+
 /**
  * Node in a string queue.
  * 
  * char *line: stored string
+ * size_t line_bytes: size of the line's allocation (accounted to MEM_QUEUE while queued)
+ * rec_meta_t meta: metadata of the record
  * struct str_node *next: pointer to next node
  */
 typedef struct str_node {
     char *line;
+    size_t line_bytes;
+    rec_meta_t meta;
     struct str_node *next;
 } str_node_t;
 
@@ -29,17 +67,22 @@ typedef struct str_node {
  * pthread_mutex_t m: mutex for synchronizing access
  * pthread_cond_t c: condition variable for signaling
  * int closed: flag indicating if the queue is closed
+ * atomic_int len: number of queued items (written under the mutex, read without it)
+ * atomic_int hwm: largest number of items queued at once since queue_init()
  */
 typedef struct str_queue {
     str_node_t *head, *tail;
     pthread_mutex_t m;
     pthread_cond_t c;
     int closed;
+    atomic_int len, hwm;
 } str_queue_t;
 
 void queue_init(str_queue_t *q);
 void queue_push(str_queue_t *q, const char *s);
 char* queue_pop(str_queue_t *q); // caller must free
+void queue_push_meta(str_queue_t *q, const char *s, const rec_meta_t *meta);
+char* queue_pop_meta(str_queue_t *q, rec_meta_t *meta); // caller must free
 void queue_close(str_queue_t *q);
 
 /* Non-blocking pop: returns a popped string or NULL immediately if the queue is empty.
@@ -47,11 +90,23 @@ void queue_close(str_queue_t *q);
  */
 char* queue_try_pop(str_queue_t *q);
 
-/* Return the number of items currently queued. This iterates the list under
- * the queue mutex and may be O(n).
+/* Pop with a deadline: blocks for at most `timeout_ms` milliseconds and returns NULL
+ * when nothing arrived in time (or the queue is closed and empty). `meta` may be NULL.
  */
+char* queue_pop_timed(str_queue_t *q, int timeout_ms, rec_meta_t *meta);
+
+/* Return non-zero when the queue currently holds no items (O(1)). */
+int queue_is_empty(str_queue_t *q);
+
+/* Return non-zero once queue_close() has been called on the queue. */
+int queue_is_closed(str_queue_t *q);
+
+/* Return the number of items currently queued (O(1), does not take the queue mutex). */
 int queue_length(str_queue_t *q);
 
+/* Return the largest number of items queued at once since queue_init(). */
+int queue_high_water(str_queue_t *q);
+
 void stats_init(void);
 void stats_inc_received(void);
 void stats_inc_processed(void);
@@ -60,10 +115,66 @@ void stats_get_counts(long long *received, long long *processed, long long *repr
 
 #define STATS_WINDOW_SECONDS 60
 
-void stats_record_prediction_error(double abs_err);
+/* Gauges published by several NN stages (one per shard) are kept per slot and summed on read. */
+#define STATS_MAX_SLOTS 64
+
+/* Prediction error series: one per model output (N_METRICS) and their per-record average */
+#define STATS_ERR_ALL N_METRICS
+#define STATS_ERR_SERIES (N_METRICS + 1)
+/* Time resolution of the per-series error windows */
+#define STATS_ERR_SLICE_SECONDS 5
+
+/**
+ * Prediction errors of a series over a window.
+ *
+ * count, mean, max: over all samples (mean / max are NAN without samples)
+ * p50, p95, p99: from the quantile sketch, within SKETCH_ALPHA (see sketch.h)
+ */
+typedef struct {
+    long long count;
+    double mean, max, p50, p95, p99;
+} stats_err_agg_t;
+
+void stats_record_prediction_errors(const double *abs_err, int n);
+void stats_get_error_agg(int window_sec, int series, stats_err_agg_t *out);
 
 void stats_get_window_rates(int window_sec, long long *received, long long *processed, long long *represented);
 
 void stats_get_avg_error(int window_sec, double *avg);
 
+void stats_record_train_step(long long cpu_ns);
+void stats_record_train_steps(long long steps, long long cpu_ns);
+void stats_inc_train_deferred(void);
+void stats_inc_train_dropped(void);
+void stats_set_train_backlog(int slot, int backlog);
+void stats_get_train(int window_sec, double *core_frac, long long *trained, long long *deferred, long long *dropped, int *backlog);
+
+void stats_set_train_cost(int slot, double cost);
+double stats_get_train_cost(int slot);
+
+void stats_set_model_cache(int slot, long long resident, long long bytes, long long loads, long long spills);
+void stats_get_model_cache(long long *resident, long long *bytes, long long *loads, long long *spills);
+
+/* Routing tiers of the statistical detectors and the detector kinds counted per alarm. */
+#define STATS_TIER_DETECTOR 0
+#define STATS_TIER_MODEL 1
+#define STATS_TIER_ESCALATED 2
+#define STATS_TIERS 3
+#define STATS_DETECTORS 3
+
+void stats_record_tier(int tier, unsigned alarms);
+void stats_get_tiers(long long *tiers, long long *alarms);
+
+void stats_record_horizon(int reused, int steps);
+void stats_get_horizon(long long *refreshes, long long *reused, long long *steps);
+
+void stats_record_federation(long long sent_bytes, long long recv_bytes, int rounds, int merged, int live_peers);
+void stats_get_federation(long long *sent_bytes, long long *recv_bytes, long long *rounds, long long *merged, int *live_peers);
+
+void stats_record_wal(long long records, long long bytes, long long syncs, long long sync_ns, long long replayed);
+void stats_get_wal(long long *records, long long *bytes, long long *syncs, long long *sync_ns, long long *replayed);
+
+int stats_write(FILE *f);
+int stats_read(FILE *f);
+
 #endif
@@ -0,0 +1,321 @@
+/*
+ * config.c
+ *
+ * Command-line option parsing for the receiver. Every option is described by
+ * one row in the `options` table, so adding a setting means adding a field to
+ * receiver_config_t, its default and a table row. `--config FILE` reads the
+ * same options from a file of `name=value` lines.
+ */
+
+#ifndef CONFIG_C_HEADER
+#define CONFIG_C_HEADER
+#include "config.h"
+#endif
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "common.h"
+
+receiver_config_t g_config;
+
+typedef enum { OPT_INT, OPT_DOUBLE, OPT_STRING, OPT_FILE } opt_type_t;
+
+/** Nesting limit of `config` lines inside configuration files. */
+#define CONFIG_DEPTH_MAX 4
+
+/**
+ * Description of a single command-line option.
+ *
+ * name: option name without the leading dashes
+ * type: type of the value stored at `offset` (OPT_FILE: a configuration file to read)
+ * offset: offset of the value inside receiver_config_t (unused for OPT_FILE)
+ * help: one-line description printed by config_print_usage()
+ */
+typedef struct {
+    const char *name;
+    opt_type_t type;
+    size_t offset;
+    const char *help;
+} config_option_t;
+
+static const config_option_t options[] = {
+    { "train-budget", OPT_DOUBLE, offsetof(receiver_config_t, train_cpu_budget), "fraction of one core online training may use, e.g. 0.05 (0 = unlimited)" },
+    { "train-backlog", OPT_INT, offsetof(receiver_config_t, train_backlog), "max. training samples deferred while over budget" },
+    { "per-source-models", OPT_INT, offsetof(receiver_config_t, per_source_models), "1 = one model per source address, 0 = single shared model" },
+    { "model-cache-mb", OPT_DOUBLE, offsetof(receiver_config_t, model_cache_mb), "memory budget for resident per-source models in MiB" },
+    { "model-spill-dir", OPT_STRING, offsetof(receiver_config_t, model_spill_dir), "directory evicted per-source models are spilled to" },
+    { "shards", OPT_INT, offsetof(receiver_config_t, shards), "run N shared-nothing receive shards on SO_REUSEPORT sockets (0 = queue pipeline)" },
+    { "workers", OPT_INT, offsetof(receiver_config_t, workers), "run the pipeline stages as tasks on N work-stealing workers (0 = one thread per stage)" },
+    { "model", OPT_STRING, offsetof(receiver_config_t, model), "prediction model: mlp or gru (recurrent, one hidden state per source)" },
+    { "gru-hidden", OPT_INT, offsetof(receiver_config_t, gru_hidden), "hidden state size of the gru model" },
+    { "gru-window", OPT_INT, offsetof(receiver_config_t, gru_window), "truncated BPTT window of the gru model in steps" },
+    { "gru-weights", OPT_STRING, offsetof(receiver_config_t, gru_weights), "weight file of the gru model" },
+    { "train-threads", OPT_INT, offsetof(receiver_config_t, train_threads), "parallel SGD threads for the shared model (needs --per-source-models=0, not with --train-budget)" },
+    { "train-sync", OPT_STRING, offsetof(receiver_config_t, train_sync), "parallel SGD updates: hogwild (lock-free) or striped (per-layer locks)" },
+    { "features", OPT_STRING, offsetof(receiver_config_t, features), "model inputs, comma-separated: raw, lagK, delta, emaH, minW, maxW, varW (e.g. raw,delta,ema8,var16)" },
+    { "norm", OPT_STRING, offsetof(receiver_config_t, norm), "input/output normalization: adaptive (learned from the stream) or static (built-in scales)" },
+    { "norm-window", OPT_INT, offsetof(receiver_config_t, norm_window), "samples per adaptive normalization window" },
+    { "norm-rate", OPT_DOUBLE, offsetof(receiver_config_t, norm_rate), "fraction of the way the scales move towards each window's estimate" },
+    { "norm-freeze", OPT_INT, offsetof(receiver_config_t, norm_freeze), "freeze the adaptive scales after N samples (0 = never)" },
+    { "horizon", OPT_INT, offsetof(receiver_config_t, horizon), "forecast the next N samples per record by autoregressive rollout (1 = next sample only)" },
+    { "horizon-tol", OPT_DOUBLE, offsetof(receiver_config_t, horizon_tol), "relative deviation from the forecast under which the cached rollout is shifted instead of recomputed (0 = always recompute)" },
+    { "detectors", OPT_STRING, offsetof(receiver_config_t, detectors), "statistical detectors, groups of ewmaL+cusumH+hwP optionally prefixed by a metric (e.g. ewma3+cusum5,rtt:hw288), off = none" },
+    { "route", OPT_STRING, offsetof(receiver_config_t, route), "records the model sees: all, or suspicious (only windows a detector raised an alarm for)" },
+    { "detect-hold", OPT_INT, offsetof(receiver_config_t, detect_hold), "records after an alarm that are still routed as suspicious" },
+    { "layers", OPT_STRING, offsetof(receiver_config_t, layers), "hidden layer sizes of the mlp model, comma-separated (none = no hidden layer)" },
+    { "learning-rate", OPT_DOUBLE, offsetof(receiver_config_t, learning_rate), "learning rate of the mlp model" },
+    { "hidden-act", OPT_STRING, offsetof(receiver_config_t, hidden_act), "activation of the mlp hidden layers: linear, relu, sigmoid or tanh" },
+    { "output-act", OPT_STRING, offsetof(receiver_config_t, output_act), "activation of the mlp output layer: linear, relu, sigmoid or tanh" },
+    { "weights", OPT_STRING, offsetof(receiver_config_t, weights), "weight file of the mlp model (seed of the per-source models)" },
+    { "port", OPT_INT, offsetof(receiver_config_t, port), "UDP port the records are received on" },
+    { "fed-port", OPT_INT, offsetof(receiver_config_t, fed_port), "federated averaging: UDP port peer updates are received on (0 = off; needs --per-source-models=0 and the mlp model)" },
+    { "fed-peers", OPT_STRING, offsetof(receiver_config_t, fed_peers), "federated averaging: comma-separated host:port peers updates are sent to" },
+    { "fed-interval", OPT_DOUBLE, offsetof(receiver_config_t, fed_interval), "seconds between federation rounds" },
+    { "fed-kbps", OPT_DOUBLE, offsetof(receiver_config_t, fed_kbps), "federation send budget in kB/s (all peers together)" },
+    { "fed-keyframe", OPT_INT, offsetof(receiver_config_t, fed_keyframe), "federation rounds between full weight copies (the others send changes only)" },
+    { "state-dir", OPT_STRING, offsetof(receiver_config_t, state_dir), "directory the pipeline state is saved to on SIGINT/SIGTERM and restored from on start (\"\" = cold start)" },
+    { "wal-dir", OPT_STRING, offsetof(receiver_config_t, wal_dir), "write-ahead log of ingested records, replayed into the model after a crash (\"\" = off; needs --state-dir, not with --shards / --workers)" },
+    { "wal-sync-ms", OPT_INT, offsetof(receiver_config_t, wal_sync_ms), "group commit interval of the write-ahead log in ms (records of the last interval can be lost)" },
+    { "wal-segment-mb", OPT_DOUBLE, offsetof(receiver_config_t, wal_segment_mb), "size in MiB after which a new write-ahead log segment is started" },
+    { "wal-checkpoint", OPT_DOUBLE, offsetof(receiver_config_t, wal_checkpoint), "seconds between state checkpoints that truncate the write-ahead log" },
+    { "store-dir", OPT_STRING, offsetof(receiver_config_t, store_dir), "store the received metrics and the predictions compressed in this directory (\"\" = off)" },
+    { "metrics-port", OPT_INT, offsetof(receiver_config_t, metrics_port), "serve Prometheus metrics at GET /metrics on this TCP port (0 = off)" },
+    { "metrics-addr", OPT_STRING, offsetof(receiver_config_t, metrics_addr), "IPv4 address the metrics port binds to (0.0.0.0 = all interfaces)" },
+    { "metrics-socket", OPT_STRING, offsetof(receiver_config_t, metrics_socket), "also serve the metrics on this Unix domain socket (\"\" = none)" },
+    { "log-level", OPT_STRING, offsetof(receiver_config_t, log_level), "lowest level logged: debug (every record), info, warn or error" },
+    { "log-rate", OPT_INT, offsetof(receiver_config_t, log_rate), "messages per second logged per call site, the rest are counted (0 = unlimited)" },
+    { "trace-file", OPT_STRING, offsetof(receiver_config_t, trace_file), "write per-record stage spans to this binary ring file, see tools/trace_export.py (\"\" = off)" },
+    { "trace-sample", OPT_INT, offsetof(receiver_config_t, trace_sample), "trace one received record in N" },
+    { "trace-mb", OPT_DOUBLE, offsetof(receiver_config_t, trace_mb), "size of the trace file in MiB, the oldest spans are overwritten (32 bytes each)" },
+    { "perf-counters", OPT_INT, offsetof(receiver_config_t, perf_counters), "1 = count CPU time, cycles, instructions, cache and branch misses per pipeline stage (Linux perf_event_open)" },
+    { "mem-budget-mb", OPT_DOUBLE, offsetof(receiver_config_t, mem_budget_mb), "exit with an error as soon as the resident or accounted memory exceeds this many MiB (0 = no budget)" },
+    { "config", OPT_FILE, 0, "read options from a file of name=value lines ('#' starts a comment); later options override" },
+};
+
+#define N_OPTIONS (sizeof(options) / sizeof(options[0]))
+
+/**
+ * Fill a configuration with default values.
+ *
+ * @param c configuration to initialize
+ */
+void config_defaults(receiver_config_t *c){
+    memset(c, 0, sizeof(*c));
+    c->train_cpu_budget = 0.0;
+    c->train_backlog = 256;
+    c->per_source_models = 1;
+    c->model_cache_mb = 16.0;
+    c->model_spill_dir = "data/models";
+    c->shards = 0;
+    c->workers = 0;
+    c->model = "mlp";
+    c->gru_hidden = 16;
+    c->gru_window = 8;
+    c->gru_weights = "data/gru_weights.bin";
+    c->train_threads = 1;
+    c->train_sync = "hogwild";
+    c->features = "raw";
+    c->norm = "adaptive";
+    c->norm_window = 1024;
+    c->norm_rate = 0.1;
+    c->norm_freeze = 0;
+    c->horizon = 1;
+    c->horizon_tol = 0.05;
+    c->detectors = "ewma4+cusum8+hw";
+    c->route = "all";
+    c->detect_hold = 4;
+    c->layers = "16,32,64,32,16";
+    c->learning_rate = 0.1;
+    c->hidden_act = "sigmoid";
+    c->output_act = "relu";
+    c->weights = "data/nn_weights.bin";
+    c->port = PORT;
+    c->fed_port = 0;
+    c->fed_peers = "";
+    c->fed_interval = 10.0;
+    c->fed_kbps = 16.0;
+    c->fed_keyframe = 10;
+    c->state_dir = "data/state";
+    c->wal_dir = "";
+    c->wal_sync_ms = 50;
+    c->wal_segment_mb = 16.0;
+    c->wal_checkpoint = 60.0;
+    c->store_dir = "";
+    c->metrics_port = 0;
+    c->metrics_addr = "127.0.0.1";
+    c->metrics_socket = "";
+    c->log_level = "info";
+    c->log_rate = 100;
+    c->trace_file = "";
+    c->trace_sample = 100;
+    c->trace_mb = 64.0;
+    c->perf_counters = 0;
+    c->mem_budget_mb = 0.0;
+}
+
+/**
+ * Store a textual option value into the configuration.
+ *
+ * @param c configuration to update
+ * @param o option descriptor
+ * @param value textual value from the command line
+ * @return 0 on success, -1 when the value cannot be parsed
+ */
+static int config_set(receiver_config_t *c, const config_option_t *o, const char *value){
+    char *end = NULL;
+    void *dst = (char*)c + o->offset;
+    switch(o->type){
+        case OPT_INT: {
+            long v = strtol(value, &end, 10);
+            if(end == value || *end != '\0') return -1;
+            *(int*)dst = (int)v;
+            return 0;
+        }
+        case OPT_DOUBLE: {
+            double v = strtod(value, &end);
+            if(end == value || *end != '\0') return -1;
+            *(double*)dst = v;
+            return 0;
+        }
+        case OPT_STRING:
+            *(const char**)dst = value;
+            return 0;
+        case OPT_FILE:
+            return config_load_file(c, value);
+    }
+    return -1;
+}
+
+/**
+ * Look up an option by name.
+ *
+ * @param name option name without dashes
+ * @param name_len length of the name
+ * @return descriptor or NULL when unknown
+ */
+static const config_option_t* config_find(const char *name, size_t name_len){
+    for(size_t k=0;k<N_OPTIONS;k++){
+        if(strlen(options[k].name) == name_len && strncmp(options[k].name, name, name_len) == 0) return &options[k];
+    }
+    return NULL;
+}
+
+/**
+ * Read options from a configuration file.
+ *
+ * Every non-empty line is `name=value` (or `name value`) with the option
+ * names of the command line; leading dashes are optional and `#` starts a
+ * comment. Errors are reported on stderr with the file name and line.
+ * String values are copied and stay allocated for the life of the process.
+ *
+ * @param c configuration to update
+ * @param path file to read
+ * @return 0 on success, -1 on error
+ */
+int config_load_file(receiver_config_t *c, const char *path){
+    static int depth = 0;
+    if(depth >= CONFIG_DEPTH_MAX){
+        fprintf(stderr, "%s: configuration files nested too deeply\n", path);
+        return -1;
+    }
+    FILE *f = fopen(path, "r");
+    if(!f){
+        fprintf(stderr, "cannot open configuration file '%s'\n", path);
+        return -1;
+    }
+    depth++;
+    char line[1024];
+    int lineno = 0, rc = 0;
+    while(rc == 0 && fgets(line, sizeof(line), f)){
+        lineno++;
+        char *hash = strchr(line, '#');
+        if(hash) *hash = '\0';
+        char *s = line;
+        while(isspace((unsigned char)*s)) s++;
+        size_t len = strlen(s);
+        while(len > 0 && isspace((unsigned char)s[len-1])) s[--len] = '\0';
+        if(len == 0) continue;
+        while(*s == '-') s++;
+        size_t name_len = strcspn(s, "= \t");
+        const char *value = s + name_len;
+        while(*value == ' ' || *value == '\t') value++;
+        if(*value == '=') value++;
+        while(*value == ' ' || *value == '\t') value++;
+        const config_option_t *o = config_find(s, name_len);
+        if(!o){
+            fprintf(stderr, "%s:%d: unknown option '%.*s'\n", path, lineno, (int)name_len, s);
+            rc = -1;
+        } else if(*value == '\0'){
+            fprintf(stderr, "%s:%d: option '%s' requires a value\n", path, lineno, o->name);
+            rc = -1;
+        } else {
+            char *copy = strdup(value);
+            if(!copy || config_set(c, o, copy) != 0){
+                if(o->type != OPT_FILE) fprintf(stderr, "%s:%d: invalid value '%s' for option '%s'\n", path, lineno, value, o->name);
+                rc = -1;
+            }
+            if(copy && o->type != OPT_STRING) free(copy);
+        }
+    }
+    depth--;
+    fclose(f);
+    return rc;
+}
+
+/**
+ * Parse command-line arguments into a configuration.
+ *
+ * Options are accepted as `--name=value` or `--name value`. Unknown options
+ * and unparsable values are reported on stderr. `--config FILE` applies the
+ * file's options at its position, so options after it override the file.
+ *
+ * @param c configuration to update (should be initialized with config_defaults)
+ * @param argc argument count
+ * @param argv argument vector
+ * @return 0 on success, 1 when help was requested, -1 on error
+ */
+int config_parse_args(receiver_config_t *c, int argc, char **argv){
+    for(int i=1;i<argc;i++){
+        const char *arg = argv[i];
+        if(strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) return 1;
+        if(strncmp(arg, "--", 2) != 0){
+            fprintf(stderr, "unexpected argument '%s'\n", arg);
+            return -1;
+        }
+        const char *name = arg + 2;
+        const char *eq = strchr(name, '=');
+        size_t name_len = eq ? (size_t)(eq - name) : strlen(name);
+        const config_option_t *o = config_find(name, name_len);
+        if(!o){
+            fprintf(stderr, "unknown option '%s'\n", arg);
+            return -1;
+        }
+        const char *value = NULL;
+        if(eq) value = eq + 1;
+        else if(i+1 < argc) value = argv[++i];
+        else {
+            fprintf(stderr, "option '--%s' requires a value\n", o->name);
+            return -1;
+        }
+        if(config_set(c, o, value) != 0){
+            /* a configuration file reports its own errors */
+            if(o->type != OPT_FILE) fprintf(stderr, "invalid value '%s' for option '--%s'\n", value, o->name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Print the list of supported options.
+ *
+ * @param f output stream
+ * @param prog program name shown in the usage line
+ */
+void config_print_usage(FILE *f, const char *prog){
+    fprintf(f, "usage: %s [options]\n\noptions:\n", prog);
+    for(size_t k=0;k<N_OPTIONS;k++) fprintf(f, "  --%-22s %s\n", options[k].name, options[k].help);
+}
@@ -0,0 +1,126 @@
+/**
+ * config.h
+ *
+ * Runtime configuration of the receiver application, filled from command-line options.
+ */
+
+#ifndef RECEIVER_CONFIG_H
+#define RECEIVER_CONFIG_H
+
+#include <stdio.h>
+
+/**
+ * Receiver runtime configuration.
+ *
+ * double train_cpu_budget: fraction of one core online training may use (<= 0 disables the cap)
+ * int train_backlog: capacity of the deferred training sample backlog
+ * int per_source_models: non-zero to keep one model per source address
+ * double model_cache_mb: memory budget for resident per-source models
+ * const char *model_spill_dir: directory evicted per-source models are written to
+ * int shards: number of SO_REUSEPORT receive shards (0 = classic queue pipeline)
+ * int train_threads: trainer threads for the single shared model (> 1 enables parallel SGD, not limited by train_cpu_budget)
+ * const char *train_sync: "hogwild" (lock-free) or "striped" (per-layer locks) parallel updates
+ * const char *model: "mlp" (feed-forward network) or "gru" (recurrent model with per-source state)
+ * int gru_hidden: hidden state size of the recurrent model
+ * int gru_window: truncated BPTT length in steps
+ * const char *gru_weights: file the recurrent weights are loaded from / saved to
+ * int workers: number of work-stealing pool workers running the stages as tasks (0 = one thread per stage)
+ * const char *features: feature set computed per stream and fed to the model (see module1/feature_stage.h)
+ * const char *norm: "adaptive" (streaming normalization, see module2/norm.c) or "static" (fixed scales)
+ * int norm_window: samples per normalization statistics window
+ * double norm_rate: fraction of the way the scales move towards each window's estimate
+ * int norm_freeze: samples after which the scales stop moving (0 = never)
+ * int horizon: number of future samples forecast per record (1 = next sample only, see module2/horizon.c)
+ * double horizon_tol: relative deviation from the forecast under which a cached rollout is reused (0 = never)
+ * const char *detectors: statistical detectors per metric (see module1/detect.c), "off" for none
+ * const char *route: "all" (every record reaches the model) or "suspicious" (only records in alarm windows)
+ * int detect_hold: records after an alarm that still count as suspicious
+ * const char *layers: hidden layer sizes of the mlp model, comma-separated ("none" = no hidden layer)
+ * double learning_rate: learning rate of the mlp model
+ * const char *hidden_act: activation of the mlp hidden layers (linear, relu, sigmoid, tanh)
+ * const char *output_act: activation of the mlp output layer
+ * const char *weights: weight file of the mlp model
+ * int port: UDP port the records are received on
+ * int fed_port: UDP port of the federation (0 = federation off, see module2/federation.c)
+ * const char *fed_peers: comma-separated host:port list of the peers updates are sent to
+ * double fed_interval: seconds between federation rounds
+ * double fed_kbps: federation send budget in kilobytes per second
+ * int fed_keyframe: federation rounds between full weight copies
+ * const char *state_dir: directory of the shutdown snapshot restored on start ("" = cold start, see state.c)
+ * const char *wal_dir: directory of the write-ahead log of ingested records ("" = off, see wal.c)
+ * int wal_sync_ms: group commit interval of the write-ahead log in milliseconds
+ * double wal_segment_mb: size after which a new log segment is started
+ * double wal_checkpoint: seconds between checkpoints of the pipeline state that truncate the log
+ * const char *store_dir: directory of the compressed history of metrics and predictions ("" = off, see tsdb.c)
+ * int metrics_port: TCP port of the Prometheus metrics endpoint (0 = off, see metrics.c)
+ * const char *metrics_addr: IPv4 address the metrics endpoint binds to
+ * const char *metrics_socket: Unix domain socket the metrics endpoint also listens on ("" = none)
+ * const char *log_level: lowest level of the messages written (debug, info, warn, error, see log.c)
+ * int log_rate: messages per second written per logging call site (0 = unlimited)
+ * const char *trace_file: ring file sampled records are traced to ("" = off, see trace.c)
+ * int trace_sample: trace one received record in this many
+ * double trace_mb: size of the trace file in MiB
+ * int perf_counters: 1 = count CPU events per pipeline stage with perf_event_open (see perfctr.c)
+ * double mem_budget_mb: exit as soon as the process uses more memory than this many MiB (0 = no budget, see memstat.c)
+ */
+typedef struct {
+    double train_cpu_budget;
+    int train_backlog;
+    int per_source_models;
+    double model_cache_mb;
+    const char *model_spill_dir;
+    int shards;
+    const char *model;
+    int gru_hidden;
+    int gru_window;
+    const char *gru_weights;
+    int workers;
+    int train_threads;
+    const char *train_sync;
+    const char *features;
+    const char *norm;
+    int norm_window;
+    double norm_rate;
+    int norm_freeze;
+    int horizon;
+    double horizon_tol;
+    const char *detectors;
+    const char *route;
+    int detect_hold;
+    const char *layers;
+    double learning_rate;
+    const char *hidden_act;
+    const char *output_act;
+    const char *weights;
+    int port;
+    int fed_port;
+    const char *fed_peers;
+    double fed_interval;
+    double fed_kbps;
+    int fed_keyframe;
+    const char *state_dir;
+    const char *wal_dir;
+    int wal_sync_ms;
+    double wal_segment_mb;
+    double wal_checkpoint;
+    const char *store_dir;
+    int metrics_port;
+    const char *metrics_addr;
+    const char *metrics_socket;
+    const char *log_level;
+    int log_rate;
+    const char *trace_file;
+    int trace_sample;
+    double trace_mb;
+    int perf_counters;
+    double mem_budget_mb;
+} receiver_config_t;
+
+extern receiver_config_t g_config;
+
+void config_defaults(receiver_config_t *c);
+int config_parse_args(receiver_config_t *c, int argc, char **argv);
+int config_load_file(receiver_config_t *c, const char *path);
+void config_print_usage(FILE *f, const char *prog);
+
+#endif
@@ -13,16 +13,31 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#ifndef _WIN32
+#include <sys/select.h>
+#endif
 
 #include "platform.h"
 #include "types.h"
 #include "common.h"
 #include "queues.h"
 #include "module1/data_processor.h"
+#include "module1/feature_stage.h"
 #include "module2/nn.h"
 #include "module3/represent.h"
 #include "module4/ui.h"
 #include "log.h"
+#include "config.h"
+#include "shard.h"
+#include "task_pipeline.h"
+#include "state.h"
+#include "wal.h"
+#include "tsdb.h"
+#include "clock.h"
+#include "latency.h"
+#include "trace.h"
+#include "metrics.h"
+#include "perfctr.h"
 
 /**
  * Safe copy helper to avoid -Wstringop-truncation on strncpy and ensure NUL termination.
@@ -44,46 +59,142 @@ static void safe_strncpy(char *dst, const char *src, size_t dst_size){
  */
 void *preproc_thread(void *arg);
 
+/**
+ * Replay callback of the write-ahead log: queue a logged record for the
+ * feature stage, flagged so the NN stage trains on it without output.
+ *
+ * @param src source of the record
+ * @param line preprocessed record
+ * @param lsn sequence number of the record
+ * @param ctx unused
+ */
+static void wal_replay_record(const char *src, const char *line, unsigned long long lsn, void *ctx){
+  (void)ctx;
+  rec_meta_t meta;
+  memset(&meta, 0, sizeof(meta));
+  safe_strncpy(meta.src, src, sizeof(meta.src));
+  meta.flags = REC_REPLAYED;
+  meta.lsn = lsn;
+  queue_push_meta(&proc_queue, line, &meta);
+}
+
 /**
  * Run the main receiver loop: initialize sockets, start pipeline threads, receive UDP messages and push them into the processing pipeline.
+ * With `--shards=N` the receive path is handed to run_shards(), with `--workers=N` to
+ * run_task_pipeline().
+ *
+ * SIGINT / SIGTERM end the loop: every stage finishes the records already
+ * queued for it, and the stages and this function save their state to
+ * `--state-dir` (see state.c) before the process exits.
  */
 int run_receiver(void){
   if (platform_socket_init() != 0) {
     return EXIT_FAILURE;
   }
   log_init();
+  platform_catch_stop_signals();
+  if(g_config.store_dir[0]){
+    g_store = tsdb_open(g_config.store_dir, 1);
+    if(!g_store){ LOG_ERROR("[tsdb] cannot open the store in %s\n", g_config.store_dir); platform_socket_cleanup(); log_close(); return 1; }
+  }
+  if(g_config.shards > 0 || g_config.workers > 0){
+    queue_init(&error_queue);
+    if(clock_start() != 0) LOG_ERROR("[clock] cannot start the clock ticker, reading the system clock instead\n");
+    stats_init();
+    state_restore_stats();
+    if(trace_start(g_config.trace_file, g_config.trace_sample, g_config.trace_mb) != 0){
+      clock_stop(); tsdb_close(g_store); platform_socket_cleanup(); log_close(); return EXIT_FAILURE;
+    }
+    perfctr_start(g_config.perf_counters);
+    if(metrics_start(g_config.metrics_addr, g_config.metrics_port, g_config.metrics_socket) != 0){
+      perfctr_stop(); trace_stop(); clock_stop(); tsdb_close(g_store); platform_socket_cleanup(); log_close(); return EXIT_FAILURE;
+    }
+    int rc = g_config.shards > 0 ? run_shards(g_config.shards) : run_task_pipeline(g_config.workers);
+    state_save_stats();
+    metrics_stop();
+    perfctr_stop();
+    trace_stop();
+    clock_stop();
+    tsdb_close(g_store);
+    g_store = NULL;
+    platform_socket_cleanup();
+    log_close();
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
   socket_t sock = socket(AF_INET, SOCK_DGRAM, 0);
-  if(sock == (socket_t)-1 || sock == INVALID_SOCKET){ perror("socket"); platform_socket_cleanup(); return 1; }
+  if(sock == (socket_t)-1 || sock == INVALID_SOCKET){ perror("socket"); tsdb_close(g_store); platform_socket_cleanup(); log_close(); return 1; }
   struct sockaddr_in me;
   memset(&me,0,sizeof(me));
   me.sin_family = AF_INET;
-  me.sin_port = htons(PORT);
+  me.sin_port = htons((unsigned short)g_config.port);
   me.sin_addr.s_addr = INADDR_ANY;
-  if(bind(sock, (struct sockaddr*)&me, sizeof(me))<0){ perror("bind"); CLOSESOCKET(sock); platform_socket_cleanup(); return 1; }
+  if(bind(sock, (struct sockaddr*)&me, sizeof(me))<0){ perror("bind"); CLOSESOCKET(sock); tsdb_close(g_store); platform_socket_cleanup(); log_close(); return 1; }
   queue_init(&raw_queue);
   queue_init(&proc_queue);
+  queue_init(&feat_queue);
   queue_init(&repr_queue);
   queue_init(&error_queue);
+  if(clock_start() != 0) LOG_ERROR("[clock] cannot start the clock ticker, reading the system clock instead\n");
   stats_init();
-  pthread_t t_preproc, t_nn, t_repr, t_ui;
-  if(pthread_create(&t_preproc, NULL, preproc_thread, NULL) != 0){ perror("pthread_create preproc"); }
-  if(pthread_create(&t_nn, NULL, nn_thread, NULL) != 0){ perror("pthread_create nn"); }
-  if(pthread_create(&t_repr, NULL, represent_thread, NULL) != 0){ perror("pthread_create represent"); }
-  if(pthread_create(&t_ui, NULL, ui_thread, NULL) != 0){ perror("pthread_create ui"); }
-  LOG_INFO("Simple receiver listening on UDP port %d (pipeline threads started)\n", PORT);
-  while(1){
+  state_restore_stats();
+  wal_t *wal = NULL;
+  if(g_config.wal_dir[0]){
+    wal = wal_open(g_config.wal_dir, g_config.wal_sync_ms, (size_t)(g_config.wal_segment_mb * 1024.0 * 1024.0));
+    if(!wal){ LOG_ERROR("[wal] cannot open the write-ahead log in %s\n", g_config.wal_dir); clock_stop(); CLOSESOCKET(sock); tsdb_close(g_store); platform_socket_cleanup(); log_close(); return 1; }
+  }
+  if(trace_start(g_config.trace_file, g_config.trace_sample, g_config.trace_mb) != 0){
+    wal_close(wal); clock_stop(); CLOSESOCKET(sock); tsdb_close(g_store); platform_socket_cleanup(); log_close(); return 1;
+  }
+  perfctr_start(g_config.perf_counters);
+  if(metrics_start(g_config.metrics_addr, g_config.metrics_port, g_config.metrics_socket) != 0){
+    perfctr_stop(); trace_stop(); wal_close(wal); clock_stop(); CLOSESOCKET(sock); tsdb_close(g_store); platform_socket_cleanup(); log_close(); return 1;
+  }
+  /* stages in pipeline order; on shutdown each one's input queue is closed once the stage before it has exited */
+  static void* (*const stage_fn[])(void*) = { preproc_thread, feature_thread, nn_thread, represent_thread };
+  static const char *const stage_name[] = { "preproc", "features", "nn", "represent" };
+  str_queue_t *stage_in[] = { &raw_queue, &proc_queue, &feat_queue, &repr_queue };
+  void *stage_arg[] = { wal, NULL, wal, NULL };
+  enum { N_STAGES = 4 };
+  pthread_t t_stage[N_STAGES], t_ui;
+  int started[N_STAGES], ui_started;
+  for(int i=0;i<N_STAGES;i++){
+    started[i] = pthread_create(&t_stage[i], NULL, stage_fn[i], stage_arg[i]) == 0;
+    if(!started[i]) fprintf(stderr, "pthread_create %s failed\n", stage_name[i]);
+  }
+  ui_started = pthread_create(&t_ui, NULL, ui_thread, NULL) == 0;
+  if(!ui_started){ perror("pthread_create ui"); }
+  if(wal){
+    /* replayed before new datagrams are queued, so the pipeline sees the records in log order */
+    long long replayed = wal_replay(wal, wal_replay_record, NULL);
+    if(replayed < 0) LOG_ERROR("[wal] replay of %s failed\n", g_config.wal_dir);
+    else if(replayed > 0) LOG_INFO("[wal] replayed %lld records from %s\n", replayed, g_config.wal_dir);
+  }
+  LOG_INFO("Simple receiver listening on UDP port %d (pipeline threads started)\n", g_config.port);
+  while(!platform_stop_requested()){
+    fd_set rd;
+    FD_ZERO(&rd);
+    FD_SET(sock, &rd);
+    struct timeval tv = { 0, STATE_STOP_POLL_MS * 1000 };
+    if(select((int)sock + 1, &rd, NULL, NULL, &tv) <= 0) continue;
     char buf[8192];
     struct sockaddr_in from; socklen_t flen = sizeof(from);
     int n = (int)recvfrom(sock, buf, (int)sizeof(buf)-1, 0, (struct sockaddr*)&from, &flen);
     if(n <= 0) continue;
     if(n >= (int)sizeof(buf)) n = (int)sizeof(buf)-1;
     buf[n] = '\0';
-  queue_push(&raw_queue, buf);
+    rec_meta_t meta;
+    memset(&meta, 0, sizeof(meta));
+    inet_ntop(AF_INET, &from.sin_addr, meta.src, sizeof(meta.src));
+    lat_stamp(&meta);
+    trace_stamp(&meta);
+  queue_push_meta(&raw_queue, buf, &meta);
   stats_inc_received();
+    /* the rest only logs the datagram's fields */
+    if(!LOG_ENABLED(LOG_LEVEL_DEBUG)) continue;
     recv_msg_t m;
     memset(&m, 0, sizeof(m));
     if(buf[0] == '{'){
-      safe_strncpy(m.payload, buf, sizeof(m.payload));
+      m.payload = buf;
       m.ts = 0;
     } else {
       char *comma = strchr(buf, ',');
@@ -100,11 +211,11 @@ int run_receiver(void){
           long long v = atoll(tbuf);
           if(v != 0){ m.ts = v; parsed_ts = 1; }
           else { m.ts = 0; }
-          safe_strncpy(m.payload, comma+1, sizeof(m.payload));
+          m.payload = comma + 1;
         }
       }
       if(!parsed_ts){
-  safe_strncpy(m.payload, buf, sizeof(m.payload));
+  m.payload = buf;
 #ifdef _WIN32
         SYSTEMTIME st; FILETIME ft; GetSystemTime(&st); SystemTimeToFileTime(&st, &ft);
         unsigned long long t = ((unsigned long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
@@ -117,26 +228,49 @@ int run_receiver(void){
     }
     inet_ntop(AF_INET, &from.sin_addr, m.src_addr, sizeof(m.src_addr));
     m.src_port = ntohs(from.sin_port);
-  LOG_INFO("--- received from %s:%d ---\n", m.src_addr, m.src_port);
+  LOG_DEBUG("--- received from %s:%d ---\n", m.src_addr, m.src_port);
     data_point_t dp; parse_json_to_datapoint(m.payload, &dp);
     int has_timestamp = !isnan(dp.timestamp);
     int has_export_bytes = !isnan(dp.export_bytes);
     if(has_timestamp || has_export_bytes || !isnan(dp.export_flows) || !isnan(dp.export_packets) || !isnan(dp.export_rtr) || !isnan(dp.export_rtt) || !isnan(dp.export_srt)){
   if(has_timestamp) m.ts = (long long)dp.timestamp;
-  LOG_INFO("timestamp: %lld\n", m.ts);
-  LOG_INFO("export_bytes: %.6f\n", dp.export_bytes);
-  LOG_INFO("export_flows: %.6f\n", dp.export_flows);
-  LOG_INFO("export_packets: %.6f\n", dp.export_packets);
-  LOG_INFO("export_rtr: %.6f\n", dp.export_rtr);
-  LOG_INFO("export_rtt: %.6f\n", dp.export_rtt);
-  LOG_INFO("export_srt: %.6f\n", dp.export_srt);
+  LOG_DEBUG("timestamp: %lld\n", m.ts);
+  LOG_DEBUG("export_bytes: %.6f\n", dp.export_bytes);
+  LOG_DEBUG("export_flows: %.6f\n", dp.export_flows);
+  LOG_DEBUG("export_packets: %.6f\n", dp.export_packets);
+  LOG_DEBUG("export_rtr: %.6f\n", dp.export_rtr);
+  LOG_DEBUG("export_rtt: %.6f\n", dp.export_rtt);
+  LOG_DEBUG("export_srt: %.6f\n", dp.export_srt);
     } else {
-      LOG_INFO("timestamp: %lld\n", m.ts);
-      LOG_INFO("payload: %s\n", m.payload);
+      LOG_DEBUG("timestamp: %lld\n", m.ts);
+      LOG_DEBUG("payload: %s\n", m.payload);
     }
   }
+  LOG_INFO("Stop requested, draining the pipeline queues\n");
+  int saved = 1, failed = 0;
+  for(int i=0;i<N_STAGES;i++){
+    void *ret = STATE_NOT_SAVED;
+    queue_close(stage_in[i]);
+    if(started[i]) pthread_join(t_stage[i], &ret);
+    if(ret != NULL) saved = 0;
+    if(ret == STATE_STAGE_FAILED) failed = 1;
+  }
+  if(ui_started) pthread_join(t_ui, NULL);
+  if(state_save_stats() != 0) saved = 0;
+  /* when every stage saved everything it consumed, the whole log is covered */
+  if(wal){
+    if(saved) wal_checkpoint(wal, wal_last_lsn(wal));
+    else LOG_ERROR("[wal] the pipeline state was not saved completely, keeping the log\n");
+  }
+  wal_close(wal);
+  metrics_stop();
+  perfctr_stop();
+  trace_stop();
+  clock_stop();
+  tsdb_close(g_store);
+  g_store = NULL;
   CLOSESOCKET(sock);
   platform_socket_cleanup();
   log_close();
-  return EXIT_SUCCESS;
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
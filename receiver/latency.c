@@ -0,0 +1,226 @@
+/*
+ * latency.c
+ *
+ * Per-stage latency histograms. Values are bucketed log-linearly (HDR
+ * style): exact below 2^(LAT_SUB_BITS+1) ns, then 2^LAT_SUB_BITS buckets per
+ * power of two. Every recording thread owns a set of histograms, allocated
+ * on its first record and written without locked instructions; threads
+ * beyond LAT_SLOTS share one set updated with atomic adds. Readers sum the
+ * sets with relaxed loads, so a snapshot may miss records in flight but
+ * never blocks a stage.
+ */
+#ifndef LATENCY_C_HEADER
+#define LATENCY_C_HEADER
+
+#include "latency.h"
+
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "platform.h"
+#include "memstat.h"
+
+/* Threads with a histogram set of their own */
+#define LAT_SLOTS 64
+
+const char *const lat_stage_names[LAT_STAGES] = { "preproc", "features", "nn", "infer", "train", "represent", "end-to-end" };
+
+/**
+ * Histogram as recorded (see lat_hist_t).
+ */
+typedef struct {
+    atomic_llong count, sum, max;
+    atomic_llong b[LAT_BUCKETS];
+} lat_live_t;
+
+/**
+ * Histograms of one thread, on their own cache lines.
+ */
+typedef struct {
+    _Alignas(64) lat_live_t h[LAT_STAGES];
+} lat_set_t;
+
+static _Atomic(lat_set_t*) lat_sets[LAT_SLOTS];
+static atomic_int lat_claimed;
+static lat_set_t lat_shared;
+static _Thread_local lat_set_t *lat_own;
+
+/**
+ * Bucket of a value.
+ *
+ * @param ns value in nanoseconds (clamped to the covered range)
+ * @return bucket index
+ */
+static int lat_bucket(long long ns){
+    unsigned long long v = ns > 0 ? (unsigned long long)ns : 0;
+    const unsigned long long top = (1ULL << (LAT_MAX_SHIFT + LAT_SUB_BITS + 1)) - 1;
+    if(v > top) v = top;
+    int msb = v ? 63 - __builtin_clzll(v) : 0;
+    int shift = msb > LAT_SUB_BITS ? msb - LAT_SUB_BITS : 0;
+    return (shift << LAT_SUB_BITS) + (int)(v >> shift);
+}
+
+/**
+ * Largest value of a bucket.
+ *
+ * @param idx bucket index
+ * @return upper bound in nanoseconds
+ */
+long long lat_bucket_upper(int idx){
+    int shift = idx < (2 << LAT_SUB_BITS) ? 0 : (idx >> LAT_SUB_BITS) - 1;
+    long long mant = idx - (shift << LAT_SUB_BITS);
+    return ((mant + 1) << shift) - 1;
+}
+
+/**
+ * Get the calling thread's histogram set, claiming and allocating one on
+ * first use.
+ *
+ * @return the thread's own set, or &lat_shared
+ */
+static lat_set_t* lat_set(void){
+    if(lat_own) return lat_own;
+    int i = atomic_fetch_add(&lat_claimed, 1);
+    lat_set_t *s = NULL;
+    if(i < LAT_SLOTS){
+        s = (lat_set_t*)mem_aligned_alloc(MEM_STATS, _Alignof(lat_set_t), sizeof(lat_set_t));
+        if(s) memset(s, 0, sizeof(*s));
+        atomic_store_explicit(&lat_sets[i], s, memory_order_release);
+    }
+    lat_own = s ? s : &lat_shared;
+    return lat_own;
+}
+
+/**
+ * Record a latency of the calling thread.
+ *
+ * @param stage LAT_* stage
+ * @param ns latency in nanoseconds
+ */
+void lat_record(int stage, long long ns){
+    if(stage < 0 || stage >= LAT_STAGES) return;
+    if(ns < 0) ns = 0;
+    lat_set_t *s = lat_set();
+    lat_live_t *h = &s->h[stage];
+    atomic_llong *b = &h->b[lat_bucket(ns)];
+    if(s == &lat_shared){
+        atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&h->sum, ns, memory_order_relaxed);
+        atomic_fetch_add_explicit(b, 1, memory_order_relaxed);
+        long long m = atomic_load_explicit(&h->max, memory_order_relaxed);
+        while(ns > m && !atomic_compare_exchange_weak_explicit(&h->max, &m, ns, memory_order_relaxed, memory_order_relaxed)){}
+        return;
+    }
+    /* single writer: plain read-modify-write through relaxed atomics */
+    atomic_store_explicit(&h->count, atomic_load_explicit(&h->count, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&h->sum, atomic_load_explicit(&h->sum, memory_order_relaxed) + ns, memory_order_relaxed);
+    atomic_store_explicit(b, atomic_load_explicit(b, memory_order_relaxed) + 1, memory_order_relaxed);
+    if(ns > atomic_load_explicit(&h->max, memory_order_relaxed)) atomic_store_explicit(&h->max, ns, memory_order_relaxed);
+}
+
+/**
+ * Stamp a record received now: its ingest time and the start of its first hop.
+ *
+ * @param meta record metadata
+ */
+void lat_stamp(rec_meta_t *meta){
+    meta->ingest_ns = meta->hop_ns = platform_monotonic_ns();
+}
+
+/**
+ * Record the time a record spent since it left the previous stage and
+ * start its next hop. Records without an ingest time (replayed from the
+ * write-ahead log, checkpoint markers) are skipped.
+ *
+ * @param meta record metadata
+ * @param stage LAT_* hop the record just finished
+ */
+void lat_hop(rec_meta_t *meta, int stage){
+    if(!meta->ingest_ns) return;
+    long long now = platform_monotonic_ns();
+    lat_record(stage, now - meta->hop_ns);
+    meta->hop_ns = now;
+}
+
+/**
+ * Add a recorded histogram to a merged one.
+ */
+static void lat_add_live(lat_hist_t *out, lat_live_t *h){
+    out->count += atomic_load_explicit(&h->count, memory_order_relaxed);
+    out->sum += atomic_load_explicit(&h->sum, memory_order_relaxed);
+    long long m = atomic_load_explicit(&h->max, memory_order_relaxed);
+    if(m > out->max) out->max = m;
+    for(int i=0;i<LAT_BUCKETS;i++) out->b[i] += atomic_load_explicit(&h->b[i], memory_order_relaxed);
+}
+
+/**
+ * Merge the histograms of all threads for one stage.
+ *
+ * @param stage LAT_* stage
+ * @param out receives the merged histogram
+ */
+void lat_snapshot(int stage, lat_hist_t *out){
+    memset(out, 0, sizeof(*out));
+    if(stage < 0 || stage >= LAT_STAGES) return;
+    int n = atomic_load(&lat_claimed);
+    if(n > LAT_SLOTS) n = LAT_SLOTS;
+    for(int i=0;i<n;i++){
+        lat_set_t *s = atomic_load_explicit(&lat_sets[i], memory_order_acquire);
+        if(s) lat_add_live(out, &s->h[stage]);
+    }
+    lat_add_live(out, &lat_shared.h[stage]);
+}
+
+/**
+ * Add one merged histogram to another.
+ *
+ * @param dst histogram receiving the sum
+ * @param src histogram to add
+ */
+void lat_hist_merge(lat_hist_t *dst, const lat_hist_t *src){
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if(src->max > dst->max) dst->max = src->max;
+    for(int i=0;i<LAT_BUCKETS;i++) dst->b[i] += src->b[i];
+}
+
+/**
+ * Histogram of the values recorded between two snapshots. The maximum is
+ * that of `cur` (an upper bound for the interval).
+ *
+ * @param out receives cur - prev
+ * @param cur later snapshot
+ * @param prev earlier snapshot of the same stage
+ */
+void lat_hist_diff(lat_hist_t *out, const lat_hist_t *cur, const lat_hist_t *prev){
+    out->count = cur->count - prev->count;
+    out->sum = cur->sum - prev->sum;
+    out->max = cur->max;
+    for(int i=0;i<LAT_BUCKETS;i++) out->b[i] = cur->b[i] - prev->b[i];
+}
+
+/**
+ * Value at a quantile, as the upper bound of its bucket.
+ *
+ * @param h histogram
+ * @param q quantile in [0, 1]
+ * @return latency in nanoseconds, 0 for an empty histogram
+ */
+long long lat_hist_quantile(const lat_hist_t *h, double q){
+    if(h->count <= 0) return 0;
+    long long rank = (long long)(q * (double)h->count + 0.5);
+    if(rank < 1) rank = 1;
+    if(rank > h->count) rank = h->count;
+    long long seen = 0;
+    for(int i=0;i<LAT_BUCKETS;i++){
+        seen += h->b[i];
+        if(seen >= rank){
+            long long v = lat_bucket_upper(i);
+            return v < h->max || h->max <= 0 ? v : h->max;
+        }
+    }
+    return h->max;
+}
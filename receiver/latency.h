@@ -0,0 +1,53 @@
+/**
+ * latency.h
+ *
+ * Declarations for the per-stage latency histograms. Records carry their
+ * monotonic ingest time and the time they left the previous stage
+ * (rec_meta_t); every stage records the time since then into a log-linear
+ * histogram of the calling thread. Snapshots merge the threads' histograms.
+ */
+
+#ifndef RECEIVER_LATENCY_H
+#define RECEIVER_LATENCY_H
+
+#include "common.h"
+
+/* Hops and phases a record's latency is split into */
+#define LAT_PREPROC 0   /* ingest -> preprocessed (includes the raw queue) */
+#define LAT_FEATURES 1  /* preprocessed -> features computed */
+#define LAT_NN 2        /* features -> predictions queued (includes inference) */
+#define LAT_INFER 3     /* inference of one record */
+#define LAT_TRAIN 4     /* training work done on the record's path */
+#define LAT_REPRESENT 5 /* predictions queued -> represented */
+#define LAT_E2E 6       /* ingest -> represented */
+#define LAT_STAGES 7
+
+/** Sub-buckets per power of two (2^LAT_SUB_BITS): values are kept within 1/32 (~3%). */
+#define LAT_SUB_BITS 5
+/** Largest power-of-two bucket above the linear range; longer values are clamped (about 73 minutes). */
+#define LAT_MAX_SHIFT 36
+#define LAT_BUCKETS ((LAT_MAX_SHIFT + 2) << LAT_SUB_BITS)
+
+/**
+ * Merged histogram of latencies in nanoseconds.
+ *
+ * count, sum, max: number, sum and largest of the recorded values
+ * b: count per log-linear bucket
+ */
+typedef struct {
+    long long count, sum, max;
+    long long b[LAT_BUCKETS];
+} lat_hist_t;
+
+extern const char *const lat_stage_names[LAT_STAGES];
+
+void lat_stamp(rec_meta_t *meta);
+void lat_hop(rec_meta_t *meta, int stage);
+void lat_record(int stage, long long ns);
+void lat_snapshot(int stage, lat_hist_t *out);
+void lat_hist_merge(lat_hist_t *dst, const lat_hist_t *src);
+void lat_hist_diff(lat_hist_t *out, const lat_hist_t *cur, const lat_hist_t *prev);
+long long lat_hist_quantile(const lat_hist_t *h, double q);
+long long lat_bucket_upper(int idx);
+
+#endif
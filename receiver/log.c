@@ -1,8 +1,20 @@
 /*
  * log.c
  *
- * Logging helpers and platform-adapted output routines used by receiver
- * components.
+ * Logging. Producers never take a lock or format text: log_write() reads
+ * the argument kinds of the call site's format (parsed once per site),
+ * copies the arguments into a record - strings by value, so callers may
+ * pass stack buffers - and appends it to the calling thread's
+ * single-producer ring. The writer thread started by log_init() drains the
+ * rings every LOG_FLUSH_MS, merging them by time stamp, formats the records
+ * into one buffer per stream (warnings and errors to stderr, the rest to
+ * stdout) and writes each buffer with one fwrite / fflush.
+ *
+ * A full ring drops the record and counts it, so a slow terminal never
+ * stalls a pipeline thread; the writer reports the drops, and the next
+ * message of a rate-limited call site reports how many it suppressed.
+ * Rings of threads that exited are reused once drained. Threads beyond
+ * LOG_RINGS get no ring and their messages are dropped.
  */
 
 #ifndef LOG_C_HEADER
@@ -13,45 +25,597 @@
 
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "platform.h"
+#include "clock.h"
 
 #ifdef _WIN32
 #include <windows.h>
-static CRITICAL_SECTION log_lock;
-#else
-#include <pthread.h>
-static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+#define LOG_RINGS 64
+#define LOG_RING_BYTES (64 * 1024) /* power of two */
+#define LOG_REC_MAX 2048
+#define LOG_STR_MAX 1024
+#define LOG_FLUSH_MS 10
+#define LOG_OUT_BYTES (128 * 1024)
+/* Room kept free in an output buffer before a record is formatted into it */
+#define LOG_LINE_MAX 16384
+#define LOG_DEFAULT_RATE 100
+
+/* Kinds of recorded arguments, by the type they are read as */
+enum { LOG_ARG_INT, LOG_ARG_LONG, LOG_ARG_LLONG, LOG_ARG_SIZE, LOG_ARG_INTMAX, LOG_ARG_PTRDIFF,
+       LOG_ARG_DOUBLE, LOG_ARG_LDOUBLE, LOG_ARG_PTR, LOG_ARG_STR };
+/* log_scan_spec() results that are not an argument */
+#define LOG_SPEC_PERCENT -1
+#define LOG_SPEC_UNSUPPORTED -2
+
+/* Ring states */
+#define LOG_RING_FREE 0
+#define LOG_RING_OWNED 1
+#define LOG_RING_RELEASED 2 /* the owner exited; free again once drained */
+
+/* Record flags */
+#define LOG_REC_PAD 1u  /* filler up to the end of the ring */
+#define LOG_REC_TEXT 2u /* a single preformatted string follows instead of arguments */
+
 /**
- * Initialize logging subsystem resources.
+ * Record header, followed by the arguments in 8-byte slots (strings
+ * NUL-terminated and padded to 8 bytes).
+ *
+ * len: bytes including the header, a multiple of 8
+ * flags: LOG_REC_*
+ * suppressed: messages of the site the rate limit dropped before this one
+ * site, fmt: call site and its format
+ * ns: monotonic time the record was written
  */
-void log_init(void){
+typedef struct {
+    uint32_t len;
+    uint32_t flags;
+    uint32_t suppressed;
+    uint32_t reserved;
+    log_site_t *site;
+    const char *fmt;
+    long long ns;
+} log_rec_t;
+
+/**
+ * Single-producer ring; tail and head count bytes ever written / consumed.
+ */
+typedef struct {
+    _Alignas(64) atomic_size_t tail;
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) unsigned char buf[LOG_RING_BYTES];
+} log_ring_t;
+
+/**
+ * Output buffer of one stream (writer thread only).
+ */
+typedef struct {
+    FILE *f;
+    size_t len;
+    char buf[LOG_OUT_BYTES];
+} log_out_t;
+
+atomic_int log_level = LOG_LEVEL_INFO;
+static atomic_int log_rate = LOG_DEFAULT_RATE;
+static atomic_int log_running;
+static pthread_t log_thread;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_llong log_written, log_dropped, log_suppressed;
+
+static _Atomic(log_ring_t*) log_rings[LOG_RINGS];
+static atomic_int log_ring_state[LOG_RINGS];
+static pthread_key_t log_key;
+static pthread_once_t log_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local log_ring_t *log_own;
+static _Thread_local int log_no_ring;
+
+static log_out_t log_out[2];
+
+/**
+ * Thread exit: hand the thread's ring back to the writer.
+ *
+ * @param state the ring's entry in log_ring_state
+ */
+static void log_thread_exit(void *state){
+    log_own = NULL;
+    log_no_ring = 1;
+    atomic_store_explicit((atomic_int*)state, LOG_RING_RELEASED, memory_order_release);
+}
+
+static void log_key_create(void){
+    pthread_key_create(&log_key, log_thread_exit);
+}
+
+/**
+ * Get the calling thread's ring, claiming a free one on first use.
+ *
+ * @return ring or NULL when all are taken
+ */
+static log_ring_t* log_ring(void){
+    if(log_own) return log_own;
+    if(log_no_ring) return NULL;
+    pthread_once(&log_key_once, log_key_create);
+    for(int i=0;i<LOG_RINGS;i++){
+        int expected = LOG_RING_FREE;
+        if(!atomic_compare_exchange_strong(&log_ring_state[i], &expected, LOG_RING_OWNED)) continue;
+        log_ring_t *r = atomic_load_explicit(&log_rings[i], memory_order_acquire);
+        if(!r){
+            r = (log_ring_t*)aligned_alloc(_Alignof(log_ring_t), sizeof(log_ring_t));
+            if(!r){ atomic_store(&log_ring_state[i], LOG_RING_FREE); break; }
+            atomic_init(&r->tail, 0);
+            atomic_init(&r->head, 0);
+            atomic_store_explicit(&log_rings[i], r, memory_order_release);
+        }
+        pthread_setspecific(log_key, &log_ring_state[i]);
+        log_own = r;
+        return r;
+    }
+    log_no_ring = 1;
+    return NULL;
+}
+
+/**
+ * Append a record to the ring.
+ *
+ * @param rec record starting with its log_rec_t header
+ * @param len record length, a multiple of 8
+ * @return 0 on success, -1 when the ring is full
+ */
+static int log_ring_push(log_ring_t *r, const unsigned char *rec, size_t len){
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    size_t off = tail & (LOG_RING_BYTES - 1);
+    size_t pad = off + len > LOG_RING_BYTES ? LOG_RING_BYTES - off : 0;
+    if(tail + pad + len - head > LOG_RING_BYTES) return -1;
+    if(pad){
+        log_rec_t filler;
+        memset(&filler, 0, sizeof(filler));
+        filler.len = (uint32_t)pad;
+        filler.flags = LOG_REC_PAD;
+        memcpy(r->buf + off, &filler, pad < sizeof(filler) ? pad : sizeof(filler));
+        off = 0;
+    }
+    memcpy(r->buf + off, rec, len);
+    atomic_store_explicit(&r->tail, tail + pad + len, memory_order_release);
+    return 0;
+}
+
+/**
+ * Oldest record of a ring, skipping filler (writer thread only).
+ *
+ * @return record header inside the ring, NULL when the ring is empty
+ */
+static const log_rec_t* log_ring_peek(log_ring_t *r){
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    for(;;){
+        if(head == atomic_load_explicit(&r->tail, memory_order_acquire)) return NULL;
+        const log_rec_t *h = (const log_rec_t*)(r->buf + (head & (LOG_RING_BYTES - 1)));
+        if(!(h->flags & LOG_REC_PAD)) return h;
+        head += h->len;
+        atomic_store_explicit(&r->head, head, memory_order_release);
+    }
+}
+
+/**
+ * Scan one conversion specification.
+ *
+ * @param p points just after the '%'
+ * @param kind receives the LOG_ARG_* kind of the converted value, or LOG_SPEC_PERCENT / LOG_SPEC_UNSUPPORTED
+ * @param stars receives the number of '*' width / precision arguments read before the value
+ * @return pointer just past the conversion character
+ */
+static const char* log_scan_spec(const char *p, int *kind, int *stars){
+    *stars = 0;
+    if(*p == '%'){ *kind = LOG_SPEC_PERCENT; return p + 1; }
+    while(*p && strchr("-+ #0'", *p)) p++;
+    if(*p == '*'){ ++*stars; p++; } else while(*p >= '0' && *p <= '9') p++;
+    if(*p == '.'){
+        p++;
+        if(*p == '*'){ ++*stars; p++; } else while(*p >= '0' && *p <= '9') p++;
+    }
+    int k = LOG_ARG_INT, ld = 0;
+    if(*p == 'h'){ p++; if(*p == 'h') p++; }
+    else if(*p == 'l'){ p++; k = LOG_ARG_LONG; if(*p == 'l'){ p++; k = LOG_ARG_LLONG; } }
+    else if(*p == 'z'){ p++; k = LOG_ARG_SIZE; }
+    else if(*p == 'j'){ p++; k = LOG_ARG_INTMAX; }
+    else if(*p == 't'){ p++; k = LOG_ARG_PTRDIFF; }
+    else if(*p == 'L'){ p++; ld = 1; }
+    switch(*p){
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+        *kind = k;
+        break;
+    case 'c':
+        *kind = k == LOG_ARG_INT ? LOG_ARG_INT : LOG_SPEC_UNSUPPORTED;
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        *kind = ld ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+        break;
+    case 's':
+        *kind = k == LOG_ARG_INT ? LOG_ARG_STR : LOG_SPEC_UNSUPPORTED;
+        break;
+    case 'p':
+        *kind = LOG_ARG_PTR;
+        break;
+    default: /* %n, wide characters, a truncated specification */
+        *kind = LOG_SPEC_UNSUPPORTED;
+        return *p ? p + 1 : p;
+    }
+    return p + 1;
+}
+
+/**
+ * Read the argument kinds of a format.
+ *
+ * @param types receives up to LOG_MAX_ARGS kinds
+ * @return number of arguments, -1 when the format has more than LOG_MAX_ARGS or a conversion that is not recorded
+ */
+static int log_parse(const char *fmt, unsigned char *types){
+    int n = 0;
+    for(const char *p = fmt; *p; ){
+        if(*p++ != '%') continue;
+        int kind, stars;
+        p = log_scan_spec(p, &kind, &stars);
+        if(kind == LOG_SPEC_PERCENT) continue;
+        if(kind == LOG_SPEC_UNSUPPORTED || n + stars + 1 > LOG_MAX_ARGS) return -1;
+        while(stars-- > 0) types[n++] = LOG_ARG_INT;
+        types[n++] = (unsigned char)kind;
+    }
+    return n;
+}
+
+/**
+ * Count a message against the call site's rate limit.
+ *
+ * @param suppressed receives the messages of the site suppressed since its last written one
+ * @return non-zero when the message may be written
+ */
+static int log_admit(log_site_t *site, unsigned *suppressed){
+    *suppressed = 0;
+    int rate = atomic_load_explicit(&log_rate, memory_order_relaxed);
+    if(rate <= 0) return 1;
+    long long sec = clock_coarse_ms() / 1000;
+    long long w = atomic_load_explicit(&site->window, memory_order_relaxed);
+    if(w != sec && atomic_compare_exchange_strong(&site->window, &w, sec)) atomic_store_explicit(&site->count, 0, memory_order_relaxed);
+    if(atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed) >= rate){
+        atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&log_suppressed, 1, memory_order_relaxed);
+        return 0;
+    }
+    if(atomic_load_explicit(&site->suppressed, memory_order_relaxed))
+        *suppressed = (unsigned)atomic_exchange_explicit(&site->suppressed, 0, memory_order_relaxed);
+    return 1;
+}
+
+/**
+ * Write a message of a call site (use the LOG_* macros). Formats directly
+ * while the writer thread is not running, otherwise queues a record.
+ *
+ * @param site call site
+ * @param fmt printf-style format
+ * @param ... format arguments
+ */
+void log_write(log_site_t *site, const char *fmt, ...){
+    unsigned suppressed;
+    if(!fmt || !log_admit(site, &suppressed)) return;
+    va_list ap;
+    va_start(ap, fmt);
+    if(!atomic_load_explicit(&log_running, memory_order_acquire)){
+        FILE *f = site->level >= LOG_LEVEL_WARN ? stderr : stdout;
+        pthread_mutex_lock(&log_lock);
+        if(suppressed) fprintf(f, "[log] %u messages from %s:%d suppressed\n", suppressed, site->file, site->line);
+        vfprintf(f, fmt, ap);
+        fflush(f);
+        pthread_mutex_unlock(&log_lock);
+        va_end(ap);
+        atomic_fetch_add_explicit(&log_written, 1, memory_order_relaxed);
+        return;
+    }
+    log_ring_t *r = log_ring();
+    if(!r){
+        va_end(ap);
+        atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    /* argument kinds: parsed by the site's first caller, re-parsed if the site passes another format */
+    unsigned char local[LOG_MAX_ARGS];
+    const unsigned char *types = local;
+    int n;
+    if(atomic_load_explicit(&site->parsed, memory_order_acquire) == 1 && site->fmt == fmt){
+        types = site->types;
+        n = site->n_args;
+    } else {
+        n = log_parse(fmt, local);
+        int expected = 0;
+        if(atomic_compare_exchange_strong(&site->parsed, &expected, 2)){
+            site->fmt = fmt;
+            memcpy(site->types, local, sizeof(local));
+            site->n_args = n;
+            atomic_store_explicit(&site->parsed, 1, memory_order_release);
+        }
+    }
+
+    union { log_rec_t h; unsigned char b[LOG_REC_MAX]; } rec;
+    size_t off = sizeof(log_rec_t);
+    uint32_t flags = 0;
+    if(n < 0){
+        /* a format the record cannot carry is formatted here */
+        int len = vsnprintf((char*)rec.b + off, LOG_REC_MAX - off, fmt, ap);
+        if(len < 0) len = 0;
+        if((size_t)len >= LOG_REC_MAX - off) len = (int)(LOG_REC_MAX - off - 1);
+        off += (size_t)len + 1;
+        flags = LOG_REC_TEXT;
+    } else {
+        for(int i=0;i<n;i++){
+            long long v = 0;
+            double d;
+            const void *ptr;
+            switch(types[i]){
+            case LOG_ARG_INT: v = va_arg(ap, int); break;
+            case LOG_ARG_LONG: v = va_arg(ap, long); break;
+            case LOG_ARG_LLONG: v = va_arg(ap, long long); break;
+            case LOG_ARG_SIZE: v = (long long)va_arg(ap, size_t); break;
+            case LOG_ARG_INTMAX: v = (long long)va_arg(ap, intmax_t); break;
+            case LOG_ARG_PTRDIFF: v = (long long)va_arg(ap, ptrdiff_t); break;
+            case LOG_ARG_DOUBLE: d = va_arg(ap, double); memcpy(&v, &d, sizeof(v)); break;
+            case LOG_ARG_LDOUBLE: d = (double)va_arg(ap, long double); memcpy(&v, &d, sizeof(v)); break;
+            case LOG_ARG_PTR: ptr = va_arg(ap, void*); v = (long long)(intptr_t)ptr; break;
+            case LOG_ARG_STR: {
+                const char *s = va_arg(ap, const char*);
+                if(!s) s = "(null)";
+                /* keep room for the slots still to come (off and the room stay multiples of 8) */
+                size_t room = LOG_REC_MAX - off - 8 * (size_t)(n - i - 1), len = 0;
+                if(room > LOG_STR_MAX) room = LOG_STR_MAX;
+                while(len + 1 < room && s[len]) len++;
+                memcpy(rec.b + off, s, len);
+                rec.b[off + len] = '\0';
+                off = (off + len + 8) & ~(size_t)7;
+                continue;
+            }
+            }
+            memcpy(rec.b + off, &v, sizeof(v));
+            off += sizeof(v);
+        }
+    }
+    va_end(ap);
+    off = (off + 7) & ~(size_t)7;
+    memset(&rec.h, 0, sizeof(rec.h));
+    rec.h.len = (uint32_t)off;
+    rec.h.flags = flags;
+    rec.h.suppressed = suppressed;
+    rec.h.site = site;
+    rec.h.fmt = fmt;
+    rec.h.ns = platform_monotonic_ns();
+    if(log_ring_push(r, rec.b, off) != 0){
+        if(suppressed) atomic_fetch_add_explicit(&site->suppressed, (int)suppressed, memory_order_relaxed);
+        atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+    }
+}
+
+/**
+ * Read the next 8-byte argument slot.
+ */
+static long long log_slot(const unsigned char **a){
+    long long v;
+    memcpy(&v, *a, sizeof(v));
+    *a += sizeof(v);
+    return v;
+}
+
+/**
+ * Format a record.
+ *
+ * @param out output buffer
+ * @param room size of `out`
+ * @param h record
+ * @return number of characters written (without the NUL)
+ */
+static size_t log_format(char *out, size_t room, const log_rec_t *h){
+    const unsigned char *a = (const unsigned char*)(h + 1);
+    if(h->flags & LOG_REC_TEXT){
+        int n = snprintf(out, room, "%s", (const char*)a);
+        return n < 0 ? 0 : (size_t)n < room ? (size_t)n : room - 1;
+    }
+    size_t o = 0;
+    for(const char *p = h->fmt; *p && o + 1 < room; ){
+        if(*p != '%'){ out[o++] = *p++; continue; }
+        int kind, stars;
+        const char *end = log_scan_spec(p + 1, &kind, &stars);
+        if(kind == LOG_SPEC_PERCENT){ out[o++] = '%'; p = end; continue; }
+        /* the specification with every '*' replaced by its argument */
+        char spec[64];
+        size_t sl = 0;
+        for(const char *q = p; q < end && sl + 12 < sizeof(spec); q++){
+            if(*q == '*') sl += (size_t)snprintf(spec + sl, sizeof(spec) - sl, "%d", (int)log_slot(&a));
+            else spec[sl++] = *q;
+        }
+        spec[sl] = '\0';
+        p = end;
+        long long v = kind == LOG_ARG_STR ? 0 : log_slot(&a);
+        double d;
+        memcpy(&d, &v, sizeof(d));
+        int w = 0;
+        switch(kind){
+        case LOG_ARG_INT: w = snprintf(out + o, room - o, spec, (int)v); break;
+        case LOG_ARG_LONG: w = snprintf(out + o, room - o, spec, (long)v); break;
+        case LOG_ARG_LLONG: w = snprintf(out + o, room - o, spec, v); break;
+        case LOG_ARG_SIZE: w = snprintf(out + o, room - o, spec, (size_t)v); break;
+        case LOG_ARG_INTMAX: w = snprintf(out + o, room - o, spec, (intmax_t)v); break;
+        case LOG_ARG_PTRDIFF: w = snprintf(out + o, room - o, spec, (ptrdiff_t)v); break;
+        case LOG_ARG_DOUBLE: w = snprintf(out + o, room - o, spec, d); break;
+        case LOG_ARG_LDOUBLE: w = snprintf(out + o, room - o, spec, (long double)d); break;
+        case LOG_ARG_PTR: w = snprintf(out + o, room - o, spec, (void*)(intptr_t)v); break;
+        case LOG_ARG_STR: {
+            const char *s = (const char*)a;
+            size_t len = strlen(s);
+            a += (len + 8) & ~(size_t)7;
+            w = snprintf(out + o, room - o, spec, s);
+            break;
+        }
+        default: break;
+        }
+        if(w < 0) w = 0;
+        o = (size_t)w < room - o ? o + (size_t)w : room - 1;
+    }
+    out[o] = '\0';
+    return o;
+}
+
+/**
+ * Write out a stream's buffer.
+ */
+static void log_out_flush(log_out_t *o){
+    if(!o->len) return;
+    fwrite(o->buf, 1, o->len, o->f);
+    fflush(o->f);
+    o->len = 0;
+}
+
+/**
+ * Append formatted text to a stream's buffer.
+ */
+static void log_out_printf(log_out_t *o, const char *fmt, ...){
+    if(LOG_OUT_BYTES - o->len < LOG_LINE_MAX) log_out_flush(o);
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(o->buf + o->len, LOG_OUT_BYTES - o->len, fmt, ap);
+    va_end(ap);
+    if(n > 0) o->len += (size_t)n < LOG_OUT_BYTES - o->len ? (size_t)n : LOG_OUT_BYTES - o->len - 1;
+}
+
+/**
+ * Write every record queued before the call, oldest first across the
+ * rings, then report drops (writer thread only).
+ */
+static void log_drain(void){
+    static long long reported_drops;
+    long long until = platform_monotonic_ns();
+    log_out[0].f = stdout;
+    log_out[1].f = stderr;
+    for(;;){
+        log_ring_t *best = NULL;
+        const log_rec_t *bh = NULL;
+        for(int i=0;i<LOG_RINGS;i++){
+            log_ring_t *r = atomic_load_explicit(&log_rings[i], memory_order_acquire);
+            if(!r) continue;
+            int state = atomic_load_explicit(&log_ring_state[i], memory_order_acquire);
+            const log_rec_t *h = log_ring_peek(r);
+            if(!h){
+                if(state == LOG_RING_RELEASED) atomic_compare_exchange_strong(&log_ring_state[i], &state, LOG_RING_FREE);
+                continue;
+            }
+            if(h->ns <= until && (!bh || h->ns < bh->ns)){ best = r; bh = h; }
+        }
+        if(!best) break;
+        log_out_t *o = &log_out[bh->site->level >= LOG_LEVEL_WARN];
+        if(LOG_OUT_BYTES - o->len < LOG_LINE_MAX) log_out_flush(o);
+        if(bh->suppressed) log_out_printf(o, "[log] %u messages from %s:%d suppressed\n", bh->suppressed, bh->site->file, bh->site->line);
+        o->len += log_format(o->buf + o->len, LOG_OUT_BYTES - o->len, bh);
+        atomic_store_explicit(&best->head, atomic_load_explicit(&best->head, memory_order_relaxed) + bh->len, memory_order_release);
+        atomic_fetch_add_explicit(&log_written, 1, memory_order_relaxed);
+    }
+    long long drops = atomic_load_explicit(&log_dropped, memory_order_relaxed);
+    if(drops > reported_drops){
+        log_out_printf(&log_out[1], "[log] %lld messages dropped (log ring full)\n", drops - reported_drops);
+        reported_drops = drops;
+    }
+    log_out_flush(&log_out[0]);
+    log_out_flush(&log_out[1]);
+}
+
+/**
+ * Writer thread: drain the rings until log_close(), then once more.
+ *
+ * @param arg unused
+ * @return NULL
+ */
+static void* log_main(void *arg){
+    (void)arg;
+    while(atomic_load(&log_running)){
+        log_drain();
 #ifdef _WIN32
-    InitializeCriticalSection(&log_lock);
+        Sleep(LOG_FLUSH_MS);
 #else
-    pthread_mutex_init(&log_lock, NULL);
+        struct timespec ts = {0, LOG_FLUSH_MS * 1000000L};
+        nanosleep(&ts, NULL);
 #endif
+    }
+    log_drain();
+    return NULL;
 }
 
 /**
- * Release logging subsystem resources.
+ * Start the writer thread; messages are queued from now on. When the thread
+ * cannot be started they keep being written directly.
+ */
+void log_init(void){
+    if(atomic_load(&log_running)) return;
+    atomic_store(&log_running, 1);
+    if(pthread_create(&log_thread, NULL, log_main, NULL) != 0) atomic_store(&log_running, 0);
+}
+
+/**
+ * Write the queued messages and stop the writer thread; later messages are
+ * written directly.
  */
 void log_close(void){
-#ifdef _WIN32
-    DeleteCriticalSection(&log_lock);
-#else
-    pthread_mutex_destroy(&log_lock);
-#endif
+    if(!atomic_exchange(&log_running, 0)) return;
+    pthread_join(log_thread, NULL);
+}
+
+/**
+ * Parse a level name.
+ *
+ * @param name debug, info, warn or error
+ * @return LOG_LEVEL_*, -1 for an unknown name
+ */
+int log_parse_level(const char *name){
+    static const char *const names[] = { "debug", "info", "warn", "error" };
+    for(int i=0;i<4;i++) if(strcmp(name, names[i]) == 0) return i;
+    return -1;
+}
+
+/**
+ * Set the lowest level written.
+ *
+ * @param level LOG_LEVEL_*
+ */
+void log_set_level(int level){
+    atomic_store(&log_level, level);
+}
+
+/**
+ * Set the rate limit of every call site.
+ *
+ * @param per_sec messages per second and call site (0 = unlimited)
+ */
+void log_set_rate(int per_sec){
+    atomic_store(&log_rate, per_sec > 0 ? per_sec : 0);
 }
 
 /**
- * Thread-safe fprintf wrapper used by the project for serialized logging.
+ * Get the message counters.
  *
- * This function acquires the internal log lock, performs a vfprintf to the
- * provided FILE* and flushes the stream. If `f` is NULL the call is a no-op.
+ * @param written pointer receiving the messages written or NULL
+ * @param dropped pointer receiving the messages dropped for lack of ring space or NULL
+ * @param suppressed pointer receiving the messages suppressed by the rate limit or NULL
+ */
+void log_get_counts(long long *written, long long *dropped, long long *suppressed){
+    if(written) *written = atomic_load_explicit(&log_written, memory_order_relaxed);
+    if(dropped) *dropped = atomic_load_explicit(&log_dropped, memory_order_relaxed);
+    if(suppressed) *suppressed = atomic_load_explicit(&log_suppressed, memory_order_relaxed);
+}
+
+/**
+ * Thread-safe fprintf wrapper that writes and flushes immediately, bypassing
+ * the levels and rings. If `f` is NULL the call is a no-op.
  *
  * @param f FILE pointer to write to (e.g., stdout/stderr or a log file)
  * @param fmt printf-style format string
@@ -59,19 +623,11 @@ void log_close(void){
  */
 void log_fprintf(FILE *f, const char *fmt, ...){
     if(!f) return;
-#ifdef _WIN32
-    EnterCriticalSection(&log_lock);
-#else
     pthread_mutex_lock(&log_lock);
-#endif
     va_list ap;
     va_start(ap, fmt);
     vfprintf(f, fmt, ap);
     va_end(ap);
     fflush(f);
-#ifdef _WIN32
-    LeaveCriticalSection(&log_lock);
-#else
     pthread_mutex_unlock(&log_lock);
-#endif
 }
@@ -1,19 +1,84 @@
 /**
  * log.h
- * 
- * Declarations for thread-safe logging functions used across the receiver application.
+ *
+ * Declarations for the logging used across the receiver application. Once
+ * log_init() has started the writer thread, LOG_* calls append a compact
+ * record (call site, format pointer and arguments) to a ring of the calling
+ * thread and return; the writer formats the records and writes them in
+ * batches. Before log_init() and after log_close() (and in the offline
+ * tools) messages are written directly.
+ *
+ * Levels below `--log-level` are skipped at runtime; levels below
+ * LOG_COMPILE_LEVEL (make DEBUG_LOG=0 builds with LOG_LEVEL_INFO) are
+ * removed by the compiler. Every call site writes at most `--log-rate`
+ * messages per second and reports how many it suppressed.
  */
 #ifndef RECEIVER_LOG_H
 #define RECEIVER_LOG_H
 
 #include <stdio.h>
+#include <stdatomic.h>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/** Most conversions a format may have to be recorded as arguments (others are formatted by the caller). */
+#define LOG_MAX_ARGS 16
+
+/**
+ * State of one LOG_* call site (a static of the macro expansion).
+ *
+ * level, file, line: set by the macro
+ * parsed: 1 once types / n_args describe fmt
+ * fmt, types, n_args: argument kinds of the site's format
+ * window, count, suppressed: rate limit (current second, messages written in it, messages dropped since the last written one)
+ */
+typedef struct log_site {
+    int level;
+    const char *file;
+    int line;
+    atomic_int parsed;
+    const char *fmt;
+    unsigned char types[LOG_MAX_ARGS];
+    int n_args;
+    atomic_llong window;
+    atomic_int count;
+    atomic_int suppressed;
+} log_site_t;
+
+extern atomic_int log_level;
 
 void log_init(void);
 void log_close(void);
+int log_parse_level(const char *name);
+void log_set_level(int level);
+void log_set_rate(int per_sec);
+void log_get_counts(long long *written, long long *dropped, long long *suppressed);
 
+#ifdef __GNUC__
+void log_write(log_site_t *site, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+#else
+void log_write(log_site_t *site, const char *fmt, ...);
+#endif
 void log_fprintf(FILE *f, const char *fmt, ...);
 
-#define LOG_INFO(...)  log_fprintf(stdout, __VA_ARGS__)
-#define LOG_ERROR(...) log_fprintf(stderr, __VA_ARGS__)
+/* Non-zero when a message of `level` would be written; a constant 0 for levels removed at compile time. */
+#define LOG_ENABLED(level) ((level) >= LOG_COMPILE_LEVEL && (level) >= atomic_load_explicit(&log_level, memory_order_relaxed))
+
+#define LOG_AT(lvl, ...) do { \
+    static log_site_t log_site_ = { .level = (lvl), .file = __FILE__, .line = __LINE__ }; \
+    if(LOG_ENABLED(lvl)) log_write(&log_site_, __VA_ARGS__); \
+} while(0)
+
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
 
-#endif 
+#endif
@@ -11,19 +11,140 @@
 #include <string.h>
 
 #include "platform.h"
+#include "log.h"
+#include "memstat.h"
+#include "config.h"
 #include "io.h"
+#include "module1/feature_stage.h"
+#include "module2/horizon.h"
+#include "module2/nn_params.h"
+#include "module2/gru.h"
+#include "module2/hogwild.h"
+#include "module2/federation.h"
 
 /**
  * Program entrypoint.
  *
- * This function forwards to run_receiver() which performs socket creation,
- * thread startup and the main receive loop.
+ * Parses command-line options into the global configuration and forwards
+ * to run_receiver() which performs socket creation, thread startup and the
+ * main receive loop.
  *
- * @param argc count of command-line arguments (unused)
- * @param argv array of command-line arguments (unused)
+ * @param argc count of command-line arguments
+ * @param argv array of command-line arguments
  * @return return code from run_receiver()
  */
 int main(int argc, char **argv){
-  (void)argc; (void)argv;
+  config_defaults(&g_config);
+  int rc = config_parse_args(&g_config, argc, argv);
+  if(rc != 0){
+    config_print_usage(rc > 0 ? stdout : stderr, argv[0]);
+    return rc > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  feature_set_t fs;
+  if(feature_set_parse(g_config.features, &fs) != 0){
+    fprintf(stderr, "invalid --features '%s' (at most %d groups of raw, lagK, delta, emaH, minW, maxW, varW)\n", g_config.features, FEATURE_SPECS_MAX);
+    return EXIT_FAILURE;
+  }
+  detect_set_t ds;
+  if(detect_set_parse(g_config.detectors, &ds) != 0){
+    fprintf(stderr, "invalid --detectors '%s' (groups of ewmaL, cusumH, hwP or none, optionally prefixed by bytes:, flows:, packets:, rtr:, rtt: or srt:)\n", g_config.detectors);
+    return EXIT_FAILURE;
+  }
+  if(strcmp(g_config.route, "all") != 0 && strcmp(g_config.route, "suspicious") != 0){
+    fprintf(stderr, "unknown --route '%s' (expected all or suspicious)\n", g_config.route);
+    return EXIT_FAILURE;
+  }
+  if(g_config.horizon < 1 || g_config.horizon > HORIZON_MAX){
+    fprintf(stderr, "invalid --horizon %d (expected 1..%d)\n", g_config.horizon, HORIZON_MAX);
+    return EXIT_FAILURE;
+  }
+  size_t layers[NN_LAYERS_MAX];
+  act_t act;
+  if(nn_parse_layers(g_config.layers, layers, NN_LAYERS_MAX) < 0){
+    fprintf(stderr, "invalid --layers '%s' (up to %d comma-separated neuron counts, or none)\n", g_config.layers, NN_LAYERS_MAX);
+    return EXIT_FAILURE;
+  }
+  if(nn_parse_activation(g_config.hidden_act, &act) != 0 || nn_parse_activation(g_config.output_act, &act) != 0){
+    fprintf(stderr, "unknown --hidden-act '%s' or --output-act '%s' (expected linear, relu, sigmoid or tanh)\n", g_config.hidden_act, g_config.output_act);
+    return EXIT_FAILURE;
+  }
+  if(strcmp(g_config.model, "mlp") != 0 && strcmp(g_config.model, "gru") != 0){
+    fprintf(stderr, "unknown --model '%s' (expected mlp or gru)\n", g_config.model);
+    return EXIT_FAILURE;
+  }
+  if(g_config.gru_hidden < 1 || g_config.gru_hidden > GRU_HIDDEN_MAX || g_config.gru_window < 1 || g_config.gru_window > GRU_WINDOW_MAX){
+    fprintf(stderr, "invalid --gru-hidden %d or --gru-window %d (expected 1..%d and 1..%d)\n",
+            g_config.gru_hidden, g_config.gru_window, GRU_HIDDEN_MAX, GRU_WINDOW_MAX);
+    return EXIT_FAILURE;
+  }
+  if(g_config.train_threads < 1 || g_config.train_threads > HOGWILD_MAX_THREADS || g_config.train_backlog < 1){
+    fprintf(stderr, "invalid --train-threads %d or --train-backlog %d (expected 1..%d and >= 1)\n",
+            g_config.train_threads, g_config.train_backlog, HOGWILD_MAX_THREADS);
+    return EXIT_FAILURE;
+  }
+  if(g_config.train_threads > 1 && g_config.train_cpu_budget > 0.0){
+    fprintf(stderr, "--train-threads > 1 trains without a CPU budget, it cannot be combined with --train-budget\n");
+    return EXIT_FAILURE;
+  }
+  if(!(g_config.learning_rate > 0.0)){
+    fprintf(stderr, "invalid --learning-rate %g (expected > 0)\n", g_config.learning_rate);
+    return EXIT_FAILURE;
+  }
+  if(g_config.port < 1 || g_config.port > 65535){
+    fprintf(stderr, "invalid --port %d\n", g_config.port);
+    return EXIT_FAILURE;
+  }
+  if(g_config.fed_port != 0){
+    if(g_config.fed_port < 0 || g_config.fed_port > 65535 || g_config.fed_port == g_config.port){
+      fprintf(stderr, "invalid --fed-port %d (1..65535, not the receive port)\n", g_config.fed_port);
+      return EXIT_FAILURE;
+    }
+    if(g_config.per_source_models || strcmp(g_config.model, "mlp") != 0 || g_config.shards > 0 || g_config.workers > 0){
+      fprintf(stderr, "federation needs one shared mlp model: --per-source-models=0 --model=mlp without --shards / --workers\n");
+      return EXIT_FAILURE;
+    }
+    if(federation_check_peers(g_config.fed_peers) < 0){
+      fprintf(stderr, "invalid --fed-peers '%s' (up to %d comma-separated host:port)\n", g_config.fed_peers, FED_MAX_PEERS);
+      return EXIT_FAILURE;
+    }
+    if(!(g_config.fed_interval > 0.0) || !(g_config.fed_kbps > 0.0) || g_config.fed_keyframe < 1){
+      fprintf(stderr, "invalid --fed-interval, --fed-kbps or --fed-keyframe (expected > 0)\n");
+      return EXIT_FAILURE;
+    }
+  }
+  int level = log_parse_level(g_config.log_level);
+  if(level < 0 || g_config.log_rate < 0){
+    fprintf(stderr, "invalid --log-level '%s' (expected debug, info, warn or error) or --log-rate %d\n", g_config.log_level, g_config.log_rate);
+    return EXIT_FAILURE;
+  }
+  log_set_level(level);
+  log_set_rate(g_config.log_rate);
+  if(g_config.perf_counters != 0 && g_config.perf_counters != 1){
+    fprintf(stderr, "invalid --perf-counters %d (expected 0 or 1)\n", g_config.perf_counters);
+    return EXIT_FAILURE;
+  }
+  if(!(g_config.mem_budget_mb >= 0.0)){
+    fprintf(stderr, "invalid --mem-budget-mb %g (MiB, 0 = no budget)\n", g_config.mem_budget_mb);
+    return EXIT_FAILURE;
+  }
+  if(g_config.trace_sample < 1 || g_config.trace_mb < 0.001){
+    fprintf(stderr, "invalid --trace-sample %d or --trace-mb %g\n", g_config.trace_sample, g_config.trace_mb);
+    return EXIT_FAILURE;
+  }
+  if(g_config.metrics_port < 0 || g_config.metrics_port > 65535){
+    fprintf(stderr, "invalid --metrics-port %d (1..65535, 0 = off)\n", g_config.metrics_port);
+    return EXIT_FAILURE;
+  }
+  if(g_config.wal_dir[0]){
+    if(!g_config.state_dir[0] || g_config.shards > 0 || g_config.workers > 0){
+      fprintf(stderr, "--wal-dir needs --state-dir and the queue pipeline (no --shards / --workers)\n");
+      return EXIT_FAILURE;
+    }
+    if(g_config.wal_sync_ms < 1 || !(g_config.wal_segment_mb >= 0.01) || !(g_config.wal_checkpoint > 0.0)){
+      fprintf(stderr, "invalid --wal-sync-ms, --wal-segment-mb or --wal-checkpoint (expected > 0)\n");
+      return EXIT_FAILURE;
+    }
+  }
+  mem_set_budget((long long)(g_config.mem_budget_mb * 1048576.0));
   return run_receiver();
 }
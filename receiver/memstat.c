@@ -0,0 +1,286 @@
+/*
+ * memstat.c
+ *
+ * Memory accounting. mem_alloc() and friends put a small header in front of
+ * every block with its size and tag, so mem_free() can take the bytes off
+ * the right subsystem without being told; a block from mem_alloc() must be
+ * released with mem_free() and never with free(). The counters are shared
+ * atomics: one add per subsystem and one for the total on every allocation
+ * and free, plus a compare-and-swap when a peak rises.
+ *
+ * The budget (`--mem-budget-mb`) is checked against the accounted total on
+ * every allocation and against the resident set size by mem_check(). When
+ * either exceeds it the process reports the usage per subsystem on stderr
+ * and exits at once: on a small device that is better than being picked by
+ * the OOM killer later, with nothing logged.
+ */
+#ifndef MEMSTAT_C_HEADER
+#define MEMSTAT_C_HEADER
+
+#include "memstat.h"
+
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "platform.h"
+#include "log.h"
+
+const char *const mem_tag_names[MEM_TAGS] = { "queue", "nn", "stats", "io", "llm" };
+
+/**
+ * Header in front of every accounted block.
+ *
+ * bytes: bytes accounted for the block, header and padding included
+ * offset: distance from the start of the allocation to the caller's pointer
+ * tag: MEM_* subsystem
+ */
+typedef struct {
+    size_t bytes;
+    unsigned int offset;
+    int tag;
+} mem_hdr_t;
+
+/* Header size, rounded up so the caller's pointer keeps malloc()'s alignment */
+#define MEM_HDR_BYTES ((sizeof(mem_hdr_t) + _Alignof(max_align_t) - 1) / _Alignof(max_align_t) * _Alignof(max_align_t))
+
+/**
+ * Counters of one subsystem, on their own cache line.
+ */
+typedef struct {
+    _Alignas(64) atomic_llong bytes;
+    atomic_llong peak;
+    atomic_llong allocs;
+    atomic_llong frees;
+} mem_live_t;
+
+/* Per subsystem, and the total of all of them at MEM_TAGS */
+static mem_live_t mem_live[MEM_TAGS + 1];
+static atomic_llong mem_limit;
+static atomic_int mem_failing;
+
+/**
+ * Report the memory use and exit: the budget is exceeded.
+ *
+ * @param what "accounted" or "resident"
+ * @param used bytes in use
+ */
+static void mem_over_budget(const char *what, long long used){
+    /* the first thread to notice reports, the others carry on until it exits */
+    if(atomic_exchange(&mem_failing, 1)) return;
+    long long limit = atomic_load(&mem_limit);
+    long long rss = -1, hwm = -1;
+    platform_memory_status(&rss, &hwm);
+    log_fprintf(stderr, "[mem] %s memory %.1f MiB exceeds the budget of %.1f MiB (resident %.1f MiB, peak %.1f MiB), exiting\n",
+                what, (double)used / 1048576.0, (double)limit / 1048576.0, (double)rss / 1048576.0, (double)hwm / 1048576.0);
+    for(int t=0;t<MEM_TAGS;t++){
+        mem_usage_t u;
+        mem_get_usage(t, &u);
+        log_fprintf(stderr, "[mem]   %-6s %10.1f KiB (peak %.1f KiB, %lld live blocks)\n", mem_tag_names[t],
+                    (double)u.bytes / 1024.0, (double)u.peak / 1024.0, u.allocs - u.frees);
+    }
+    _Exit(EXIT_FAILURE);
+}
+
+/**
+ * Raise a peak to a new value if it is larger.
+ */
+static void mem_raise(atomic_llong *peak, long long v){
+    long long p = atomic_load_explicit(peak, memory_order_relaxed);
+    while(v > p && !atomic_compare_exchange_weak_explicit(peak, &p, v, memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+/**
+ * Add bytes to a subsystem and the total, and check the budget.
+ *
+ * @param tag MEM_* subsystem
+ * @param bytes bytes added (negative when released)
+ */
+static void mem_add(int tag, long long bytes){
+    long long cur = atomic_fetch_add_explicit(&mem_live[tag].bytes, bytes, memory_order_relaxed) + bytes;
+    long long all = atomic_fetch_add_explicit(&mem_live[MEM_TAGS].bytes, bytes, memory_order_relaxed) + bytes;
+    if(bytes <= 0) return;
+    mem_raise(&mem_live[tag].peak, cur);
+    mem_raise(&mem_live[MEM_TAGS].peak, all);
+    long long limit = atomic_load_explicit(&mem_limit, memory_order_relaxed);
+    if(limit > 0 && all > limit) mem_over_budget("accounted", all);
+}
+
+/**
+ * Count an allocation or a free.
+ */
+static void mem_count(int tag, long long bytes, int freed){
+    atomic_llong *c = freed ? &mem_live[tag].frees : &mem_live[tag].allocs;
+    atomic_fetch_add_explicit(c, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(freed ? &mem_live[MEM_TAGS].frees : &mem_live[MEM_TAGS].allocs, 1, memory_order_relaxed);
+    mem_add(tag, freed ? -bytes : bytes);
+}
+
+/**
+ * Fill in the header of a new block and account it.
+ *
+ * @param base start of the allocation
+ * @param offset distance to the caller's pointer (>= MEM_HDR_BYTES)
+ * @param bytes size of the allocation
+ * @return the caller's pointer
+ */
+static void* mem_track(int tag, unsigned char *base, size_t offset, size_t bytes){
+    unsigned char *p = base + offset;
+    mem_hdr_t *h = (mem_hdr_t*)(p - MEM_HDR_BYTES);
+    h->bytes = bytes;
+    h->offset = (unsigned int)offset;
+    h->tag = tag;
+    mem_count(tag, (long long)bytes, 0);
+    return p;
+}
+
+static mem_hdr_t* mem_hdr(void *p){
+    return (mem_hdr_t*)((unsigned char*)p - MEM_HDR_BYTES);
+}
+
+/**
+ * Allocate accounted memory, like malloc().
+ *
+ * @param tag MEM_* subsystem
+ * @param size bytes
+ * @return block (release with mem_free()) or NULL
+ */
+void* mem_alloc(int tag, size_t size){
+    if(tag < 0 || tag >= MEM_TAGS || size > (size_t)-1 - MEM_HDR_BYTES) return NULL;
+    unsigned char *base = (unsigned char*)malloc(MEM_HDR_BYTES + size);
+    if(!base) return NULL;
+    return mem_track(tag, base, MEM_HDR_BYTES, MEM_HDR_BYTES + size);
+}
+
+/**
+ * Allocate zeroed accounted memory, like calloc().
+ *
+ * @param tag MEM_* subsystem
+ * @param n elements
+ * @param size bytes per element
+ * @return block (release with mem_free()) or NULL
+ */
+void* mem_calloc(int tag, size_t n, size_t size){
+    if(size && n > ((size_t)-1 - MEM_HDR_BYTES) / size) return NULL;
+    if(tag < 0 || tag >= MEM_TAGS) return NULL;
+    unsigned char *base = (unsigned char*)calloc(1, MEM_HDR_BYTES + n * size);
+    if(!base) return NULL;
+    return mem_track(tag, base, MEM_HDR_BYTES, MEM_HDR_BYTES + n * size);
+}
+
+/**
+ * Resize accounted memory, like realloc(). The block stays with the
+ * subsystem it was allocated for.
+ *
+ * @param tag MEM_* subsystem of a new block (p == NULL)
+ * @param p block from mem_alloc(), mem_calloc() or mem_realloc(), or NULL
+ * @param size new size in bytes
+ * @return resized block or NULL (p is left untouched then)
+ */
+void* mem_realloc(int tag, void *p, size_t size){
+    if(!p) return mem_alloc(tag, size);
+    if(size > (size_t)-1 - MEM_HDR_BYTES) return NULL;
+    mem_hdr_t *h = mem_hdr(p);
+    size_t old = h->bytes;
+    tag = h->tag;
+    unsigned char *base = (unsigned char*)realloc((unsigned char*)p - MEM_HDR_BYTES, MEM_HDR_BYTES + size);
+    if(!base) return NULL;
+    h = (mem_hdr_t*)base;
+    h->bytes = MEM_HDR_BYTES + size;
+    mem_add(tag, (long long)h->bytes - (long long)old);
+    return base + MEM_HDR_BYTES;
+}
+
+/**
+ * Allocate accounted memory with a given alignment, like aligned_alloc().
+ * Such blocks cannot be resized.
+ *
+ * @param tag MEM_* subsystem
+ * @param align alignment, a power of two
+ * @param size bytes
+ * @return block (release with mem_free()) or NULL
+ */
+void* mem_aligned_alloc(int tag, size_t align, size_t size){
+    if(align < MEM_HDR_BYTES) align = MEM_HDR_BYTES;
+    if(tag < 0 || tag >= MEM_TAGS || size > (size_t)-1 - 2 * align) return NULL;
+    /* aligned_alloc() wants a multiple of the alignment */
+    size_t bytes = (align + size + align - 1) / align * align;
+    unsigned char *base = (unsigned char*)aligned_alloc(align, bytes);
+    if(!base) return NULL;
+    return mem_track(tag, base, align, bytes);
+}
+
+/**
+ * Release accounted memory.
+ *
+ * @param p block from one of the mem_*alloc() functions, or NULL
+ */
+void mem_free(void *p){
+    if(!p) return;
+    mem_hdr_t *h = mem_hdr(p);
+    mem_count(h->tag, (long long)h->bytes, 1);
+    free((unsigned char*)p - h->offset);
+}
+
+/**
+ * Account memory allocated elsewhere, e.g. records handed to a queue and
+ * freed by the consumer with free().
+ *
+ * @param tag MEM_* subsystem
+ * @param bytes bytes taken (negative when given back)
+ */
+void mem_charge(int tag, long long bytes){
+    if(tag < 0 || tag >= MEM_TAGS || bytes == 0) return;
+    mem_add(tag, bytes);
+}
+
+/**
+ * Set the memory budget.
+ *
+ * @param bytes budget in bytes (0 = none)
+ */
+void mem_set_budget(long long bytes){
+    atomic_store(&mem_limit, bytes > 0 ? bytes : 0);
+    if(bytes <= 0) return;
+    LOG_INFO("[mem] memory budget %.1f MiB\n", (double)bytes / 1048576.0);
+    mem_check();
+}
+
+/**
+ * Get the memory budget.
+ *
+ * @return budget in bytes, 0 when there is none
+ */
+long long mem_budget(void){
+    return atomic_load_explicit(&mem_limit, memory_order_relaxed);
+}
+
+/**
+ * Check the resident set size against the budget; exits when it is
+ * exceeded. Called periodically (the accounted bytes are checked on every
+ * allocation).
+ */
+void mem_check(void){
+    long long limit = atomic_load_explicit(&mem_limit, memory_order_relaxed);
+    if(limit <= 0) return;
+    long long rss = -1, hwm = -1;
+    if(platform_memory_status(&rss, &hwm) == 0 && rss > limit) mem_over_budget("resident", rss);
+}
+
+/**
+ * Get the memory of one subsystem.
+ *
+ * @param tag MEM_* subsystem, MEM_TAGS for the total
+ * @param out receives the usage
+ */
+void mem_get_usage(int tag, mem_usage_t *out){
+    memset(out, 0, sizeof(*out));
+    if(tag < 0 || tag > MEM_TAGS) return;
+    out->bytes = atomic_load_explicit(&mem_live[tag].bytes, memory_order_relaxed);
+    out->peak = atomic_load_explicit(&mem_live[tag].peak, memory_order_relaxed);
+    out->allocs = atomic_load_explicit(&mem_live[tag].allocs, memory_order_relaxed);
+    out->frees = atomic_load_explicit(&mem_live[tag].frees, memory_order_relaxed);
+}
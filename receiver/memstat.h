@@ -0,0 +1,52 @@
+/**
+ * memstat.h
+ *
+ * Declarations for the memory accounting. The queues, the models, the
+ * statistics, the I/O paths and the LLM client allocate through mem_alloc()
+ * and friends with a MEM_* tag; current and peak bytes and the allocation
+ * counts are kept per subsystem. With `--mem-budget-mb` the process stops as
+ * soon as it uses more memory than the budget.
+ */
+
+#ifndef RECEIVER_MEMSTAT_H
+#define RECEIVER_MEMSTAT_H
+
+#include <stddef.h>
+
+/* Subsystems memory is accounted to */
+#define MEM_QUEUE 0 /* records waiting in the pipeline queues and task pools */
+#define MEM_NN 1    /* models, training, forecasts and federation */
+#define MEM_STATS 2 /* feature windows, prediction error windows, latency histograms, time-series store */
+#define MEM_IO 3    /* write-ahead log and metrics responses */
+#define MEM_LLM 4   /* LLM requests and replies */
+#define MEM_TAGS 5
+
+/**
+ * Memory of one subsystem (or of all of them).
+ *
+ * bytes: allocated now, allocator headers included
+ * peak: largest value of `bytes` so far
+ * allocs, frees: allocations and frees so far
+ */
+typedef struct {
+    long long bytes;
+    long long peak;
+    long long allocs;
+    long long frees;
+} mem_usage_t;
+
+extern const char *const mem_tag_names[MEM_TAGS];
+
+void* mem_alloc(int tag, size_t size);
+void* mem_calloc(int tag, size_t n, size_t size);
+void* mem_realloc(int tag, void *p, size_t size);
+void* mem_aligned_alloc(int tag, size_t align, size_t size);
+void mem_free(void *p);
+void mem_charge(int tag, long long bytes);
+
+void mem_set_budget(long long bytes);
+long long mem_budget(void);
+void mem_check(void);
+void mem_get_usage(int tag, mem_usage_t *out);
+
+#endif
@@ -0,0 +1,628 @@
+/*
+ * metrics.c
+ *
+ * Metrics endpoint. metrics_start() listens on a TCP port (`--metrics-port`,
+ * bound to `--metrics-addr`) and/or a Unix domain socket (`--metrics-socket`)
+ * and answers `GET /metrics` from one thread in the Prometheus text format
+ * (version 0.0.4). Every scrape reads the per-thread stats shards, the queue
+ * counters and the latency histograms without a lock, and the gauges behind
+ * stats_m for a few loads, so a scrape never makes a pipeline thread wait
+ * for it. Connections are served one at a time and closed after the
+ * response, which is all a scraper needs; a client that stalls for
+ * METRICS_IO_TIMEOUT_MS is dropped.
+ *
+ * Families (all prefixed `analyzer_` except the process gauge):
+ *   records_total{stage}, routed_records_total{tier}, detector_alarms_total{detector}
+ *   queue_depth{queue}, queue_high_water{queue}
+ *   train_steps_total, train_deferred_total, train_dropped_total, train_backlog,
+ *   train_duty_cycle, train_cost{slot}
+ *   stage_latency_seconds{stage} (histogram)
+ *   stage_cpu_records_total{stage}, stage_cpu_seconds_total{stage}, stage_cpu_events_total{stage,event},
+ *   stage_ipc{stage}, stage_cache_misses_per_record{stage}, stage_branch_misses_per_record{stage}
+ *   (with --perf-counters)
+ *   prediction_error{output,quantile}, prediction_error_mean{output},
+ *   prediction_error_samples{output} (last STATS_WINDOW_SECONDS)
+ *   model_cache_models, model_cache_bytes, model_cache_loads_total, model_cache_spills_total
+ *   store_points, store_bytes, wal_*_total, log_messages_total{outcome},
+ *   traced_records_total, trace_spans_total,
+ *   memory_bytes{subsystem}, memory_peak_bytes{subsystem}, memory_allocations_total{subsystem},
+ *   memory_frees_total{subsystem}, memory_budget_bytes (with --mem-budget-mb),
+ *   resident_memory_peak_bytes, process_resident_memory_bytes
+ */
+
+#ifndef METRICS_C_HEADER
+#define METRICS_C_HEADER
+#include "metrics.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#ifndef _WIN32
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#include "platform.h"
+#include "common.h"
+#include "queues.h"
+#include "latency.h"
+#include "tsdb.h"
+#include "log.h"
+#include "trace.h"
+#include "perfctr.h"
+#include "memstat.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define METRICS_POLL_MS 200
+#define METRICS_IO_TIMEOUT_MS 1000
+#define METRICS_REQ_MAX 4096
+/* Window of the training duty cycle */
+#define METRICS_DUTY_SECONDS 10
+
+/**
+ * Growable text buffer; `failed` is set once an allocation failed.
+ */
+typedef struct {
+    char *p;
+    size_t len, cap;
+    int failed;
+} metrics_buf_t;
+
+static socket_t metrics_socks[2];
+static int metrics_n_socks;
+static atomic_int metrics_running;
+static pthread_t metrics_thread;
+#ifndef _WIN32
+static char metrics_unix_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+#endif
+
+/**
+ * Append formatted text to the buffer.
+ */
+static void mb_printf(metrics_buf_t *b, const char *fmt, ...){
+    while(!b->failed){
+        size_t room = b->cap - b->len;
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(b->p ? b->p + b->len : NULL, room, fmt, ap);
+        va_end(ap);
+        if(n < 0){ b->failed = 1; return; }
+        if((size_t)n < room){ b->len += (size_t)n; return; }
+        size_t cap = b->cap ? b->cap : 4096;
+        while(cap - b->len <= (size_t)n) cap *= 2;
+        char *p = (char*)mem_realloc(MEM_IO, b->p, cap);
+        if(!p){ b->failed = 1; return; }
+        b->p = p;
+        b->cap = cap;
+    }
+}
+
+/**
+ * Append the HELP and TYPE lines of a family.
+ */
+static void mb_family(metrics_buf_t *b, const char *name, const char *type, const char *help){
+    mb_printf(b, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * Append an integer sample.
+ *
+ * @param labels label pairs without braces ("" = none)
+ */
+static void mb_int(metrics_buf_t *b, const char *name, const char *labels, long long v){
+    mb_printf(b, labels[0] ? "%s{%s} %lld\n" : "%s%s %lld\n", name, labels, v);
+}
+
+/**
+ * Append a floating-point sample, spelling NaN and infinities the way the
+ * format expects.
+ *
+ * @param labels label pairs without braces ("" = none)
+ */
+static void mb_double(metrics_buf_t *b, const char *name, const char *labels, double v){
+    char num[32];
+    if(isnan(v)) snprintf(num, sizeof(num), "NaN");
+    else if(isinf(v)) snprintf(num, sizeof(num), v > 0 ? "+Inf" : "-Inf");
+    else snprintf(num, sizeof(num), "%.10g", v);
+    mb_printf(b, labels[0] ? "%s{%s} %s\n" : "%s%s %s\n", name, labels, num);
+}
+
+/**
+ * Append the latency histograms. Bucket bounds run 1-2.5-5 per decade from
+ * 1 us to 100 s; a log-linear bucket of latency.c is counted under the
+ * first bound at or above its largest value, so a count may lag its bound
+ * by the histogram's ~3% resolution.
+ */
+static void metrics_latency(metrics_buf_t *b){
+    lat_hist_t *h = (lat_hist_t*)mem_alloc(MEM_IO, sizeof(lat_hist_t));
+    if(!h){ b->failed = 1; return; }
+    static const double steps[3] = { 1.0, 2.5, 5.0 };
+    mb_family(b, "analyzer_stage_latency_seconds", "histogram", "Time records spent per pipeline hop and phase (see latency.h).");
+    for(int s=0;s<LAT_STAGES;s++){
+        lat_snapshot(s, h);
+        int i = 0;
+        long long cum = 0;
+        double decade = 1e-6;
+        for(int k=0;k<=8*3;k++){
+            double le = k < 8*3 ? steps[k % 3] * decade : 100.0;
+            long long le_ns = (long long)(le * 1e9 + 0.5);
+            while(i < LAT_BUCKETS && lat_bucket_upper(i) <= le_ns) cum += h->b[i++];
+            mb_printf(b, "analyzer_stage_latency_seconds_bucket{stage=\"%s\",le=\"%g\"} %lld\n", lat_stage_names[s], le, cum);
+            if(k % 3 == 2) decade *= 10.0;
+        }
+        /* +Inf and the count come from the buckets, so they agree even while records are in flight */
+        while(i < LAT_BUCKETS) cum += h->b[i++];
+        mb_printf(b, "analyzer_stage_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lld\n", lat_stage_names[s], cum);
+        mb_printf(b, "analyzer_stage_latency_seconds_sum{stage=\"%s\"} %.9f\n", lat_stage_names[s], (double)h->sum / 1e9);
+        mb_printf(b, "analyzer_stage_latency_seconds_count{stage=\"%s\"} %lld\n", lat_stage_names[s], cum);
+    }
+    mem_free(h);
+}
+
+/**
+ * Append the CPU counters per stage (only while perfctr.c counts). The
+ * ratios cover the whole run; rate() over the counters gives recent ones.
+ */
+static void metrics_perf(metrics_buf_t *b){
+    int mask = perfctr_events();
+    if(!mask) return;
+    perf_counts_t c[PERF_STAGES];
+    for(int s=0;s<PERF_STAGES;s++) perfctr_snapshot(s, &c[s]);
+    char labels[96];
+    mb_family(b, "analyzer_stage_cpu_records_total", "counter", "Records the per-stage CPU counters cover.");
+    for(int s=0;s<PERF_STAGES;s++){
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", perf_stage_names[s]);
+        mb_int(b, "analyzer_stage_cpu_records_total", labels, c[s].records);
+    }
+    if(mask & (1 << PERF_EV_TASK_CLOCK)){
+        mb_family(b, "analyzer_stage_cpu_seconds_total", "counter", "CPU time spent per stage.");
+        for(int s=0;s<PERF_STAGES;s++){
+            snprintf(labels, sizeof(labels), "stage=\"%s\"", perf_stage_names[s]);
+            mb_double(b, "analyzer_stage_cpu_seconds_total", labels, (double)c[s].v[PERF_EV_TASK_CLOCK] / 1e9);
+        }
+    }
+    if(mask & ~(1 << PERF_EV_TASK_CLOCK)){
+        mb_family(b, "analyzer_stage_cpu_events_total", "counter", "Hardware events (user space) counted per stage.");
+        for(int s=0;s<PERF_STAGES;s++){
+            for(int ev=PERF_EV_CYCLES;ev<PERF_EVENTS;ev++){
+                if(!(mask & (1 << ev))) continue;
+                snprintf(labels, sizeof(labels), "stage=\"%s\",event=\"%s\"", perf_stage_names[s], perf_event_names[ev]);
+                mb_int(b, "analyzer_stage_cpu_events_total", labels, c[s].v[ev]);
+            }
+        }
+    }
+    static const struct { const char *name, *help; int num, den; } ratios[3] = {
+        { "analyzer_stage_ipc", "Instructions per cycle per stage.", PERF_EV_INSTRUCTIONS, PERF_EV_CYCLES },
+        { "analyzer_stage_cache_misses_per_record", "Cache misses per record per stage.", PERF_EV_CACHE_MISSES, -1 },
+        { "analyzer_stage_branch_misses_per_record", "Branch misses per record per stage.", PERF_EV_BRANCH_MISSES, -1 },
+    };
+    for(int r=0;r<3;r++){
+        if(!(mask & (1 << ratios[r].num)) || (ratios[r].den >= 0 && !(mask & (1 << ratios[r].den)))) continue;
+        mb_family(b, ratios[r].name, "gauge", ratios[r].help);
+        for(int s=0;s<PERF_STAGES;s++){
+            double den = ratios[r].den >= 0 ? (double)c[s].v[ratios[r].den] : (double)c[s].records;
+            snprintf(labels, sizeof(labels), "stage=\"%s\"", perf_stage_names[s]);
+            mb_double(b, ratios[r].name, labels, den > 0 ? (double)c[s].v[ratios[r].num] / den : NAN);
+        }
+    }
+}
+
+/**
+ * Append the prediction error aggregates of every model output and of
+ * their per-record average over the last STATS_WINDOW_SECONDS.
+ */
+static void metrics_errors(metrics_buf_t *b){
+    stats_err_agg_t agg[STATS_ERR_SERIES];
+    for(int k=0;k<STATS_ERR_SERIES;k++) stats_get_error_agg(STATS_WINDOW_SECONDS, k, &agg[k]);
+    char labels[96];
+    mb_family(b, "analyzer_prediction_error", "gauge", "Absolute prediction error quantiles per output over the last 60 s (quantile 1 = max).");
+    for(int k=0;k<STATS_ERR_SERIES;k++){
+        const char *out = k < STATS_ERR_ALL ? tsdb_column_names[TSDB_COL_METRICS + k] : "average";
+        static const char *const q[4] = { "0.5", "0.95", "0.99", "1" };
+        const double v[4] = { agg[k].p50, agg[k].p95, agg[k].p99, agg[k].max };
+        for(int j=0;j<4;j++){
+            snprintf(labels, sizeof(labels), "output=\"%s\",quantile=\"%s\"", out, q[j]);
+            mb_double(b, "analyzer_prediction_error", labels, v[j]);
+        }
+    }
+    mb_family(b, "analyzer_prediction_error_mean", "gauge", "Mean absolute prediction error per output over the last 60 s.");
+    for(int k=0;k<STATS_ERR_SERIES;k++){
+        snprintf(labels, sizeof(labels), "output=\"%s\"", k < STATS_ERR_ALL ? tsdb_column_names[TSDB_COL_METRICS + k] : "average");
+        mb_double(b, "analyzer_prediction_error_mean", labels, agg[k].mean);
+    }
+    mb_family(b, "analyzer_prediction_error_samples", "gauge", "Predictions the error aggregates cover.");
+    for(int k=0;k<STATS_ERR_SERIES;k++){
+        snprintf(labels, sizeof(labels), "output=\"%s\"", k < STATS_ERR_ALL ? tsdb_column_names[TSDB_COL_METRICS + k] : "average");
+        mb_int(b, "analyzer_prediction_error_samples", labels, agg[k].count);
+    }
+}
+
+/**
+ * Append the accounted memory per subsystem (see memstat.c), the budget and
+ * the resident memory with its high-water mark.
+ */
+static void metrics_memory(metrics_buf_t *b){
+    char labels[64];
+    mem_usage_t u[MEM_TAGS];
+    for(int t=0;t<MEM_TAGS;t++) mem_get_usage(t, &u[t]);
+    mb_family(b, "analyzer_memory_bytes", "gauge", "Memory allocated now per subsystem, allocator headers included.");
+    for(int t=0;t<MEM_TAGS;t++){
+        snprintf(labels, sizeof(labels), "subsystem=\"%s\"", mem_tag_names[t]);
+        mb_int(b, "analyzer_memory_bytes", labels, u[t].bytes);
+    }
+    mb_family(b, "analyzer_memory_peak_bytes", "gauge", "Largest memory allocated at once per subsystem.");
+    for(int t=0;t<MEM_TAGS;t++){
+        snprintf(labels, sizeof(labels), "subsystem=\"%s\"", mem_tag_names[t]);
+        mb_int(b, "analyzer_memory_peak_bytes", labels, u[t].peak);
+    }
+    mb_family(b, "analyzer_memory_allocations_total", "counter", "Allocations per subsystem.");
+    for(int t=0;t<MEM_TAGS;t++){
+        snprintf(labels, sizeof(labels), "subsystem=\"%s\"", mem_tag_names[t]);
+        mb_int(b, "analyzer_memory_allocations_total", labels, u[t].allocs);
+    }
+    mb_family(b, "analyzer_memory_frees_total", "counter", "Frees per subsystem.");
+    for(int t=0;t<MEM_TAGS;t++){
+        snprintf(labels, sizeof(labels), "subsystem=\"%s\"", mem_tag_names[t]);
+        mb_int(b, "analyzer_memory_frees_total", labels, u[t].frees);
+    }
+    long long budget = mem_budget();
+    if(budget > 0){
+        mb_family(b, "analyzer_memory_budget_bytes", "gauge", "Memory budget the process exits beyond (--mem-budget-mb).");
+        mb_int(b, "analyzer_memory_budget_bytes", "", budget);
+    }
+    long long rss, hwm;
+    if(platform_memory_status(&rss, &hwm) == 0){
+        mb_family(b, "process_resident_memory_bytes", "gauge", "Resident memory size in bytes.");
+        mb_int(b, "process_resident_memory_bytes", "", rss);
+        if(hwm >= 0){
+            mb_family(b, "analyzer_resident_memory_peak_bytes", "gauge", "Largest resident memory size so far in bytes.");
+            mb_int(b, "analyzer_resident_memory_peak_bytes", "", hwm);
+        }
+    }
+}
+
+/**
+ * Build the exposition text of the current metrics.
+ *
+ * @param len receives the length of the text
+ * @return NUL-terminated text owned by the caller, NULL when out of memory
+ */
+char* metrics_render(size_t *len){
+    metrics_buf_t b = { NULL, 0, 0, 0 };
+    char labels[64];
+
+    long long recv, proc, repr;
+    stats_get_counts(&recv, &proc, &repr);
+    mb_family(&b, "analyzer_records_total", "counter", "Records that passed a pipeline stage.");
+    mb_int(&b, "analyzer_records_total", "stage=\"received\"", recv);
+    mb_int(&b, "analyzer_records_total", "stage=\"processed\"", proc);
+    mb_int(&b, "analyzer_records_total", "stage=\"represented\"", repr);
+
+    long long tiers[STATS_TIERS], alarms[STATS_DETECTORS];
+    stats_get_tiers(tiers, alarms);
+    static const char *const tier_names[STATS_TIERS] = { "detector", "model", "escalated" };
+    static const char *const detector_names[STATS_DETECTORS] = { "ewma", "cusum", "hw" };
+    mb_family(&b, "analyzer_routed_records_total", "counter", "Records per routing tier of the statistical detectors.");
+    for(int i=0;i<STATS_TIERS;i++){
+        snprintf(labels, sizeof(labels), "tier=\"%s\"", tier_names[i]);
+        mb_int(&b, "analyzer_routed_records_total", labels, tiers[i]);
+    }
+    mb_family(&b, "analyzer_detector_alarms_total", "counter", "Records a detector kind raised an alarm on.");
+    for(int i=0;i<STATS_DETECTORS;i++){
+        snprintf(labels, sizeof(labels), "detector=\"%s\"", detector_names[i]);
+        mb_int(&b, "analyzer_detector_alarms_total", labels, alarms[i]);
+    }
+
+    /* the queues of the thread-per-stage pipeline; --shards / --workers leave them empty */
+    static const struct { const char *name; str_queue_t *q; } queues[] = {
+        { "raw", &raw_queue }, { "proc", &proc_queue }, { "feat", &feat_queue }, { "repr", &repr_queue }, { "error", &error_queue }
+    };
+    const int n_queues = (int)(sizeof(queues) / sizeof(queues[0]));
+    mb_family(&b, "analyzer_queue_depth", "gauge", "Records waiting in a pipeline queue.");
+    for(int i=0;i<n_queues;i++){
+        snprintf(labels, sizeof(labels), "queue=\"%s\"", queues[i].name);
+        mb_int(&b, "analyzer_queue_depth", labels, queue_length(queues[i].q));
+    }
+    mb_family(&b, "analyzer_queue_high_water", "gauge", "Largest number of records a pipeline queue held at once.");
+    for(int i=0;i<n_queues;i++){
+        snprintf(labels, sizeof(labels), "queue=\"%s\"", queues[i].name);
+        mb_int(&b, "analyzer_queue_high_water", labels, queue_high_water(queues[i].q));
+    }
+
+    double duty;
+    long long trained, deferred, dropped;
+    int backlog;
+    stats_get_train(METRICS_DUTY_SECONDS, &duty, &trained, &deferred, &dropped, &backlog);
+    mb_family(&b, "analyzer_train_steps_total", "counter", "Online training steps run.");
+    mb_int(&b, "analyzer_train_steps_total", "", trained);
+    mb_family(&b, "analyzer_train_deferred_total", "counter", "Training samples deferred into the backlog by the CPU budget.");
+    mb_int(&b, "analyzer_train_deferred_total", "", deferred);
+    mb_family(&b, "analyzer_train_dropped_total", "counter", "Training samples dropped from a full backlog or with an evicted model.");
+    mb_int(&b, "analyzer_train_dropped_total", "", dropped);
+    mb_family(&b, "analyzer_train_backlog", "gauge", "Training samples waiting in the backlogs.");
+    mb_int(&b, "analyzer_train_backlog", "", backlog);
+    mb_family(&b, "analyzer_train_duty_cycle", "gauge", "Fraction of one core spent training over the last 10 s.");
+    mb_double(&b, "analyzer_train_duty_cycle", "", duty);
+    mb_family(&b, "analyzer_train_cost", "gauge", "Cost of the latest training step per NN stage slot.");
+    for(int i=0;i<STATS_MAX_SLOTS;i++){
+        double cost = stats_get_train_cost(i);
+        if(isnan(cost)) continue;
+        snprintf(labels, sizeof(labels), "slot=\"%d\"", i);
+        mb_double(&b, "analyzer_train_cost", labels, cost);
+    }
+
+    metrics_latency(&b);
+    metrics_perf(&b);
+    metrics_errors(&b);
+
+    long long resident, bytes, loads, spills;
+    stats_get_model_cache(&resident, &bytes, &loads, &spills);
+    mb_family(&b, "analyzer_model_cache_models", "gauge", "Per-source models resident in memory.");
+    mb_int(&b, "analyzer_model_cache_models", "", resident);
+    mb_family(&b, "analyzer_model_cache_bytes", "gauge", "Memory used by the resident per-source models.");
+    mb_int(&b, "analyzer_model_cache_bytes", "", bytes);
+    mb_family(&b, "analyzer_model_cache_loads_total", "counter", "Per-source models loaded back from spill files.");
+    mb_int(&b, "analyzer_model_cache_loads_total", "", loads);
+    mb_family(&b, "analyzer_model_cache_spills_total", "counter", "Per-source models spilled on eviction.");
+    mb_int(&b, "analyzer_model_cache_spills_total", "", spills);
+
+    if(g_store){
+        long long points, store_bytes;
+        tsdb_usage(g_store, &points, &store_bytes);
+        mb_family(&b, "analyzer_store_points", "gauge", "Values held by the history store.");
+        mb_int(&b, "analyzer_store_points", "", points);
+        mb_family(&b, "analyzer_store_bytes", "gauge", "Size of the history store's blocks.");
+        mb_int(&b, "analyzer_store_bytes", "", store_bytes);
+    }
+
+    long long wal_records, wal_bytes, wal_syncs, wal_sync_ns, wal_replayed;
+    stats_get_wal(&wal_records, &wal_bytes, &wal_syncs, &wal_sync_ns, &wal_replayed);
+    mb_family(&b, "analyzer_wal_records_total", "counter", "Records appended to the write-ahead log.");
+    mb_int(&b, "analyzer_wal_records_total", "", wal_records);
+    mb_family(&b, "analyzer_wal_bytes_total", "counter", "Bytes appended to the write-ahead log.");
+    mb_int(&b, "analyzer_wal_bytes_total", "", wal_bytes);
+    mb_family(&b, "analyzer_wal_syncs_total", "counter", "Group commits of the write-ahead log.");
+    mb_int(&b, "analyzer_wal_syncs_total", "", wal_syncs);
+    mb_family(&b, "analyzer_wal_sync_seconds_total", "counter", "Time spent flushing the write-ahead log.");
+    mb_double(&b, "analyzer_wal_sync_seconds_total", "", (double)wal_sync_ns / 1e9);
+    mb_family(&b, "analyzer_wal_replayed_total", "counter", "Records replayed from the write-ahead log on start.");
+    mb_int(&b, "analyzer_wal_replayed_total", "", wal_replayed);
+
+    long long log_written, log_dropped, log_suppressed;
+    log_get_counts(&log_written, &log_dropped, &log_suppressed);
+    mb_family(&b, "analyzer_log_messages_total", "counter", "Log messages written, dropped for lack of ring space and suppressed by the rate limit.");
+    mb_int(&b, "analyzer_log_messages_total", "outcome=\"written\"", log_written);
+    mb_int(&b, "analyzer_log_messages_total", "outcome=\"dropped\"", log_dropped);
+    mb_int(&b, "analyzer_log_messages_total", "outcome=\"suppressed\"", log_suppressed);
+
+    long long traced, spans;
+    trace_get_counts(&traced, &spans);
+    mb_family(&b, "analyzer_traced_records_total", "counter", "Received records sampled for the trace (--trace-file).");
+    mb_int(&b, "analyzer_traced_records_total", "", traced);
+    mb_family(&b, "analyzer_trace_spans_total", "counter", "Stage spans written to the trace file.");
+    mb_int(&b, "analyzer_trace_spans_total", "", spans);
+
+    metrics_memory(&b);
+
+    if(b.failed){ mem_free(b.p); return NULL; }
+    if(len) *len = b.len;
+    return b.p;
+}
+
+/**
+ * Wait until a socket is readable or writable.
+ *
+ * @param s socket
+ * @param write non-zero to wait for writability
+ * @param deadline_ns monotonic deadline
+ * @return non-zero when ready before the deadline
+ */
+static int metrics_wait(socket_t s, int write, long long deadline_ns){
+    long long left = deadline_ns - platform_monotonic_ns();
+    if(left <= 0) return 0;
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(s, &fds);
+    struct timeval tv = { (long)(left / 1000000000LL), (long)(left % 1000000000LL / 1000) };
+    return select((int)s + 1, write ? NULL : &fds, write ? &fds : NULL, NULL, &tv) > 0;
+}
+
+/**
+ * Send a whole buffer.
+ *
+ * @return 0 on success, -1 on an error or timeout
+ */
+static int metrics_send_all(socket_t s, const char *p, size_t len, long long deadline_ns){
+    while(len > 0){
+        if(!metrics_wait(s, 1, deadline_ns)) return -1;
+        int chunk = len > 65536 ? 65536 : (int)len;
+        int n = (int)send(s, p, chunk, MSG_NOSIGNAL);
+        if(n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * Read one request from a connection and answer it.
+ *
+ * @param c accepted connection
+ */
+static void metrics_serve(socket_t c){
+    long long deadline = platform_monotonic_ns() + METRICS_IO_TIMEOUT_MS * 1000000LL;
+    char req[METRICS_REQ_MAX];
+    size_t got = 0;
+    req[0] = '\0';
+    /* the request line and headers; a body is never expected */
+    while(!strstr(req, "\n\r\n") && !strstr(req, "\n\n")){
+        if(got + 1 >= sizeof(req) || !metrics_wait(c, 0, deadline)) return;
+        int n = (int)recv(c, req + got, (int)(sizeof(req) - 1 - got), 0);
+        if(n <= 0) return;
+        got += (size_t)n;
+        req[got] = '\0';
+    }
+    const char *status = "200 OK";
+    char *body = NULL;
+    size_t len = 0;
+    int head = strncmp(req, "HEAD ", 5) == 0;
+    if(strncmp(req, "GET ", 4) != 0 && !head) status = "405 Method Not Allowed";
+    else {
+        const char *path = req + (head ? 5 : 4);
+        size_t plen = strcspn(path, " ?\r\n");
+        if(plen != 8 || strncmp(path, "/metrics", 8) != 0) status = "404 Not Found";
+        else if(!(body = metrics_render(&len))) status = "500 Internal Server Error";
+    }
+    char hdr[256];
+    int hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                        "Content-Length: %zu\r\nConnection: close\r\n\r\n", status, len);
+    if(metrics_send_all(c, hdr, (size_t)hlen, deadline) == 0 && body && !head) metrics_send_all(c, body, len, deadline);
+    mem_free(body);
+}
+
+/**
+ * Listener thread: accept and serve connections until metrics_stop().
+ *
+ * @param arg unused
+ * @return NULL
+ */
+static void* metrics_main(void *arg){
+    (void)arg;
+    while(atomic_load(&metrics_running)){
+        fd_set rd;
+        FD_ZERO(&rd);
+        int maxfd = 0;
+        for(int i=0;i<metrics_n_socks;i++){
+            FD_SET(metrics_socks[i], &rd);
+            if((int)metrics_socks[i] > maxfd) maxfd = (int)metrics_socks[i];
+        }
+        struct timeval tv = { 0, METRICS_POLL_MS * 1000 };
+        if(select(maxfd + 1, &rd, NULL, NULL, &tv) <= 0) continue;
+        for(int i=0;i<metrics_n_socks;i++){
+            if(!FD_ISSET(metrics_socks[i], &rd)) continue;
+            socket_t c = accept(metrics_socks[i], NULL, NULL);
+            if(c == INVALID_SOCKET) continue;
+            metrics_serve(c);
+            CLOSESOCKET(c);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Close the listeners and remove the Unix socket file.
+ */
+static void metrics_close_all(void){
+    for(int i=0;i<metrics_n_socks;i++) CLOSESOCKET(metrics_socks[i]);
+    metrics_n_socks = 0;
+#ifndef _WIN32
+    if(metrics_unix_path[0]) unlink(metrics_unix_path);
+    metrics_unix_path[0] = '\0';
+#endif
+}
+
+/**
+ * Open a TCP listener.
+ *
+ * @return 0 on success, -1 on error (logged)
+ */
+static int metrics_listen_tcp(const char *addr, int port){
+    struct sockaddr_in me;
+    memset(&me, 0, sizeof(me));
+    me.sin_family = AF_INET;
+    me.sin_port = htons((unsigned short)port);
+    if(inet_pton(AF_INET, addr, &me.sin_addr) != 1){
+        LOG_ERROR("[metrics] invalid listen address '%s'\n", addr);
+        return -1;
+    }
+    socket_t s = socket(AF_INET, SOCK_STREAM, 0);
+    if(s == INVALID_SOCKET){ LOG_ERROR("[metrics] cannot create a TCP socket\n"); return -1; }
+    int one = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+    if(bind(s, (struct sockaddr*)&me, sizeof(me)) < 0 || listen(s, 8) < 0){
+        LOG_ERROR("[metrics] cannot listen on TCP %s:%d\n", addr, port);
+        CLOSESOCKET(s);
+        return -1;
+    }
+    metrics_socks[metrics_n_socks++] = s;
+    return 0;
+}
+
+#ifndef _WIN32
+/**
+ * Open a Unix domain socket listener, replacing a stale socket file.
+ *
+ * @return 0 on success, -1 on error (logged)
+ */
+static int metrics_listen_unix(const char *path){
+    struct sockaddr_un un;
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(un.sun_path)){ LOG_ERROR("[metrics] socket path '%s' is too long\n", path); return -1; }
+    strcpy(un.sun_path, path);
+    struct stat st;
+    if(lstat(path, &st) == 0){
+        if(!S_ISSOCK(st.st_mode)){ LOG_ERROR("[metrics] %s exists and is not a socket\n", path); return -1; }
+        unlink(path);
+    }
+    socket_t s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(s == INVALID_SOCKET){ LOG_ERROR("[metrics] cannot create a Unix socket\n"); return -1; }
+    if(bind(s, (struct sockaddr*)&un, sizeof(un)) < 0 || listen(s, 8) < 0){
+        LOG_ERROR("[metrics] cannot listen on %s\n", path);
+        CLOSESOCKET(s);
+        return -1;
+    }
+    metrics_socks[metrics_n_socks++] = s;
+    strcpy(metrics_unix_path, path);
+    return 0;
+}
+#endif
+
+/**
+ * Start serving the metrics. Does nothing when neither a port nor a socket
+ * path is given.
+ *
+ * @param addr IPv4 address the TCP listener binds to
+ * @param port TCP port (0 = no TCP listener)
+ * @param unix_path Unix domain socket path ("" or NULL = none; not supported on Windows)
+ * @return 0 on success, -1 when a listener or the thread cannot be set up
+ */
+int metrics_start(const char *addr, int port, const char *unix_path){
+    if(atomic_load(&metrics_running)) return 0;
+    if(port > 0 && metrics_listen_tcp(addr, port) != 0) return -1;
+    if(unix_path && unix_path[0]){
+#ifndef _WIN32
+        if(metrics_listen_unix(unix_path) != 0){ metrics_close_all(); return -1; }
+#else
+        LOG_ERROR("[metrics] Unix sockets are not supported on this platform, ignoring %s\n", unix_path);
+#endif
+    }
+    if(metrics_n_socks == 0) return 0;
+    atomic_store(&metrics_running, 1);
+    if(pthread_create(&metrics_thread, NULL, metrics_main, NULL) != 0){
+        atomic_store(&metrics_running, 0);
+        metrics_close_all();
+        return -1;
+    }
+    if(port > 0) LOG_INFO("[metrics] serving /metrics on TCP %s:%d\n", addr, port);
+    if(unix_path && unix_path[0] && metrics_n_socks > (port > 0)) LOG_INFO("[metrics] serving /metrics on %s\n", unix_path);
+    return 0;
+}
+
+/**
+ * Stop serving the metrics and close the listeners.
+ */
+void metrics_stop(void){
+    if(!atomic_exchange(&metrics_running, 0)) return;
+    pthread_join(metrics_thread, NULL);
+    metrics_close_all();
+}
@@ -0,0 +1,18 @@
+/**
+ * metrics.h
+ *
+ * Declarations for the metrics endpoint: a minimal HTTP server answering
+ * `GET /metrics` with the receiver's counters, queue depths, latency
+ * histograms and gauges in the Prometheus text exposition format.
+ */
+
+#ifndef RECEIVER_METRICS_H
+#define RECEIVER_METRICS_H
+
+#include <stddef.h>
+
+int metrics_start(const char *addr, int port, const char *unix_path);
+void metrics_stop(void);
+char* metrics_render(size_t *len);
+
+#endif
@@ -20,6 +20,12 @@
 #include "parser.h"
 #include "../common.h"
 #include "../queues.h"
+#include "../config.h"
+#include "../clock.h"
+#include "../latency.h"
+#include "../trace.h"
+#include "../perfctr.h"
+#include "../wal.h"
 
 /**
  * Process an input file line-by-line.
@@ -90,48 +96,88 @@ int convert_json_to_datapoint(const char *s, data_point_t *d){
   return 0;
 }
 
+/**
+ * Preprocess a single raw line.
+ *
+ * Parses the line into a `data_point_t` and, when it contains numeric data,
+ * writes the CSV form expected by the NN stage
+ * ("ts_ms,bytes,flows,packets,rtr,rtt,srt") into `out`.
+ *
+ * @param line raw input line
+ * @param out output buffer for the CSV line
+ * @param out_len size of the output buffer
+ * @return 1 when `out` holds the converted line, 0 when the raw line should be forwarded unchanged
+ */
+int preproc_line(const char *line, char *out, size_t out_len){
+    data_point_t dp;
+    if(!convert_json_to_datapoint(line, &dp)) return 0;
+    long long ts_ms = 0;
+    if(!isnan(dp.timestamp)) ts_ms = (long long)(dp.timestamp * 1000.0);
+    snprintf(out, out_len, "%lld,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f",
+             ts_ms,
+             (double)dp.export_bytes,
+             (double)dp.export_flows,
+             (double)dp.export_packets,
+             (double)dp.export_rtr,
+             (double)dp.export_rtt,
+             (double)dp.export_srt);
+    return 1;
+}
+
 /**
  * Preprocessing thread for the pipeline.
  *
  * Reads raw lines from `raw_queue`, attempts to parse them into
  * `data_point_t` and forwards either a CSV-formatted string expected by the
- * NN thread or the original raw line to `proc_queue`.
+ * NN thread or the original raw line to `proc_queue`. Record metadata (the
+ * datagram source) is forwarded unchanged.
  *
- * @param arg unused thread argument
+ * With a write-ahead log every preprocessed record is appended to it before
+ * being forwarded, and every `--wal-checkpoint` seconds a checkpoint marker
+ * covering the records appended so far is sent down the pipeline.
+ *
+ * @param arg write-ahead log (wal_t*), NULL without `--wal-dir`
  * @return NULL
  */
 void *preproc_thread(void *arg){
-    (void)arg;
+    wal_t *wal = (wal_t*)arg;
+    long long ckpt_ms = (long long)(g_config.wal_checkpoint * 1e3);
+    long long last_ckpt = clock_coarse_ms();
+    unsigned long long marked = 0;
     while(1){
-        char *line = queue_pop(&raw_queue);
+        rec_meta_t meta;
+        char *line = queue_pop_meta(&raw_queue, &meta);
         if(!line) break;
 
-        data_point_t dp;
-        if(convert_json_to_datapoint(line, &dp)){
-            char outbuf[512];
-            long long ts_ms = 0;
-            if(!isnan(dp.timestamp)) ts_ms = (long long)(dp.timestamp * 1000.0);
-            /* We don't need the formatted-length return value here, avoid unused-variable warning */
-            snprintf(outbuf, sizeof(outbuf), "%lld,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f",
-                     ts_ms,
-                     (double)dp.export_bytes,
-                     (double)dp.export_flows,
-                     (double)dp.export_packets,
-                     (double)dp.export_rtr,
-                     (double)dp.export_rtt,
-                     (double)dp.export_srt);
-            char *p = strdup(outbuf);
-            if(p) {
-                queue_push(&proc_queue, p);
-                stats_inc_processed();
-            }
-        } else {
-            queue_push(&proc_queue, line);
-            stats_inc_processed();
-            free(line);
-            continue;
+        trace_wait(&meta);
+        perf_mark_t pm;
+        perfctr_enter(&pm);
+        char outbuf[512];
+        long long t_trace = TRACE_BEGIN(&meta);
+        int parsed = preproc_line(line, outbuf, sizeof(outbuf));
+        TRACE_END(&meta, TRACE_PARSE, t_trace);
+        lat_hop(&meta, LAT_PREPROC);
+        if(parsed){
+            if(wal) meta.lsn = wal_append(wal, meta.src, outbuf);
+            queue_push_meta(&proc_queue, outbuf, &meta);
         }
+        else queue_push_meta(&proc_queue, line, &meta);
+        perfctr_exit(&pm, PERF_PREPROC, 1);
+        stats_inc_processed();
         free(line);
+
+        long long now = wal ? clock_coarse_ms() : 0;
+        if(wal && now - last_ckpt >= ckpt_ms){
+            rec_meta_t mark;
+            memset(&mark, 0, sizeof(mark));
+            mark.flags = REC_CHECKPOINT;
+            mark.lsn = wal_last_lsn(wal);
+            if(mark.lsn > marked){
+                queue_push_meta(&proc_queue, "", &mark);
+                marked = mark.lsn;
+            }
+            last_ckpt = now;
+        }
     }
     return NULL;
-}
\ No newline at end of file
+}
@@ -8,6 +8,7 @@
 #define DATA_PROCESSOR_H
 
 #include <stdio.h>
+#include <stddef.h>
 #include "../types.h"
 
 
@@ -16,5 +17,6 @@ void parse_data(const char *raw_data);
 void convert_data(const char *parsed_data);
 void parse_json_to_datapoint(const char *s, data_point_t *d);
 int convert_json_to_datapoint(const char *s, data_point_t *d);
+int preproc_line(const char *line, char *out, size_t out_len);
 
 #endif 
\ No newline at end of file
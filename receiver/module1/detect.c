@@ -0,0 +1,219 @@
+/*
+ * detect.c
+ *
+ * Streaming statistical detectors, a cheap first stage in front of the
+ * model. Every metric of a stream can run any of:
+ *   ewmaL   EWMA control chart: the smoothed value (lambda 0.2) leaves
+ *           baseline +- L sigma * sqrt(lambda / (2 - lambda))
+ *   cusumH  two-sided tabular CUSUM on the standardized value (slack 0.5
+ *           sigma), alarm when a sum exceeds H sigma; the sums restart after it
+ *   hwP     Holt-Winters (additive, season of P samples, trend only without
+ *           P): alarm when the one-step forecast misses by more than 4 RMS
+ *           residuals
+ * The baseline mean / variance of EWMA and CUSUM and the residual RMS of
+ * Holt-Winters are exponentially weighted (1/64), so a level shift is
+ * reported and then absorbed. A sample is tested before it updates the
+ * state, and no alarm is raised during the warm-up. Each detector costs a
+ * handful of floating point operations and a fixed number of doubles per
+ * metric and stream.
+ */
+
+#ifndef DETECT_C_HEADER
+#define DETECT_C_HEADER
+#include "detect.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define DETECT_WARMUP 16
+#define DETECT_BASE_RATE (1.0 / 64.0)
+#define DETECT_EWMA_LAMBDA 0.2
+#define DETECT_CUSUM_SLACK 0.5
+#define DETECT_HW_ALPHA 0.2
+#define DETECT_HW_BETA 0.05
+#define DETECT_HW_GAMMA 0.1
+#define DETECT_HW_SIGMAS 4.0
+
+static const char *metric_names[N_METRICS] = { "bytes", "flows", "packets", "rtr", "rtt", "srt" };
+
+/**
+ * Parse an optional numeric suffix of a detector token.
+ *
+ * @param s text after the detector name ("" keeps `*out`)
+ * @param lo, hi accepted range
+ * @param out receives the value
+ * @return 0 on success, -1 when malformed or out of range
+ */
+static int parse_suffix(const char *s, double lo, double hi, double *out){
+    if(*s == '\0') return 0;
+    char *end = NULL;
+    double v = strtod(s, &end);
+    if(*end != '\0' || !(v >= lo && v <= hi)) return -1;
+    *out = v;
+    return 0;
+}
+
+/**
+ * Parse one `+`-separated list of detectors.
+ *
+ * @param list detector list, e.g. "ewma3+cusum5+hw288" or "none"
+ * @param dm receives the detectors (state offsets are filled in later)
+ * @return 0 on success, -1 on an unknown detector
+ */
+static int parse_detectors(char *list, detect_metric_t *dm){
+    memset(dm, 0, sizeof(*dm));
+    dm->ewma_limit = 3.0;
+    dm->cusum_h = 5.0;
+    char *save = NULL;
+    for(char *tok = strtok_r(list, "+", &save); tok; tok = strtok_r(NULL, "+", &save)){
+        double v = 0.0;
+        if(strcmp(tok, "none") == 0 || strcmp(tok, "off") == 0) dm->kinds = 0;
+        else if(strncmp(tok, "ewma", 4) == 0){
+            if(parse_suffix(tok + 4, 0.1, 100.0, &dm->ewma_limit) != 0) return -1;
+            dm->kinds |= DETECT_EWMA;
+        } else if(strncmp(tok, "cusum", 5) == 0){
+            if(parse_suffix(tok + 5, 0.1, 1000.0, &dm->cusum_h) != 0) return -1;
+            dm->kinds |= DETECT_CUSUM;
+        } else if(strncmp(tok, "hw", 2) == 0){
+            if(parse_suffix(tok + 2, 2.0, (double)DETECT_PERIOD_MAX, &v) != 0 || v != floor(v)) return -1;
+            dm->hw_period = (int)v;
+            dm->kinds |= DETECT_HW;
+        } else return -1;
+    }
+    return 0;
+}
+
+/**
+ * Parse a detector specification: comma-separated groups of `+`-joined
+ * detectors (`ewmaL`, `cusumH`, `hwP`, `none`), each optionally prefixed
+ * with a metric name (`bytes`, `flows`, `packets`, `rtr`, `rtt`, `srt`)
+ * and a colon. A group without a prefix applies to all metrics; later groups
+ * replace earlier ones, e.g. "ewma3+cusum5,rtt:hw288,rtr:none". "off"
+ * disables all detectors.
+ *
+ * @param spec specification string
+ * @param ds receives the parsed configuration
+ * @return 0 on success, -1 on a malformed specification
+ */
+int detect_set_parse(const char *spec, detect_set_t *ds){
+    memset(ds, 0, sizeof(*ds));
+    char buf[256];
+    if(!spec || strlen(spec) >= sizeof(buf)) return -1;
+    snprintf(buf, sizeof(buf), "%s", spec);
+    char *save = NULL;
+    for(char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)){
+        int metric = -1;
+        char *colon = strchr(tok, ':');
+        if(colon){
+            *colon = '\0';
+            for(int m=0;m<N_METRICS;m++) if(strcmp(tok, metric_names[m]) == 0) metric = m;
+            if(metric < 0) return -1;
+            tok = colon + 1;
+        }
+        detect_metric_t dm;
+        if(*tok == '\0' || parse_detectors(tok, &dm) != 0) return -1;
+        for(int m=0;m<N_METRICS;m++) if(metric < 0 || metric == m) ds->metrics[m] = dm;
+    }
+    for(int m=0;m<N_METRICS;m++){
+        detect_metric_t *dm = &ds->metrics[m];
+        dm->state_len = 0;
+        if(dm->kinds & (DETECT_EWMA | DETECT_CUSUM)) dm->state_len += 2;
+        if(dm->kinds & DETECT_EWMA) dm->state_len += 1;
+        if(dm->kinds & DETECT_CUSUM) dm->state_len += 2;
+        if(dm->kinds & DETECT_HW) dm->state_len += 3 + (size_t)dm->hw_period;
+        dm->state_off = ds->state_len;
+        ds->state_len += dm->state_len;
+    }
+    return 0;
+}
+
+/**
+ * Check whether any metric has a detector.
+ *
+ * @param ds detector configuration
+ * @return non-zero when at least one detector is enabled
+ */
+int detect_set_enabled(const detect_set_t *ds){
+    for(int m=0;m<N_METRICS;m++) if(ds->metrics[m].kinds) return 1;
+    return 0;
+}
+
+/**
+ * Standard deviation from a variance, floored so a constant series does not
+ * divide by zero.
+ */
+static double detect_sd(double mean, double var){
+    double floor_sd = 1e-9 * (fabs(mean) + 1.0);
+    double sd = var > 0.0 ? sqrt(var) : 0.0;
+    return sd > floor_sd ? sd : floor_sd;
+}
+
+/**
+ * Test one sample of a stream against its detectors and update their state.
+ *
+ * @param ds detector configuration
+ * @param state the stream's detector state (ds->state_len doubles, zeroed for a new stream)
+ * @param n number of samples of the stream including this one
+ * @param x raw metrics of the sample (length N_METRICS)
+ * @return DETECT_* bits of the detectors that raised an alarm on any metric
+ */
+unsigned detect_update(const detect_set_t *ds, double *state, long long n, const double *x){
+    unsigned alarms = 0;
+    double rate = 1.0 / (double)n > DETECT_BASE_RATE ? 1.0 / (double)n : DETECT_BASE_RATE;
+    for(int m=0;m<N_METRICS;m++){
+        const detect_metric_t *dm = &ds->metrics[m];
+        if(!dm->kinds) continue;
+        double v = x[m];
+        double *st = state + dm->state_off;
+        if(dm->kinds & (DETECT_EWMA | DETECT_CUSUM)){
+            /* st[0] = baseline mean, st[1] = baseline variance */
+            double *mu = st, *var = st + 1;
+            st += 2;
+            if(n == 1) *mu = v;
+            double sd = detect_sd(*mu, *var);
+            if(dm->kinds & DETECT_EWMA){
+                double *s = st++;
+                if(n == 1) *s = v;
+                else *s += DETECT_EWMA_LAMBDA * (v - *s);
+                double width = sd * sqrt(DETECT_EWMA_LAMBDA / (2.0 - DETECT_EWMA_LAMBDA));
+                if(n > DETECT_WARMUP && fabs(*s - *mu) > dm->ewma_limit * width) alarms |= DETECT_EWMA;
+            }
+            if(dm->kinds & DETECT_CUSUM){
+                double *hi = st, *lo = st + 1;
+                st += 2;
+                if(n > DETECT_WARMUP){
+                    double z = (v - *mu) / sd;
+                    *hi = fmax(0.0, *hi + z - DETECT_CUSUM_SLACK);
+                    *lo = fmax(0.0, *lo - z - DETECT_CUSUM_SLACK);
+                    if(*hi > dm->cusum_h || *lo > dm->cusum_h){ alarms |= DETECT_CUSUM; *hi = *lo = 0.0; }
+                }
+            }
+            double d = v - *mu;
+            *mu += rate * d;
+            *var = (1.0 - rate) * (*var + rate * d * d);
+        }
+        if(dm->kinds & DETECT_HW){
+            /* st[0] = level, st[1] = trend, st[2] = mean squared residual, then the season */
+            double *level = st, *trend = st + 1, *msr = st + 2, *season = st + 3;
+            int p = dm->hw_period;
+            int si = p ? (int)((n - 1) % p) : 0;
+            double seas = p ? season[si] : 0.0;
+            if(n == 1){
+                *level = v;
+                continue;
+            }
+            double r = v - (*level + *trend + seas);
+            if(n > DETECT_WARMUP + 2LL * p && fabs(r) > DETECT_HW_SIGMAS * detect_sd(*level, *msr)) alarms |= DETECT_HW;
+            double rr = 1.0 / (double)(n - 1) > DETECT_BASE_RATE ? 1.0 / (double)(n - 1) : DETECT_BASE_RATE;
+            *msr += rr * (r * r - *msr);
+            double prev = *level;
+            *level = DETECT_HW_ALPHA * (v - seas) + (1.0 - DETECT_HW_ALPHA) * (*level + *trend);
+            *trend = DETECT_HW_BETA * (*level - prev) + (1.0 - DETECT_HW_BETA) * *trend;
+            if(p) season[si] = DETECT_HW_GAMMA * (v - *level) + (1.0 - DETECT_HW_GAMMA) * seas;
+        }
+    }
+    return alarms;
+}
@@ -0,0 +1,58 @@
+/**
+ * detect.h
+ *
+ * Declarations for the streaming statistical detectors in module1. They run per stream in
+ * the feature stage, ahead of the NN stage, and decide which records are suspicious enough
+ * to be worth the model (and the LLM).
+ */
+
+#ifndef DETECT_H
+#define DETECT_H
+
+#include <stddef.h>
+
+#include "../types.h"
+
+/** Detector kinds (bit mask). */
+#define DETECT_EWMA  1u /* EWMA control chart */
+#define DETECT_CUSUM 2u /* two-sided tabular CUSUM */
+#define DETECT_HW    4u /* Holt-Winters forecast residual */
+
+/** Largest Holt-Winters season length accepted in a detector spec. */
+#define DETECT_PERIOD_MAX 2048
+
+/**
+ * Detectors of one metric.
+ *
+ * kinds: DETECT_* bits of the enabled detectors
+ * ewma_limit: EWMA control limit in standard deviations of the chart statistic
+ * cusum_h: CUSUM decision interval in standard deviations
+ * hw_period: Holt-Winters season length in samples (0 = trend only)
+ * state_off: offset of the metric's state in a stream's detector state
+ * state_len: doubles of state of the metric
+ */
+typedef struct {
+    unsigned kinds;
+    double ewma_limit;
+    double cusum_h;
+    int hw_period;
+    size_t state_off;
+    size_t state_len;
+} detect_metric_t;
+
+/**
+ * Parsed detector configuration (`--detectors`).
+ *
+ * metrics: detectors per metric, in data point order
+ * state_len: doubles of detector state per stream
+ */
+typedef struct {
+    detect_metric_t metrics[N_METRICS];
+    size_t state_len;
+} detect_set_t;
+
+int detect_set_parse(const char *spec, detect_set_t *ds);
+int detect_set_enabled(const detect_set_t *ds);
+unsigned detect_update(const detect_set_t *ds, double *state, long long n, const double *x);
+
+#endif
@@ -0,0 +1,638 @@
+/*
+ * feature_stage.c
+ *
+ * Sliding-window feature engineering. Every stream (source address) keeps a
+ * ring buffer of its recent samples plus a small state block per feature
+ * group, so each feature is updated in O(1) (amortized for the monotonic
+ * deques of the rolling min/max) per message:
+ *   lagK   value K samples ago           (ring buffer)
+ *   delta  change since the last sample  (ring buffer)
+ *   emaH   EMA with a half-life of H     (one running value)
+ *   minW   rolling minimum over W        (monotonic deque)
+ *   maxW   rolling maximum over W        (monotonic deque)
+ *   varW   rolling variance over W       (sliding Welford mean / M2)
+ * The stage appends the feature vector to the preprocessed CSV line as
+ * "ts,b,f,p,rtr,rtt,srt|x1,...,xN"; the NN stage reads it from there.
+ *
+ * With `--detectors` the stream also runs the statistical detectors of
+ * detect.c. An alarm marks the record and the next `--detect-hold` records
+ * of the stream as suspicious; with `--route=suspicious` all other records
+ * bypass the model.
+ */
+
+#ifndef FEATURE_STAGE_C_HEADER
+#define FEATURE_STAGE_C_HEADER
+#include "feature_stage.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "../queues.h"
+#include "../config.h"
+#include "../state.h"
+#include "../log.h"
+#include "../tsdb.h"
+#include "../latency.h"
+#include "../trace.h"
+#include "../memstat.h"
+
+#define FEATURE_BUCKETS 1024
+#define FEATURE_STREAMS_MAX 4096
+#define FEATURE_SNAPSHOT_MAGIC 0x53545346u /* "FSTS" */
+#define FEATURE_SNAPSHOT_VERSION 1u
+
+/**
+ * Per-stream state.
+ *
+ * key: source address ("" when all records share one stream)
+ * count: samples seen so far
+ * pos: ring slot of the newest sample
+ * hold: records left in the suspicious window opened by the last alarm
+ * bypassed: non-zero while the stream's records bypass the model
+ * hnext: next stream in the same hash bucket
+ * lru_prev, lru_next: neighbours in the LRU list (head = most recently used)
+ * data: history * N_METRICS ring values followed by the feature groups' and the detectors' state
+ */
+typedef struct feature_stream_s {
+    char key[64];
+    long long count;
+    int pos;
+    int hold;
+    int bypassed;
+    struct feature_stream_s *hnext;
+    struct feature_stream_s *lru_prev, *lru_next;
+    double data[];
+} feature_stream_t;
+
+/**
+ * Feature stage structure definition.
+ *
+ * fs: feature set computed for every record
+ * ds: statistical detectors run on every record
+ * detect_on: non-zero when `ds` enables any detector
+ * route_suspicious: non-zero when records outside suspicious windows bypass the model
+ * max_streams: streams kept before the least recently used one is dropped
+ * n_streams: streams currently held
+ * buckets: hash buckets (chained through feature_stream_t.hnext)
+ * lru_head, lru_tail: most / least recently used streams
+ */
+struct feature_stage_s {
+    feature_set_t fs;
+    detect_set_t ds;
+    int detect_on;
+    int route_suspicious;
+    size_t max_streams;
+    size_t n_streams;
+    feature_stream_t *buckets[FEATURE_BUCKETS];
+    feature_stream_t *lru_head, *lru_tail;
+};
+
+/**
+ * Parse a token of the form `<prefix><N>` with 1 <= N <= FEATURE_WINDOW_MAX.
+ *
+ * @param tok token
+ * @param prefix expected prefix
+ * @param out receives N
+ * @return 1 when the token matches, 0 otherwise
+ */
+static int parse_param_token(const char *tok, const char *prefix, int *out){
+    size_t pl = strlen(prefix);
+    if(strncmp(tok, prefix, pl) != 0 || tok[pl] == '\0') return 0;
+    char *end = NULL;
+    long v = strtol(tok + pl, &end, 10);
+    if(*end != '\0' || v < 1 || v > FEATURE_WINDOW_MAX) return 0;
+    *out = (int)v;
+    return 1;
+}
+
+/**
+ * Parse a feature set specification, a comma-separated list of groups:
+ * `raw`, `lagK`, `delta`, `emaH`, `minW`, `maxW`, `varW` (e.g.
+ * "raw,lag1,delta,ema8,min16,max16,var16"). Every group yields one feature
+ * per metric, in the order given.
+ *
+ * @param spec specification string
+ * @param fs receives the parsed set
+ * @return 0 on success, -1 on a malformed or too large specification
+ */
+int feature_set_parse(const char *spec, feature_set_t *fs){
+    memset(fs, 0, sizeof(*fs));
+    fs->history = 1;
+    char buf[256];
+    if(!spec || strlen(spec) >= sizeof(buf)) return -1;
+    snprintf(buf, sizeof(buf), "%s", spec);
+    char *save = NULL;
+    for(char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)){
+        if(fs->n_specs == FEATURE_SPECS_MAX) return -1;
+        feature_spec_t *sp = &fs->specs[fs->n_specs];
+        int v = 0;
+        memset(sp, 0, sizeof(*sp));
+        if(strcmp(tok, "raw") == 0){ sp->kind = FEAT_RAW; }
+        else if(strcmp(tok, "delta") == 0){ sp->kind = FEAT_DELTA; if(fs->history < 2) fs->history = 2; }
+        else if(parse_param_token(tok, "lag", &v)){ sp->kind = FEAT_LAG; if(fs->history < v + 1) fs->history = v + 1; }
+        else if(parse_param_token(tok, "ema", &v)){ sp->kind = FEAT_EMA; sp->alpha = 1.0 - pow(2.0, -1.0 / (double)v); sp->state_len = 1; }
+        else if(parse_param_token(tok, "min", &v)){ sp->kind = FEAT_MIN; sp->state_len = 2 + 2 * (size_t)v; }
+        else if(parse_param_token(tok, "max", &v)){ sp->kind = FEAT_MAX; sp->state_len = 2 + 2 * (size_t)v; }
+        else if(parse_param_token(tok, "var", &v) && v >= 2){ sp->kind = FEAT_VAR; sp->state_len = 2; if(fs->history < v + 1) fs->history = v + 1; }
+        else return -1;
+        sp->param = v;
+        sp->state_off = fs->state_len;
+        fs->state_len += sp->state_len * N_METRICS;
+        fs->n_specs++;
+    }
+    if(fs->n_specs == 0) return -1;
+    fs->n_features = (size_t)fs->n_specs * N_METRICS;
+    return 0;
+}
+
+/**
+ * Check whether a set is just the current raw metrics, in which case the
+ * stage has nothing to add and records are forwarded unchanged.
+ *
+ * @param fs feature set
+ * @return non-zero for the plain `raw` set
+ */
+int feature_set_is_raw(const feature_set_t *fs){
+    return fs->n_specs == 1 && fs->specs[0].kind == FEAT_RAW;
+}
+
+/**
+ * Normalization scale of every feature: the metric's scale for value-like
+ * features and deltas, its square for the variance.
+ *
+ * @param fs feature set
+ * @param metric_scales scale per metric (length N_METRICS)
+ * @param out receives fs->n_features scales
+ */
+void feature_set_scales(const feature_set_t *fs, const double *metric_scales, double *out){
+    for(int s=0;s<fs->n_specs;s++){
+        for(int m=0;m<N_METRICS;m++){
+            double sc = metric_scales[m];
+            out[s * N_METRICS + m] = fs->specs[s].kind == FEAT_VAR ? sc * sc : sc;
+        }
+    }
+}
+
+/**
+ * Parse a comma-separated list of feature values (the part after '|').
+ *
+ * @param s value list
+ * @param fv receives the values
+ * @return number of values, -1 on a malformed or too long list
+ */
+int features_parse(const char *s, feature_vec_t *fv){
+    fv->n = 0;
+    while(*s){
+        if(fv->n == FEATURE_MAX) return -1;
+        char *end = NULL;
+        double v = strtod(s, &end);
+        if(end == s) return -1;
+        fv->v[fv->n++] = v;
+        if(*end == ',') end++;
+        else if(*end != '\0') return -1;
+        s = end;
+    }
+    return (int)fv->n;
+}
+
+/**
+ * Derive the feature vector of a hypothetical next sample from the current
+ * one, for autoregressive rollouts that cannot see a stream's history:
+ * raw, delta and EMA are exact, a lag shifts in the next shorter lag of the
+ * set (the current value for lag1, otherwise it is kept), min/max take the
+ * new value into account without expiring old ones and the variance is kept.
+ *
+ * @param fs feature set
+ * @param cur raw metrics the current vector was computed from (length N_METRICS)
+ * @param x current feature vector
+ * @param next raw metrics of the next sample (length N_METRICS)
+ * @param out receives the next feature vector (may not alias `x`)
+ */
+void feature_set_advance(const feature_set_t *fs, const double *cur, const feature_vec_t *x, const double *next, feature_vec_t *out){
+    out->n = fs->n_features;
+    for(int g=0; g<fs->n_specs; g++){
+        const feature_spec_t *sp = &fs->specs[g];
+        /* the group holding lag K-1, if the set has one */
+        int shorter = -1;
+        if(sp->kind == FEAT_LAG && sp->param > 1){
+            for(int o=0;o<fs->n_specs;o++) if(fs->specs[o].kind == FEAT_LAG && fs->specs[o].param == sp->param - 1) shorter = o;
+        }
+        for(int m=0;m<N_METRICS;m++){
+            double v = x->v[g * N_METRICS + m];
+            switch(sp->kind){
+            case FEAT_RAW: v = next[m]; break;
+            case FEAT_LAG:
+                if(sp->param == 1) v = cur[m];
+                else if(shorter >= 0) v = x->v[shorter * N_METRICS + m];
+                break;
+            case FEAT_DELTA: v = next[m] - cur[m]; break;
+            case FEAT_EMA: v += sp->alpha * (next[m] - v); break;
+            case FEAT_MIN: if(next[m] < v) v = next[m]; break;
+            case FEAT_MAX: if(next[m] > v) v = next[m]; break;
+            case FEAT_VAR: break;
+            }
+            out->v[g * N_METRICS + m] = v;
+        }
+    }
+}
+
+/**
+ * FNV-1a hash of a NUL-terminated key.
+ *
+ * @param key string to hash
+ * @return bucket index
+ */
+static size_t feature_hash(const char *key){
+    uint32_t h = 2166136261u;
+    for(const unsigned char *p = (const unsigned char*)key; *p; p++){ h ^= *p; h *= 16777619u; }
+    return (size_t)(h & (FEATURE_BUCKETS - 1));
+}
+
+static void stream_unlink(feature_stage_t *fst, feature_stream_t *s){
+    if(s->lru_prev) s->lru_prev->lru_next = s->lru_next; else fst->lru_head = s->lru_next;
+    if(s->lru_next) s->lru_next->lru_prev = s->lru_prev; else fst->lru_tail = s->lru_prev;
+    s->lru_prev = s->lru_next = NULL;
+}
+
+static void stream_push_front(feature_stage_t *fst, feature_stream_t *s){
+    s->lru_prev = NULL;
+    s->lru_next = fst->lru_head;
+    if(fst->lru_head) fst->lru_head->lru_prev = s;
+    fst->lru_head = s;
+    if(!fst->lru_tail) fst->lru_tail = s;
+}
+
+/**
+ * Drop a stream; its source starts over with an empty history.
+ *
+ * @param fst stage
+ * @param s stream to drop
+ */
+static void stream_drop(feature_stage_t *fst, feature_stream_t *s){
+    feature_stream_t **pp = &fst->buckets[feature_hash(s->key)];
+    while(*pp && *pp != s) pp = &(*pp)->hnext;
+    if(*pp) *pp = s->hnext;
+    stream_unlink(fst, s);
+    mem_free(s);
+    fst->n_streams--;
+}
+
+/**
+ * Look up (or create) the stream of a source and mark it most recently used.
+ *
+ * @param fst stage
+ * @param key source address
+ * @return stream or NULL on allocation failure
+ */
+static feature_stream_t* stream_get(feature_stage_t *fst, const char *key){
+    size_t b = feature_hash(key);
+    for(feature_stream_t *s = fst->buckets[b]; s; s = s->hnext){
+        if(strcmp(s->key, key) == 0){
+            if(fst->lru_head != s){ stream_unlink(fst, s); stream_push_front(fst, s); }
+            return s;
+        }
+    }
+    if(fst->n_streams >= fst->max_streams && fst->lru_tail) stream_drop(fst, fst->lru_tail);
+    size_t n_data = (size_t)fst->fs.history * N_METRICS + fst->fs.state_len + fst->ds.state_len;
+    feature_stream_t *s = (feature_stream_t*)mem_calloc(MEM_STATS, 1, sizeof(feature_stream_t) + sizeof(double) * n_data);
+    if(!s) return NULL;
+    snprintf(s->key, sizeof(s->key), "%s", key);
+    s->pos = -1;
+    s->hnext = fst->buckets[b];
+    fst->buckets[b] = s;
+    stream_push_front(fst, s);
+    fst->n_streams++;
+    return s;
+}
+
+/**
+ * Value of a metric `lag` samples ago; the oldest sample stands in while
+ * the history is shorter than the lag.
+ */
+static double stream_hist(const feature_set_t *fs, const feature_stream_t *s, int lag, int m){
+    if((long long)lag >= s->count) lag = (int)(s->count - 1);
+    int slot = (s->pos - lag + fs->history) % fs->history;
+    return s->data[(size_t)slot * N_METRICS + (size_t)m];
+}
+
+/**
+ * Push a sample into a monotonic deque and return the window's extreme.
+ * State layout: head, len, idx[W], val[W] (ring).
+ *
+ * @param st deque state
+ * @param w window length
+ * @param t index of the sample
+ * @param x sample value
+ * @param is_max non-zero for a rolling maximum, zero for a minimum
+ * @return minimum / maximum of the last `w` samples
+ */
+static double mono_push(double *st, int w, long long t, double x, int is_max){
+    int head = (int)st[0], len = (int)st[1];
+    double *idx = st + 2, *val = st + 2 + w;
+    while(len > 0 && (long long)idx[head] <= t - w){ head = (head + 1) % w; len--; }
+    while(len > 0){
+        int back = (head + len - 1) % w;
+        if(is_max ? val[back] > x : val[back] < x) break;
+        len--;
+    }
+    int slot = (head + len) % w;
+    idx[slot] = (double)t;
+    val[slot] = x;
+    len++;
+    st[0] = head; st[1] = len;
+    return val[head];
+}
+
+/**
+ * Add one sample to a stream and compute its feature vector.
+ *
+ * @param fs feature set
+ * @param s stream
+ * @param x raw metrics of the sample (length N_METRICS)
+ * @param out receives fs->n_features features
+ */
+static void stream_update(const feature_set_t *fs, feature_stream_t *s, const double *x, feature_vec_t *out){
+    s->pos = (s->pos + 1) % fs->history;
+    memcpy(&s->data[(size_t)s->pos * N_METRICS], x, sizeof(double) * N_METRICS);
+    s->count++;
+    long long t = s->count - 1;
+    double *state = s->data + (size_t)fs->history * N_METRICS;
+    out->n = fs->n_features;
+    for(int g=0; g<fs->n_specs; g++){
+        const feature_spec_t *sp = &fs->specs[g];
+        for(int m=0;m<N_METRICS;m++){
+            double *st = state + sp->state_off + (size_t)m * sp->state_len;
+            double v = x[m];
+            switch(sp->kind){
+            case FEAT_RAW: break;
+            case FEAT_LAG: v = stream_hist(fs, s, sp->param, m); break;
+            case FEAT_DELTA: v = s->count > 1 ? x[m] - stream_hist(fs, s, 1, m) : 0.0; break;
+            case FEAT_EMA:
+                if(s->count > 1) st[0] += sp->alpha * (x[m] - st[0]);
+                else st[0] = x[m];
+                v = st[0];
+                break;
+            case FEAT_MIN: v = mono_push(st, sp->param, t, x[m], 0); break;
+            case FEAT_MAX: v = mono_push(st, sp->param, t, x[m], 1); break;
+            case FEAT_VAR: {
+                /* st[0] = window mean, st[1] = sum of squared deviations (M2) */
+                double mean = st[0];
+                if(s->count <= sp->param){
+                    double d = x[m] - mean;
+                    st[0] = mean + d / (double)s->count;
+                    st[1] += d * (x[m] - st[0]);
+                } else {
+                    double old = stream_hist(fs, s, sp->param, m);
+                    st[0] = mean + (x[m] - old) / (double)sp->param;
+                    st[1] += (x[m] - old) * (x[m] - st[0] + old - mean);
+                }
+                if(st[1] < 0.0) st[1] = 0.0;
+                long long n = s->count < sp->param ? s->count : sp->param;
+                v = st[1] / (double)n;
+                break;
+            }
+            }
+            out->v[g * N_METRICS + m] = v;
+        }
+    }
+}
+
+/**
+ * Run the detectors on the newest sample of a stream and set the record's
+ * routing flags.
+ *
+ * @param fst stage
+ * @param s stream (already updated with the sample)
+ * @param x raw metrics of the sample (length N_METRICS)
+ * @param meta record metadata receiving the REC_* flags
+ */
+static void stream_detect(feature_stage_t *fst, feature_stream_t *s, const double *x, rec_meta_t *meta){
+    double *state = s->data + (size_t)fst->fs.history * N_METRICS + fst->fs.state_len;
+    unsigned alarms = detect_update(&fst->ds, state, s->count, x);
+    if(alarms) s->hold = g_config.detect_hold + 1;
+    if(s->hold > 0){
+        meta->flags |= REC_SUSPICIOUS;
+        s->hold--;
+    }
+    int tier = STATS_TIER_MODEL;
+    if(fst->route_suspicious && !(meta->flags & REC_SUSPICIOUS)){
+        meta->flags |= REC_BYPASS;
+        s->bypassed = 1;
+        tier = STATS_TIER_DETECTOR;
+    } else if(s->bypassed){
+        meta->flags |= REC_RESUMED;
+        s->bypassed = 0;
+    }
+    /* DETECT_EWMA / CUSUM / HW are bits 0..2, the order of the stats' alarm counters */
+    stats_record_tier(tier, alarms);
+}
+
+/**
+ * Create a feature stage.
+ *
+ * @param fs feature set to compute
+ * @param ds statistical detectors to run, or NULL for none
+ * @param max_streams streams kept before the least recently used one is dropped (0 = default)
+ * @return allocated stage or NULL on error
+ */
+feature_stage_t* feature_stage_create(const feature_set_t *fs, const detect_set_t *ds, size_t max_streams){
+    feature_stage_t *fst = (feature_stage_t*)mem_calloc(MEM_STATS, 1, sizeof(feature_stage_t));
+    if(!fst) return NULL;
+    fst->fs = *fs;
+    if(ds) fst->ds = *ds;
+    fst->detect_on = detect_set_enabled(&fst->ds);
+    fst->route_suspicious = fst->detect_on && strcmp(g_config.route, "suspicious") == 0;
+    fst->max_streams = max_streams ? max_streams : FEATURE_STREAMS_MAX;
+    return fst;
+}
+
+/**
+ * Free a feature stage and all stream state.
+ *
+ * @param fst stage (may be NULL)
+ */
+void feature_stage_free(feature_stage_t *fst){
+    if(!fst) return;
+    while(fst->lru_tail) stream_drop(fst, fst->lru_tail);
+    mem_free(fst);
+}
+
+/**
+ * Fingerprint of the options that shape a stream's state, so a snapshot is
+ * only restored into a stage computing the same features and detectors.
+ */
+static uint32_t feature_stage_fingerprint(const feature_stage_t *fst){
+    uint32_t h = 2166136261u;
+    const char *parts[3] = { g_config.features, "|", g_config.detectors };
+    for(int k=0;k<3;k++)
+        for(const unsigned char *p = (const unsigned char*)parts[k]; *p; p++){ h ^= *p; h *= 16777619u; }
+    h ^= (uint32_t)fst->fs.history * 31u + (uint32_t)fst->fs.state_len * 7u + (uint32_t)fst->ds.state_len;
+    return h;
+}
+
+/**
+ * Write the state of every stream (history ring, feature and detector
+ * state, alarm window) so a restarted stage continues where this one
+ * stopped.
+ *
+ * Layout: magic, version, fingerprint, doubles per stream, stream count
+ * (uint32 each), then per stream from least to most recently used: key
+ * (64 bytes), count (int64), pos, hold, bypassed (int32) and the state.
+ *
+ * @param fst stage
+ * @param f file opened for binary writing
+ * @return 0 on success, -1 on a write error
+ */
+int feature_stage_write(const feature_stage_t *fst, FILE *f){
+    size_t n_data = (size_t)fst->fs.history * N_METRICS + fst->fs.state_len + fst->ds.state_len;
+    uint32_t hdr[5] = { FEATURE_SNAPSHOT_MAGIC, FEATURE_SNAPSHOT_VERSION, feature_stage_fingerprint(fst), (uint32_t)n_data, (uint32_t)fst->n_streams };
+    int ok = fwrite(hdr, sizeof(hdr), 1, f) == 1;
+    for(const feature_stream_t *s = fst->lru_tail; s && ok; s = s->lru_prev){
+        int64_t count = s->count;
+        int32_t small[3] = { s->pos, s->hold, s->bypassed };
+        ok = fwrite(s->key, sizeof(s->key), 1, f) == 1
+          && fwrite(&count, sizeof(count), 1, f) == 1
+          && fwrite(small, sizeof(small), 1, f) == 1
+          && fwrite(s->data, sizeof(double), n_data, f) == n_data;
+    }
+    return ok ? 0 : -1;
+}
+
+/**
+ * Restore the streams saved by feature_stage_write(). Streams beyond the
+ * stage's limit drop out in LRU order as usual.
+ *
+ * @param fst stage, normally still empty
+ * @param f file opened for binary reading
+ * @return number of streams restored, or -1 when the file is damaged or belongs to other options
+ */
+int feature_stage_read(feature_stage_t *fst, FILE *f){
+    size_t n_data = (size_t)fst->fs.history * N_METRICS + fst->fs.state_len + fst->ds.state_len;
+    uint32_t hdr[5];
+    if(fread(hdr, sizeof(hdr), 1, f) != 1 || hdr[0] != FEATURE_SNAPSHOT_MAGIC || hdr[1] != FEATURE_SNAPSHOT_VERSION
+       || hdr[2] != feature_stage_fingerprint(fst) || hdr[3] != (uint32_t)n_data) return -1;
+    int restored = 0;
+    for(uint32_t i=0;i<hdr[4];i++){
+        char key[64];
+        int64_t count;
+        int32_t small[3];
+        if(fread(key, sizeof(key), 1, f) != 1 || fread(&count, sizeof(count), 1, f) != 1
+           || fread(small, sizeof(small), 1, f) != 1) return -1;
+        key[sizeof(key) - 1] = '\0';
+        feature_stream_t *s = stream_get(fst, key);
+        if(!s || fread(s->data, sizeof(double), n_data, f) != n_data) return -1;
+        if(small[0] < -1 || small[0] >= fst->fs.history){ stream_drop(fst, s); return -1; }
+        s->count = count;
+        s->pos = small[0];
+        s->hold = small[1];
+        s->bypassed = small[2];
+        restored++;
+    }
+    return restored;
+}
+
+/**
+ * Compute the features of one preprocessed record and run the stream's
+ * detectors on it.
+ *
+ * @param fst stage
+ * @param line preprocessed CSV line ("ts,bytes,flows,packets,rtr,rtt,srt")
+ * @param meta record metadata (source address), receives the REC_* routing flags
+ * @param out output buffer for "line|x1,...,xN"
+ * @param out_len size of the output buffer
+ * @return 1 when `out` holds the extended line, 0 when the line should be forwarded unchanged
+ */
+int feature_stage_line(feature_stage_t *fst, const char *line, rec_meta_t *meta, char *out, size_t out_len){
+    int raw = feature_set_is_raw(&fst->fs);
+    if(raw && !fst->detect_on && !g_store) return 0;
+    double x[N_METRICS];
+    char *end = NULL;
+    double ts = strtod(line, &end);
+    if(end == line || *end != ',') return 0;
+    for(int m=0;m<N_METRICS;m++){
+        const char *p = end + 1;
+        x[m] = strtod(p, &end);
+        if(end == p || (m < N_METRICS - 1 && *end != ',')) return 0;
+    }
+    /* every parsed record is stored, including those the detectors route past the model */
+    if(g_store && !(meta->flags & REC_REPLAYED)){
+        float xf[N_METRICS];
+        for(int m=0;m<N_METRICS;m++) xf[m] = (float)x[m];
+        tsdb_append(g_store, meta->src, TSDB_COL_METRICS, (long long)ts, xf, N_METRICS);
+    }
+    if(raw && !fst->detect_on) return 0;
+    feature_stream_t *s = stream_get(fst, g_config.per_source_models ? meta->src : "");
+    if(!s){ LOG_ERROR("[features] no stream state for source '%s'\n", meta->src); return 0; }
+    feature_vec_t fv;
+    stream_update(&fst->fs, s, x, &fv);
+    if(fst->detect_on) stream_detect(fst, s, x, meta);
+    if(raw) return 0;
+    size_t off = (size_t)snprintf(out, out_len, "%s|", line);
+    for(size_t i=0;i<fv.n && off < out_len;i++)
+        off += (size_t)snprintf(out + off, out_len - off, i ? ",%.9g" : "%.9g", fv.v[i]);
+    if(off >= out_len){ LOG_ERROR("[features] feature line truncated\n"); return 0; }
+    return 1;
+}
+
+/**
+ * Feature thread for the pipeline.
+ *
+ * Reads preprocessed lines from `proc_queue`, appends the feature vector of
+ * the record's stream and forwards the result to `feat_queue`. Lines that are
+ * not preprocessed records are forwarded unchanged; records the detectors
+ * route past the model are dropped here. The streams are restored from and
+ * saved to `--state-dir`; the thread returns when `proc_queue` is closed.
+ *
+ * @param arg unused thread argument
+ * @return NULL when the streams were saved on shutdown, STATE_NOT_SAVED when
+ *         they were not, STATE_STAGE_FAILED when the stage could not be created
+ */
+void *feature_thread(void *arg){
+    (void)arg;
+    feature_set_t fs;
+    if(feature_set_parse(g_config.features, &fs) != 0){
+        LOG_ERROR("invalid --features '%s'\n", g_config.features);
+        platform_request_stop();
+        return STATE_STAGE_FAILED;
+    }
+    detect_set_t ds;
+    if(detect_set_parse(g_config.detectors, &ds) != 0){
+        LOG_ERROR("invalid --detectors '%s'\n", g_config.detectors);
+        platform_request_stop();
+        return STATE_STAGE_FAILED;
+    }
+    feature_stage_t *fst = feature_stage_create(&fs, &ds, 0);
+    if(!fst){ LOG_ERROR("feature_stage_create failed, stopping\n"); platform_request_stop(); return STATE_STAGE_FAILED; }
+    state_restore_features(fst, 0);
+    while(1){
+        rec_meta_t meta;
+        char *line = queue_pop_meta(&proc_queue, &meta);
+        if(!line) break;
+        if(meta.flags & REC_CHECKPOINT){
+            /* the streams are saved here, the models once the marker reaches the NN stage (lsn 0 = nothing to truncate) */
+            long long t_trace = TRACE_ACTIVE() ? platform_monotonic_ns() : 0;
+            if(state_save_features(fst, 0) != 0) meta.lsn = 0;
+            if(t_trace) trace_span(0, TRACE_CHECKPOINT, t_trace, platform_monotonic_ns());
+            queue_push_meta(&feat_queue, line, &meta);
+            free(line);
+            continue;
+        }
+        trace_wait(&meta);
+        char outbuf[2048];
+        long long t_trace = TRACE_BEGIN(&meta);
+        int extended = feature_stage_line(fst, line, &meta, outbuf, sizeof(outbuf));
+        TRACE_END(&meta, TRACE_FEATURES, t_trace);
+        lat_hop(&meta, LAT_FEATURES);
+        if(meta.flags & REC_BYPASS){ /* handled by the detectors alone */ }
+        else if(extended) queue_push_meta(&feat_queue, outbuf, &meta);
+        else queue_push_meta(&feat_queue, line, &meta);
+        free(line);
+    }
+    int rc = state_save_features(fst, 0);
+    feature_stage_free(fst);
+    return rc == 0 ? NULL : STATE_NOT_SAVED;
+}
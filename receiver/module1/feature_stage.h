@@ -0,0 +1,86 @@
+/**
+ * feature_stage.h
+ *
+ * Declarations for the sliding-window feature stage in module1. The stage sits between
+ * preprocessing and the NN stage, keeps a short history per stream and turns every
+ * preprocessed record into the feature vector the network is trained on. The stream's
+ * statistical detectors (see detect.h) run here too and set the record's routing flags.
+ */
+
+#ifndef FEATURE_STAGE_H
+#define FEATURE_STAGE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "../types.h"
+#include "../common.h"
+#include "detect.h"
+
+/** Maximum number of feature groups in a set (every group yields N_METRICS features). */
+#define FEATURE_SPECS_MAX (FEATURE_MAX / N_METRICS)
+
+/** Largest lag / window length accepted in a feature spec. */
+#define FEATURE_WINDOW_MAX 1024
+
+/**
+ * Kind of a feature group.
+ *
+ * FEAT_RAW: current value
+ * FEAT_LAG: value K samples ago
+ * FEAT_DELTA: change since the previous sample
+ * FEAT_EMA: exponential moving average with a half-life of H samples
+ * FEAT_MIN, FEAT_MAX: rolling minimum / maximum over the last W samples
+ * FEAT_VAR: rolling (population) variance over the last W samples
+ */
+typedef enum { FEAT_RAW, FEAT_LAG, FEAT_DELTA, FEAT_EMA, FEAT_MIN, FEAT_MAX, FEAT_VAR } feature_kind_t;
+
+/**
+ * One feature group, applied to each metric.
+ *
+ * kind: feature kind
+ * param: lag K, half-life H or window W (0 for raw / delta)
+ * alpha: EMA smoothing factor derived from the half-life
+ * state_off: offset of the group's per-metric state in a stream's state block
+ * state_len: doubles of state per metric
+ */
+typedef struct {
+    feature_kind_t kind;
+    int param;
+    double alpha;
+    size_t state_off;
+    size_t state_len;
+} feature_spec_t;
+
+/**
+ * Parsed feature set (`--features`).
+ *
+ * n_specs, specs: feature groups in output order
+ * n_features: width of the resulting feature vector (n_specs * N_METRICS)
+ * history: samples of raw history a stream keeps for lags and windows
+ * state_len: doubles of per-stream state besides the history
+ */
+typedef struct {
+    int n_specs;
+    feature_spec_t specs[FEATURE_SPECS_MAX];
+    size_t n_features;
+    int history;
+    size_t state_len;
+} feature_set_t;
+
+typedef struct feature_stage_s feature_stage_t;
+
+int feature_set_parse(const char *spec, feature_set_t *fs);
+int feature_set_is_raw(const feature_set_t *fs);
+void feature_set_scales(const feature_set_t *fs, const double *metric_scales, double *out);
+int features_parse(const char *s, feature_vec_t *fv);
+void feature_set_advance(const feature_set_t *fs, const double *cur, const feature_vec_t *x, const double *next, feature_vec_t *out);
+
+feature_stage_t* feature_stage_create(const feature_set_t *fs, const detect_set_t *ds, size_t max_streams);
+void feature_stage_free(feature_stage_t *fst);
+int feature_stage_line(feature_stage_t *fst, const char *line, rec_meta_t *meta, char *out, size_t out_len);
+int feature_stage_write(const feature_stage_t *fst, FILE *f);
+int feature_stage_read(feature_stage_t *fst, FILE *f);
+void *feature_thread(void *arg);
+
+#endif
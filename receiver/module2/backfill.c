@@ -0,0 +1,101 @@
+/*
+ * backfill.c
+ *
+ * Parallel rescoring of a history. The series is cut into chunks of
+ * BACKFILL_CHUNK samples that worker threads claim from a shared counter, so
+ * a slow thread only delays its own chunk. Every worker packs its own copy of
+ * the weights (nn_batch_create()) and turns its chunk into input features one
+ * tile at a time right before nn_batch_predict(), so each sample is read from
+ * memory once and the predictions are written once. Chunks are independent:
+ * the inputs are the raw metrics of each sample (the feature set of the
+ * offline tools), no state carries over from one sample to the next.
+ */
+
+#ifndef BACKFILL_C_HEADER
+#define BACKFILL_C_HEADER
+#include "backfill.h"
+#endif
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "../log.h"
+
+/**
+ * Work shared by the backfill threads.
+ *
+ * nn: model being scored
+ * dps, n: history
+ * out_raw: n * OUTPUT_SIZE predictions
+ * next: first sample of the next unclaimed chunk
+ * failed: set by a worker that could not allocate its batch state
+ */
+typedef struct {
+    const nn_t *nn;
+    const data_point_t *dps;
+    size_t n;
+    float *out_raw;
+    atomic_size_t next;
+    atomic_int failed;
+} backfill_job_t;
+
+/**
+ * Backfill thread: claim chunks until the history is exhausted.
+ *
+ * @param arg backfill_job_t
+ * @return NULL
+ */
+static void* backfill_worker(void *arg){
+    backfill_job_t *job = (backfill_job_t*)arg;
+    nn_batch_t *bt = nn_batch_create(job->nn);
+    if(!bt){ atomic_store(&job->failed, 1); return NULL; }
+    feature_vec_t xs[NN_BATCH_TILE];
+    while(1){
+        size_t from = atomic_fetch_add(&job->next, BACKFILL_CHUNK);
+        if(from >= job->n) break;
+        size_t to = job->n - from < BACKFILL_CHUNK ? job->n : from + BACKFILL_CHUNK;
+        for(size_t s=from; s<to; s+=NN_BATCH_TILE){
+            size_t rows = to - s < NN_BATCH_TILE ? to - s : NN_BATCH_TILE;
+            for(size_t r=0;r<rows;r++) features_from_datapoint(&job->dps[s + r], &xs[r]);
+            nn_batch_predict(bt, xs, rows, job->out_raw + s * OUTPUT_SIZE);
+        }
+    }
+    nn_batch_free(bt);
+    return NULL;
+}
+
+/**
+ * Predict every sample of a history with one model on several threads.
+ * The model must not be trained while the backfill runs.
+ *
+ * @param nn model (its input size must match the raw metrics, N_METRICS)
+ * @param dps history of n data points
+ * @param n number of data points
+ * @param out_raw receives n * OUTPUT_SIZE denormalized predictions, out_raw[i] from dps[i]
+ * @param n_threads worker threads (1..BACKFILL_MAX_THREADS, 1 = run on the caller)
+ * @return 0 on success, -1 on error
+ */
+int nn_backfill(const nn_t *nn, const data_point_t *dps, size_t n, float *out_raw, int n_threads){
+    if(n_threads < 1 || n_threads > BACKFILL_MAX_THREADS) return -1;
+    backfill_job_t job;
+    job.nn = nn;
+    job.dps = dps;
+    job.n = n;
+    job.out_raw = out_raw;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failed, 0);
+    pthread_t threads[BACKFILL_MAX_THREADS];
+    int started = 0;
+    for(int i=1;i<n_threads;i++){
+        if(pthread_create(&threads[started], NULL, backfill_worker, &job) != 0){
+            LOG_ERROR("[backfill] cannot start worker %d, continuing with %d\n", i, started + 1);
+            break;
+        }
+        started++;
+    }
+    backfill_worker(&job);
+    for(int i=0;i<started;i++) pthread_join(threads[i], NULL);
+    return atomic_load(&job.failed) ? -1 : 0;
+}
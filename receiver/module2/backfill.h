@@ -0,0 +1,23 @@
+/**
+ * backfill.h
+ *
+ * Declarations for the parallel backfill driver used in module2: rescoring a
+ * long history with one model on several threads.
+ */
+
+#ifndef BACKFILL_H
+#define BACKFILL_H
+
+#include <stddef.h>
+
+#include "nn.h"
+#include "../types.h"
+
+/** Samples a worker claims at a time. */
+#define BACKFILL_CHUNK 4096
+
+#define BACKFILL_MAX_THREADS 64
+
+int nn_backfill(const nn_t *nn, const data_point_t *dps, size_t n, float *out_raw, int n_threads);
+
+#endif
@@ -0,0 +1,587 @@
+/*
+ * federation.c
+ *
+ * Federated averaging of the shared model between analyzers. Every
+ * `--fed-interval` seconds the model's thread hands a copy of its weights and
+ * the number of samples it trained on since the last round to the
+ * federation thread, which:
+ *   - averages it with the latest weights of every live peer, weighted by the
+ *     samples each trained on (FedAvg), and hands the difference back; the
+ *     model's thread adds it to the network between two records, so
+ *     inference never waits for the network or the merge;
+ *   - sends its merged weights to the peers as updates of what they already
+ *     hold: the weights are cut into blocks of FED_BLOCK values, each block
+ *     is sent as an 8-bit quantized difference to the peers' copy with one
+ *     float scale. The quantization error stays in the difference and is
+ *     sent in a later round. Every `--fed-keyframe` rounds all blocks are
+ *     sent as absolute values, so a new peer or one that lost a datagram
+ *     gets a complete copy again.
+ * Sending is paced by a token bucket to `--fed-kbps`; a delta round only
+ * sends the blocks that changed most and fit into one interval's budget, and
+ * nothing once the models agree.
+ * A peer is used for averaging only while its copy is complete (no lost
+ * datagram since its last keyframe) and it was heard from within
+ * FED_STALE_INTERVALS intervals.
+ *
+ * Datagram: magic "FED1", sender node id, datagram sequence number, round,
+ * parameter count, samples (uint32 each, network order), flags and block
+ * count (uint16), then per block its index, scale (uint32) and FED_BLOCK
+ * int8 values. Peers must run the same topology; others are ignored, as are
+ * datagrams from an address and port not listed in `--fed-peers` and
+ * datagrams with a block scale that is not finite or above FED_SCALE_MAX.
+ */
+
+#ifndef FEDERATION_C_HEADER
+#define FEDERATION_C_HEADER
+#include "federation.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <sys/select.h>
+#include <netdb.h>
+#endif
+
+#include "../platform.h"
+#include "../common.h"
+#include "../log.h"
+#include "../memstat.h"
+
+#define FED_MAGIC 0x46454431u /* "FED1" */
+#define FED_BLOCK 64
+#define FED_BLOCKS_PER_DGRAM 16
+#define FED_HDR_BYTES 28
+#define FED_BLOCK_BYTES (8 + FED_BLOCK)
+#define FED_DGRAM_MAX (FED_HDR_BYTES + FED_BLOCKS_PER_DGRAM * FED_BLOCK_BYTES)
+#define FED_FLAG_KEY 1u
+#define FED_STALE_INTERVALS 3
+#define FED_MIN_CHANGE 1e-5 /* smaller block changes wait for the next keyframe */
+#define FED_POLL_MS 50
+#define FED_SCALE_MAX 1e12f /* largest block scale accepted, i.e. values up to about 1.3e14 */
+
+/**
+ * Copy of one peer's model.
+ *
+ * node: the peer's node id (0 = free slot)
+ * replica: the peer's weights as reconstructed from its datagrams
+ * stale: per block, non-zero until the block arrived in a keyframe after the last lost datagram
+ * n_stale: number of stale blocks (the copy is used only at 0)
+ * last_seq: sequence number of the last datagram
+ * samples: samples the peer trained on in its last round (its FedAvg weight)
+ * heard_ns: monotonic time of the last datagram
+ */
+typedef struct {
+    uint32_t node;
+    double *replica;
+    unsigned char *stale;
+    size_t n_stale;
+    uint32_t last_seq;
+    uint32_t samples;
+    long long heard_ns;
+} fed_peer_t;
+
+/**
+ * Federation state.
+ *
+ * n_params, n_blocks: model size in values / FED_BLOCK blocks
+ * sock: UDP socket bound to `--fed-port`
+ * dest, n_dest: peers updates are sent to
+ * node: this analyzer's node id
+ * interval_ns, rate, keyframe_every: round length, send rate in bytes/s, keyframe period in rounds
+ * m: protects the hand-off below
+ * snap, snap_samples, snap_ready: weights handed over by the model's thread for the next round
+ * corr, corr_ready: merge correction handed back to the model's thread
+ * stop: set by federation_free()
+ * work, last_round_ns, trained: model thread only
+ * the rest: federation thread only (mine: weights of the round; target: merged
+ * weights being sent; sent: what the peers hold of them; order, order_len,
+ * order_pos, key: blocks of the current round still to send; tokens,
+ * tokens_ns: send budget)
+ */
+struct federation_s {
+    size_t n_params, n_blocks;
+    socket_t sock;
+    struct sockaddr_in dest[FED_MAX_PEERS];
+    int n_dest;
+    uint32_t node;
+    long long interval_ns;
+    double rate;
+    int keyframe_every;
+    pthread_t thread;
+    int thread_started;
+
+    pthread_mutex_t m;
+    double *snap;
+    uint32_t snap_samples;
+    int snap_ready;
+    double *corr;
+    atomic_int corr_ready;
+    atomic_int stop;
+
+    double *work;
+    long long last_round_ns;
+    uint32_t trained;
+
+    fed_peer_t peers[FED_MAX_PEERS];
+    double *mine, *target, *sent;
+    uint32_t mine_samples;
+    uint32_t round, seq;
+    size_t *order, order_len, order_pos;
+    int key;
+    double tokens;
+    long long tokens_ns;
+};
+
+/**
+ * Resolve one `host:port` peer.
+ *
+ * @param spec peer text (not NUL-terminated at the end of the peer)
+ * @param len length of the peer text
+ * @param out receives the address (may be NULL)
+ * @return 0 on success, -1 when malformed or unknown
+ */
+static int fed_resolve(const char *spec, size_t len, struct sockaddr_in *out){
+    char host[256];
+    if(len == 0 || len >= sizeof(host)) return -1;
+    memcpy(host, spec, len);
+    host[len] = '\0';
+    char *colon = strrchr(host, ':');
+    if(!colon || colon == host || colon[1] == '\0') return -1;
+    *colon = '\0';
+    char *end = NULL;
+    long port = strtol(colon + 1, &end, 10);
+    if(*end != '\0' || port < 1 || port > 65535) return -1;
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if(getaddrinfo(host, colon + 1, &hints, &res) != 0 || !res) return -1;
+    if(out) memcpy(out, res->ai_addr, sizeof(*out));
+    freeaddrinfo(res);
+    return 0;
+}
+
+/**
+ * Parse a comma-separated list of `host:port` peers.
+ *
+ * @param spec peer list ("" = none)
+ * @param out receives up to FED_MAX_PEERS addresses (may be NULL)
+ * @return number of peers, -1 on a malformed or unknown peer or too many peers
+ */
+static int fed_parse_peers(const char *spec, struct sockaddr_in *out){
+    int n = 0;
+    const char *s = spec ? spec : "";
+    while(*s){
+        size_t len = strcspn(s, ",");
+        if(n >= FED_MAX_PEERS || fed_resolve(s, len, out ? &out[n] : NULL) != 0) return -1;
+        n++;
+        s += len;
+        if(*s == ',') s++;
+    }
+    return n;
+}
+
+/**
+ * Validate a `--fed-peers` list.
+ *
+ * @param peers comma-separated `host:port` list
+ * @return number of peers, -1 when invalid
+ */
+int federation_check_peers(const char *peers){
+    return fed_parse_peers(peers, NULL);
+}
+
+static void put_u32(unsigned char *p, uint32_t v){ v = htonl(v); memcpy(p, &v, 4); }
+static uint32_t get_u32(const unsigned char *p){ uint32_t v; memcpy(&v, p, 4); return ntohl(v); }
+
+/**
+ * Find the slot of a peer, taking a free or the longest silent slot for a new one.
+ */
+static fed_peer_t* fed_peer_slot(federation_t *fed, uint32_t node){
+    fed_peer_t *slot = NULL;
+    for(int i=0;i<FED_MAX_PEERS;i++) if(fed->peers[i].node == node) return &fed->peers[i];
+    for(int i=0;i<FED_MAX_PEERS && !slot;i++) if(fed->peers[i].node == 0) slot = &fed->peers[i];
+    if(!slot){
+        slot = &fed->peers[0];
+        for(int i=1;i<FED_MAX_PEERS;i++) if(fed->peers[i].heard_ns < slot->heard_ns) slot = &fed->peers[i];
+    }
+    if(!slot->replica){
+        slot->replica = (double*)mem_calloc(MEM_NN, fed->n_params, sizeof(double));
+        slot->stale = (unsigned char*)mem_alloc(MEM_NN, fed->n_blocks);
+        if(!slot->replica || !slot->stale){ mem_free(slot->replica); mem_free(slot->stale); slot->replica = NULL; slot->stale = NULL; return NULL; }
+    }
+    slot->node = node;
+    memset(slot->stale, 1, fed->n_blocks);
+    slot->n_stale = fed->n_blocks;
+    slot->samples = 0;
+    return slot;
+}
+
+/**
+ * Check that a datagram comes from one of the `--fed-peers`.
+ *
+ * @param fed federation
+ * @param from sender address
+ * @return non-zero for a configured peer
+ */
+static int fed_is_peer(const federation_t *fed, const struct sockaddr_in *from){
+    for(int i=0;i<fed->n_dest;i++)
+        if(fed->dest[i].sin_addr.s_addr == from->sin_addr.s_addr && fed->dest[i].sin_port == from->sin_port) return 1;
+    return 0;
+}
+
+/**
+ * Get the scale of a block, rejecting values that would poison the copy.
+ *
+ * @param b block
+ * @param scale receives the scale
+ * @return 0 on success, -1 when the scale is not finite, negative or above FED_SCALE_MAX
+ */
+static int fed_block_scale(const unsigned char *b, float *scale){
+    uint32_t bits = get_u32(b + 4);
+    memcpy(scale, &bits, sizeof(*scale));
+    return isfinite(*scale) && *scale >= 0.0f && *scale <= FED_SCALE_MAX ? 0 : -1;
+}
+
+/**
+ * Apply one received datagram to the sender's copy. A datagram with an
+ * invalid block is dropped as a whole, so the copy waits for the next
+ * keyframe as after a lost datagram.
+ *
+ * @param fed federation
+ * @param buf datagram
+ * @param len datagram length
+ */
+static void fed_receive(federation_t *fed, const unsigned char *buf, size_t len){
+    if(len < FED_HDR_BYTES || get_u32(buf) != FED_MAGIC) return;
+    uint32_t node = get_u32(buf + 4), seq = get_u32(buf + 8);
+    uint32_t n_params = get_u32(buf + 16), samples = get_u32(buf + 20);
+    unsigned flags = ((unsigned)buf[24] << 8) | buf[25];
+    size_t nb = ((size_t)buf[26] << 8) | buf[27];
+    if(node == fed->node || node == 0 || len != FED_HDR_BYTES + nb * FED_BLOCK_BYTES) return;
+    if(n_params != fed->n_params){
+        LOG_ERROR("[fed] ignoring node %08x: %u parameters, expected %zu\n", node, n_params, fed->n_params);
+        return;
+    }
+    float scale;
+    for(size_t k=0;k<nb;k++){
+        if(fed_block_scale(buf + FED_HDR_BYTES + k * FED_BLOCK_BYTES, &scale) != 0){
+            LOG_WARN("[fed] ignoring a datagram of node %08x with block scale %g\n", node, (double)scale);
+            return;
+        }
+    }
+    int known = 0;
+    for(int i=0;i<FED_MAX_PEERS;i++) if(fed->peers[i].node == node) known = 1;
+    fed_peer_t *p = fed_peer_slot(fed, node);
+    if(!p) return;
+    /* a lost datagram leaves unknown blocks behind: wait for the next keyframe */
+    if(known && seq != p->last_seq + 1){
+        memset(p->stale, 1, fed->n_blocks);
+        p->n_stale = fed->n_blocks;
+    }
+    p->last_seq = seq;
+    p->samples = samples;
+    p->heard_ns = platform_monotonic_ns();
+    const unsigned char *b = buf + FED_HDR_BYTES;
+    for(size_t k=0;k<nb;k++, b += FED_BLOCK_BYTES){
+        uint32_t idx = get_u32(b);
+        if(idx >= fed->n_blocks) continue;
+        fed_block_scale(b, &scale);
+        double *r = p->replica + (size_t)idx * FED_BLOCK;
+        size_t cnt = fed->n_params - (size_t)idx * FED_BLOCK < FED_BLOCK ? fed->n_params - (size_t)idx * FED_BLOCK : FED_BLOCK;
+        for(size_t i=0;i<cnt;i++){
+            double v = (double)(int8_t)b[8 + i] * (double)scale;
+            if(flags & FED_FLAG_KEY) r[i] = v;
+            else r[i] += v;
+        }
+        if((flags & FED_FLAG_KEY) && p->stale[idx]){ p->stale[idx] = 0; p->n_stale--; }
+    }
+    stats_record_federation(0, (long long)len, 0, 0, -1);
+}
+
+/**
+ * Quantize one block of the current round into a datagram and update what
+ * the peers will hold.
+ *
+ * @param fed federation
+ * @param idx block index
+ * @param out FED_BLOCK_BYTES bytes
+ */
+static void fed_encode_block(federation_t *fed, size_t idx, unsigned char *out){
+    size_t off = idx * FED_BLOCK;
+    size_t cnt = fed->n_params - off < FED_BLOCK ? fed->n_params - off : FED_BLOCK;
+    double d[FED_BLOCK], maxabs = 0.0;
+    for(size_t i=0;i<cnt;i++){
+        d[i] = fed->key ? fed->target[off + i] : fed->target[off + i] - fed->sent[off + i];
+        if(fabs(d[i]) > maxabs) maxabs = fabs(d[i]);
+    }
+    float scale = (float)(maxabs / 127.0);
+    uint32_t bits;
+    memcpy(&bits, &scale, sizeof(bits));
+    put_u32(out, (uint32_t)idx);
+    put_u32(out + 4, bits);
+    memset(out + 8, 0, FED_BLOCK);
+    for(size_t i=0;i<cnt;i++){
+        long q = scale > 0.0f ? lrint(d[i] / (double)scale) : 0;
+        if(q > 127) q = 127;
+        if(q < -127) q = -127;
+        out[8 + i] = (unsigned char)(int8_t)q;
+        double v = (double)q * (double)scale;
+        if(fed->key) fed->sent[off + i] = v;
+        else fed->sent[off + i] += v;
+    }
+}
+
+/**
+ * Send the next datagram of the current round to every peer if the token
+ * bucket allows.
+ *
+ * @return 1 when a datagram was sent, 0 otherwise
+ */
+static int fed_send_next(federation_t *fed){
+    if(fed->order_pos >= fed->order_len || fed->n_dest == 0) return 0;
+    size_t nb = fed->order_len - fed->order_pos;
+    if(nb > FED_BLOCKS_PER_DGRAM) nb = FED_BLOCKS_PER_DGRAM;
+    size_t len = FED_HDR_BYTES + nb * FED_BLOCK_BYTES;
+    double cost = (double)(len * (size_t)fed->n_dest);
+    long long now = platform_monotonic_ns();
+    fed->tokens += fed->rate * (double)(now - fed->tokens_ns) / 1e9;
+    fed->tokens_ns = now;
+    double cap = (double)(FED_DGRAM_MAX * fed->n_dest) * 2.0;
+    if(fed->tokens > cap) fed->tokens = cap;
+    if(fed->tokens < cost) return 0;
+    fed->tokens -= cost;
+    unsigned char buf[FED_DGRAM_MAX];
+    put_u32(buf, FED_MAGIC);
+    put_u32(buf + 4, fed->node);
+    put_u32(buf + 8, ++fed->seq);
+    put_u32(buf + 12, fed->round);
+    put_u32(buf + 16, (uint32_t)fed->n_params);
+    put_u32(buf + 20, fed->mine_samples);
+    buf[24] = 0;
+    buf[25] = fed->key ? FED_FLAG_KEY : 0;
+    buf[26] = (unsigned char)(nb >> 8);
+    buf[27] = (unsigned char)(nb & 0xff);
+    for(size_t k=0;k<nb;k++) fed_encode_block(fed, fed->order[fed->order_pos++], buf + FED_HDR_BYTES + k * FED_BLOCK_BYTES);
+    for(int i=0;i<fed->n_dest;i++)
+        sendto(fed->sock, (const char*)buf, (int)len, 0, (const struct sockaddr*)&fed->dest[i], sizeof(fed->dest[i]));
+    stats_record_federation((long long)cost, 0, 0, 0, -1);
+    if(fed->order_pos >= fed->order_len) fed->key = 0;
+    return 1;
+}
+
+static const double *g_fed_mag;
+
+/** Order blocks by decreasing change. */
+static int fed_mag_cmp(const void *a, const void *b){
+    double x = g_fed_mag[*(const size_t*)a], y = g_fed_mag[*(const size_t*)b];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/**
+ * Run one round: merge the handed-over weights with the live peers, hand
+ * the correction back and plan which blocks to send.
+ *
+ * @param fed federation
+ */
+static void fed_round(federation_t *fed){
+    fed->round++;
+    long long now = platform_monotonic_ns();
+    double wsum = (double)fed->mine_samples;
+    int used = 0, live = 0;
+    for(size_t i=0;i<fed->n_params;i++) fed->target[i] = wsum * fed->mine[i];
+    for(int k=0;k<FED_MAX_PEERS;k++){
+        const fed_peer_t *p = &fed->peers[k];
+        if(!p->node || now - p->heard_ns > FED_STALE_INTERVALS * fed->interval_ns) continue;
+        live++;
+        if(p->n_stale > 0 || p->samples == 0) continue;
+        for(size_t i=0;i<fed->n_params;i++) fed->target[i] += (double)p->samples * p->replica[i];
+        wsum += (double)p->samples;
+        used++;
+    }
+    if(used > 0 && wsum > 0.0){
+        for(size_t i=0;i<fed->n_params;i++) fed->target[i] /= wsum;
+        pthread_mutex_lock(&fed->m);
+        for(size_t i=0;i<fed->n_params;i++) fed->corr[i] = fed->target[i] - fed->mine[i];
+        atomic_store(&fed->corr_ready, 1);
+        pthread_mutex_unlock(&fed->m);
+    } else {
+        memcpy(fed->target, fed->mine, sizeof(double) * fed->n_params);
+    }
+    stats_record_federation(0, 0, 1, used, live);
+
+    if(fed->n_dest == 0){ fed->order_len = fed->order_pos = 0; return; }
+    /* an unfinished keyframe is finished before deltas go out again */
+    if(fed->key && fed->order_pos < fed->order_len) return;
+    if(fed->keyframe_every <= 1 || (fed->round - 1) % (uint32_t)fed->keyframe_every == 0) fed->key = 1;
+    fed->order_pos = 0;
+    if(fed->key){
+        for(size_t b=0;b<fed->n_blocks;b++) fed->order[b] = b;
+        fed->order_len = fed->n_blocks;
+        return;
+    }
+    double *mag = fed->mine; /* no longer needed this round */
+    fed->order_len = 0;
+    for(size_t b=0;b<fed->n_blocks;b++){
+        double m = 0.0;
+        for(size_t i=b*FED_BLOCK; i<(b+1)*FED_BLOCK && i<fed->n_params; i++){
+            double d = fabs(fed->target[i] - fed->sent[i]);
+            if(d > m) m = d;
+        }
+        mag[b] = m;
+        if(m >= FED_MIN_CHANGE) fed->order[fed->order_len++] = b;
+    }
+    g_fed_mag = mag;
+    qsort(fed->order, fed->order_len, sizeof(size_t), fed_mag_cmp);
+    /* one interval's worth of the bandwidth budget; the rest stays in the difference */
+    double budget = fed->rate * (double)fed->interval_ns / 1e9 / (double)(fed->n_dest > 0 ? fed->n_dest : 1);
+    size_t max_blocks = (size_t)(budget / (FED_BLOCK_BYTES + (double)FED_HDR_BYTES / FED_BLOCKS_PER_DGRAM));
+    if(fed->order_len > max_blocks) fed->order_len = max_blocks;
+}
+
+/**
+ * Federation thread: receive peer updates, run rounds and pace the sends.
+ *
+ * @param arg federation_t
+ * @return NULL
+ */
+static void* fed_thread(void *arg){
+    federation_t *fed = (federation_t*)arg;
+    unsigned char buf[FED_DGRAM_MAX + 64];
+    while(!atomic_load(&fed->stop)){
+        int wait_ms = fed->order_pos < fed->order_len ? 2 : FED_POLL_MS;
+        fd_set rd;
+        FD_ZERO(&rd);
+        FD_SET(fed->sock, &rd);
+        struct timeval tv = { 0, wait_ms * 1000 };
+        if(select((int)fed->sock + 1, &rd, NULL, NULL, &tv) > 0 && FD_ISSET(fed->sock, &rd)){
+            struct sockaddr_in from;
+            socklen_t flen = sizeof(from);
+            int n = (int)recvfrom(fed->sock, (char*)buf, (int)sizeof(buf), 0, (struct sockaddr*)&from, &flen);
+            if(n > 0 && flen >= (socklen_t)sizeof(from) && from.sin_family == AF_INET && fed_is_peer(fed, &from)) fed_receive(fed, buf, (size_t)n);
+        }
+        int ready = 0;
+        pthread_mutex_lock(&fed->m);
+        if(fed->snap_ready){
+            memcpy(fed->mine, fed->snap, sizeof(double) * fed->n_params);
+            fed->mine_samples = fed->snap_samples;
+            fed->snap_ready = 0;
+            ready = 1;
+        }
+        pthread_mutex_unlock(&fed->m);
+        if(ready) fed_round(fed);
+        while(fed_send_next(fed)) {}
+    }
+    return NULL;
+}
+
+/**
+ * Start federation for a model.
+ *
+ * @param nn model whose weights are exchanged (only its size is read here)
+ * @param port UDP port to receive peer updates on
+ * @param peers comma-separated `host:port` peers updates are sent to ("" = receive only)
+ * @param interval_s seconds between rounds
+ * @param kbps send budget in kilobytes per second (all peers together)
+ * @param keyframe_every rounds between full copies
+ * @return federation or NULL on error
+ */
+federation_t* federation_create(const nn_t *nn, int port, const char *peers, double interval_s, double kbps, int keyframe_every){
+    if(port < 1 || port > 65535 || !(interval_s > 0.0) || !(kbps > 0.0) || keyframe_every < 1) return NULL;
+    federation_t *fed = (federation_t*)mem_calloc(MEM_NN, 1, sizeof(federation_t));
+    if(!fed) return NULL;
+    fed->sock = INVALID_SOCKET;
+    pthread_mutex_init(&fed->m, NULL);
+    fed->n_params = nn_param_count(nn);
+    fed->n_blocks = (fed->n_params + FED_BLOCK - 1) / FED_BLOCK;
+    fed->interval_ns = (long long)(interval_s * 1e9);
+    fed->rate = kbps * 1000.0;
+    fed->keyframe_every = keyframe_every;
+    fed->node = (uint32_t)(platform_monotonic_ns() ^ ((long long)time(NULL) * 2654435761LL) ^ (long long)(uintptr_t)fed) | 1u;
+    fed->n_dest = fed_parse_peers(peers, fed->dest);
+    if(fed->n_dest < 0){ LOG_ERROR("[fed] invalid peer list '%s'\n", peers); federation_free(fed); return NULL; }
+    size_t n = fed->n_params;
+    fed->snap = (double*)mem_calloc(MEM_NN, n, sizeof(double));
+    fed->corr = (double*)mem_calloc(MEM_NN, n, sizeof(double));
+    fed->work = (double*)mem_calloc(MEM_NN, n, sizeof(double));
+    fed->mine = (double*)mem_calloc(MEM_NN, n > fed->n_blocks ? n : fed->n_blocks, sizeof(double));
+    fed->target = (double*)mem_calloc(MEM_NN, n, sizeof(double));
+    fed->sent = (double*)mem_calloc(MEM_NN, n, sizeof(double));
+    fed->order = (size_t*)mem_calloc(MEM_NN, fed->n_blocks, sizeof(size_t));
+    if(!fed->snap || !fed->corr || !fed->work || !fed->mine || !fed->target || !fed->sent || !fed->order){ federation_free(fed); return NULL; }
+    fed->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in me;
+    memset(&me, 0, sizeof(me));
+    me.sin_family = AF_INET;
+    me.sin_port = htons((unsigned short)port);
+    me.sin_addr.s_addr = INADDR_ANY;
+    if(fed->sock == INVALID_SOCKET || bind(fed->sock, (struct sockaddr*)&me, sizeof(me)) < 0){
+        LOG_ERROR("[fed] cannot bind UDP port %d\n", port);
+        federation_free(fed);
+        return NULL;
+    }
+    fed->last_round_ns = fed->tokens_ns = platform_monotonic_ns();
+    if(pthread_create(&fed->thread, NULL, fed_thread, fed) != 0){ federation_free(fed); return NULL; }
+    fed->thread_started = 1;
+    LOG_INFO("[fed] node %08x on UDP port %d, %d peers, %zu parameters, round %.1f s, %.1f kB/s\n",
+             fed->node, port, fed->n_dest, fed->n_params, interval_s, kbps);
+    return fed;
+}
+
+void federation_free(federation_t *fed){
+    if(!fed) return;
+    atomic_store(&fed->stop, 1);
+    if(fed->thread_started) pthread_join(fed->thread, NULL);
+    if(fed->sock != INVALID_SOCKET) CLOSESOCKET(fed->sock);
+    for(int i=0;i<FED_MAX_PEERS;i++){ mem_free(fed->peers[i].replica); mem_free(fed->peers[i].stale); }
+    mem_free(fed->snap);
+    mem_free(fed->corr);
+    mem_free(fed->work);
+    mem_free(fed->mine);
+    mem_free(fed->target);
+    mem_free(fed->sent);
+    mem_free(fed->order);
+    pthread_mutex_destroy(&fed->m);
+    mem_free(fed);
+}
+
+/**
+ * Called by the model's thread after every record and while it is idle:
+ * apply a finished merge and, once per interval, hand the weights over for
+ * the next round. Never waits: when the federation thread holds the lock,
+ * the step is retried on the next call.
+ *
+ * @param fed federation
+ * @param nn the federated model
+ * @param trained 1 when the record was used for training (0 when idle)
+ */
+void federation_tick(federation_t *fed, nn_t *nn, int trained){
+    fed->trained += (uint32_t)trained;
+    int merge = atomic_load(&fed->corr_ready);
+    long long now = platform_monotonic_ns();
+    int round = now - fed->last_round_ns >= fed->interval_ns;
+    if(!merge && !round) return;
+    if(pthread_mutex_trylock(&fed->m) != 0) return;
+    if(merge){
+        /* add the merge to the current weights, keeping what was trained since the snapshot */
+        nn_export_params(nn, fed->work);
+        for(size_t i=0;i<fed->n_params;i++) fed->work[i] += fed->corr[i];
+        nn_import_params(nn, fed->work);
+        atomic_store(&fed->corr_ready, 0);
+    }
+    if(round && !fed->snap_ready){
+        nn_export_params(nn, fed->snap);
+        fed->snap_samples = fed->trained;
+        fed->snap_ready = 1;
+        fed->trained = 0;
+        fed->last_round_ns = now;
+    }
+    pthread_mutex_unlock(&fed->m);
+}
@@ -0,0 +1,26 @@
+/**
+ * federation.h
+ *
+ * Declarations for the federated model averaging used in module2. Analyzers
+ * that learn the same traffic exchange compressed weight updates over UDP and
+ * merge their shared models by weighted averaging (FedAvg).
+ */
+
+#ifndef FEDERATION_H
+#define FEDERATION_H
+
+#include <stddef.h>
+
+#include "nn.h"
+
+/** Largest number of peers in `--fed-peers`. */
+#define FED_MAX_PEERS 16
+
+typedef struct federation_s federation_t;
+
+federation_t* federation_create(const nn_t *nn, int port, const char *peers, double interval_s, double kbps, int keyframe_every);
+void federation_free(federation_t *fed);
+void federation_tick(federation_t *fed, nn_t *nn, int trained);
+int federation_check_peers(const char *peers);
+
+#endif
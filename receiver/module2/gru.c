@@ -0,0 +1,407 @@
+/*
+ * gru.c
+ *
+ * Single-layer GRU with a linear output head. Inference costs one cell
+ * update per datapoint: the stream's hidden state summarizes the whole
+ * history, so no input window has to be rebuilt. Every step is cached in a
+ * small ring so training can backpropagate through the last `window` steps
+ * (truncated BPTT) at a bounded cost.
+ *
+ *   z = sigmoid(Wz [x; h] + bz)          update gate
+ *   r = sigmoid(Wr [x; h] + br)          reset gate
+ *   c = tanh(Wh [x; r*h] + bh)           candidate
+ *   h' = (1 - z) * h + z * c
+ *   y = Wo h' + bo                       normalized prediction of the next sample
+ */
+
+#ifndef GRU_C_HEADER
+#define GRU_C_HEADER
+#include "gru.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "util.h"
+#include "norm.h"
+#include "../memstat.h"
+
+#define GRU_MAGIC 0x31555247u /* "GRU1" */
+#define GRU_CLIP_NORM 5.0
+
+/**
+ * GRU model structure definition.
+ *
+ * params: normalization offsets / scales and learning rate
+ * norm: streaming statistics behind the offsets / scales
+ * I, H, O: input, hidden and output sizes
+ * window: number of steps backpropagated by gru_stream_train_prev()
+ * n_params: length of `p` and `grad`
+ * p: all parameters (Wz, Wr, Wh, bz, br, bh, Wo, bo)
+ * grad: gradient accumulator of the same layout
+ * scratch: 3H doubles of BPTT work space
+ * Wz, Wr, Wh, bz, br, bh, Wo, bo: views into `p` (gates are H x (I+H) row-major)
+ */
+struct gru_s {
+    nn_params_t params;
+    norm_state_t norm;
+    size_t I, H, O;
+    size_t window;
+    size_t n_params;
+    double *p;
+    double *grad;
+    double *scratch;
+    double *Wz, *Wr, *Wh, *bz, *br, *bh, *Wo, *bo;
+};
+
+/**
+ * Per-stream state.
+ *
+ * h: current hidden state (H)
+ * steps: ring of cached steps, each I + 5H doubles: x, h_prev, z, r, c, h
+ * cap: ring capacity (window + 1)
+ * newest: ring index of the most recent step
+ * count: number of valid steps
+ */
+struct gru_stream_s {
+    double *h;
+    double *steps;
+    size_t cap;
+    size_t newest;
+    size_t count;
+};
+
+static double sigm(double v){ return 1.0 / (1.0 + exp(-v)); }
+
+static size_t gru_step_len(const gru_t *g){ return g->I + 5 * g->H; }
+
+static double* gru_step_at(const gru_t *g, const gru_stream_t *s, size_t back){
+    size_t idx = (s->newest + s->cap - back) % s->cap;
+    return s->steps + idx * gru_step_len(g);
+}
+
+/**
+ * Point the named views at their slices of a parameter array.
+ */
+static void gru_bind(gru_t *g, double *base, double **Wz, double **Wr, double **Wh, double **bz, double **br, double **bh, double **Wo, double **bo){
+    size_t gate = g->H * (g->I + g->H);
+    *Wz = base; *Wr = *Wz + gate; *Wh = *Wr + gate;
+    *bz = *Wh + gate; *br = *bz + g->H; *bh = *br + g->H;
+    *Wo = *bh + g->H; *bo = *Wo + g->O * g->H;
+}
+
+/**
+ * Create a GRU model with random weights.
+ *
+ * @param params input size, scales and learning rate (the MLP layer fields are ignored)
+ * @param hidden hidden state size
+ * @param window truncated BPTT length in steps (at least 1)
+ * @return allocated model or NULL on error
+ */
+gru_t* gru_create(const nn_params_t *params, size_t hidden, size_t window){
+    if(hidden == 0 || hidden > GRU_HIDDEN_MAX || window > GRU_WINDOW_MAX || params->input_size == 0 || params->input_size > FEATURE_MAX) return NULL;
+    gru_t *g = (gru_t*)mem_calloc(MEM_NN, 1, sizeof(gru_t));
+    if(!g) return NULL;
+    g->params = *params;
+    norm_state_init(&g->norm);
+    g->I = params->input_size; g->H = hidden; g->O = OUTPUT_SIZE;
+    g->window = window ? window : 1;
+    g->n_params = 3 * g->H * (g->I + g->H) + 3 * g->H + g->O * g->H + g->O;
+    g->p = (double*)mem_alloc(MEM_NN, sizeof(double) * g->n_params);
+    g->grad = (double*)mem_alloc(MEM_NN, sizeof(double) * g->n_params);
+    g->scratch = (double*)mem_alloc(MEM_NN, sizeof(double) * 3 * g->H);
+    if(!g->p || !g->grad || !g->scratch){ gru_free(g); return NULL; }
+    double a = 1.0 / sqrt((double)g->H);
+    for(size_t i=0;i<g->n_params;i++) g->p[i] = ((double)rand() / (double)RAND_MAX * 2.0 - 1.0) * a;
+    gru_bind(g, g->p, &g->Wz, &g->Wr, &g->Wh, &g->bz, &g->br, &g->bh, &g->Wo, &g->bo);
+    for(size_t i=0;i<g->H;i++){ g->bz[i] = 0.0; g->br[i] = 0.0; g->bh[i] = 0.0; }
+    for(size_t i=0;i<g->O;i++) g->bo[i] = 0.0;
+    return g;
+}
+
+void gru_free(gru_t *g){
+    if(!g) return;
+    mem_free(g->p);
+    mem_free(g->grad);
+    mem_free(g->scratch);
+    mem_free(g);
+}
+
+size_t gru_param_count(const gru_t *g){
+    return g->n_params;
+}
+
+/**
+ * Save the parameters: magic, I, H, O (uint32 each) followed by the doubles
+ * and the normalization block (see norm_write()).
+ *
+ * @param g model
+ * @param filename path of the weight file
+ * @return 0 on success, -1 on error
+ */
+int gru_save(const gru_t *g, const char *filename){
+    FILE *f = fopen(filename, "wb");
+    if(!f) return -1;
+    uint32_t hdr[4] = { GRU_MAGIC, (uint32_t)g->I, (uint32_t)g->H, (uint32_t)g->O };
+    int ok = fwrite(hdr, sizeof(hdr), 1, f) == 1 && fwrite(g->p, sizeof(double), g->n_params, f) == g->n_params
+          && norm_write(f, &g->norm, &g->params) == 0;
+    if(fclose(f) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+/**
+ * Load parameters saved by gru_save() when the shapes match.
+ *
+ * @param g model
+ * @param filename path of the weight file
+ * @return 0 on success, -1 when missing or incompatible
+ */
+int gru_load(gru_t *g, const char *filename){
+    FILE *f = fopen(filename, "rb");
+    if(!f) return -1;
+    uint32_t hdr[4];
+    int ok = fread(hdr, sizeof(hdr), 1, f) == 1 && hdr[0] == GRU_MAGIC
+          && hdr[1] == g->I && hdr[2] == g->H && hdr[3] == g->O;
+    double *tmp = ok ? (double*)mem_alloc(MEM_NN, sizeof(double) * g->n_params) : NULL;
+    ok = ok && tmp && fread(tmp, sizeof(double), g->n_params, f) == g->n_params;
+    if(ok){
+        memcpy(g->p, tmp, sizeof(double) * g->n_params);
+        /* optional: files written before streaming normalization end here */
+        norm_read(f, &g->norm, &g->params);
+    }
+    mem_free(tmp);
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+/**
+ * Feed one sample to the model's streaming normalization (see norm.c).
+ *
+ * @param g model
+ * @param in input features of the sample (raw values)
+ * @param target_raw raw metrics of the sample (length OUTPUT_SIZE)
+ */
+void gru_observe(gru_t *g, const feature_vec_t *in, const float *target_raw){
+    norm_observe(&g->norm, &g->params, in, target_raw);
+}
+
+/**
+ * Create the state of a new stream (zero hidden state, empty history).
+ *
+ * @param g model the stream belongs to
+ * @return allocated stream or NULL on error
+ */
+gru_stream_t* gru_stream_create(const gru_t *g){
+    gru_stream_t *s = (gru_stream_t*)mem_calloc(MEM_NN, 1, sizeof(gru_stream_t));
+    if(!s) return NULL;
+    s->cap = g->window + 1;
+    s->h = (double*)mem_calloc(MEM_NN, g->H, sizeof(double));
+    s->steps = (double*)mem_alloc(MEM_NN, sizeof(double) * s->cap * gru_step_len(g));
+    if(!s->h || !s->steps){ gru_stream_free(s); return NULL; }
+    s->newest = s->cap - 1;
+    return s;
+}
+
+void gru_stream_free(gru_stream_t *s){
+    if(!s) return;
+    mem_free(s->h);
+    mem_free(s->steps);
+    mem_free(s);
+}
+
+/**
+ * Memory of one stream's state in bytes.
+ */
+size_t gru_stream_bytes(const gru_t *g){
+    return sizeof(gru_stream_t) + sizeof(double) * (g->H + (g->window + 1) * gru_step_len(g));
+}
+
+/**
+ * Linear output head: y = Wo h + bo.
+ */
+static void gru_head(const gru_t *g, const double *h, double *y){
+    for(size_t o=0;o<g->O;o++){
+        const double *w = g->Wo + o * g->H;
+        double v = g->bo[o];
+        for(size_t k=0;k<g->H;k++) v += w[k] * h[k];
+        y[o] = v;
+    }
+}
+
+/**
+ * One GRU cell update: gates, candidate and new hidden state.
+ *
+ * @param g model
+ * @param x normalized input (I)
+ * @param hp hidden state before the step (H)
+ * @param z, r, c receive the gate and candidate activations (H each)
+ * @param h receives the hidden state after the step (H)
+ */
+static void gru_cell(const gru_t *g, const double *x, const double *hp, double *z, double *r, double *c, double *h){
+    size_t I = g->I, H = g->H, IH = I + H;
+    for(size_t j=0;j<H;j++){
+        const double *wz = g->Wz + j * IH, *wr = g->Wr + j * IH;
+        double az = g->bz[j], ar = g->br[j];
+        for(size_t i=0;i<I;i++){ az += wz[i] * x[i]; ar += wr[i] * x[i]; }
+        for(size_t k=0;k<H;k++){ az += wz[I+k] * hp[k]; ar += wr[I+k] * hp[k]; }
+        z[j] = sigm(az);
+        r[j] = sigm(ar);
+    }
+    for(size_t j=0;j<H;j++){
+        const double *wh = g->Wh + j * IH;
+        double ac = g->bh[j];
+        for(size_t i=0;i<I;i++) ac += wh[i] * x[i];
+        for(size_t k=0;k<H;k++) ac += wh[I+k] * r[k] * hp[k];
+        c[j] = tanh(ac);
+        h[j] = (1.0 - z[j]) * hp[j] + z[j] * c[j];
+    }
+}
+
+/**
+ * Advance a stream by one datapoint (one cell update) and predict the next
+ * datapoint.
+ *
+ * @param g model
+ * @param s stream state
+ * @param in features of the new datapoint (raw values)
+ * @param out_raw prediction of the next datapoint (length OUTPUT_SIZE, raw values)
+ */
+void gru_stream_step(const gru_t *g, gru_stream_t *s, const feature_vec_t *in, float *out_raw){
+    size_t I = g->I, H = g->H;
+    s->newest = (s->newest + 1) % s->cap;
+    if(s->count < s->cap) s->count++;
+    double *st = gru_step_at(g, s, 0);
+    double *x = st, *hp = x + I, *z = hp + H, *r = z + H, *c = r + H, *h = c + H;
+    normalize_input(&g->params, in, x);
+    memcpy(hp, s->h, sizeof(double) * H);
+    gru_cell(g, x, hp, z, r, c, h);
+    memcpy(s->h, h, sizeof(double) * H);
+    double y[OUTPUT_SIZE];
+    gru_head(g, h, y);
+    denormalize_output(&g->params, y, out_raw);
+}
+
+/**
+ * Hidden state of a stream after its newest step.
+ *
+ * @param s stream state
+ * @return hidden state (gru_hidden_size() doubles)
+ */
+const double* gru_stream_hidden(const gru_stream_t *s){
+    return s->h;
+}
+
+size_t gru_hidden_size(const gru_t *g){
+    return g->H;
+}
+
+/**
+ * Doubles of work space gru_rollout_step() needs.
+ */
+size_t gru_rollout_work_len(const gru_t *g){
+    return g->I + 3 * g->H;
+}
+
+/**
+ * One cell update on a detached hidden state, for rollouts over hypothetical
+ * future inputs: nothing of the stream (or its BPTT history) is touched.
+ *
+ * @param g model
+ * @param h_in hidden state before the step
+ * @param in features of the (predicted) datapoint (raw values)
+ * @param h_out receives the hidden state after the step (may not alias `h_in`)
+ * @param work gru_rollout_work_len() doubles of work space
+ * @param out_raw prediction of the datapoint after `in` (length OUTPUT_SIZE, raw values)
+ */
+void gru_rollout_step(const gru_t *g, const double *h_in, const feature_vec_t *in, double *h_out, double *work, float *out_raw){
+    double *x = work, *z = x + g->I, *r = z + g->H, *c = r + g->H;
+    normalize_input(&g->params, in, x);
+    gru_cell(g, x, h_in, z, r, c, h_out);
+    double y[OUTPUT_SIZE];
+    gru_head(g, h_out, y);
+    denormalize_output(&g->params, y, out_raw);
+}
+
+/**
+ * Train the prediction made at the step before the newest one (the one
+ * that predicted the newest datapoint) with truncated BPTT over at most
+ * `window` cached steps. Gradients are clipped to a global norm of 5.
+ *
+ * Not reentrant for the same model: the gradient buffer is shared.
+ *
+ * @param g model
+ * @param s stream state
+ * @param target_raw actual values of the newest datapoint (length OUTPUT_SIZE)
+ * @return Euclidean cost (normalized domain) before the update, NaN when the stream has no earlier step
+ */
+double gru_stream_train_prev(gru_t *g, gru_stream_t *s, const float *target_raw){
+    if(s->count < 2) return NAN;
+    size_t I = g->I, H = g->H, IH = I + H;
+    double *dWz, *dWr, *dWh, *dbz, *dbr, *dbh, *dWo, *dbo;
+    memset(g->grad, 0, sizeof(double) * g->n_params);
+    gru_bind(g, g->grad, &dWz, &dWr, &dWh, &dbz, &dbr, &dbh, &dWo, &dbo);
+
+    /* loss at step T = newest - 1 */
+    const double *sT = gru_step_at(g, s, 1);
+    const double *hT = sT + I + 4 * H;
+    double y[OUTPUT_SIZE], dy[OUTPUT_SIZE], t[OUTPUT_SIZE];
+    gru_head(g, hT, y);
+    normalize_target(&g->params, target_raw, t);
+    double sum_sq = 0.0;
+    for(size_t o=0;o<g->O;o++){
+        dy[o] = y[o] - t[o];
+        sum_sq += dy[o] * dy[o];
+    }
+    /* dh: gradient w.r.t. the hidden state after the step, dhp: before it, drh: w.r.t. r*h_prev */
+    double *dh_v = g->scratch, *dhp_v = dh_v + H, *drh_v = dh_v + 2 * H;
+    for(size_t k=0;k<H;k++) dh_v[k] = 0.0;
+    for(size_t o=0;o<g->O;o++){
+        dbo[o] += dy[o];
+        for(size_t k=0;k<H;k++){ dWo[o * H + k] += dy[o] * hT[k]; dh_v[k] += g->Wo[o * H + k] * dy[o]; }
+    }
+
+    size_t steps = s->count - 1;
+    if(steps > g->window) steps = g->window;
+    for(size_t back=1; back<=steps; back++){
+        const double *st = gru_step_at(g, s, back);
+        const double *x = st, *hp = x + I, *z = hp + H, *r = z + H, *c = r + H;
+        for(size_t k=0;k<H;k++){ dhp_v[k] = dh_v[k] * (1.0 - z[k]); drh_v[k] = 0.0; }
+        /* candidate */
+        for(size_t j=0;j<H;j++){
+            double dac = dh_v[j] * z[j] * (1.0 - c[j] * c[j]);
+            dbh[j] += dac;
+            double *dw = dWh + j * IH;
+            const double *w = g->Wh + j * IH;
+            for(size_t i=0;i<I;i++) dw[i] += dac * x[i];
+            for(size_t k=0;k<H;k++){ dw[I+k] += dac * r[k] * hp[k]; drh_v[k] += w[I+k] * dac; }
+        }
+        for(size_t k=0;k<H;k++) dhp_v[k] += drh_v[k] * r[k];
+        /* update and reset gates */
+        for(size_t j=0;j<H;j++){
+            double daz = dh_v[j] * (c[j] - hp[j]) * z[j] * (1.0 - z[j]);
+            double dar = drh_v[j] * hp[j] * r[j] * (1.0 - r[j]);
+            dbz[j] += daz;
+            dbr[j] += dar;
+            double *dwz = dWz + j * IH, *dwr = dWr + j * IH;
+            const double *wz = g->Wz + j * IH, *wr = g->Wr + j * IH;
+            for(size_t i=0;i<I;i++){ dwz[i] += daz * x[i]; dwr[i] += dar * x[i]; }
+            for(size_t k=0;k<H;k++){
+                dwz[I+k] += daz * hp[k];
+                dwr[I+k] += dar * hp[k];
+                dhp_v[k] += wz[I+k] * daz + wr[I+k] * dar;
+            }
+        }
+        memcpy(dh_v, dhp_v, sizeof(double) * H);
+    }
+
+    double norm = 0.0;
+    for(size_t i=0;i<g->n_params;i++) norm += g->grad[i] * g->grad[i];
+    norm = sqrt(norm);
+    double scale = norm > GRU_CLIP_NORM ? GRU_CLIP_NORM / norm : 1.0;
+    double lr = g->params.learning_rate * scale;
+    for(size_t i=0;i<g->n_params;i++) g->p[i] -= lr * g->grad[i];
+    return sqrt(sum_sq);
+}
@@ -0,0 +1,42 @@
+/**
+ * gru.h
+ *
+ * Declarations for the recurrent (GRU) model used in module2. The weights are
+ * shared, every stream keeps its own hidden state and a bounded history for
+ * truncated backpropagation through time.
+ */
+
+#ifndef GRU_H
+#define GRU_H
+
+#include <stddef.h>
+
+#include "nn_params.h"
+#include "../types.h"
+
+/** Largest hidden state size and truncated BPTT window accepted by gru_create(). */
+#define GRU_HIDDEN_MAX 1024
+#define GRU_WINDOW_MAX 1024
+
+typedef struct gru_s gru_t;
+typedef struct gru_stream_s gru_stream_t;
+
+gru_t* gru_create(const nn_params_t *params, size_t hidden, size_t window);
+void gru_free(gru_t *g);
+size_t gru_param_count(const gru_t *g);
+int gru_save(const gru_t *g, const char *filename);
+int gru_load(gru_t *g, const char *filename);
+void gru_observe(gru_t *g, const feature_vec_t *in, const float *target_raw);
+
+gru_stream_t* gru_stream_create(const gru_t *g);
+void gru_stream_free(gru_stream_t *s);
+size_t gru_stream_bytes(const gru_t *g);
+void gru_stream_step(const gru_t *g, gru_stream_t *s, const feature_vec_t *in, float *out_raw);
+double gru_stream_train_prev(gru_t *g, gru_stream_t *s, const float *target_raw);
+const double* gru_stream_hidden(const gru_stream_t *s);
+
+size_t gru_hidden_size(const gru_t *g);
+size_t gru_rollout_work_len(const gru_t *g);
+void gru_rollout_step(const gru_t *g, const double *h_in, const feature_vec_t *in, double *h_out, double *work, float *out_raw);
+
+#endif
@@ -10,6 +10,7 @@
 #include <stdio.h>
 
 #include "h_layer.h"
+#include "../memstat.h"
 
 /**
  * Create a new hidden layer with specified number of neurons and input length.
@@ -21,12 +22,12 @@
  */
 h_layer_t* h_layer_create(size_t n_neurons, size_t input_len)
 {
-    h_layer_t* L = (h_layer_t*)calloc(1, sizeof(h_layer_t));
+    h_layer_t* L = (h_layer_t*)mem_calloc(MEM_NN, 1, sizeof(h_layer_t));
     if (!L) return NULL;
     L->n_neurons = n_neurons;
     L->input_len = input_len;
-    L->neurons = (neuron_t**)malloc(sizeof(neuron_t*) * n_neurons);
-    if (!L->neurons) { free(L); return NULL; }
+    L->neurons = (neuron_t**)mem_alloc(MEM_NN, sizeof(neuron_t*) * n_neurons);
+    if (!L->neurons) { mem_free(L); return NULL; }
     for (size_t i = 0; i < n_neurons; i++)
         L->neurons[i] = neuron_create(input_len);
     return L;
@@ -43,8 +44,8 @@ void h_layer_free(h_layer_t* L)
     for (size_t i = 0; i < L->n_neurons; i++) {
         neuron_free(L->neurons[i]);
     }
-    free(L->neurons);
-    free(L);
+    mem_free(L->neurons);
+    mem_free(L);
 }
 
 /**
@@ -0,0 +1,219 @@
+/*
+ * hogwild.c
+ *
+ * Parallel SGD for one shared network. Training samples are queued and a
+ * fixed set of trainer threads runs nn_train_sample() on them concurrently,
+ * either without any locking (Hogwild: sparse, small updates tolerate the
+ * occasional lost write) or with one mutex per layer.
+ */
+
+#ifndef HOGWILD_C_HEADER
+#define HOGWILD_C_HEADER
+#include "hogwild.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "../common.h"
+#include "../platform.h"
+#include "../log.h"
+#include "../memstat.h"
+
+#define HOGWILD_BATCH 16
+
+/**
+ * Queued training sample.
+ */
+typedef struct {
+    feature_vec_t in;
+    float target[OUTPUT_SIZE];
+} hogwild_sample_t;
+
+/**
+ * Trainer structure definition.
+ *
+ * nn: shared network all trainers update
+ * mode: synchronization of the weight updates
+ * layer_locks: one mutex per layer (HOGWILD_STRIPED only)
+ * n_threads, threads: trainer threads
+ * m, c_work, c_idle: protect the queue; signal new samples / an idle trainer set
+ * ring, cap, head, count: bounded sample queue (oldest dropped when full)
+ * busy: trainers currently working on a batch
+ * stop: set by hogwild_free()
+ * last_cost: cost of the most recently finished step
+ */
+struct hogwild_s {
+    nn_t *nn;
+    hogwild_mode_t mode;
+    pthread_mutex_t *layer_locks;
+    int n_threads;
+    pthread_t threads[HOGWILD_MAX_THREADS];
+    pthread_mutex_t m;
+    pthread_cond_t c_work, c_idle;
+    hogwild_sample_t *ring;
+    int cap, head, count;
+    int busy;
+    int stop;
+    double last_cost;
+};
+
+/**
+ * Trainer thread: take up to HOGWILD_BATCH samples at a time and train on
+ * them outside the queue lock.
+ *
+ * @param arg hogwild_t
+ * @return NULL
+ */
+static void* hogwild_worker(void *arg){
+    hogwild_t *hw = (hogwild_t*)arg;
+    hogwild_sample_t batch[HOGWILD_BATCH];
+    while(1){
+        pthread_mutex_lock(&hw->m);
+        while(hw->count == 0 && !hw->stop) pthread_cond_wait(&hw->c_work, &hw->m);
+        if(hw->count == 0 && hw->stop){ pthread_mutex_unlock(&hw->m); break; }
+        int n = hw->count < HOGWILD_BATCH ? hw->count : HOGWILD_BATCH;
+        for(int i=0;i<n;i++){
+            batch[i] = hw->ring[hw->head];
+            hw->head = (hw->head + 1) % hw->cap;
+        }
+        hw->count -= n;
+        hw->busy++;
+        pthread_mutex_unlock(&hw->m);
+
+        long long t0 = platform_thread_cpu_ns();
+        double cost = NAN;
+        for(int i=0;i<n;i++) cost = nn_train_sample(hw->nn, &batch[i].in, batch[i].target, hw->layer_locks);
+        stats_record_train_steps(n, platform_thread_cpu_ns() - t0);
+
+        pthread_mutex_lock(&hw->m);
+        hw->busy--;
+        if(!isnan(cost)) hw->last_cost = cost;
+        if(hw->count == 0 && hw->busy == 0) pthread_cond_broadcast(&hw->c_idle);
+        pthread_mutex_unlock(&hw->m);
+    }
+    return NULL;
+}
+
+/**
+ * Create a trainer for a shared network and start its threads.
+ *
+ * @param nn network to train (must outlive the trainer)
+ * @param n_threads number of trainer threads (1..64)
+ * @param mode lock-free or per-layer locked updates
+ * @param queue_cap capacity of the sample queue
+ * @return allocated trainer or NULL on error
+ */
+hogwild_t* hogwild_create(nn_t *nn, int n_threads, hogwild_mode_t mode, int queue_cap){
+    if(n_threads < 1 || n_threads > HOGWILD_MAX_THREADS || queue_cap < 1) return NULL;
+    hogwild_t *hw = (hogwild_t*)mem_calloc(MEM_NN, 1, sizeof(hogwild_t));
+    if(!hw) return NULL;
+    hw->nn = nn;
+    hw->mode = mode;
+    hw->cap = queue_cap;
+    hw->last_cost = NAN;
+    hw->ring = (hogwild_sample_t*)mem_alloc(MEM_NN, sizeof(hogwild_sample_t) * (size_t)queue_cap);
+    if(!hw->ring){ mem_free(hw); return NULL; }
+    if(mode == HOGWILD_STRIPED){
+        size_t n_layers = nn_layer_count(nn);
+        hw->layer_locks = (pthread_mutex_t*)mem_alloc(MEM_NN, sizeof(pthread_mutex_t) * n_layers);
+        if(!hw->layer_locks){ mem_free(hw->ring); mem_free(hw); return NULL; }
+        for(size_t i=0;i<n_layers;i++) pthread_mutex_init(&hw->layer_locks[i], NULL);
+    }
+    pthread_mutex_init(&hw->m, NULL);
+    pthread_cond_init(&hw->c_work, NULL);
+    pthread_cond_init(&hw->c_idle, NULL);
+    for(int i=0;i<n_threads;i++){
+        if(pthread_create(&hw->threads[hw->n_threads], NULL, hogwild_worker, hw) != 0){ LOG_ERROR("[hogwild] pthread_create failed\n"); break; }
+        hw->n_threads++;
+    }
+    if(hw->n_threads == 0){ hogwild_free(hw); return NULL; }
+    return hw;
+}
+
+/**
+ * Stop the trainer after the queued samples are trained and free it.
+ * The network itself is not freed.
+ *
+ * @param hw trainer (may be NULL)
+ */
+void hogwild_free(hogwild_t *hw){
+    if(!hw) return;
+    pthread_mutex_lock(&hw->m);
+    hw->stop = 1;
+    pthread_cond_broadcast(&hw->c_work);
+    pthread_mutex_unlock(&hw->m);
+    for(int i=0;i<hw->n_threads;i++) pthread_join(hw->threads[i], NULL);
+    if(hw->layer_locks){
+        size_t n_layers = nn_layer_count(hw->nn);
+        for(size_t i=0;i<n_layers;i++) pthread_mutex_destroy(&hw->layer_locks[i]);
+        mem_free(hw->layer_locks);
+    }
+    pthread_cond_destroy(&hw->c_idle);
+    pthread_cond_destroy(&hw->c_work);
+    pthread_mutex_destroy(&hw->m);
+    mem_free(hw->ring);
+    mem_free(hw);
+}
+
+/**
+ * Queue a training sample. When the queue is full the oldest sample is
+ * dropped (counted as a dropped training sample).
+ *
+ * @param hw trainer
+ * @param in network input (raw values)
+ * @param target desired raw outputs (length OUTPUT_SIZE)
+ */
+void hogwild_submit(hogwild_t *hw, const feature_vec_t *in, const float *target){
+    pthread_mutex_lock(&hw->m);
+    if(hw->count == hw->cap){
+        hw->head = (hw->head + 1) % hw->cap;
+        hw->count--;
+        stats_inc_train_dropped();
+    }
+    hogwild_sample_t *s = &hw->ring[(hw->head + hw->count) % hw->cap];
+    s->in = *in;
+    memcpy(s->target, target, sizeof(s->target));
+    hw->count++;
+    pthread_cond_signal(&hw->c_work);
+    pthread_mutex_unlock(&hw->m);
+}
+
+/**
+ * Block until every queued sample has been trained.
+ *
+ * @param hw trainer
+ */
+void hogwild_wait_idle(hogwild_t *hw){
+    pthread_mutex_lock(&hw->m);
+    while(hw->count > 0 || hw->busy > 0) pthread_cond_wait(&hw->c_idle, &hw->m);
+    pthread_mutex_unlock(&hw->m);
+}
+
+/**
+ * Cost of the most recently finished training step.
+ *
+ * @param hw trainer
+ * @return cost or NaN when nothing was trained yet
+ */
+double hogwild_last_cost(hogwild_t *hw){
+    pthread_mutex_lock(&hw->m);
+    double c = hw->last_cost;
+    pthread_mutex_unlock(&hw->m);
+    return c;
+}
+
+/**
+ * Parse a synchronization mode name ("hogwild" or "striped").
+ *
+ * @param name mode name
+ * @param mode output mode
+ * @return 0 on success, -1 for an unknown name
+ */
+int hogwild_parse_mode(const char *name, hogwild_mode_t *mode){
+    if(strcmp(name, "hogwild") == 0){ *mode = HOGWILD_LOCKFREE; return 0; }
+    if(strcmp(name, "striped") == 0){ *mode = HOGWILD_STRIPED; return 0; }
+    return -1;
+}
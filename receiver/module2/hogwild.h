@@ -0,0 +1,31 @@
+/**
+ * hogwild.h
+ *
+ * Declarations for the multi-threaded trainer of a shared model used in module2.
+ */
+
+#ifndef HOGWILD_H
+#define HOGWILD_H
+
+#include "nn.h"
+#include "../types.h"
+
+/** How concurrent trainers synchronize their weight updates. */
+typedef enum {
+    HOGWILD_LOCKFREE = 0, /* no locks, updates may race (Hogwild) */
+    HOGWILD_STRIPED       /* one mutex per layer */
+} hogwild_mode_t;
+
+/** Most trainer threads hogwild_create() accepts. */
+#define HOGWILD_MAX_THREADS 64
+
+typedef struct hogwild_s hogwild_t;
+
+hogwild_t* hogwild_create(nn_t *nn, int n_threads, hogwild_mode_t mode, int queue_cap);
+void hogwild_free(hogwild_t *hw);
+void hogwild_submit(hogwild_t *hw, const feature_vec_t *in, const float *target);
+void hogwild_wait_idle(hogwild_t *hw);
+double hogwild_last_cost(hogwild_t *hw);
+int hogwild_parse_mode(const char *name, hogwild_mode_t *mode);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * horizon.c
+ *
+ * Multi-horizon forecasts by autoregressive rollout. The one-step model
+ * predicts t+1; its prediction is fed back as the next input (the feature
+ * vector is advanced with feature_set_advance(), the recurrent model keeps a
+ * detached hidden state) to predict t+2 and so on up to t+k.
+ *
+ * A full rollout costs k-1 extra model steps. The rollout made at t already
+ * assumed t+1 would look like its first prediction, so when the sample that
+ * actually arrives is within the relative tolerance of it, the cached
+ * predictions for t+2..t+k still hold: they shift down one horizon and only
+ * the new t+k+1 is computed, from the input vector and hidden state the
+ * previous rollout ended in. A sample off the forecast, or a cache whose
+ * rollout has been replaced step by step (k-1 shifts), triggers a full
+ * rollout again.
+ */
+
+#ifndef HORIZON_C_HEADER
+#define HORIZON_C_HEADER
+#include "horizon.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../memstat.h"
+
+/**
+ * Rollout cache of one source.
+ *
+ * k: number of horizons
+ * valid: non-zero once a rollout has been made
+ * age: shifts since the last full rollout
+ * pred: k predictions of OUTPUT_SIZE raw values, pred[j] is the forecast for t+1+j
+ * tail_x: input features the rollout's last step was made from
+ * tail_metrics: raw metrics tail_x was advanced to (the forecast for t+k-1)
+ * tail_h: hidden state after the last step (recurrent model only)
+ * h_next: hidden state being computed
+ * work: gru_rollout_work_len() doubles for the recurrent model
+ */
+struct horizon_s {
+    int k;
+    int valid;
+    int age;
+    float *pred;
+    feature_vec_t tail_x;
+    double tail_metrics[N_METRICS];
+    double *tail_h;
+    double *h_next;
+    double *work;
+};
+
+/**
+ * Create the rollout cache of a source.
+ *
+ * @param k number of horizons (1..HORIZON_MAX)
+ * @param gru recurrent model the rollouts run on, or NULL for the MLP
+ * @return allocated cache or NULL on error
+ */
+horizon_t* horizon_create(int k, const gru_t *gru){
+    if(k < 1 || k > HORIZON_MAX) return NULL;
+    horizon_t *hz = (horizon_t*)mem_calloc(MEM_NN, 1, sizeof(horizon_t));
+    if(!hz) return NULL;
+    hz->k = k;
+    hz->pred = (float*)mem_calloc(MEM_NN, (size_t)k * OUTPUT_SIZE, sizeof(float));
+    if(!hz->pred){ horizon_free(hz); return NULL; }
+    if(gru){
+        size_t H = gru_hidden_size(gru);
+        hz->tail_h = (double*)mem_calloc(MEM_NN, H, sizeof(double));
+        hz->h_next = (double*)mem_calloc(MEM_NN, H, sizeof(double));
+        hz->work = (double*)mem_calloc(MEM_NN, gru_rollout_work_len(gru), sizeof(double));
+        if(!hz->tail_h || !hz->h_next || !hz->work){ horizon_free(hz); return NULL; }
+    }
+    return hz;
+}
+
+void horizon_free(horizon_t *hz){
+    if(!hz) return;
+    mem_free(hz->pred);
+    mem_free(hz->tail_h);
+    mem_free(hz->h_next);
+    mem_free(hz->work);
+    mem_free(hz);
+}
+
+/**
+ * Memory of one rollout cache in bytes.
+ */
+size_t horizon_bytes(int k, const gru_t *gru){
+    size_t b = sizeof(horizon_t) + sizeof(float) * (size_t)k * OUTPUT_SIZE;
+    if(gru) b += sizeof(double) * (2 * gru_hidden_size(gru) + gru_rollout_work_len(gru));
+    return b;
+}
+
+/**
+ * One rollout step from the cached tail: advance the tail's inputs to the
+ * forecast `next` and predict the sample after it.
+ *
+ * @param hz cache (tail_x / tail_metrics / tail_h are moved forward)
+ * @param m model
+ * @param next forecast the tail is advanced to (length OUTPUT_SIZE)
+ * @param out receives the prediction (length OUTPUT_SIZE)
+ */
+static void horizon_step(horizon_t *hz, const horizon_model_t *m, const float *next, float *out){
+    double nx[N_METRICS];
+    feature_vec_t x;
+    for(int i=0;i<N_METRICS;i++) nx[i] = (double)next[i];
+    feature_set_advance(m->fs, hz->tail_metrics, &hz->tail_x, nx, &x);
+    if(m->gru){
+        gru_rollout_step(m->gru, hz->tail_h, &x, hz->h_next, hz->work, out);
+        memcpy(hz->tail_h, hz->h_next, sizeof(double) * gru_hidden_size(m->gru));
+    } else {
+        nn_predict_and_maybe_train(m->nn, &x, NULL, out);
+    }
+    hz->tail_x = x;
+    memcpy(hz->tail_metrics, nx, sizeof(nx));
+}
+
+/**
+ * Whether the sample that arrived matches the forecast the cache made for it.
+ */
+static int horizon_on_track(const horizon_t *hz, const float *cur_raw, double tol){
+    for(int i=0;i<OUTPUT_SIZE;i++){
+        double a = (double)cur_raw[i], p = (double)hz->pred[i];
+        if(fabs(a - p) > tol * fabs(a)) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Refresh the forecasts of a source after a new sample.
+ *
+ * @param hz cache of the source
+ * @param m model of the source
+ * @param x input features of the new sample
+ * @param cur_raw raw metrics of the new sample (length OUTPUT_SIZE)
+ * @param pred1 the model's prediction for t+1, already computed from `x`
+ * @param hidden hidden state after the sample (recurrent model), NULL for the MLP
+ * @param tol relative tolerance under which the cached rollout is reused (0 = never)
+ * @param reused receives 1 when the cached rollout was shifted, 0 after a full rollout (may be NULL)
+ * @return number of extra model steps spent
+ */
+int horizon_update(horizon_t *hz, const horizon_model_t *m, const feature_vec_t *x, const float *cur_raw,
+                   const float *pred1, const double *hidden, double tol, int *reused){
+    int k = hz->k;
+    int shift = hz->valid && tol > 0.0 && hz->age + 1 < k && horizon_on_track(hz, cur_raw, tol);
+    if(reused) *reused = shift;
+    if(k == 1){
+        memcpy(hz->pred, pred1, sizeof(float) * OUTPUT_SIZE);
+        hz->valid = 1;
+        return 0;
+    }
+    if(shift){
+        float last[OUTPUT_SIZE];
+        memcpy(last, hz->pred + (size_t)(k - 1) * OUTPUT_SIZE, sizeof(last));
+        memmove(hz->pred + OUTPUT_SIZE, hz->pred + 2 * OUTPUT_SIZE, sizeof(float) * (size_t)(k - 2) * OUTPUT_SIZE);
+        memcpy(hz->pred, pred1, sizeof(float) * OUTPUT_SIZE);
+        horizon_step(hz, m, last, hz->pred + (size_t)(k - 1) * OUTPUT_SIZE);
+        hz->age++;
+        return 1;
+    }
+    memcpy(hz->pred, pred1, sizeof(float) * OUTPUT_SIZE);
+    hz->tail_x = *x;
+    for(int i=0;i<N_METRICS;i++) hz->tail_metrics[i] = (double)cur_raw[i];
+    if(m->gru) memcpy(hz->tail_h, hidden, sizeof(double) * gru_hidden_size(m->gru));
+    for(int j=1;j<k;j++) horizon_step(hz, m, hz->pred + (size_t)(j - 1) * OUTPUT_SIZE, hz->pred + (size_t)j * OUTPUT_SIZE);
+    hz->valid = 1;
+    hz->age = 0;
+    return k - 1;
+}
+
+/**
+ * Forecast for one horizon.
+ *
+ * @param hz cache
+ * @param step horizon, 1 = next sample .. k
+ * @return OUTPUT_SIZE raw values
+ */
+const float* horizon_pred(const horizon_t *hz, int step){
+    return hz->pred + (size_t)(step - 1) * OUTPUT_SIZE;
+}
@@ -0,0 +1,44 @@
+/**
+ * horizon.h
+ *
+ * Declarations for the multi-horizon forecasts used in module2. Every source
+ * keeps the predictions for its next `k` samples together with the state the
+ * autoregressive rollout ended in, so a new sample usually costs a single
+ * extra model step instead of a full rollout.
+ */
+
+#ifndef HORIZON_H
+#define HORIZON_H
+
+#include <stddef.h>
+
+#include "nn.h"
+#include "gru.h"
+#include "../module1/feature_stage.h"
+#include "../types.h"
+
+#define HORIZON_MAX 32
+
+/**
+ * Model a rollout runs on.
+ *
+ * nn: MLP of the source, used when `gru` is NULL
+ * gru: recurrent model of the stage, or NULL
+ * fs: feature set the model inputs are computed with
+ */
+typedef struct {
+    nn_t *nn;
+    const gru_t *gru;
+    const feature_set_t *fs;
+} horizon_model_t;
+
+typedef struct horizon_s horizon_t;
+
+horizon_t* horizon_create(int k, const gru_t *gru);
+void horizon_free(horizon_t *hz);
+size_t horizon_bytes(int k, const gru_t *gru);
+int horizon_update(horizon_t *hz, const horizon_model_t *m, const feature_vec_t *x, const float *cur_raw,
+                   const float *pred1, const double *hidden, double tol, int *reused);
+const float* horizon_pred(const horizon_t *hz, int step);
+
+#endif
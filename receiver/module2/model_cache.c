@@ -0,0 +1,344 @@
+/*
+ * model_cache.c
+ *
+ * Hash table of per-source models with an LRU memory bound. Entries that do
+ * not fit into the budget are written to compact spill files (float32
+ * parameters plus the previous datapoint/prediction) and removed from
+ * memory; a later request for the same source loads the file again.
+ */
+
+#ifndef MODEL_CACHE_C_HEADER
+#define MODEL_CACHE_C_HEADER
+#include "model_cache.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../common.h"
+#include "../platform.h"
+#include "../log.h"
+#include "../memstat.h"
+
+#define MODEL_CACHE_BUCKETS 1024
+#define SPILL_MAGIC 0x4d53504eu /* "NPSM" */
+#define SPILL_VERSION 3u
+
+/**
+ * Model cache structure definition.
+ *
+ * params: parameters used to create every per-source network
+ * budget_bytes: memory budget for resident entries
+ * entry_bytes: memory of one resident entry (measured on first create)
+ * extra_bytes: per-entry memory owned by the user of the cache (e.g. recurrent state)
+ * resident: number of entries currently in memory
+ * spill_dir: directory for spill files ("" disables spilling)
+ * seed_path: weight file used to initialize new sources ("" = random init)
+ * buckets: hash buckets (chained through model_entry_t.hnext)
+ * lru_head, lru_tail: most / least recently used resident entries
+ * evict_fn, evict_ctx: hook called before an entry is evicted
+ * loads, spills: number of spill files read / written
+ */
+struct model_cache_s {
+    nn_params_t params;
+    size_t budget_bytes;
+    size_t entry_bytes;
+    size_t extra_bytes;
+    size_t resident;
+    char spill_dir[256];
+    char seed_path[256];
+    model_entry_t *buckets[MODEL_CACHE_BUCKETS];
+    model_entry_t *lru_head, *lru_tail;
+    model_evict_fn evict_fn;
+    void *evict_ctx;
+    long long loads, spills;
+};
+
+/**
+ * FNV-1a hash of a NUL-terminated key.
+ *
+ * @param key string to hash
+ * @return bucket index
+ */
+static size_t model_cache_hash(const char *key){
+    uint32_t h = 2166136261u;
+    for(const unsigned char *p = (const unsigned char*)key; *p; p++){ h ^= *p; h *= 16777619u; }
+    return (size_t)(h & (MODEL_CACHE_BUCKETS - 1));
+}
+
+/**
+ * Build the spill file path for a key. Characters other than letters and
+ * digits are replaced so IPv4/IPv6 addresses map to valid file names.
+ *
+ * @param mc cache
+ * @param key source key
+ * @param out output buffer
+ * @param out_len size of the output buffer
+ */
+static void model_cache_spill_path(const model_cache_t *mc, const char *key, char *out, size_t out_len){
+    char name[64];
+    size_t i = 0;
+    for(; key[i] && i < sizeof(name)-1; i++){
+        char ch = key[i];
+        int ok = (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+        name[i] = ok ? ch : '_';
+    }
+    name[i] = '\0';
+    snprintf(out, out_len, "%s/%s.bin", mc->spill_dir, i ? name : "default");
+}
+
+/**
+ * Write an entry to its spill file.
+ *
+ * Layout: magic, version, parameter count, has_prev, feature count (uint32
+ * each), previous features (float32 each), previous prediction (6 floats),
+ * the parameters as float32 in nn_export_params() order and the network's
+ * normalization block.
+ *
+ * @param mc cache
+ * @param e entry to write
+ * @return 0 on success, -1 on error
+ */
+static int model_cache_spill(model_cache_t *mc, const model_entry_t *e){
+    char path[384];
+    model_cache_spill_path(mc, e->key, path, sizeof(path));
+    size_t n = nn_param_count(e->nn);
+    double *params = (double*)mem_alloc(MEM_NN, sizeof(double) * n);
+    float *packed = (float*)mem_alloc(MEM_NN, sizeof(float) * n);
+    if(!params || !packed){ mem_free(params); mem_free(packed); return -1; }
+    nn_export_params(e->nn, params);
+    for(size_t i=0;i<n;i++) packed[i] = (float)params[i];
+    mem_free(params);
+
+    /* written under a temporary name so a crash never leaves a torn file behind */
+    char tmp[392];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if(!f){ mem_free(packed); return -1; }
+    uint32_t hdr[5] = { SPILL_MAGIC, SPILL_VERSION, (uint32_t)n, (uint32_t)e->has_prev, (uint32_t)e->prev_x.n };
+    float prev[FEATURE_MAX];
+    for(size_t i=0;i<e->prev_x.n;i++) prev[i] = (float)e->prev_x.v[i];
+    int ok = fwrite(hdr, sizeof(hdr), 1, f) == 1
+          && fwrite(prev, sizeof(float), e->prev_x.n, f) == e->prev_x.n
+          && fwrite(e->prev_out, sizeof(e->prev_out), 1, f) == 1
+          && fwrite(packed, sizeof(float), n, f) == n
+          && nn_write_norm(e->nn, f) == 0;
+    mem_free(packed);
+    if(fclose(f) != 0) ok = 0;
+#ifdef _WIN32
+    if(ok) remove(path);
+#endif
+    if(!ok || rename(tmp, path) != 0){ remove(tmp); return -1; }
+    return 0;
+}
+
+/**
+ * Load an entry from its spill file if one exists and matches the network.
+ *
+ * @param mc cache
+ * @param e entry with an allocated network
+ * @return 0 on success, -1 when no compatible spill file exists
+ */
+static int model_cache_load(model_cache_t *mc, model_entry_t *e){
+    char path[384];
+    model_cache_spill_path(mc, e->key, path, sizeof(path));
+    FILE *f = fopen(path, "rb");
+    if(!f) return -1;
+    size_t n = nn_param_count(e->nn);
+    uint32_t hdr[5];
+    float prev[FEATURE_MAX];
+    int rc = -1;
+    float *packed = (float*)mem_alloc(MEM_NN, sizeof(float) * n);
+    double *params = (double*)mem_alloc(MEM_NN, sizeof(double) * n);
+    if(packed && params
+       && fread(hdr, sizeof(hdr), 1, f) == 1
+       && hdr[0] == SPILL_MAGIC && hdr[1] == SPILL_VERSION && hdr[2] == (uint32_t)n
+       && hdr[4] <= FEATURE_MAX
+       && fread(prev, sizeof(float), hdr[4], f) == hdr[4]
+       && fread(e->prev_out, sizeof(e->prev_out), 1, f) == 1
+       && fread(packed, sizeof(float), n, f) == n
+       && nn_read_norm(e->nn, f) == 0){
+        for(size_t i=0;i<n;i++) params[i] = (double)packed[i];
+        nn_import_params(e->nn, params);
+        e->has_prev = (int)hdr[3];
+        e->prev_x.n = hdr[4];
+        for(size_t i=0;i<e->prev_x.n;i++) e->prev_x.v[i] = (double)prev[i];
+        rc = 0;
+    } else {
+        LOG_ERROR("[models] ignoring incompatible spill file %s\n", path);
+    }
+    mem_free(packed);
+    mem_free(params);
+    fclose(f);
+    return rc;
+}
+
+/**
+ * Create a model cache.
+ *
+ * @param params parameters for every network (set weights_path to NULL for per-source models,
+ *               otherwise every model autosaves to the same file)
+ * @param budget_bytes memory budget for resident models (at least one model is always kept)
+ * @param spill_dir directory for spill files, NULL to discard evicted models
+ * @param seed_path weight file used to initialize new sources, or NULL
+ * @return allocated cache or NULL on error
+ */
+model_cache_t* model_cache_create(const nn_params_t *params, size_t budget_bytes, const char *spill_dir, const char *seed_path){
+    model_cache_t *mc = (model_cache_t*)mem_calloc(MEM_NN, 1, sizeof(model_cache_t));
+    if(!mc) return NULL;
+    mc->params = *params;
+    mc->budget_bytes = budget_bytes;
+    if(spill_dir){
+        snprintf(mc->spill_dir, sizeof(mc->spill_dir), "%s", spill_dir);
+        if(platform_mkdir_p(mc->spill_dir) != 0) LOG_ERROR("[models] cannot create spill directory %s\n", mc->spill_dir);
+    }
+    if(seed_path) snprintf(mc->seed_path, sizeof(mc->seed_path), "%s", seed_path);
+    return mc;
+}
+
+/**
+ * Unlink an entry from the LRU list.
+ */
+static void lru_unlink(model_cache_t *mc, model_entry_t *e){
+    if(e->lru_prev) e->lru_prev->lru_next = e->lru_next; else mc->lru_head = e->lru_next;
+    if(e->lru_next) e->lru_next->lru_prev = e->lru_prev; else mc->lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+/**
+ * Insert an entry at the most-recently-used end of the LRU list.
+ */
+static void lru_push_front(model_cache_t *mc, model_entry_t *e){
+    e->lru_prev = NULL;
+    e->lru_next = mc->lru_head;
+    if(mc->lru_head) mc->lru_head->lru_prev = e; else mc->lru_tail = e;
+    mc->lru_head = e;
+}
+
+/**
+ * Evict an entry: run the hook, spill it (if enabled) and free it.
+ *
+ * @param mc cache
+ * @param e resident entry to evict
+ * @return 0 on success, -1 when the entry could not be spilled (it is freed anyway)
+ */
+static int model_cache_evict(model_cache_t *mc, model_entry_t *e){
+    int rc = 0;
+    if(mc->evict_fn) mc->evict_fn(e, mc->evict_ctx);
+    if(mc->spill_dir[0]){
+        if(model_cache_spill(mc, e) == 0) mc->spills++;
+        else { LOG_ERROR("[models] failed to spill model for '%s'\n", e->key); rc = -1; }
+    }
+    model_entry_t **pp = &mc->buckets[model_cache_hash(e->key)];
+    while(*pp && *pp != e) pp = &(*pp)->hnext;
+    if(*pp) *pp = e->hnext;
+    lru_unlink(mc, e);
+    nn_free(e->nn);
+    mem_free(e);
+    mc->resident--;
+    return rc;
+}
+
+/**
+ * Free the cache. Resident entries are spilled first so no state is lost.
+ *
+ * @param mc cache to free (may be NULL)
+ * @return 0 on success, -1 when a resident entry could not be spilled
+ */
+int model_cache_free(model_cache_t *mc){
+    if(!mc) return 0;
+    int rc = 0;
+    while(mc->lru_tail) if(model_cache_evict(mc, mc->lru_tail) != 0) rc = -1;
+    mem_free(mc);
+    return rc;
+}
+
+/**
+ * Write every resident entry to its spill file without evicting it, so the
+ * files on disk hold the current state of all models.
+ *
+ * @param mc cache
+ * @return 0 on success, -1 when spilling is disabled or a file could not be written
+ */
+int model_cache_checkpoint(model_cache_t *mc){
+    if(!mc->spill_dir[0]) return -1;
+    int rc = 0;
+    for(model_entry_t *e = mc->lru_head; e; e = e->lru_next){
+        if(model_cache_spill(mc, e) == 0) mc->spills++;
+        else { LOG_ERROR("[models] failed to checkpoint model for '%s'\n", e->key); rc = -1; }
+    }
+    return rc;
+}
+
+/**
+ * Register a hook that is called right before an entry is evicted, e.g. to
+ * drop pending work that references the entry's network.
+ *
+ * @param mc cache
+ * @param fn hook function (NULL to remove)
+ * @param ctx opaque pointer passed to the hook
+ */
+void model_cache_set_evict_hook(model_cache_t *mc, model_evict_fn fn, void *ctx){
+    mc->evict_fn = fn;
+    mc->evict_ctx = ctx;
+}
+
+/**
+ * Account for memory the cache user attaches to every entry, so the budget
+ * covers it too. Must be called before the first model_cache_get().
+ *
+ * @param mc cache
+ * @param bytes additional bytes per resident entry
+ */
+void model_cache_set_entry_extra(model_cache_t *mc, size_t bytes){
+    mc->extra_bytes = bytes;
+}
+
+/**
+ * Look up (or create) the entry for a source and mark it most recently used.
+ *
+ * New entries are loaded from their spill file when one exists, otherwise
+ * initialized from the seed weight file. Least recently used entries are
+ * evicted while the budget is exceeded; the returned entry is never evicted
+ * by this call.
+ *
+ * @param mc cache
+ * @param key source address ("" for records without a known source)
+ * @return entry pointer valid until the next model_cache_get call, or NULL on allocation failure
+ */
+model_entry_t* model_cache_get(model_cache_t *mc, const char *key){
+    size_t b = model_cache_hash(key);
+    for(model_entry_t *e = mc->buckets[b]; e; e = e->hnext){
+        if(strcmp(e->key, key) == 0){
+            if(mc->lru_head != e){ lru_unlink(mc, e); lru_push_front(mc, e); }
+            return e;
+        }
+    }
+    model_entry_t *e = (model_entry_t*)mem_calloc(MEM_NN, 1, sizeof(model_entry_t));
+    if(!e) return NULL;
+    snprintf(e->key, sizeof(e->key), "%s", key);
+    e->nn = nn_create(&mc->params);
+    if(!e->nn){ mem_free(e); return NULL; }
+    if(mc->spill_dir[0] && model_cache_load(mc, e) == 0) mc->loads++;
+    else if(mc->seed_path[0]) nn_load_weights(e->nn, mc->seed_path);
+    if(mc->entry_bytes == 0) mc->entry_bytes = sizeof(model_entry_t) + nn_memory_bytes(e->nn) + mc->extra_bytes;
+
+    e->hnext = mc->buckets[b];
+    mc->buckets[b] = e;
+    lru_push_front(mc, e);
+    mc->resident++;
+    while(mc->resident > 1 && mc->resident * mc->entry_bytes > mc->budget_bytes) model_cache_evict(mc, mc->lru_tail);
+    return e;
+}
+
+/**
+ * Publish cache occupancy through the stats module.
+ *
+ * @param mc cache
+ * @param stats_slot gauge slot of the owning NN stage
+ */
+void model_cache_publish_stats(const model_cache_t *mc, int stats_slot){
+    stats_set_model_cache(stats_slot, (long long)mc->resident, (long long)(mc->resident * mc->entry_bytes), mc->loads, mc->spills);
+}
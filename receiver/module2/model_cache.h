@@ -0,0 +1,56 @@
+/**
+ * model_cache.h
+ *
+ * Declarations for the per-source model cache used in module2. Every traffic
+ * source gets its own network and previous datapoint/prediction; resident
+ * entries are bounded by a memory budget and evicted in LRU order to compact
+ * spill files that are loaded again on demand.
+ */
+
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <stddef.h>
+
+#include "nn.h"
+#include "gru.h"
+#include "../types.h"
+
+/**
+ * Per-source model state.
+ *
+ * key: source address the entry belongs to
+ * nn: the source's network
+ * has_prev: non-zero once prev_x / prev_out hold a sample
+ * prev_x: features of the previous datapoint received from the source
+ * prev_out: prediction made for the previous datapoint
+ * stream: recurrent state of the source (`--model=gru`, owned by the NN stage), NULL otherwise
+ * horizon: multi-horizon forecasts of the source (`--horizon` > 1, owned by the NN stage), NULL otherwise
+ * hnext: next entry in the same hash bucket
+ * lru_prev, lru_next: neighbours in the LRU list (head = most recently used)
+ */
+typedef struct model_entry_s {
+    char key[64];
+    nn_t *nn;
+    int has_prev;
+    feature_vec_t prev_x;
+    float prev_out[OUTPUT_SIZE];
+    gru_stream_t *stream;
+    struct horizon_s *horizon;
+    struct model_entry_s *hnext;
+    struct model_entry_s *lru_prev, *lru_next;
+} model_entry_t;
+
+typedef struct model_cache_s model_cache_t;
+
+typedef void (*model_evict_fn)(model_entry_t *e, void *ctx);
+
+model_cache_t* model_cache_create(const nn_params_t *params, size_t budget_bytes, const char *spill_dir, const char *seed_path);
+int model_cache_free(model_cache_t *mc);
+int model_cache_checkpoint(model_cache_t *mc);
+void model_cache_set_evict_hook(model_cache_t *mc, model_evict_fn fn, void *ctx);
+void model_cache_set_entry_extra(model_cache_t *mc, size_t bytes);
+model_entry_t* model_cache_get(model_cache_t *mc, const char *key);
+void model_cache_publish_stats(const model_cache_t *mc, int stats_slot);
+
+#endif
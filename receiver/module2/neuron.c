@@ -12,6 +12,7 @@
 #include <math.h>
 
 #include "neuron.h"
+#include "../memstat.h"
 
 /** Apply activation function.
  * 
@@ -57,11 +58,11 @@ static double drand_unit(){ return (double)rand() / (double)RAND_MAX * 2.0 - 1.0
  * @return pointer to allocated neuron_t or NULL on error
  */
 neuron_t* neuron_create(size_t in_len){
-neuron_t* n = (neuron_t*)calloc(1,sizeof(neuron_t));
+neuron_t* n = (neuron_t*)mem_calloc(MEM_NN, 1,sizeof(neuron_t));
 if(!n) return NULL;
 n->in_len = in_len;
-n->w = (double*)malloc(sizeof(double)*in_len);
-if(!n->w){ free(n); return NULL; }
+n->w = (double*)mem_alloc(MEM_NN, sizeof(double)*in_len);
+if(!n->w){ mem_free(n); return NULL; }
 // init small random weights
 for(size_t i=0;i<in_len;i++) n->w[i] = drand_unit()*0.1;
 n->b = drand_unit()*0.1;
@@ -73,7 +74,7 @@ return n;
 /**
  * Free a neuron and its resources.
  */
-void neuron_free(neuron_t* n){ if(!n) return; free(n->w); free(n); }
+void neuron_free(neuron_t* n){ if(!n) return; mem_free(n->w); mem_free(n); }
 
 /**
  * Compute neuron output: V = A*B + C (dot product + bias)
@@ -90,6 +91,31 @@ double neuron_forward(neuron_t* n, const double* input){
 	return activate(z, n->act);
 }
 
+/**
+ * Compute the neuron's pre-activation z = w·x + b without storing it, so the
+ * neuron can be evaluated by several threads at once.
+ *
+ * @param n pointer to neuron
+ * @param input input array of length n->in_len
+ * @return pre-activation value
+ */
+double neuron_preact(const neuron_t* n, const double* input){
+	double z = 0.0;
+	for(size_t i=0;i<n->in_len;i++) z += n->w[i] * input[i];
+	return z + n->b;
+}
+
+/**
+ * Apply the neuron's activation function to a pre-activation value.
+ *
+ * @param n pointer to neuron
+ * @param z pre-activation value
+ * @return activated value
+ */
+double neuron_activate(const neuron_t* n, double z){
+	return activate(z, n->act);
+}
+
 /**
  * Update neuron weights using gradient descent.
  * 
@@ -99,7 +125,21 @@ double neuron_forward(neuron_t* n, const double* input){
  * @param lr learning rate
  */
 void neuron_update(neuron_t* n, const double* input, double grad_out, double lr){
-	double dact = activate_derivative(n->last_z, n->act);
+	neuron_update_z(n, input, n->last_z, grad_out, lr);
+}
+
+/**
+ * Update neuron weights using gradient descent with an explicitly provided
+ * pre-activation (instead of the stored last_z).
+ *
+ * @param n pointer to neuron
+ * @param input input array of length n->in_len
+ * @param z pre-activation the input produced
+ * @param grad_out gradient w.r.t. output (dL/dV)
+ * @param lr learning rate
+ */
+void neuron_update_z(neuron_t* n, const double* input, double z, double grad_out, double lr){
+	double dact = activate_derivative(z, n->act);
 	double grad_pre = grad_out * dact; /* dL/dz */
 	for(size_t i=0;i<n->in_len;i++){
 		double g = grad_pre * input[i];
@@ -136,9 +176,9 @@ int neuron_read(FILE* f, neuron_t* n){
 	size_t in_len=0;
 	if(fread(&in_len,sizeof(size_t),1,f)!=1) return -1;
 	if(n->in_len != in_len){
-		double* neww = (double*)malloc(sizeof(double)*in_len);
+		double* neww = (double*)mem_alloc(MEM_NN, sizeof(double)*in_len);
 		if(!neww) return -1;
-		free(n->w);
+		mem_free(n->w);
 		n->w = neww;
 		n->in_len = in_len;
 	}
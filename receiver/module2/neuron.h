@@ -44,6 +44,11 @@ double neuron_forward(neuron_t* n, const double* input);
 
 void neuron_update(neuron_t* n, const double* input, double grad_out, double lr);
 
+/* Reentrant variants: no last_z is stored, the caller keeps the pre-activation */
+double neuron_preact(const neuron_t* n, const double* input);
+double neuron_activate(const neuron_t* n, double z);
+void neuron_update_z(neuron_t* n, const double* input, double z, double grad_out, double lr);
+
 int neuron_write(FILE* f, const neuron_t* n);
 int neuron_read(FILE* f, neuron_t* n);
 
@@ -8,17 +8,40 @@
 #define NN_H
 
 #include <stddef.h>
+#include <stdio.h>
+#include <pthread.h>
 
 #include "nn_params.h"
 #include "../types.h"
 
 typedef struct nn_s nn_t;
+typedef struct nn_batch_s nn_batch_t;
+
+/** Samples per tile of the batch inference path. */
+#define NN_BATCH_TILE 32
 
 nn_t* nn_create(const nn_params_t *params);
 void nn_free(nn_t* nn);
-double nn_predict_and_maybe_train(nn_t* nn, const data_point_t* in, const float* target_raw, float* out_raw);
+double nn_predict_and_maybe_train(nn_t* nn, const feature_vec_t* in, const float* target_raw, float* out_raw);
 void* nn_thread(void* arg);
 int nn_save_weights(nn_t* nn, const char* filename);
 int nn_load_weights(nn_t* nn, const char* filename);
 
+size_t nn_param_count(const nn_t* nn);
+void nn_export_params(const nn_t* nn, double* dst);
+void nn_import_params(nn_t* nn, const double* src);
+size_t nn_memory_bytes(const nn_t* nn);
+
+size_t nn_layer_count(const nn_t* nn);
+double nn_train_sample(nn_t* nn, const feature_vec_t* in, const float* target_raw, pthread_mutex_t* layer_locks);
+
+void nn_observe(nn_t* nn, const feature_vec_t* in, const float* target_raw);
+int nn_write_norm(const nn_t* nn, FILE* f);
+int nn_read_norm(nn_t* nn, FILE* f);
+
+int nn_predict_batch(const nn_t* nn, const feature_vec_t* in, size_t m, float* out_raw);
+nn_batch_t* nn_batch_create(const nn_t* nn);
+void nn_batch_free(nn_batch_t* bt);
+void nn_batch_predict(nn_batch_t* bt, const feature_vec_t* in, size_t m, float* out_raw);
+
 #endif
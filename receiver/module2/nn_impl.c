@@ -23,6 +23,8 @@
 #include "h_layer.h"
 #include "nn_params.h"
 #include "util.h"
+#include "norm.h"
+#include "../memstat.h"
 
 #include <sys/stat.h>
 #ifdef _WIN32
@@ -37,6 +39,7 @@
  * size_t n_layers: number of hidden layers
  * h_layer_t **layers: array of hidden layers
  * h_layer_t *output_layer: output layer
+ * norm_state_t norm: streaming statistics behind params' offsets / scales
  */
 struct nn_s{
     nn_params_t params;
@@ -44,6 +47,7 @@ struct nn_s{
     size_t n_layers;
     h_layer_t **layers;
     h_layer_t *output_layer;
+    norm_state_t norm;
 };
 
 /**
@@ -51,31 +55,33 @@ struct nn_s{
  *
  * The function allocates the nn_t structure, creates hidden and output
  * layers according to provided parameters and attempts to load saved
- * weights from disk. On failure it returns NULL.
+ * weights from `params.weights_path` (if set). On failure it returns NULL.
  *
  * @param p_in pointer to nn_params_t with desired configuration
  * @return pointer to allocated nn_t or NULL on error
  */
 nn_t* nn_create(const nn_params_t *p_in){
-    nn_t* nn = (nn_t*)calloc(1,sizeof(nn_t));
+    nn_t* nn = (nn_t*)mem_calloc(MEM_NN, 1,sizeof(nn_t));
     if(!nn) return NULL;
     nn->params = *p_in;
+    if(p_in->input_size == 0 || p_in->input_size > FEATURE_MAX){ mem_free(nn); return NULL; }
+    norm_state_init(&nn->norm);
     size_t default_neurons[] = {16, 32, 64, 32, 16};
     if(p_in->n_hidden_layers==0){
         nn->n_layers = 0;
         nn->neurons_per_layer = NULL;
     } else {
         nn->n_layers = p_in->n_hidden_layers;
-        nn->neurons_per_layer = (size_t*)malloc(sizeof(size_t)*nn->n_layers);
+        nn->neurons_per_layer = (size_t*)mem_alloc(MEM_NN, sizeof(size_t)*nn->n_layers);
         if(p_in->neurons_per_layer!=NULL){
             for(size_t i=0;i<nn->n_layers;i++) nn->neurons_per_layer[i] = p_in->neurons_per_layer[i];
         } else {
             for(size_t i=0;i<nn->n_layers;i++) nn->neurons_per_layer[i] = default_neurons[i%5];
         }
     }
-    size_t prev_size = INPUT_SIZE;
+    size_t prev_size = nn->params.input_size;
     if(nn->n_layers>0){
-        nn->layers = (h_layer_t**)malloc(sizeof(h_layer_t*)*nn->n_layers);
+        nn->layers = (h_layer_t**)mem_alloc(MEM_NN, sizeof(h_layer_t*)*nn->n_layers);
         for(size_t i=0;i<nn->n_layers;i++){
             nn->layers[i] = h_layer_create(nn->neurons_per_layer[i], prev_size);
             /* set activation for neurons in this hidden layer from params */
@@ -95,10 +101,12 @@ nn_t* nn_create(const nn_params_t *p_in){
         }
     }
     srand((unsigned)time(NULL));
-    if(nn_load_weights(nn, "data/nn_weights.bin")==0){
-        LOG_INFO("[nn] loaded weights from data/nn_weights.bin\n");
-    } else {
-        LOG_INFO("[nn] no weight file loaded (starting with random weights)\n");
+    if(nn->params.weights_path){
+        if(nn_load_weights(nn, nn->params.weights_path)==0){
+            LOG_INFO("[nn] loaded weights from %s\n", nn->params.weights_path);
+        } else {
+            LOG_INFO("[nn] no weight file loaded (starting with random weights)\n");
+        }
     }
     return nn;
 }
@@ -106,56 +114,59 @@ nn_t* nn_create(const nn_params_t *p_in){
 /**
  * Free a neural network instance and persist weights.
  *
- * Attempts to save weights to disk (best-effort) and frees all allocated
- * substructures owned by `nn`.
+ * Attempts to save weights to `params.weights_path` (best-effort, skipped
+ * when it is NULL) and frees all allocated substructures owned by `nn`.
  *
  * @param nn pointer previously returned by nn_create
  */
 void nn_free(nn_t* nn){
     if(!nn) return;
-    if(nn_save_weights(nn, "data/nn_weights.bin")==0){
-        LOG_INFO("[nn] saved weights to data/nn_weights.bin\n");
-    } else {
-        LOG_ERROR("[nn] failed to save weights to data/nn_weights.bin\n");
+    if(nn->params.weights_path){
+        if(nn_save_weights(nn, nn->params.weights_path)==0){
+            LOG_INFO("[nn] saved weights to %s\n", nn->params.weights_path);
+        } else {
+            LOG_ERROR("[nn] failed to save weights to %s\n", nn->params.weights_path);
+        }
     }
-    if(nn->neurons_per_layer) free(nn->neurons_per_layer);
-    if(nn->layers){ for(size_t i=0;i<nn->n_layers;i++) h_layer_free(nn->layers[i]); free(nn->layers); }
+    if(nn->neurons_per_layer) mem_free(nn->neurons_per_layer);
+    if(nn->layers){ for(size_t i=0;i<nn->n_layers;i++) h_layer_free(nn->layers[i]); mem_free(nn->layers); }
     if(nn->output_layer) h_layer_free(nn->output_layer);
-    free(nn);
+    mem_free(nn);
 }
 
 /**
  * Predict (and optionally train) the neural network for a datapoint.
  *
- * The function accepts raw `data_point_t` input, normalizes it, runs a
+ * The function accepts a raw feature vector, normalizes it, runs a
  * forward pass and, if `target_raw` is non-NULL, performs an online
  * training update using `target_raw` as the desired raw outputs. After the
  * operation the predicted (denormalized) outputs are written into `out_raw`.
  *
  * @param nn network instance
- * @param in pointer to input datapoint (raw values)
+ * @param in pointer to input features (raw values, params.input_size of them)
  * @param target_raw optional pointer to target raw outputs (length OUTPUT_SIZE) or NULL
  * @param out_raw output buffer (length OUTPUT_SIZE) receiving denormalized prediction
  * @return Euclidean cost after training if training occurred, otherwise NaN
  */
-double nn_predict_and_maybe_train(nn_t* nn, const data_point_t* in, const float* target_raw, float* out_raw){
-    double input_norm[INPUT_SIZE];
+double nn_predict_and_maybe_train(nn_t* nn, const feature_vec_t* in, const float* target_raw, float* out_raw){
+    size_t n_in = nn->params.input_size;
+    double input_norm[FEATURE_MAX];
     normalize_input(&nn->params, in, input_norm);
     size_t n_hidden = nn->n_layers;
     size_t n_layers_total = n_hidden + 2; 
-    size_t *sizes = (size_t*)malloc(sizeof(size_t)*n_layers_total);
+    size_t *sizes = (size_t*)mem_alloc(MEM_NN, sizeof(size_t)*n_layers_total);
     if(!sizes) return NAN;
-    sizes[0] = INPUT_SIZE;
+    sizes[0] = n_in;
     for(size_t i=0;i<n_hidden;i++) sizes[i+1] = nn->layers[i]->n_neurons;
     sizes[n_layers_total-1] = OUTPUT_SIZE;
-    size_t *offset = (size_t*)malloc(sizeof(size_t)*n_layers_total);
-    if(!offset){ free(sizes); return NAN; }
+    size_t *offset = (size_t*)mem_alloc(MEM_NN, sizeof(size_t)*n_layers_total);
+    if(!offset){ mem_free(sizes); return NAN; }
     size_t acc = 0; for(size_t i=0;i<n_layers_total;i++){ offset[i]=acc; acc += sizes[i]; }
     size_t total_neurons = acc;
 
-    double *acts = (double*)malloc(sizeof(double)*total_neurons);
-    if(!acts){ free(sizes); free(offset); return NAN; }
-    for(size_t i=0;i<INPUT_SIZE;i++) acts[offset[0]+i] = input_norm[i];
+    double *acts = (double*)mem_alloc(MEM_NN, sizeof(double)*total_neurons);
+    if(!acts){ mem_free(sizes); mem_free(offset); return NAN; }
+    for(size_t i=0;i<n_in;i++) acts[offset[0]+i] = input_norm[i];
     for(size_t L=1; L<n_layers_total; L++){
         double *prev_ptr = &acts[offset[L-1]];
         size_t cur_n = sizes[L];
@@ -172,10 +183,10 @@ double nn_predict_and_maybe_train(nn_t* nn, const data_point_t* in, const float*
 
     if(target_raw){     
         double target_norm[OUTPUT_SIZE];
-        for(size_t i=0;i<OUTPUT_SIZE;i++) target_norm[i] = ((double)target_raw[i]) / nn->params.scales[i];
+        normalize_target(&nn->params, target_raw, target_norm);
         size_t deltas_len = total_neurons - sizes[0];
-    double *deltas = (double*)malloc(sizeof(double)*deltas_len);
-    if(!deltas){ free(acts); free(sizes); free(offset); return NAN; }
+    double *deltas = (double*)mem_alloc(MEM_NN, sizeof(double)*deltas_len);
+    if(!deltas){ mem_free(acts); mem_free(sizes); mem_free(offset); return NAN; }
         size_t out_layer_index = n_layers_total - 1;
         size_t out_off = offset[out_layer_index] - sizes[0];
         double sum_sq = 0.0;
@@ -228,7 +239,8 @@ double nn_predict_and_maybe_train(nn_t* nn, const data_point_t* in, const float*
                 }
             }
         }
-        {
+        if(LOG_ENABLED(LOG_LEVEL_DEBUG)){
+            /* a pass over every weight, only for the debug log */
             double sum_sq_w = 0.0;
             for(size_t L=0; L<nn->n_layers; L++){
                 h_layer_t *hl = nn->layers[L];
@@ -245,10 +257,10 @@ double nn_predict_and_maybe_train(nn_t* nn, const data_point_t* in, const float*
                 sum_sq_w += n->b*n->b;
             }
             double l2 = sqrt(sum_sq_w);
-            LOG_INFO("[nn-debug] weights L2 norm = %f\n", l2);
+            LOG_DEBUG("[nn-debug] weights L2 norm = %f\n", l2);
         }
         double cost = sqrt(sum_sq);
-    LOG_INFO("[nn] training: euclidean cost=%f\n", cost);
+    LOG_DEBUG("[nn] training: euclidean cost=%f\n", cost);
         for(size_t L=1; L<n_layers_total; L++){
             double *prev_ptr = &acts[offset[L-1]];
             size_t cur_n = sizes[L];
@@ -262,18 +274,18 @@ double nn_predict_and_maybe_train(nn_t* nn, const data_point_t* in, const float*
         }
         denormalize_output(&nn->params, out_norm, out_raw);
 
-    nn_save_weights(nn, "data/nn_weights.bin");
+    if(nn->params.weights_path) nn_save_weights(nn, nn->params.weights_path);
 
-        free(deltas);
-        free(acts);
-        free(sizes);
-        free(offset);
+        mem_free(deltas);
+        mem_free(acts);
+        mem_free(sizes);
+        mem_free(offset);
         return cost;
     } else {
         denormalize_output(&nn->params, out_norm, out_raw);
-        free(acts);
-        free(sizes);
-        free(offset);
+        mem_free(acts);
+        mem_free(sizes);
+        mem_free(offset);
         return NAN;
     }
 }
@@ -283,7 +295,8 @@ double nn_predict_and_maybe_train(nn_t* nn, const data_point_t* in, const float*
  *
  * The function attempts to create a parent directory (if present in the
  * filename) and writes a simple representation of the network (layer sizes
- * followed by per-neuron weight/bias arrays).
+ * followed by per-neuron weight/bias arrays) and the normalization block
+ * (see norm_write()).
  *
  * @param nn network instance
  * @param filename path to write the weight file
@@ -310,6 +323,7 @@ int nn_save_weights(nn_t* nn, const char* filename){
     for(size_t i=0;i<nn->n_layers;i++) if(fwrite(&nn->neurons_per_layer[i],sizeof(size_t),1,f)!=1){ fclose(f); return -1; }
     for(size_t i=0;i<nn->n_layers;i++) if(h_layer_write(f, nn->layers[i])!=0){ fclose(f); return -1; }
     if(h_layer_write(f, nn->output_layer)!=0){ fclose(f); return -1; }
+    if(norm_write(f, &nn->norm, &nn->params)!=0){ fclose(f); return -1; }
     fclose(f);
     return 0;
 }
@@ -340,8 +354,8 @@ static int skip_layer(FILE* fp){
  * Load network weights from a binary file into `nn` if compatible.
  *
  * The loader accepts files containing a prefix of hidden layers matching the
- * in-memory network and an optional output layer. Mismatches are reported
- * and loading fails gracefully.
+ * in-memory network and an optional output layer, followed by an optional
+ * normalization block. Mismatches are reported and loading fails gracefully.
  *
  * @param nn network instance to load into
  * @param filename path of the weight file to read
@@ -353,9 +367,9 @@ int nn_load_weights(nn_t* nn, const char* filename){
     if(fread(&file_n_layers, sizeof(size_t), 1, f) != 1){ fclose(f); return -1; }
     size_t *file_neurons = NULL;
     if(file_n_layers > 0){
-        file_neurons = (size_t*)malloc(sizeof(size_t) * file_n_layers);
+        file_neurons = (size_t*)mem_alloc(MEM_NN, sizeof(size_t) * file_n_layers);
         if(!file_neurons){ fclose(f); return -1; }
-        if(fread(file_neurons, sizeof(size_t), file_n_layers, f) != file_n_layers){ free(file_neurons); fclose(f); return -1; }
+        if(fread(file_neurons, sizeof(size_t), file_n_layers, f) != file_n_layers){ mem_free(file_neurons); fclose(f); return -1; }
     }
     LOG_INFO("[nn] weights file: hidden_layers_in_file=%zu, expected=%zu\n", file_n_layers, nn->n_layers);
     for(size_t i=0;i<file_n_layers;i++) LOG_INFO("[nn] file layer %zu neurons=%zu\n", i, file_neurons[i]);
@@ -363,24 +377,26 @@ int nn_load_weights(nn_t* nn, const char* filename){
     for(size_t i=0;i<prefix;i++){
         if(file_neurons[i] != nn->neurons_per_layer[i]){
             LOG_ERROR("[nn] layer size mismatch at index %zu: file=%zu expected=%zu\n", i, file_neurons[i], nn->neurons_per_layer[i]);
-            free(file_neurons); fclose(f); return -1;
+            mem_free(file_neurons); fclose(f); return -1;
         }
     }
     for(size_t i=0;i<file_n_layers;i++){
         if(i < nn->n_layers){
-            if(h_layer_read(f, nn->layers[i]) != 0){ free(file_neurons); fclose(f); return -1; }
+            if(h_layer_read(f, nn->layers[i]) != 0){ mem_free(file_neurons); fclose(f); return -1; }
         } else {
-            if(skip_layer(f) != 0){ free(file_neurons); fclose(f); return -1; }
+            if(skip_layer(f) != 0){ mem_free(file_neurons); fclose(f); return -1; }
         }
     }
     int output_loaded = 0;
     if(h_layer_read(f, nn->output_layer) == 0){
         output_loaded = 1;
+        /* files written before streaming normalization end here; the static scales stay in place */
+        if(norm_read(f, &nn->norm, &nn->params) == 0) LOG_INFO("[nn] restored normalization (%lld samples seen)\n", nn->norm.seen);
     } else {
         LOG_INFO("[nn] output layer in file did not match expected output layer; leaving random output layer\n");
     }
 
-    free(file_neurons);
+    mem_free(file_neurons);
     fclose(f);
 
     if(prefix > 0 || output_loaded) {
@@ -389,3 +405,395 @@ int nn_load_weights(nn_t* nn, const char* filename){
     }
     return -1;
 }
+
+/**
+ * Return layer `i` in forward order: hidden layers first, then the output
+ * layer at index n_layers.
+ *
+ * @param nn network instance
+ * @param i layer index in [0, n_layers]
+ * @return pointer to the layer
+ */
+static h_layer_t* nn_layer_at(const nn_t* nn, size_t i){
+    return (i < nn->n_layers) ? nn->layers[i] : nn->output_layer;
+}
+
+/**
+ * Number of trainable parameters (weights and biases) of the network.
+ *
+ * @param nn network instance
+ * @return parameter count
+ */
+size_t nn_param_count(const nn_t* nn){
+    size_t count = 0;
+    for(size_t li=0; li<=nn->n_layers; li++){
+        h_layer_t *L = nn_layer_at(nn, li);
+        for(size_t j=0;j<L->n_neurons;j++) count += L->neurons[j]->in_len + 1;
+    }
+    return count;
+}
+
+/**
+ * Copy all parameters into a flat array.
+ *
+ * Layout: for each layer in forward order, for each neuron its weights
+ * followed by its bias. The array must hold nn_param_count() values.
+ *
+ * @param nn network instance
+ * @param dst destination array
+ */
+void nn_export_params(const nn_t* nn, double* dst){
+    for(size_t li=0; li<=nn->n_layers; li++){
+        h_layer_t *L = nn_layer_at(nn, li);
+        for(size_t j=0;j<L->n_neurons;j++){
+            neuron_t *n = L->neurons[j];
+            memcpy(dst, n->w, sizeof(double) * n->in_len);
+            dst += n->in_len;
+            *dst++ = n->b;
+        }
+    }
+}
+
+/**
+ * Overwrite all parameters from a flat array produced by nn_export_params().
+ *
+ * @param nn network instance
+ * @param src source array of nn_param_count() values
+ */
+void nn_import_params(nn_t* nn, const double* src){
+    for(size_t li=0; li<=nn->n_layers; li++){
+        h_layer_t *L = nn_layer_at(nn, li);
+        for(size_t j=0;j<L->n_neurons;j++){
+            neuron_t *n = L->neurons[j];
+            memcpy(n->w, src, sizeof(double) * n->in_len);
+            src += n->in_len;
+            n->b = *src++;
+        }
+    }
+}
+
+/**
+ * Approximate heap memory owned by the network (structures and parameters).
+ *
+ * @param nn network instance
+ * @return size in bytes
+ */
+size_t nn_memory_bytes(const nn_t* nn){
+    size_t bytes = sizeof(nn_t) + sizeof(size_t) * nn->n_layers + sizeof(h_layer_t*) * nn->n_layers;
+    for(size_t li=0; li<=nn->n_layers; li++){
+        h_layer_t *L = nn_layer_at(nn, li);
+        bytes += sizeof(h_layer_t) + sizeof(neuron_t*) * L->n_neurons;
+        for(size_t j=0;j<L->n_neurons;j++) bytes += sizeof(neuron_t) + sizeof(double) * L->neurons[j]->in_len;
+    }
+    return bytes;
+}
+
+/**
+ * Number of weight layers (hidden layers plus the output layer). Callers of
+ * nn_train_sample() use it to size their per-layer lock array.
+ *
+ * @param nn network instance
+ * @return layer count
+ */
+size_t nn_layer_count(const nn_t* nn){
+    return nn->n_layers + 1;
+}
+
+/**
+ * Feed one sample to the network's streaming normalization (see norm.c).
+ *
+ * @param nn network instance
+ * @param in input features of the sample (raw values)
+ * @param target_raw raw metrics of the sample (length OUTPUT_SIZE)
+ */
+void nn_observe(nn_t* nn, const feature_vec_t* in, const float* target_raw){
+    norm_observe(&nn->norm, &nn->params, in, target_raw);
+}
+
+/**
+ * Write the network's normalization block to a checkpoint.
+ *
+ * @param nn network instance
+ * @param f file open for writing
+ * @return 0 on success, -1 on error
+ */
+int nn_write_norm(const nn_t* nn, FILE* f){
+    return norm_write(f, &nn->norm, &nn->params);
+}
+
+/**
+ * Restore the network's normalization from a checkpoint block.
+ *
+ * @param nn network instance
+ * @param f file positioned at the block
+ * @return 0 on success, -1 when missing or incompatible
+ */
+int nn_read_norm(nn_t* nn, FILE* f){
+    return norm_read(f, &nn->norm, &nn->params);
+}
+
+/**
+ * One online training step that is safe to run from several threads on the
+ * same network.
+ *
+ * Same forward / backward pass as nn_predict_and_maybe_train(), but the
+ * activations and pre-activations live in a private buffer instead of the
+ * neurons, nothing is logged and no weight file is written. Without locks the
+ * weight updates race with other trainers (Hogwild); with `layer_locks` the
+ * layer being read or updated is held locked, one mutex per layer in forward
+ * order (nn_layer_count() entries).
+ *
+ * @param nn network instance shared by the trainers
+ * @param in input features (raw values, params.input_size of them)
+ * @param target_raw desired raw outputs (length OUTPUT_SIZE)
+ * @param layer_locks per-layer mutexes, or NULL for lock-free updates
+ * @return Euclidean cost (normalized domain) before the update, NaN on allocation failure
+ */
+double nn_train_sample(nn_t* nn, const feature_vec_t* in, const float* target_raw, pthread_mutex_t* layer_locks){
+    size_t n_in = nn->params.input_size;
+    size_t n_w = nn->n_layers + 1;
+    size_t total = n_in;
+    for(size_t li=0; li<n_w; li++) total += nn_layer_at(nn, li)->n_neurons;
+    /* acts: all neurons incl. inputs; zs and deltas: neurons of the weight layers only */
+    double *buf = (double*)mem_alloc(MEM_NN, sizeof(double) * (3 * total - 2 * n_in));
+    if(!buf) return NAN;
+    double *acts = buf;
+    double *zs = acts + total;
+    double *deltas = zs + (total - n_in);
+
+    normalize_input(&nn->params, in, acts);
+    size_t a_off = 0, z_off = 0;
+    for(size_t li=0; li<n_w; li++){
+        h_layer_t *L = nn_layer_at(nn, li);
+        const double *prev = &acts[a_off];
+        size_t prev_n = (li == 0) ? n_in : nn_layer_at(nn, li-1)->n_neurons;
+        if(layer_locks) pthread_mutex_lock(&layer_locks[li]);
+        for(size_t j=0;j<L->n_neurons;j++){
+            double z = neuron_preact(L->neurons[j], prev);
+            zs[z_off + j] = z;
+            acts[a_off + prev_n + j] = neuron_activate(L->neurons[j], z);
+        }
+        if(layer_locks) pthread_mutex_unlock(&layer_locks[li]);
+        a_off += prev_n;
+        z_off += L->n_neurons;
+    }
+
+    /* output deltas: prediction - target in the normalized domain */
+    h_layer_t *OL = nn->output_layer;
+    size_t out_z = z_off - OL->n_neurons;
+    double target_norm[OUTPUT_SIZE];
+    normalize_target(&nn->params, target_raw, target_norm);
+    double sum_sq = 0.0;
+    for(size_t j=0;j<OL->n_neurons;j++){
+        double diff = acts[n_in + out_z + j] - target_norm[j];
+        deltas[out_z + j] = diff;
+        sum_sq += diff * diff;
+    }
+    /* propagate to hidden layers through the (pre-update) weights of the next layer */
+    size_t next_z = out_z;
+    for(size_t li=n_w-1; li-- > 0;){
+        h_layer_t *L = nn_layer_at(nn, li);
+        h_layer_t *N = nn_layer_at(nn, li+1);
+        size_t cur_z = next_z - L->n_neurons;
+        for(size_t i=0;i<L->n_neurons;i++) deltas[cur_z + i] = 0.0;
+        if(layer_locks) pthread_mutex_lock(&layer_locks[li+1]);
+        for(size_t j=0;j<N->n_neurons;j++){
+            const neuron_t *nxt = N->neurons[j];
+            double dnext = deltas[next_z + j];
+            for(size_t i=0;i<L->n_neurons;i++) deltas[cur_z + i] += dnext * nxt->w[i];
+        }
+        if(layer_locks) pthread_mutex_unlock(&layer_locks[li+1]);
+        next_z = cur_z;
+    }
+    /* apply updates layer by layer */
+    a_off = 0; z_off = 0;
+    for(size_t li=0; li<n_w; li++){
+        h_layer_t *L = nn_layer_at(nn, li);
+        const double *prev = &acts[a_off];
+        if(layer_locks) pthread_mutex_lock(&layer_locks[li]);
+        for(size_t j=0;j<L->n_neurons;j++)
+            neuron_update_z(L->neurons[j], prev, zs[z_off + j], deltas[z_off + j], nn->params.learning_rate);
+        if(layer_locks) pthread_mutex_unlock(&layer_locks[li]);
+        a_off += (li == 0) ? n_in : nn_layer_at(nn, li-1)->n_neurons;
+        z_off += L->n_neurons;
+    }
+    mem_free(buf);
+    return sqrt(sum_sq);
+}
+
+/**
+ * Batch inference state: the weights of every layer packed into panels of
+ * NN_BATCH_PANEL neurons (for each input k the panel's NN_BATCH_PANEL weights
+ * are adjacent, the last panel is padded with zero weights), followed by the
+ * biases, plus two activation tiles of NN_BATCH_TILE samples.
+ *
+ * nn: network the weights were packed from (normalization is read live)
+ * n_w: weight layers in forward order
+ * n_in, n_out: input / output width per layer
+ * w, b: packed weights and biases per layer
+ * tile_a, tile_b: ping-pong activations, NN_BATCH_TILE rows of the widest layer
+ */
+struct nn_batch_s {
+    const nn_t *nn;
+    size_t n_w;
+    size_t *n_in, *n_out;
+    double **w, **b;
+    double *tile_a, *tile_b;
+};
+
+#define NN_BATCH_PANEL 4
+
+/** Neurons of a layer rounded up to whole panels. */
+static size_t batch_padded(size_t n){
+    return (n + NN_BATCH_PANEL - 1) / NN_BATCH_PANEL * NN_BATCH_PANEL;
+}
+
+/**
+ * Pack the network's weights for nn_batch_predict(). The pack is a snapshot:
+ * training the network afterwards does not change the batch predictions
+ * until a new pack is made. One pack must not be used by two threads at once.
+ *
+ * @param nn network instance
+ * @return allocated batch state or NULL on error
+ */
+nn_batch_t* nn_batch_create(const nn_t* nn){
+    size_t n_w = nn->n_layers + 1;
+    size_t packed = 0;
+    size_t widest = nn->params.input_size;
+    for(size_t li=0; li<n_w; li++){
+        const h_layer_t *L = nn_layer_at(nn, li);
+        size_t pad = batch_padded(L->n_neurons);
+        packed += pad * (L->input_len + 1);
+        if(pad > widest) widest = pad;
+    }
+    nn_batch_t *bt = (nn_batch_t*)mem_calloc(MEM_NN, 1, sizeof(nn_batch_t));
+    if(!bt) return NULL;
+    bt->nn = nn;
+    bt->n_w = n_w;
+    bt->n_in = (size_t*)mem_alloc(MEM_NN, sizeof(size_t) * 2 * n_w);
+    bt->w = (double**)mem_alloc(MEM_NN, sizeof(double*) * 2 * n_w);
+    /* one block: packed parameters, then both tiles */
+    double *mem = (double*)mem_calloc(MEM_NN, packed + 2 * NN_BATCH_TILE * widest, sizeof(double));
+    if(!bt->n_in || !bt->w || !mem){ mem_free(mem); bt->n_w = 0; nn_batch_free(bt); return NULL; }
+    bt->n_out = bt->n_in + n_w;
+    bt->b = bt->w + n_w;
+    for(size_t li=0; li<n_w; li++){
+        const h_layer_t *L = nn_layer_at(nn, li);
+        size_t n_in = L->input_len, pad = batch_padded(L->n_neurons);
+        bt->n_out[li] = L->n_neurons;
+        bt->n_in[li] = n_in;
+        bt->w[li] = mem;
+        bt->b[li] = mem + pad * n_in;
+        for(size_t j=0;j<L->n_neurons;j++){
+            double *panel = bt->w[li] + (j / NN_BATCH_PANEL) * NN_BATCH_PANEL * n_in + j % NN_BATCH_PANEL;
+            for(size_t k=0;k<n_in;k++) panel[k * NN_BATCH_PANEL] = L->neurons[j]->w[k];
+            bt->b[li][j] = L->neurons[j]->b;
+        }
+        mem = bt->b[li] + pad;
+    }
+    bt->tile_a = mem;
+    bt->tile_b = mem + NN_BATCH_TILE * widest;
+    return bt;
+}
+
+void nn_batch_free(nn_batch_t* bt){
+    if(!bt) return;
+    if(bt->w && bt->n_w > 0) mem_free(bt->w[0]);
+    mem_free(bt->w);
+    mem_free(bt->n_in);
+    mem_free(bt);
+}
+
+/**
+ * Z = A * W^T + b for one tile. A holds `rows` samples of n_in values, W is
+ * packed in panels (see nn_batch_s), Z receives `rows` rows of n_out values.
+ * The kernel computes 4 samples x one panel at a time: every input loaded
+ * feeds NN_BATCH_PANEL accumulators and every weight 4, and the panel's
+ * adjacent weights let the compiler use vector registers.
+ */
+static void batch_gemm(const double *A, size_t rows, size_t n_in, const double *W, const double *b, size_t n_out, double *Z){
+    size_t r = 0;
+    for(; r + 4 <= rows; r += 4){
+        const double *a0 = A + r * n_in, *a1 = a0 + n_in, *a2 = a1 + n_in, *a3 = a2 + n_in;
+        for(size_t j=0; j<n_out; j+=NN_BATCH_PANEL){
+            const double *wp = W + j * n_in;
+            double c0[NN_BATCH_PANEL] = {0}, c1[NN_BATCH_PANEL] = {0}, c2[NN_BATCH_PANEL] = {0}, c3[NN_BATCH_PANEL] = {0};
+            for(size_t k=0;k<n_in;k++){
+                const double *w = wp + k * NN_BATCH_PANEL;
+                double x0 = a0[k], x1 = a1[k], x2 = a2[k], x3 = a3[k];
+                for(int q=0;q<NN_BATCH_PANEL;q++){
+                    c0[q] += x0 * w[q];
+                    c1[q] += x1 * w[q];
+                    c2[q] += x2 * w[q];
+                    c3[q] += x3 * w[q];
+                }
+            }
+            size_t cols = n_out - j < NN_BATCH_PANEL ? n_out - j : NN_BATCH_PANEL;
+            for(size_t q=0;q<cols;q++){
+                Z[r * n_out + j + q] = c0[q] + b[j + q];
+                Z[(r + 1) * n_out + j + q] = c1[q] + b[j + q];
+                Z[(r + 2) * n_out + j + q] = c2[q] + b[j + q];
+                Z[(r + 3) * n_out + j + q] = c3[q] + b[j + q];
+            }
+        }
+    }
+    for(; r<rows; r++){
+        const double *a = A + r * n_in;
+        for(size_t j=0; j<n_out; j+=NN_BATCH_PANEL){
+            const double *wp = W + j * n_in;
+            double c[NN_BATCH_PANEL] = {0};
+            for(size_t k=0;k<n_in;k++)
+                for(int q=0;q<NN_BATCH_PANEL;q++) c[q] += a[k] * wp[k * NN_BATCH_PANEL + q];
+            size_t cols = n_out - j < NN_BATCH_PANEL ? n_out - j : NN_BATCH_PANEL;
+            for(size_t q=0;q<cols;q++) Z[r * n_out + j + q] = c[q] + b[j + q];
+        }
+    }
+}
+
+/**
+ * Predict M samples with packed weights. Samples go through the network one
+ * tile of NN_BATCH_TILE at a time: the tile's activations stay in cache from
+ * the input to the output layer and each layer is one matrix-matrix product.
+ *
+ * @param bt batch state from nn_batch_create()
+ * @param in M input feature vectors (raw values)
+ * @param m number of samples
+ * @param out_raw receives M * OUTPUT_SIZE denormalized predictions
+ */
+void nn_batch_predict(nn_batch_t* bt, const feature_vec_t* in, size_t m, float* out_raw){
+    const nn_t *nn = bt->nn;
+    size_t n_in = nn->params.input_size;
+    for(size_t s=0; s<m; s+=NN_BATCH_TILE){
+        size_t rows = m - s < NN_BATCH_TILE ? m - s : NN_BATCH_TILE;
+        double *a = bt->tile_a, *z = bt->tile_b;
+        for(size_t r=0;r<rows;r++) normalize_input(&nn->params, &in[s + r], a + r * n_in);
+        for(size_t li=0; li<bt->n_w; li++){
+            const h_layer_t *L = nn_layer_at(nn, li);
+            size_t n_out = bt->n_out[li];
+            batch_gemm(a, rows, bt->n_in[li], bt->w[li], bt->b[li], n_out, z);
+            for(size_t r=0;r<rows;r++)
+                for(size_t j=0;j<n_out;j++) z[r * n_out + j] = neuron_activate(L->neurons[j], z[r * n_out + j]);
+            double *t = a; a = z; z = t;
+        }
+        for(size_t r=0;r<rows;r++) denormalize_output(&nn->params, a + r * OUTPUT_SIZE, out_raw + (s + r) * OUTPUT_SIZE);
+    }
+}
+
+/**
+ * Predict M samples at once (no training). Same results as calling
+ * nn_predict_and_maybe_train() without a target on every sample, up to
+ * floating point summation order.
+ *
+ * @param nn network instance
+ * @param in M input feature vectors (raw values)
+ * @param m number of samples
+ * @param out_raw receives M * OUTPUT_SIZE denormalized predictions
+ * @return 0 on success, -1 on allocation failure
+ */
+int nn_predict_batch(const nn_t* nn, const feature_vec_t* in, size_t m, float* out_raw){
+    nn_batch_t *bt = nn_batch_create(nn);
+    if(!bt) return -1;
+    nn_batch_predict(bt, in, m, out_raw);
+    nn_batch_free(bt);
+    return 0;
+}
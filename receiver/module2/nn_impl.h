@@ -12,7 +12,7 @@
 nn_t* nn_create(const nn_params_t *params);
 void nn_free(nn_t* nn);
 
-double nn_predict_and_maybe_train(nn_t* nn, const data_point_t* in, const float* target_raw, float* out_raw);
+double nn_predict_and_maybe_train(nn_t* nn, const feature_vec_t* in, const float* target_raw, float* out_raw);
 
 int nn_save_weights(nn_t* nn, const char* filename);
 int nn_load_weights(nn_t* nn, const char* filename);
@@ -5,8 +5,13 @@
  * construction of parameter sets used by the network at runtime.
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "nn_params.h"
 
+static const char *act_names[] = { "linear", "relu", "sigmoid", "tanh" };
+
 /**
  * Return a set of default neural network parameters.
  *
@@ -33,8 +38,63 @@ nn_params_t default_nn_params(){
     p.scales[3] = 28.47470817; 
     p.scales[4] = 865677.7584; 
     p.scales[5] = 4782337.7; 
+    // without a feature stage the inputs are the raw metrics
+    p.input_size = N_METRICS;
+    for(size_t i=0;i<FEATURE_MAX;i++){ p.input_offsets[i] = 0.0; p.input_scales[i] = i < N_METRICS ? p.scales[i] : 1.0; }
+    // the static scales are only the starting point, see norm.c
+    p.norm.adaptive = 1;
+    p.norm.window = 1024;
+    p.norm.rate = 0.1;
+    p.norm.freeze_after = 0;
     p.hidden_activation = ACT_SIGMOID;
     p.output_activation = ACT_RELU;
+    p.weights_path = "data/nn_weights.bin";
 
     return p;
 }
+
+/**
+ * Parse a hidden layer spec: comma-separated neuron counts, e.g.
+ * "16,32,16"; "none" means no hidden layer.
+ *
+ * @param spec layer spec
+ * @param sizes receives the neuron count of every layer
+ * @param cap capacity of `sizes`
+ * @return number of layers, -1 when malformed or longer than `cap`
+ */
+int nn_parse_layers(const char *spec, size_t *sizes, size_t cap){
+    if(!spec) return -1;
+    if(strcmp(spec, "none") == 0) return 0;
+    int n = 0;
+    const char *s = spec;
+    while(1){
+        char *end = NULL;
+        long v = strtol(s, &end, 10);
+        if(end == s || v < 1 || v > 4096 || (size_t)n >= cap) return -1;
+        sizes[n++] = (size_t)v;
+        if(*end == '\0') return n;
+        if(*end != ',') return -1;
+        s = end + 1;
+    }
+}
+
+/**
+ * Parse an activation function name (linear, relu, sigmoid, tanh).
+ *
+ * @param name activation name
+ * @param act receives the activation
+ * @return 0 on success, -1 when unknown
+ */
+int nn_parse_activation(const char *name, act_t *act){
+    for(size_t i=0;i<sizeof(act_names)/sizeof(act_names[0]);i++){
+        if(name && strcmp(name, act_names[i]) == 0){ *act = (act_t)i; return 0; }
+    }
+    return -1;
+}
+
+/**
+ * Name of an activation function, as accepted by nn_parse_activation().
+ */
+const char* nn_activation_name(act_t act){
+    return (size_t)act < sizeof(act_names)/sizeof(act_names[0]) ? act_names[act] : "?";
+}
@@ -9,8 +9,26 @@
 
 #include <stddef.h>
 #include "neuron.h"
-#define INPUT_SIZE 6
-#define OUTPUT_SIZE 6
+#include "../types.h"
+#define OUTPUT_SIZE N_METRICS
+
+/** Largest number of hidden layers accepted in a layer spec. */
+#define NN_LAYERS_MAX 16
+
+/**
+ * Streaming normalization policy (see norm.h).
+ *
+ * adaptive: non-zero to learn the scales from the data, zero keeps the static scales
+ * window: samples per statistics window; the scales move once per window
+ * rate: fraction of the way the scales move towards a window's estimate (0..1)
+ * freeze_after: samples after which the scales stop moving (0 = never)
+ */
+typedef struct {
+    int adaptive;
+    int window;
+    double rate;
+    long long freeze_after;
+} norm_policy_t;
 
 /**
  * Neural network parameters structure.
@@ -18,17 +36,30 @@
  * n_hidden_layers: number of hidden layers
  * neurons_per_layer: array of neuron counts per hidden layer (length n_hidden_layers)
  * learning_rate: learning rate for online training
- * scales: array of scale factors for input normalization (length INPUT_SIZE)
+ * scales: array of scale factors of the metrics, used for the targets and outputs (length OUTPUT_SIZE)
+ * input_size: number of input features (the width of the feature set)
+ * input_offsets: subtracted from the inputs before scaling (length input_size)
+ * input_scales: scale factors for input normalization (length input_size)
+ * norm: how the scales and offsets follow the data
+ * weights_path: file the weights are loaded from on create and saved to after training / on free (NULL = none)
  */
 typedef struct {
     size_t n_hidden_layers;
     size_t *neurons_per_layer; 
     double learning_rate;
-    double scales[INPUT_SIZE]; 
+    double scales[OUTPUT_SIZE];
+    size_t input_size;
+    double input_offsets[FEATURE_MAX];
+    double input_scales[FEATURE_MAX];
+    norm_policy_t norm;
     act_t hidden_activation;
     act_t output_activation;
+    const char *weights_path;
 } nn_params_t;
 
 nn_params_t default_nn_params();
+int nn_parse_layers(const char *spec, size_t *sizes, size_t cap);
+int nn_parse_activation(const char *name, act_t *act);
+const char* nn_activation_name(act_t act);
 
 #endif
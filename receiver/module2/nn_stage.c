@@ -0,0 +1,475 @@
+/*
+ * nn_stage.c
+ *
+ * Per-record neural-network stage: looks up the model of the record's source,
+ * predicts the next sample (or the next `--horizon` samples), reports the
+ * error of the previous prediction and submits the previous -> current
+ * training pair to the budgeted scheduler.
+ * The stage is independent of any queue so it can be driven by `nn_thread`
+ * or run inline by a receiver shard.
+ */
+
+#ifndef NN_STAGE_C_HEADER
+#define NN_STAGE_C_HEADER
+#include "nn_stage.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "nn.h"
+#include "nn_params.h"
+#include "model_cache.h"
+#include "hogwild.h"
+#include "gru.h"
+#include "horizon.h"
+#include "federation.h"
+#include "../module1/feature_stage.h"
+#include "../config.h"
+#include "../platform.h"
+#include "../log.h"
+#include "../tsdb.h"
+#include "../latency.h"
+#include "../trace.h"
+#include "../perfctr.h"
+#include "../memstat.h"
+
+/** Longest sleep of an idle federated stage, in milliseconds. */
+#define NN_FED_IDLE_MS 100
+
+/**
+ * NN stage structure definition.
+ *
+ * models: per-source model cache
+ * sched: budgeted training scheduler shared by all models of the stage
+ * stats_slot: gauge slot the stage publishes its cache / backlog gauges to
+ * shared_model: non-zero when all records use the single autosaved model
+ * trainer_mode: update synchronization of the parallel trainer
+ * trainer: parallel trainer of the shared model (`--train-threads` > 1), NULL when training inline
+ * gru: recurrent model shared by the stage's sources (`--model=gru`), NULL for the MLP
+ * gru_path: file the recurrent weights are loaded from / saved to
+ * input_size: width of the feature vectors the models take (`--features`)
+ * features: feature set the inputs are computed with, used to roll forecasts forward
+ * horizon: number of forecast samples per record (`--horizon`)
+ */
+struct nn_stage_s {
+    model_cache_t *models;
+    train_sched_t sched;
+    int stats_slot;
+    int shared_model;
+    hogwild_mode_t trainer_mode;
+    hogwild_t *trainer;
+    gru_t *gru;
+    char gru_path[320];
+    size_t input_size;
+    feature_set_t features;
+    int horizon;
+    size_t layers[NN_LAYERS_MAX];
+    federation_t *fed;
+};
+
+/**
+ * Evict hook of the model cache: drop deferred training samples of a model
+ * (counted as dropped, like samples pushed out of a full backlog) and the
+ * source's recurrent state and forecasts before the entry is freed.
+ *
+ * @param e entry being evicted
+ * @param ctx NN stage
+ */
+static void nn_on_model_evict(model_entry_t *e, void *ctx){
+    nn_stage_t *st = (nn_stage_t*)ctx;
+    int dropped = train_sched_discard(&st->sched, e->nn);
+    if(dropped > 0) LOG_DEBUG("[nn] dropped %d deferred training samples of evicted model '%s'\n", dropped, e->key);
+    gru_stream_free(e->stream);
+    e->stream = NULL;
+    horizon_free(e->horizon);
+    e->horizon = NULL;
+}
+
+/**
+ * Create an NN stage.
+ *
+ * With a spill directory every model is kept in the LRU cache, seeded from
+ * the shared weight file and spilled on eviction. Without one (classic
+ * single-model pipeline) the shared model autoloads/autosaves the weight
+ * file as before; with `--train-threads` > 1 its training runs on a parallel
+ * trainer instead of the budgeted scheduler.
+ *
+ * With `--model=gru` predictions come from a recurrent model shared by the
+ * stage; every source keeps its own hidden state in its cache entry (the
+ * state is not spilled, an evicted source starts from a fresh state).
+ *
+ * The model input width and its normalization follow the `--features` set;
+ * with `--norm=adaptive` every model learns its offsets / scales from the
+ * records it sees and keeps them in its checkpoint.
+ *
+ * With `--horizon` > 1 every source also keeps forecasts for its next
+ * samples, refreshed by rollout after each record (see horizon.c).
+ *
+ * With `--fed-port` the single shared MLP of the classic pipeline is averaged
+ * with the models of other analyzers (see federation.c).
+ *
+ * @param stats_slot gauge slot for the stage's cache and backlog gauges
+ * @param train_budget fraction of one core this stage's training may use (<= 0 = unlimited)
+ * @param cache_bytes memory budget for resident per-source models
+ * @param spill_dir directory for spilled models, or NULL for the autosaved shared model
+ * @return allocated stage or NULL on error
+ */
+nn_stage_t* nn_stage_create(int stats_slot, double train_budget, size_t cache_bytes, const char *spill_dir){
+    nn_stage_t *st = (nn_stage_t*)mem_calloc(MEM_NN, 1, sizeof(nn_stage_t));
+    if(!st) return NULL;
+    st->stats_slot = stats_slot;
+    st->shared_model = spill_dir == NULL;
+    if(hogwild_parse_mode(g_config.train_sync, &st->trainer_mode) != 0){
+        LOG_ERROR("unknown --train-sync mode '%s' (expected hogwild or striped)\n", g_config.train_sync);
+        mem_free(st);
+        return NULL;
+    }
+    nn_params_t params = default_nn_params();
+    int n_layers = nn_parse_layers(g_config.layers, st->layers, NN_LAYERS_MAX);
+    if(n_layers < 0 || nn_parse_activation(g_config.hidden_act, &params.hidden_activation) != 0
+       || nn_parse_activation(g_config.output_act, &params.output_activation) != 0){
+        LOG_ERROR("invalid --layers '%s', --hidden-act '%s' or --output-act '%s'\n", g_config.layers, g_config.hidden_act, g_config.output_act);
+        mem_free(st);
+        return NULL;
+    }
+    /* the cache copies `params`, st->layers lives as long as the stage */
+    params.n_hidden_layers = (size_t)n_layers;
+    params.neurons_per_layer = st->layers;
+    params.learning_rate = g_config.learning_rate;
+    params.weights_path = g_config.weights;
+    feature_set_t fs;
+    if(feature_set_parse(g_config.features, &fs) != 0){
+        LOG_ERROR("invalid --features '%s'\n", g_config.features);
+        mem_free(st);
+        return NULL;
+    }
+    params.input_size = fs.n_features;
+    feature_set_scales(&fs, params.scales, params.input_scales);
+    st->input_size = fs.n_features;
+    st->features = fs;
+    st->horizon = g_config.horizon;
+    if(st->horizon < 1 || st->horizon > HORIZON_MAX){
+        LOG_ERROR("invalid --horizon %d (expected 1..%d)\n", g_config.horizon, HORIZON_MAX);
+        mem_free(st);
+        return NULL;
+    }
+    if(strcmp(g_config.norm, "adaptive") != 0 && strcmp(g_config.norm, "static") != 0){
+        LOG_ERROR("unknown --norm '%s' (expected adaptive or static)\n", g_config.norm);
+        mem_free(st);
+        return NULL;
+    }
+    params.norm.adaptive = strcmp(g_config.norm, "adaptive") == 0;
+    params.norm.window = g_config.norm_window;
+    params.norm.rate = g_config.norm_rate;
+    params.norm.freeze_after = g_config.norm_freeze;
+    if(strcmp(g_config.model, "gru") == 0){
+        st->gru = gru_create(&params, (size_t)g_config.gru_hidden, (size_t)g_config.gru_window);
+        if(!st->gru){ LOG_ERROR("cannot create GRU model (hidden=%d)\n", g_config.gru_hidden); mem_free(st); return NULL; }
+        if(stats_slot == 0) snprintf(st->gru_path, sizeof(st->gru_path), "%s", g_config.gru_weights);
+        else snprintf(st->gru_path, sizeof(st->gru_path), "%s.%d", g_config.gru_weights, stats_slot);
+        if(gru_load(st->gru, st->gru_path) == 0) LOG_INFO("[nn] loaded GRU weights from %s\n", st->gru_path);
+        /* cache entries only carry the per-source bookkeeping, keep their MLP minimal */
+        params.n_hidden_layers = 0;
+        params.weights_path = NULL;
+    } else if(strcmp(g_config.model, "mlp") != 0){
+        LOG_ERROR("unknown --model '%s' (expected mlp or gru)\n", g_config.model);
+        mem_free(st);
+        return NULL;
+    }
+    if(spill_dir){
+        const char *seed = params.weights_path;
+        params.weights_path = NULL;
+        st->models = model_cache_create(&params, cache_bytes, spill_dir, seed);
+    } else {
+        /* with --state-dir the shared model is spilled on shutdown too, keeping its previous sample and normalization */
+        char state_models[320];
+        int warm = g_config.state_dir && g_config.state_dir[0];
+        if(warm) snprintf(state_models, sizeof(state_models), "%s/models%d", g_config.state_dir, stats_slot);
+        st->models = model_cache_create(&params, (size_t)-1, warm ? state_models : NULL, NULL);
+    }
+    if(!st->models){ LOG_ERROR("model_cache_create failed\n"); gru_free(st->gru); mem_free(st); return NULL; }
+    size_t extra = st->gru ? gru_stream_bytes(st->gru) : 0;
+    if(st->horizon > 1) extra += horizon_bytes(st->horizon, st->gru);
+    if(extra) model_cache_set_entry_extra(st->models, extra);
+    if(train_sched_init(&st->sched, train_budget, g_config.train_backlog, stats_slot) != 0){
+        LOG_ERROR("train_sched_init failed\n");
+        model_cache_free(st->models);
+        gru_free(st->gru);
+        mem_free(st);
+        return NULL;
+    }
+    model_cache_set_evict_hook(st->models, nn_on_model_evict, st);
+    if(st->shared_model && !st->gru && g_config.train_threads > 1){
+        /* started once: when the threads cannot be created the stage keeps training inline */
+        model_entry_t *shared = model_cache_get(st->models, "");
+        st->trainer = shared ? hogwild_create(shared->nn, g_config.train_threads, st->trainer_mode, g_config.train_backlog) : NULL;
+        if(!st->trainer) LOG_ERROR("[nn] cannot start %d training threads, training inline\n", g_config.train_threads);
+    }
+    if(g_config.fed_port > 0 && st->shared_model && !st->gru && stats_slot == 0){
+        model_entry_t *shared = model_cache_get(st->models, "");
+        st->fed = shared ? federation_create(shared->nn, g_config.fed_port, g_config.fed_peers, g_config.fed_interval,
+                                             g_config.fed_kbps, g_config.fed_keyframe) : NULL;
+        if(!st->fed) LOG_ERROR("[nn] cannot start federation on UDP port %d, running alone\n", g_config.fed_port);
+    }
+    return st;
+}
+
+/**
+ * Free an NN stage. Deferred samples are trained first, ignoring the budget,
+ * then resident models are spilled.
+ *
+ * @param st stage to free (may be NULL)
+ * @return 0 on success, -1 when a model could not be saved
+ */
+int nn_stage_free(nn_stage_t *st){
+    if(!st) return 0;
+    int rc = 0;
+    int flushed = train_sched_flush(&st->sched);
+    if(flushed > 0) LOG_INFO("[nn] trained %d deferred samples before shutdown\n", flushed);
+    /* stop the trainer and the federation first: they reference the shared model owned by the cache */
+    hogwild_free(st->trainer);
+    federation_free(st->fed);
+    /* free the scheduler only after the cache: evicting spills the models and discards their samples */
+    if(model_cache_free(st->models) != 0) rc = -1;
+    train_sched_free(&st->sched);
+    if(st->gru){
+        if(gru_save(st->gru, st->gru_path) == 0) LOG_INFO("[nn] saved GRU weights to %s\n", st->gru_path);
+        else { LOG_ERROR("[nn] failed to save GRU weights to %s\n", st->gru_path); rc = -1; }
+        gru_free(st->gru);
+    }
+    mem_free(st);
+    return rc;
+}
+
+/**
+ * Save the state of every model of the stage while it keeps running:
+ * deferred samples and those queued to the trainer threads are trained
+ * first, then the resident models are written
+ * to their spill files (the shared model to `--state-dir`) and the recurrent
+ * weights to their file.
+ *
+ * @param st stage
+ * @return 0 on success, -1 when a model could not be saved
+ */
+int nn_stage_checkpoint(nn_stage_t *st){
+    train_sched_flush(&st->sched);
+    /* the marker covers the samples queued to the trainer threads, and they must not write the weights while they are saved */
+    if(st->trainer) hogwild_wait_idle(st->trainer);
+    int rc = model_cache_checkpoint(st->models);
+    if(st->gru && gru_save(st->gru, st->gru_path) != 0) rc = -1;
+    return rc;
+}
+
+/**
+ * Train the recurrent model on the prediction the source's previous step
+ * made. The stream's state has already moved on, so a step that does not fit
+ * into the budget is dropped instead of deferred.
+ *
+ * @param st stage
+ * @param me entry of the record's source
+ * @param cur_raw actual values of the current record
+ */
+static void nn_stage_train_gru(nn_stage_t *st, model_entry_t *me, const float *cur_raw){
+    if(!train_sched_admit(&st->sched)){ stats_inc_train_dropped(); return; }
+    long long t0 = platform_thread_cpu_ns();
+    double cost = gru_stream_train_prev(st->gru, me->stream, cur_raw);
+    if(!isnan(cost)) train_sched_charge(&st->sched, platform_thread_cpu_ns() - t0, cost);
+}
+
+/**
+ * Refresh the forecasts of the record's source after its one-step prediction.
+ *
+ * @param st stage
+ * @param me entry of the record's source
+ * @param x input features of the record
+ * @param cur_raw actual values of the record
+ * @param pred1 prediction for the next sample
+ * @return the source's forecasts, or NULL when they cannot be kept
+ */
+static const horizon_t* nn_stage_forecast(nn_stage_t *st, model_entry_t *me, const feature_vec_t *x, const float *cur_raw, const float *pred1){
+    if(!me->horizon) me->horizon = horizon_create(st->horizon, st->gru);
+    if(!me->horizon) return NULL;
+    horizon_model_t m = { me->nn, st->gru, &st->features };
+    int reused = 0;
+    int steps = horizon_update(me->horizon, &m, x, cur_raw, pred1, st->gru ? gru_stream_hidden(me->stream) : NULL,
+                               g_config.horizon_tol, &reused);
+    stats_record_horizon(reused, steps);
+    return me->horizon;
+}
+
+/**
+ * Process one record.
+ *
+ * Parses a CSV-formatted line (`ts,bytes,flows,packets,rtr,rtt,srt`, followed
+ * by `|x1,...,xN` when the feature stage computed the inputs), predicts the next sample with the model of the record's
+ * source and pushes the `pred_prev` / `pred` records to `out_q`. With
+ * `--horizon=K` > 1 the `pred` record carries `,hJ,v1,...,v6` for J = 2..K
+ * after its cost. Inference always runs first; the previous -> current
+ * training pair is handed to the scheduler afterwards.
+ *
+ * @param st stage
+ * @param line record line
+ * @param meta record metadata (source address); its hop time moves to when the predictions were queued
+ * @param out_q queue receiving the output records
+ */
+void nn_stage_process(nn_stage_t *st, const char *line, rec_meta_t *meta, str_queue_t *out_q){
+    long long t_start = meta->ingest_ns ? platform_monotonic_ns() : 0;
+    perf_mark_t pm;
+    perfctr_enter(&pm);
+    model_entry_t *me = model_cache_get(st->models, g_config.per_source_models ? meta->src : "");
+    if(!me){ LOG_ERROR("[nn] no model for source '%s'\n", meta->src); return; }
+    /* records in between bypassed the model: the previous sample is not this one's predecessor */
+    if(meta->flags & REC_RESUMED) me->has_prev = 0;
+    nn_t *nn = me->nn;
+    double values[OUTPUT_SIZE];
+    for(int i=0;i<OUTPUT_SIZE;i++) values[i]=0.0;
+    long long ts = 0;
+    /* fields are split by hand (not strtok) so stages may run concurrently in shards */
+    const char *tok = line;
+    for(int idx=0; tok && idx < OUTPUT_SIZE+1; idx++){
+        if(idx==0){ ts = (long long)atof(tok); }
+        else { values[idx-1] = atof(tok); }
+        tok = strchr(tok, ',');
+        if(tok) tok++;
+    }
+    /* model inputs: the feature vector appended by the feature stage, or the raw metrics */
+    feature_vec_t x;
+    const char *bar = strchr(line, '|');
+    if(bar){
+        if(features_parse(bar + 1, &x) != (int)st->input_size){ LOG_ERROR("[nn] expected %zu features: %s\n", st->input_size, line); return; }
+    } else {
+        if(st->input_size != N_METRICS){ LOG_ERROR("[nn] record without features: %s\n", line); return; }
+        x.n = N_METRICS;
+        for(int i=0;i<N_METRICS;i++) x.v[i] = (float)values[i];
+    }
+
+    float out[OUTPUT_SIZE];
+
+    float cur_raw[OUTPUT_SIZE];
+    for(int i=0;i<OUTPUT_SIZE;i++) cur_raw[i] = (float)values[i];
+    /* streaming normalization sees every record once, before it is used */
+    if(st->gru) gru_observe(st->gru, &x, cur_raw);
+    else nn_observe(nn, &x, cur_raw);
+
+    /* Predict for current datapoint (no target) first, so the prediction never waits for training */
+    if(st->gru){
+        if(!me->stream) me->stream = gru_stream_create(st->gru);
+        if(!me->stream){ LOG_ERROR("[nn] no recurrent state for source '%s'\n", meta->src); return; }
+        gru_stream_step(st->gru, me->stream, &x, out);
+    } else {
+        nn_predict_and_maybe_train(nn, &x, NULL, out);
+    }
+    double last_cost = st->trainer ? hogwild_last_cost(st->trainer) : st->sched.last_cost;
+    if(!isnan(last_cost)) stats_set_train_cost(st->stats_slot, last_cost);
+    /* a replayed record was counted before the restart, and the saved stats hold it */
+    int replayed = (meta->flags & REC_REPLAYED) != 0;
+
+    if(me->has_prev){
+        const float *prev_out = me->prev_out;
+        /* record the absolute difference between previous prediction and current raw (target) per output */
+        double abs_err[OUTPUT_SIZE];
+        for(int i=0;i<OUTPUT_SIZE;i++) abs_err[i] = fabs((double)prev_out[i] - (double)cur_raw[i]);
+        if(!replayed) stats_record_prediction_errors(abs_err, OUTPUT_SIZE);
+        /* stored next to the metrics they predicted */
+        if(g_store && !replayed) tsdb_append(g_store, meta->src, TSDB_COL_PREDICTIONS, ts, prev_out, OUTPUT_SIZE);
+        /* push the previous prediction, the actual target (current raw) and the cost for clarity */
+        char pbuf[512];
+        int poff = snprintf(pbuf, sizeof(pbuf), "pred_prev");
+        for(int i=0;i<OUTPUT_SIZE;i++) poff += snprintf(pbuf+poff, sizeof(pbuf)-poff, ",pred,%.6f", prev_out[i]);
+        for(int i=0;i<OUTPUT_SIZE;i++) poff += snprintf(pbuf+poff, sizeof(pbuf)-poff, ",target,%.6f", cur_raw[i]);
+        poff += snprintf(pbuf+poff, sizeof(pbuf)-poff, ",cost,%.6f", (isnan(last_cost)?-1.0:last_cost));
+        if(meta->trace_id){
+            /* traced: the line waits from now, not from when the features were done */
+            rec_meta_t queued = *meta;
+            queued.hop_ns = platform_monotonic_ns();
+            queue_push_meta(out_q, pbuf, &queued);
+        }
+        else queue_push_meta(out_q, pbuf, meta);
+        if(!replayed) stats_inc_represented();
+        /* build a single line and log it once (avoids interleaving) */
+        if(LOG_ENABLED(LOG_LEVEL_DEBUG)){
+            char dbgbuf[512]; int dbgoff = snprintf(dbgbuf, sizeof(dbgbuf), "[nn] prev_pred vs target: ");
+            for(int i=0;i<OUTPUT_SIZE && dbgoff < (int)sizeof(dbgbuf)-32;i++) dbgoff += snprintf(dbgbuf+dbgoff, sizeof(dbgbuf)-dbgoff, "p%.6f ", prev_out[i]);
+            dbgoff += snprintf(dbgbuf+dbgoff, sizeof(dbgbuf)-dbgoff, " | ");
+            for(int i=0;i<OUTPUT_SIZE && dbgoff < (int)sizeof(dbgbuf)-32;i++) dbgoff += snprintf(dbgbuf+dbgoff, sizeof(dbgbuf)-dbgoff, "t%.6f ", cur_raw[i]);
+            dbgoff += snprintf(dbgbuf+dbgoff, sizeof(dbgbuf)-dbgoff, " | cost=%.6f\n", (isnan(last_cost)?-1.0:last_cost));
+            LOG_DEBUG("%s", dbgbuf);
+        }
+    }
+
+    const horizon_t *hz = st->horizon > 1 ? nn_stage_forecast(st, me, &x, cur_raw, out) : NULL;
+    perfctr_exit(&pm, PERF_INFER, 1);
+    if(t_start){
+        long long now = platform_monotonic_ns();
+        lat_record(LAT_INFER, now - t_start);
+        if(meta->trace_id) trace_span(meta->trace_id, TRACE_PREDICT, t_start, now);
+        lat_hop(meta, LAT_NN);
+    }
+
+    char buf[4096];
+    int off = snprintf(buf, sizeof(buf), "pred");
+    for(int i=0;i<OUTPUT_SIZE;i++) off += snprintf(buf+off, sizeof(buf)-off, ",%.6f", out[i]);
+    /* append last_cost for visibility (if available) */
+    off += snprintf(buf+off, sizeof(buf)-off, ",cost,%.6f", (isnan(last_cost)?-1.0:last_cost));
+    for(int j=2; hz && j<=st->horizon && off < (int)sizeof(buf)-48*(OUTPUT_SIZE+1); j++){
+        const float *pj = horizon_pred(hz, j);
+        off += snprintf(buf+off, sizeof(buf)-off, ",h%d", j);
+        for(int i=0;i<OUTPUT_SIZE;i++) off += snprintf(buf+off, sizeof(buf)-off, ",%.6f", pj[i]);
+    }
+    queue_push_meta(out_q, buf, meta);
+    if(!replayed) stats_inc_represented();
+
+    /* Train on previous input -> current raw values once the outputs are published.
+       The scheduler runs the step now or defers it when over the CPU budget. */
+    if(me->has_prev){
+        long long t_train = t_start ? platform_monotonic_ns() : 0;
+        perfctr_enter(&pm);
+        if(st->gru) nn_stage_train_gru(st, me, cur_raw);
+        else if(st->trainer) hogwild_submit(st->trainer, &me->prev_x, cur_raw);
+        else train_sched_submit(&st->sched, nn, &me->prev_x, cur_raw);
+        perfctr_exit(&pm, PERF_TRAIN, 1);
+        if(t_start){
+            long long now = platform_monotonic_ns();
+            lat_record(LAT_TRAIN, now - t_train);
+            if(meta->trace_id) trace_span(meta->trace_id, TRACE_TRAIN, t_train, now);
+        }
+    }
+    if(st->fed) federation_tick(st->fed, nn, me->has_prev);
+
+    /* store current as previous for next iteration of this source */
+    me->prev_x = x;
+    memcpy(me->prev_out, out, sizeof(me->prev_out));
+    me->has_prev = 1;
+    model_cache_publish_stats(st->models, st->stats_slot);
+}
+
+/**
+ * Time until deferred training can run again. A federated stage wakes up at
+ * least every NN_FED_IDLE_MS so rounds and merges go on without traffic.
+ *
+ * @param st stage
+ * @return -1 when nothing is deferred, otherwise milliseconds to wait (0 = now)
+ */
+int nn_stage_wait_ms(nn_stage_t *st){
+    int ms = train_sched_wait_ms(&st->sched);
+    if(st->fed && (ms < 0 || ms > NN_FED_IDLE_MS)) ms = NN_FED_IDLE_MS;
+    return ms;
+}
+
+/**
+ * Train deferred samples while the budget allows and no input is waiting.
+ *
+ * @param st stage
+ * @param pending predicate reporting waiting input, or NULL
+ * @param pending_ctx context passed to `pending`
+ */
+void nn_stage_idle(nn_stage_t *st, train_pending_fn pending, void *pending_ctx){
+    train_sched_drain(&st->sched, pending, pending_ctx);
+    if(st->fed){
+        model_entry_t *shared = model_cache_get(st->models, "");
+        if(shared) federation_tick(st->fed, shared->nn, 0);
+    }
+}
@@ -0,0 +1,26 @@
+/**
+ * nn_stage.h
+ *
+ * Declarations for the per-record neural-network stage used in module2. The stage owns the
+ * per-source model cache and the training scheduler, so it can run inside the classic
+ * `nn_thread` as well as inline in a receiver shard.
+ */
+
+#ifndef NN_STAGE_H
+#define NN_STAGE_H
+
+#include <stddef.h>
+
+#include "../common.h"
+#include "train_sched.h"
+
+typedef struct nn_stage_s nn_stage_t;
+
+nn_stage_t* nn_stage_create(int stats_slot, double train_budget, size_t cache_bytes, const char *spill_dir);
+int nn_stage_free(nn_stage_t *st);
+int nn_stage_checkpoint(nn_stage_t *st);
+void nn_stage_process(nn_stage_t *st, const char *line, rec_meta_t *meta, str_queue_t *out_q);
+int nn_stage_wait_ms(nn_stage_t *st);
+void nn_stage_idle(nn_stage_t *st, train_pending_fn pending, void *pending_ctx);
+
+#endif
@@ -19,105 +19,70 @@
 #include "nn.h"
 #include "nn_impl.h"
 #include "nn_params.h"
+#include "nn_stage.h"
+#include "../config.h"
 #include "../log.h"
+#include "../state.h"
+#include "../wal.h"
+#include "../trace.h"
+
+/**
+ * Pending-input predicate for the training scheduler: new records in
+ * `feat_queue` take priority over deferred training.
+ *
+ * @param ctx queue to check
+ * @return non-zero when the queue holds records
+ */
+static int nn_queue_pending(void *ctx){
+    return !queue_is_empty((str_queue_t*)ctx);
+}
 
 /**
  * Neural-network processing thread entry point.
+ *
+ * Consumes CSV-formatted lines from `feat_queue`, runs them through the NN
+ * stage and pushes predictions and debug strings to `repr_queue`. While the
+ * queue is idle, training samples deferred by the CPU budget are drained.
+ * Checkpoint markers save the models and truncate the write-ahead log.
  * 
- * @param arg unused
+ * @param arg write-ahead log (wal_t*), NULL without `--wal-dir`
+ * @return NULL when the models were saved on shutdown, STATE_NOT_SAVED when
+ *         they were not, STATE_STAGE_FAILED when the stage could not be created
  */
 void* nn_thread(void *arg){
-    (void)arg;
-    nn_params_t params = default_nn_params();
-    nn_t* nn = nn_create(&params);
-    if(!nn){ LOG_ERROR("nn_create failed\n"); return NULL; }
-    /* load saved weights from canonical data directory if present */
-    nn_load_weights(nn, "data/nn_weights.bin");
-
-    int has_prev = 0;
-    data_point_t prev_dp;
-    float prev_out[OUTPUT_SIZE];
-    double last_cost = NAN;
-
-    /**
-     * Main neural-network processing thread.
-     *
-     * This thread consumes CSV-formatted lines from `proc_queue`, parses them
-     * into `data_point_t`, runs the neural network to predict and optionally
-     * trains the network online using the previous datapoint as input and the
-     * current raw values as target. Predictions and debug strings are pushed
-     * to `repr_queue`.
-     */
+    wal_t *wal = (wal_t*)arg;
+    nn_stage_t *st = nn_stage_create(0, g_config.train_cpu_budget, (size_t)(g_config.model_cache_mb * 1024.0 * 1024.0),
+                                     g_config.per_source_models ? g_config.model_spill_dir : NULL);
+    if(!st){ LOG_ERROR("nn_stage_create failed, stopping\n"); platform_request_stop(); return STATE_STAGE_FAILED; }
+    str_queue_t replay_out;
+    queue_init(&replay_out);
     while(1){
-        char *line = queue_pop(&proc_queue);
-        if(!line) break;
-    double values[OUTPUT_SIZE];
-        for(int i=0;i<OUTPUT_SIZE;i++) values[i]=0.0;
-        int idx=0;
-        char *tok = strtok(line, ",");
-        while(tok != NULL && idx < OUTPUT_SIZE+1){
-            if(idx==0){ /* ts */ }
-            else { values[idx-1] = atof(tok); }
-            idx++;
-            tok = strtok(NULL, ",");
+        rec_meta_t meta;
+        int wait_ms = nn_stage_wait_ms(st);
+        char *line = (wait_ms < 0) ? queue_pop_meta(&feat_queue, &meta) : queue_pop_timed(&feat_queue, wait_ms > 0 ? wait_ms : 1, &meta);
+        if(!line){
+            if(queue_is_closed(&feat_queue) && queue_is_empty(&feat_queue)) break;
+            nn_stage_idle(st, nn_queue_pending, &feat_queue);
+            continue;
         }
-        // build data_point_t from values (map order as in types.h)
-        data_point_t dp;
-        dp.timestamp = 0;
-        dp.export_bytes = (float)values[0];
-        dp.export_flows = (float)values[1];
-        dp.export_packets = (float)values[2];
-        dp.export_rtr = (float)values[3];
-        dp.export_rtt = (float)values[4];
-        dp.export_srt = (float)values[5];
-
-        float out[OUTPUT_SIZE];
-
-        /* If we have a previous datapoint, train the network using previous input -> current raw values
-           as the target. The cost will be returned. */
-        if(has_prev){
-            float cur_raw[OUTPUT_SIZE];
-            for(int i=0;i<OUTPUT_SIZE;i++) cur_raw[i] = (float)values[i];
-            last_cost = nn_predict_and_maybe_train(nn, &prev_dp, cur_raw, prev_out);
-            /* record average absolute difference between previous prediction and current raw (target) */
-            double sum_abs = 0.0;
-            for(int i=0;i<OUTPUT_SIZE;i++) sum_abs += fabs((double)prev_out[i] - (double)cur_raw[i]);
-            double avg_abs = sum_abs / (double)OUTPUT_SIZE;
-            stats_record_prediction_error(avg_abs);
-            /* push the previous prediction, the actual target (current raw) and the cost for clarity */
-            char pbuf[512];
-            int poff = snprintf(pbuf, sizeof(pbuf), "pred_prev");
-            for(int i=0;i<OUTPUT_SIZE;i++) poff += snprintf(pbuf+poff, sizeof(pbuf)-poff, ",pred,%.6f", prev_out[i]);
-            for(int i=0;i<OUTPUT_SIZE;i++) poff += snprintf(pbuf+poff, sizeof(pbuf)-poff, ",target,%.6f", cur_raw[i]);
-            poff += snprintf(pbuf+poff, sizeof(pbuf)-poff, ",cost,%.6f", (isnan(last_cost)?-1.0:last_cost));
-            queue_push(&repr_queue, pbuf);
-            stats_inc_represented();
-            /* build a single line and log it once (avoids interleaving) */
-            char dbgbuf[512]; int dbgoff = snprintf(dbgbuf, sizeof(dbgbuf), "[nn] prev_pred vs target: ");
-            for(int i=0;i<OUTPUT_SIZE && dbgoff < (int)sizeof(dbgbuf)-32;i++) dbgoff += snprintf(dbgbuf+dbgoff, sizeof(dbgbuf)-dbgoff, "p%.6f ", prev_out[i]);
-            dbgoff += snprintf(dbgbuf+dbgoff, sizeof(dbgbuf)-dbgoff, " | ");
-            for(int i=0;i<OUTPUT_SIZE && dbgoff < (int)sizeof(dbgbuf)-32;i++) dbgoff += snprintf(dbgbuf+dbgoff, sizeof(dbgbuf)-dbgoff, "t%.6f ", cur_raw[i]);
-            dbgoff += snprintf(dbgbuf+dbgoff, sizeof(dbgbuf)-dbgoff, " | cost=%.6f\n", (isnan(last_cost)?-1.0:last_cost));
-            LOG_INFO("%s", dbgbuf);
+        if(meta.flags & REC_CHECKPOINT){
+            long long t_trace = TRACE_ACTIVE() ? platform_monotonic_ns() : 0;
+            if(meta.lsn > 0 && nn_stage_checkpoint(st) == 0 && state_save_stats() == 0) wal_checkpoint(wal, meta.lsn);
+            else LOG_ERROR("[wal] checkpoint failed, keeping the log\n");
+            if(t_trace) trace_span(0, TRACE_CHECKPOINT, t_trace, platform_monotonic_ns());
+            free(line);
+            continue;
         }
-
-        /* Predict for current datapoint (no target) to produce current prediction */
-        double c = nn_predict_and_maybe_train(nn, &dp, NULL, out);
-        (void)c;
-
-        char buf[256];
-        int off = snprintf(buf, sizeof(buf), "pred");
-        for(int i=0;i<OUTPUT_SIZE;i++) off += snprintf(buf+off, sizeof(buf)-off, ",%.6f", out[i]);
-        /* append last_cost for visibility (if available) */
-        off += snprintf(buf+off, sizeof(buf)-off, ",cost,%.6f", (isnan(last_cost)?-1.0:last_cost));
-    queue_push(&repr_queue, buf);
-    stats_inc_represented();
-
-        /* store current as previous for next iteration */
-        prev_dp = dp;
-        has_prev = 1;
+        trace_wait(&meta);
+        if(meta.flags & REC_REPLAYED){
+            /* replayed records only train the model, their output was produced before the restart */
+            nn_stage_process(st, line, &meta, &replay_out);
+            char *out;
+            while((out = queue_try_pop(&replay_out)) != NULL) free(out);
+        }
+        else nn_stage_process(st, line, &meta, &repr_queue);
         free(line);
+        nn_stage_idle(st, nn_queue_pending, &feat_queue);
     }
-    nn_free(nn);
-    return NULL;
+    return nn_stage_free(st) == 0 ? NULL : STATE_NOT_SAVED;
 }
@@ -0,0 +1,167 @@
+/*
+ * norm.c
+ *
+ * Streaming normalization. Per window of `norm.window` samples the inputs
+ * and the target metrics are summarized with Welford's algorithm; at the end
+ * of a window the effective offsets and scales in nn_params_t move a fraction
+ * `norm.rate` of the way towards the window's estimate, so the distribution
+ * the network sees drifts slowly instead of jumping. During the first (short)
+ * window the scales follow the running estimate directly, so a model never
+ * trains for long on scales that do not fit the stream; `norm.freeze_after`
+ * stops all movement.
+ *
+ * Inputs are standardized: offset = mean, scale = standard deviation.
+ * Outputs keep a pure scale (mean + 3 standard deviations) because the output
+ * activation may not produce negative values.
+ */
+
+#ifndef NORM_C_HEADER
+#define NORM_C_HEADER
+#include "norm.h"
+#endif
+
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#define NORM_MAGIC 0x314d524eu /* "NRM1" */
+#define NORM_WARMUP 64
+#define NORM_EPS 1e-9
+
+/**
+ * Reset a normalization state (no samples seen).
+ *
+ * @param ns state
+ */
+void norm_state_init(norm_state_t *ns){
+    memset(ns, 0, sizeof(*ns));
+}
+
+/**
+ * Scale for a feature with the given mean and standard deviation; constant
+ * features fall back to their magnitude (or 1) instead of dividing by zero.
+ */
+static double norm_scale(double mean, double sd){
+    if(sd > NORM_EPS * (fabs(mean) + 1.0)) return sd;
+    return fabs(mean) > NORM_EPS ? fabs(mean) : 1.0;
+}
+
+/**
+ * Move the effective scales towards the current window's estimate.
+ *
+ * @param ns state
+ * @param p parameters holding the effective offsets / scales
+ * @param rate fraction of the way to move (1 = adopt the estimate)
+ */
+static void norm_apply(const norm_state_t *ns, nn_params_t *p, double rate){
+    double n = (double)ns->win_n;
+    for(size_t i=0;i<p->input_size;i++){
+        double mean = ns->in_mean[i];
+        double sc = norm_scale(mean, sqrt(ns->in_m2[i] / n));
+        p->input_offsets[i] += rate * (mean - p->input_offsets[i]);
+        p->input_scales[i] += rate * (sc - p->input_scales[i]);
+    }
+    for(size_t j=0;j<OUTPUT_SIZE;j++){
+        double mean = ns->out_mean[j];
+        double sc = norm_scale(fabs(mean) + 3.0 * sqrt(ns->out_m2[j] / n), 0.0);
+        p->scales[j] += rate * (sc - p->scales[j]);
+    }
+}
+
+/**
+ * Apply a finished window and start the next one.
+ *
+ * @param ns state
+ * @param p parameters holding the effective offsets / scales
+ */
+static void norm_refresh(norm_state_t *ns, nn_params_t *p){
+    norm_apply(ns, p, ns->refreshes == 0 ? 1.0 : p->norm.rate);
+    ns->refreshes++;
+    ns->win_n = 0;
+    memset(ns->in_mean, 0, sizeof(ns->in_mean));
+    memset(ns->in_m2, 0, sizeof(ns->in_m2));
+    memset(ns->out_mean, 0, sizeof(ns->out_mean));
+    memset(ns->out_m2, 0, sizeof(ns->out_m2));
+}
+
+/**
+ * Account one sample and, at the end of a window, update the effective
+ * offsets / scales in `p`. No-op for static normalization or once frozen.
+ *
+ * @param ns state of the model
+ * @param p parameters of the model (updated in place)
+ * @param x input features of the sample (raw values)
+ * @param y_raw raw metrics of the sample (length OUTPUT_SIZE)
+ */
+void norm_observe(norm_state_t *ns, nn_params_t *p, const feature_vec_t *x, const float *y_raw){
+    if(!p->norm.adaptive) return;
+    if(p->norm.freeze_after > 0 && ns->seen >= p->norm.freeze_after) return;
+    ns->seen++;
+    ns->win_n++;
+    double n = (double)ns->win_n;
+    for(size_t i=0;i<p->input_size;i++){
+        double d = x->v[i] - ns->in_mean[i];
+        ns->in_mean[i] += d / n;
+        ns->in_m2[i] += d * (x->v[i] - ns->in_mean[i]);
+    }
+    for(size_t j=0;j<OUTPUT_SIZE;j++){
+        double v = (double)y_raw[j];
+        double d = v - ns->out_mean[j];
+        ns->out_mean[j] += d / n;
+        ns->out_m2[j] += d * (v - ns->out_mean[j]);
+    }
+    long long window = p->norm.window > 0 ? p->norm.window : 1;
+    if(ns->refreshes == 0 && window > NORM_WARMUP) window = NORM_WARMUP;
+    if(ns->win_n >= window) norm_refresh(ns, p);
+    else if(ns->refreshes == 0 && ns->win_n >= 8) norm_apply(ns, p, 1.0);
+}
+
+/**
+ * Append the normalization block to a checkpoint: magic, input count,
+ * output count (uint32 each), seen, refreshes (int64 each), then the input
+ * offsets, input scales and output scales (doubles). The open window is not
+ * stored.
+ *
+ * @param f file open for writing
+ * @param ns state
+ * @param p parameters holding the effective offsets / scales
+ * @return 0 on success, -1 on error
+ */
+int norm_write(FILE *f, const norm_state_t *ns, const nn_params_t *p){
+    uint32_t hdr[3] = { NORM_MAGIC, (uint32_t)p->input_size, (uint32_t)OUTPUT_SIZE };
+    int64_t counts[2] = { ns->seen, ns->refreshes };
+    int ok = fwrite(hdr, sizeof(hdr), 1, f) == 1
+          && fwrite(counts, sizeof(counts), 1, f) == 1
+          && fwrite(p->input_offsets, sizeof(double), p->input_size, f) == p->input_size
+          && fwrite(p->input_scales, sizeof(double), p->input_size, f) == p->input_size
+          && fwrite(p->scales, sizeof(double), OUTPUT_SIZE, f) == OUTPUT_SIZE;
+    return ok ? 0 : -1;
+}
+
+/**
+ * Read a normalization block written by norm_write(). Nothing is changed
+ * unless the block is complete and matches the model's input size.
+ *
+ * @param f file positioned at the block
+ * @param ns state to restore
+ * @param p parameters receiving the offsets / scales
+ * @return 0 on success, -1 when missing or incompatible
+ */
+int norm_read(FILE *f, norm_state_t *ns, nn_params_t *p){
+    uint32_t hdr[3];
+    int64_t counts[2];
+    double off[FEATURE_MAX], sc[FEATURE_MAX], out_sc[OUTPUT_SIZE];
+    size_t n_in = p->input_size;
+    if(fread(hdr, sizeof(hdr), 1, f) != 1 || hdr[0] != NORM_MAGIC || hdr[1] != n_in || hdr[2] != OUTPUT_SIZE) return -1;
+    if(fread(counts, sizeof(counts), 1, f) != 1
+       || fread(off, sizeof(double), n_in, f) != n_in
+       || fread(sc, sizeof(double), n_in, f) != n_in
+       || fread(out_sc, sizeof(double), OUTPUT_SIZE, f) != OUTPUT_SIZE) return -1;
+    norm_state_init(ns);
+    ns->seen = counts[0];
+    ns->refreshes = counts[1];
+    memcpy(p->input_offsets, off, sizeof(double) * n_in);
+    memcpy(p->input_scales, sc, sizeof(double) * n_in);
+    memcpy(p->scales, out_sc, sizeof(out_sc));
+    return 0;
+}
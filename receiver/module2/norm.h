@@ -0,0 +1,39 @@
+/**
+ * norm.h
+ *
+ * Declarations for the streaming input/output normalization used in module2. A model keeps
+ * running statistics of what it sees and moves the offsets / scales of its nn_params_t
+ * towards them slowly, window by window.
+ */
+
+#ifndef NORM_H
+#define NORM_H
+
+#include <stdio.h>
+
+#include "nn_params.h"
+#include "../types.h"
+
+/**
+ * Streaming normalization state of one model.
+ *
+ * seen: samples observed in total
+ * refreshes: number of windows applied to the scales so far
+ * win_n: samples in the current window
+ * in_mean, in_m2: Welford mean / sum of squared deviations of the inputs in the window
+ * out_mean, out_m2: the same for the target metrics
+ */
+typedef struct {
+    long long seen;
+    long long refreshes;
+    long long win_n;
+    double in_mean[FEATURE_MAX], in_m2[FEATURE_MAX];
+    double out_mean[OUTPUT_SIZE], out_m2[OUTPUT_SIZE];
+} norm_state_t;
+
+void norm_state_init(norm_state_t *ns);
+void norm_observe(norm_state_t *ns, nn_params_t *p, const feature_vec_t *x, const float *y_raw);
+int norm_write(FILE *f, const norm_state_t *ns, const nn_params_t *p);
+int norm_read(FILE *f, norm_state_t *ns, nn_params_t *p);
+
+#endif
@@ -0,0 +1,244 @@
+/*
+ * train_sched.c
+ *
+ * CPU-budgeted scheduler for online training. Training steps are charged
+ * against a token bucket that refills at `budget` nanoseconds of CPU per
+ * nanosecond of wall time; samples that arrive while the bucket is empty are
+ * deferred into a bounded backlog (oldest samples are dropped when it is
+ * full) and trained later when credit becomes available again.
+ */
+
+#ifndef TRAIN_SCHED_C_HEADER
+#define TRAIN_SCHED_C_HEADER
+#include "train_sched.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../platform.h"
+#include "../memstat.h"
+
+/* Credit that may be saved up while idle, expressed in wall-clock time. */
+#define TRAIN_BURST_WINDOW_NS 1000000000.0
+
+/**
+ * Initialize a training scheduler.
+ *
+ * @param ts scheduler to initialize
+ * @param budget fraction of one core training may use (<= 0 disables the cap)
+ * @param backlog_cap capacity of the deferred sample backlog (at least 1)
+ * @param stats_slot gauge slot the backlog depth is published to
+ * @return 0 on success, -1 on allocation failure
+ */
+int train_sched_init(train_sched_t *ts, double budget, int backlog_cap, int stats_slot){
+    memset(ts, 0, sizeof(*ts));
+    if(backlog_cap < 1) backlog_cap = 1;
+    ts->budget = budget;
+    ts->burst_ns = budget > 0.0 ? budget * TRAIN_BURST_WINDOW_NS : 0.0;
+    ts->credit_ns = ts->burst_ns;
+    ts->last_refill_ns = platform_monotonic_ns();
+    ts->last_cost = NAN;
+    ts->cap = backlog_cap;
+    ts->stats_slot = stats_slot;
+    ts->backlog = (train_sample_t*)mem_alloc(MEM_NN, sizeof(train_sample_t) * (size_t)backlog_cap);
+    return ts->backlog ? 0 : -1;
+}
+
+/**
+ * Release scheduler resources. Deferred samples are discarded.
+ *
+ * @param ts scheduler to free
+ */
+void train_sched_free(train_sched_t *ts){
+    mem_free(ts->backlog);
+    ts->backlog = NULL;
+    ts->count = 0;
+}
+
+/**
+ * Add credit for the wall time elapsed since the previous refill.
+ *
+ * @param ts scheduler
+ */
+static void train_sched_refill(train_sched_t *ts){
+    long long now = platform_monotonic_ns();
+    ts->credit_ns += (double)(now - ts->last_refill_ns) * ts->budget;
+    if(ts->credit_ns > ts->burst_ns) ts->credit_ns = ts->burst_ns;
+    ts->last_refill_ns = now;
+}
+
+/**
+ * Run one training step and charge its CPU time to the budget.
+ *
+ * @param ts scheduler
+ * @param nn network to train
+ * @param in input datapoint
+ * @param target desired raw outputs
+ * @return training cost reported by nn_predict_and_maybe_train
+ */
+static double train_sched_step(train_sched_t *ts, nn_t *nn, const feature_vec_t *in, const float *target){
+    float scratch[OUTPUT_SIZE];
+    long long t0 = platform_thread_cpu_ns();
+    double cost = nn_predict_and_maybe_train(nn, in, target, scratch);
+    train_sched_charge(ts, platform_thread_cpu_ns() - t0, cost);
+    return cost;
+}
+
+/**
+ * Check whether a training step may run right now (budget available and no
+ * older samples deferred). Used by models whose samples cannot be deferred,
+ * such as recurrent streams whose state moves on with every record.
+ *
+ * @param ts scheduler
+ * @return non-zero when the step may run
+ */
+int train_sched_admit(train_sched_t *ts){
+    if(ts->budget <= 0.0) return 1;
+    train_sched_refill(ts);
+    return ts->count == 0 && ts->credit_ns >= 0.0;
+}
+
+/**
+ * Charge a training step that ran outside the scheduler to the budget.
+ *
+ * @param ts scheduler
+ * @param cpu_ns CPU time the step consumed
+ * @param cost cost returned by the step (NaN if unknown)
+ */
+void train_sched_charge(train_sched_t *ts, long long cpu_ns, double cost){
+    if(ts->budget > 0.0) ts->credit_ns -= (double)cpu_ns;
+    stats_record_train_step(cpu_ns);
+    if(!isnan(cost)) ts->last_cost = cost;
+}
+
+/**
+ * Append a sample to the backlog, dropping the oldest one when full.
+ *
+ * @param ts scheduler
+ * @param nn network the sample trains
+ * @param in input datapoint
+ * @param target desired raw outputs
+ */
+static void train_sched_defer(train_sched_t *ts, nn_t *nn, const feature_vec_t *in, const float *target){
+    if(ts->count == ts->cap){
+        ts->head = (ts->head + 1) % ts->cap;
+        ts->count--;
+        stats_inc_train_dropped();
+    }
+    train_sample_t *s = &ts->backlog[(ts->head + ts->count) % ts->cap];
+    s->nn = nn;
+    s->in = *in;
+    memcpy(s->target, target, sizeof(s->target));
+    ts->count++;
+    stats_inc_train_deferred();
+    stats_set_train_backlog(ts->stats_slot, ts->count);
+}
+
+/**
+ * Submit a training sample.
+ *
+ * The sample is trained immediately when the budget allows it and nothing
+ * older is waiting; otherwise it is deferred into the backlog.
+ *
+ * @param ts scheduler
+ * @param nn network to train
+ * @param in input datapoint (raw values)
+ * @param target desired raw outputs (length OUTPUT_SIZE)
+ * @return training cost if the sample was trained now, NaN if it was deferred
+ */
+double train_sched_submit(train_sched_t *ts, nn_t *nn, const feature_vec_t *in, const float *target){
+    if(ts->budget <= 0.0) return train_sched_step(ts, nn, in, target);
+    train_sched_refill(ts);
+    if(ts->count == 0 && ts->credit_ns >= 0.0) return train_sched_step(ts, nn, in, target);
+    train_sched_defer(ts, nn, in, target);
+    return NAN;
+}
+
+/**
+ * Train deferred samples while the budget allows it.
+ *
+ * Draining stops as soon as `pending` reports waiting input, so deferred
+ * training never delays inference of newly arrived records.
+ *
+ * @param ts scheduler
+ * @param pending predicate reporting waiting input, or NULL
+ * @param pending_ctx context passed to `pending`
+ * @return number of samples trained
+ */
+int train_sched_drain(train_sched_t *ts, train_pending_fn pending, void *pending_ctx){
+    int trained = 0;
+    if(ts->count == 0) return 0;
+    train_sched_refill(ts);
+    while(ts->count > 0 && ts->credit_ns >= 0.0){
+        if(pending && pending(pending_ctx)) break;
+        train_sample_t *s = &ts->backlog[ts->head];
+        train_sched_step(ts, s->nn, &s->in, s->target);
+        ts->head = (ts->head + 1) % ts->cap;
+        ts->count--;
+        trained++;
+        train_sched_refill(ts);
+    }
+    stats_set_train_backlog(ts->stats_slot, ts->count);
+    return trained;
+}
+
+/**
+ * Train every deferred sample regardless of the budget, e.g. before the
+ * models are saved on shutdown.
+ *
+ * @param ts scheduler
+ * @return number of samples trained
+ */
+int train_sched_flush(train_sched_t *ts){
+    int trained = 0;
+    while(ts->count > 0){
+        train_sample_t *s = &ts->backlog[ts->head];
+        train_sched_step(ts, s->nn, &s->in, s->target);
+        ts->head = (ts->head + 1) % ts->cap;
+        ts->count--;
+        trained++;
+    }
+    stats_set_train_backlog(ts->stats_slot, 0);
+    return trained;
+}
+
+/**
+ * Time until the scheduler can train the next deferred sample.
+ *
+ * @param ts scheduler
+ * @return -1 when the backlog is empty, otherwise milliseconds to wait (0 = now)
+ */
+int train_sched_wait_ms(train_sched_t *ts){
+    if(ts->count == 0) return -1;
+    if(ts->budget <= 0.0) return 0;
+    train_sched_refill(ts);
+    if(ts->credit_ns >= 0.0) return 0;
+    double ms = -ts->credit_ns / ts->budget / 1e6;
+    return (int)ceil(ms);
+}
+
+/**
+ * Remove all deferred samples that belong to `nn`; they are counted as
+ * dropped.
+ *
+ * Must be called before a network referenced by the backlog is freed.
+ *
+ * @param ts scheduler
+ * @param nn network whose samples are discarded
+ * @return number of samples discarded
+ */
+int train_sched_discard(train_sched_t *ts, const nn_t *nn){
+    int kept = 0;
+    for(int i=0;i<ts->count;i++){
+        train_sample_t *s = &ts->backlog[(ts->head + i) % ts->cap];
+        if(s->nn == nn){ stats_inc_train_dropped(); continue; }
+        if(kept != i) ts->backlog[(ts->head + kept) % ts->cap] = *s;
+        kept++;
+    }
+    int dropped = ts->count - kept;
+    ts->count = kept;
+    stats_set_train_backlog(ts->stats_slot, ts->count);
+    return dropped;
+}
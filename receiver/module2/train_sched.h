@@ -0,0 +1,66 @@
+/**
+ * train_sched.h
+ *
+ * Declarations for the CPU-budgeted online-training scheduler used in module2.
+ */
+
+#ifndef TRAIN_SCHED_H
+#define TRAIN_SCHED_H
+
+#include "nn.h"
+#include "../common.h"
+#include "../types.h"
+
+/**
+ * One deferred training sample.
+ *
+ * nn_t *nn: network the sample trains
+ * feature_vec_t in: network input (raw feature values)
+ * float target[OUTPUT_SIZE]: desired raw outputs
+ */
+typedef struct {
+    nn_t *nn;
+    feature_vec_t in;
+    float target[OUTPUT_SIZE];
+} train_sample_t;
+
+/**
+ * Training scheduler state.
+ *
+ * budget: fraction of one core training may use (<= 0 means unlimited)
+ * burst_ns: maximum credit that can be accumulated while idle
+ * credit_ns: training time currently available (negative while in debt)
+ * last_refill_ns: monotonic time of the last credit refill
+ * backlog: ring buffer of deferred samples (capacity `cap`)
+ * head: index of the oldest deferred sample
+ * count: number of deferred samples
+ * last_cost: cost returned by the most recent training step (NaN if none)
+ * stats_slot: gauge slot the backlog depth is published to
+ */
+typedef struct {
+    double budget;
+    double burst_ns;
+    double credit_ns;
+    long long last_refill_ns;
+    train_sample_t *backlog;
+    int cap;
+    int head;
+    int count;
+    double last_cost;
+    int stats_slot;
+} train_sched_t;
+
+/* Returns non-zero when new input is waiting and deferred training should yield. */
+typedef int (*train_pending_fn)(void *ctx);
+
+int train_sched_init(train_sched_t *ts, double budget, int backlog_cap, int stats_slot);
+void train_sched_free(train_sched_t *ts);
+double train_sched_submit(train_sched_t *ts, nn_t *nn, const feature_vec_t *in, const float *target);
+int train_sched_drain(train_sched_t *ts, train_pending_fn pending, void *pending_ctx);
+int train_sched_flush(train_sched_t *ts);
+int train_sched_wait_ms(train_sched_t *ts);
+int train_sched_discard(train_sched_t *ts, const nn_t *nn);
+int train_sched_admit(train_sched_t *ts);
+void train_sched_charge(train_sched_t *ts, long long cpu_ns, double cost);
+
+#endif
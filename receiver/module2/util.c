@@ -6,20 +6,42 @@
 
 #include "util.h"
 
+/**
+ * Build the raw feature vector of a data point (the six metrics, no history).
+ *
+ * @param data_point_t* in: pointer to input data point (raw values)
+ * @param feature_vec_t* out: receives N_METRICS features
+ */
+void features_from_datapoint(const data_point_t* in, feature_vec_t* out){
+    out->n = N_METRICS;
+    out->v[0] = in->export_bytes;
+    out->v[1] = in->export_flows;
+    out->v[2] = in->export_packets;
+    out->v[3] = in->export_rtr;
+    out->v[4] = in->export_rtt;
+    out->v[5] = in->export_srt;
+}
+
 /** 
  * Normalize input features to [-1, 1] range using precomputed scales.
  * 
+ * @param nn_params_t* params: pointer to nn_params_t containing input_size, input_offsets and input_scales
+ * @param feature_vec_t* in: pointer to input features (raw values, at least input_size of them)
+ * @param double* out_norm: pointer to output array (length input_size) for normalized values
+ */
+void normalize_input(const nn_params_t* params, const feature_vec_t* in, double* out_norm){
+    for(size_t i=0;i<params->input_size;i++) out_norm[i] = (in->v[i] - params->input_offsets[i]) / params->input_scales[i];
+}
+
+/**
+ * Normalize raw target values into the output domain of the network (inverse of denormalize_output()).
+ *
  * @param nn_params_t* params: pointer to nn_params_t containing scales
- * @param data_point_t* in: pointer to input data point (raw values)
- * @param double* out_norm: pointer to output array (length INPUT_SIZE) for normalized values
+ * @param float* target_raw: pointer to raw target values (length OUTPUT_SIZE)
+ * @param double* out_norm: pointer to output array (length OUTPUT_SIZE) for normalized values
  */
-void normalize_input(const nn_params_t* params, const data_point_t* in, double* out_norm){
-    out_norm[0] = in->export_bytes / params->scales[0];
-    out_norm[1] = in->export_flows / params->scales[1];
-    out_norm[2] = in->export_packets / params->scales[2];
-    out_norm[3] = in->export_rtr / params->scales[3];
-    out_norm[4] = in->export_rtt / params->scales[4];
-    out_norm[5] = in->export_srt / params->scales[5];
+void normalize_target(const nn_params_t* params, const float* target_raw, double* out_norm){
+    for(size_t i=0;i<OUTPUT_SIZE;i++) out_norm[i] = (double)target_raw[i] / params->scales[i];
 }
 
 /** 
@@ -10,7 +10,9 @@
 #include "nn_params.h"
 #include "../types.h"
 
-void normalize_input(const nn_params_t* params, const data_point_t* in, double* out_norm);
+void features_from_datapoint(const data_point_t* in, feature_vec_t* out);
+void normalize_input(const nn_params_t* params, const feature_vec_t* in, double* out_norm);
+void normalize_target(const nn_params_t* params, const float* target_raw, double* out_norm);
 void denormalize_output(const nn_params_t* params, const double* nn_out, float* out_raw);
 
 #endif
@@ -14,6 +14,8 @@
 #include <stdio.h>
 #include <curl/curl.h>
 
+#include "../memstat.h"
+
 /**
  * Buffer to hold response data
  * 
@@ -38,7 +40,7 @@ struct memchunk {
 static size_t write_cb(void *contents, size_t size, size_t nmemb, void *userp){
     size_t realsize = size * nmemb;
     struct memchunk *m = (struct memchunk*)userp;
-    char *ptr = realloc(m->buf, m->size + realsize + 1);
+    char *ptr = mem_realloc(MEM_LLM, m->buf, m->size + realsize + 1);
     if(!ptr) return 0;
     m->buf = ptr;
     memcpy(&(m->buf[m->size]), contents, realsize);
@@ -103,7 +105,7 @@ static char* extract_assistant_content(const char *resp){
         }
         if(!*q) return NULL;
         size_t len = q - p;
-        char *out = (char*)malloc(len + 1);
+        char *out = (char*)mem_alloc(MEM_LLM, len + 1);
         if(!out) return NULL;
         strncpy(out, p, len);
         out[len] = '\0';
@@ -116,7 +118,7 @@ static char* extract_assistant_content(const char *resp){
 /**
  * Send `text` as a user message to the OpenAI Chat Completions API using
  * `model`. Returns a newly-allocated C string containing the assistant
- * reply (caller must free). On error returns NULL.
+ * reply (caller must mem_free()). On error returns NULL.
  * 
  * @param text user message text
  * @param model model name (e.g., "gpt-4o-mini"), or NULL for default
@@ -130,11 +132,11 @@ char* openai_interpret_text(const char* text, const char* model){
     CURL *curl = NULL;
     CURLcode res;
     struct memchunk chunk;
-    chunk.buf = malloc(1);
+    chunk.buf = mem_alloc(MEM_LLM, 1);
     chunk.size = 0;
 
     curl = curl_easy_init();
-    if(!curl){ free(chunk.buf); return NULL; }
+    if(!curl){ mem_free(chunk.buf); return NULL; }
 
     char url[] = "https://api.openai.com/v1/chat/completions";
     curl_easy_setopt(curl, CURLOPT_URL, url);
@@ -143,8 +145,8 @@ char* openai_interpret_text(const char* text, const char* model){
 
     /* Build minimal JSON payload. Escape double quotes in `text`. */
     size_t tlen = strlen(text);
-    char *esc = malloc(tlen * 2 + 16);
-    if(!esc){ curl_easy_cleanup(curl); free(chunk.buf); return NULL; }
+    char *esc = mem_alloc(MEM_LLM, tlen * 2 + 16);
+    if(!esc){ curl_easy_cleanup(curl); mem_free(chunk.buf); return NULL; }
     char *dst = esc;
     for(const char *s = text; *s; ++s){
         if(*s == '\\') { *dst++ = '\\'; *dst++ = '\\'; }
@@ -157,8 +159,8 @@ char* openai_interpret_text(const char* text, const char* model){
     const char *model_used = model ? model : "gpt-4o-mini";
     /* safe payload length estimate */
     size_t payload_sz = strlen(esc) + strlen(model_used) + 256;
-    char *payload = malloc(payload_sz);
-    if(!payload){ free(esc); curl_easy_cleanup(curl); free(chunk.buf); return NULL; }
+    char *payload = mem_alloc(MEM_LLM, payload_sz);
+    if(!payload){ mem_free(esc); curl_easy_cleanup(curl); mem_free(chunk.buf); return NULL; }
     snprintf(payload, payload_sz,
              "{\"model\":\"%s\",\"messages\":[{\"role\":\"user\",\"content\":\"%s\"}],\"max_tokens\":256}",
              model_used, esc);
@@ -173,20 +175,20 @@ char* openai_interpret_text(const char* text, const char* model){
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
 
     res = curl_easy_perform(curl);
-    free(payload);
-    free(esc);
+    mem_free(payload);
+    mem_free(esc);
     curl_slist_free_all(headers);
 
     if(res != CURLE_OK){
         curl_easy_cleanup(curl);
-        free(chunk.buf);
+        mem_free(chunk.buf);
         return NULL;
     }
 
     char *reply = extract_assistant_content(chunk.buf);
 
     curl_easy_cleanup(curl);
-    free(chunk.buf);
+    mem_free(chunk.buf);
 
     return reply;
 }
@@ -194,7 +196,7 @@ char* openai_interpret_text(const char* text, const char* model){
 /**
  * Send `system_text` (system role) and `user_text` (user role) as messages
  * to the OpenAI Chat Completions API using `model`. Returns a newly-allocated
- * C string containing the assistant reply (caller must free). On error
+ * C string containing the assistant reply (caller must mem_free()). On error
  * returns NULL.
  * 
  * @param system_text system role message text
@@ -210,11 +212,11 @@ char* openai_interpret_with_system(const char* system_text, const char* user_tex
     CURL *curl = NULL;
     CURLcode res;
     struct memchunk chunk;
-    chunk.buf = malloc(1);
+    chunk.buf = mem_alloc(MEM_LLM, 1);
     chunk.size = 0;
 
     curl = curl_easy_init();
-    if(!curl){ free(chunk.buf); return NULL; }
+    if(!curl){ mem_free(chunk.buf); return NULL; }
 
     char url[] = "https://api.openai.com/v1/chat/completions";
     curl_easy_setopt(curl, CURLOPT_URL, url);
@@ -223,8 +225,8 @@ char* openai_interpret_with_system(const char* system_text, const char* user_tex
 
     /* Escape strings for JSON */
     size_t ulen = strlen(user_text);
-    char *uesc = malloc(ulen * 2 + 16);
-    if(!uesc){ curl_easy_cleanup(curl); free(chunk.buf); return NULL; }
+    char *uesc = mem_alloc(MEM_LLM, ulen * 2 + 16);
+    if(!uesc){ curl_easy_cleanup(curl); mem_free(chunk.buf); return NULL; }
     char *dst = uesc;
     for(const char *s = user_text; *s; ++s){
         if(*s == '\\') { *dst++ = '\\'; *dst++ = '\\'; }
@@ -237,8 +239,8 @@ char* openai_interpret_with_system(const char* system_text, const char* user_tex
     char *sesc = NULL;
     if(system_text){
         size_t slen = strlen(system_text);
-        sesc = malloc(slen * 2 + 16);
-        if(!sesc){ free(uesc); curl_easy_cleanup(curl); free(chunk.buf); return NULL; }
+        sesc = mem_alloc(MEM_LLM, slen * 2 + 16);
+        if(!sesc){ mem_free(uesc); curl_easy_cleanup(curl); mem_free(chunk.buf); return NULL; }
         dst = sesc;
         for(const char *s = system_text; *s; ++s){
             if(*s == '\\') { *dst++ = '\\'; *dst++ = '\\'; }
@@ -252,8 +254,8 @@ char* openai_interpret_with_system(const char* system_text, const char* user_tex
     const char *model_used = model ? model : "gpt-4o-mini";
     /* safe payload length estimate */
     size_t payload_sz = (sesc ? strlen(sesc) : 0) + strlen(uesc) + strlen(model_used) + 512;
-    char *payload = malloc(payload_sz);
-    if(!payload){ free(uesc); if(sesc) free(sesc); curl_easy_cleanup(curl); free(chunk.buf); return NULL; }
+    char *payload = mem_alloc(MEM_LLM, payload_sz);
+    if(!payload){ mem_free(uesc); if(sesc) mem_free(sesc); curl_easy_cleanup(curl); mem_free(chunk.buf); return NULL; }
 
     if(sesc){
         snprintf(payload, payload_sz,
@@ -275,21 +277,21 @@ char* openai_interpret_with_system(const char* system_text, const char* user_tex
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
 
     res = curl_easy_perform(curl);
-    free(payload);
-    free(uesc);
-    if(sesc) free(sesc);
+    mem_free(payload);
+    mem_free(uesc);
+    if(sesc) mem_free(sesc);
     curl_slist_free_all(headers);
 
     if(res != CURLE_OK){
         curl_easy_cleanup(curl);
-        free(chunk.buf);
+        mem_free(chunk.buf);
         return NULL;
     }
 
     char *reply = extract_assistant_content(chunk.buf);
 
     curl_easy_cleanup(curl);
-    free(chunk.buf);
+    mem_free(chunk.buf);
 
     return reply;
 }
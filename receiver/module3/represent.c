@@ -12,66 +12,114 @@
 #include "../common.h"
 #include "../queues.h"
 #include "../log.h"
+#include "../config.h"
+#include "../latency.h"
+#include "../trace.h"
+#include "../perfctr.h"
+#include "../memstat.h"
+#include "../platform.h"
+#include "represent.h"
 #ifdef OPENAI_ENABLED
 #include "openai_client.h"
 #endif
 
 /**
- * Representation thread.
+ * Initialize representation state.
  *
- * Reads formatted strings from `repr_queue` and writes them to the log for
- * human-readable representation. Returns when the queue is closed.
- *
- * @param arg unused thread argument
+ * @param rs state to reset
  */
-void* represent_thread(void* arg){
-    (void)arg;
-    double last_target_first = 0.0;
-    int have_last_target = 0;
+void represent_state_init(represent_state_t *rs){
+    rs->last_target_first = 0.0;
+    rs->have_last_target = 0;
+}
 
-    while(1){
-        char *line = queue_pop(&repr_queue);
-        if(!line) break;
-        LOG_INFO("[represent] %s\n", line);
-        /* Optionally ask OpenAI to interpret the line. This block is compiled
-         * only when `OPENAI_ENABLED` is defined (Makefile: `USE_OPENAI=1`). */
+/**
+ * Represent a single NN output line: log it and raise the anomaly alarm when
+ * a prediction exceeds the last observed target by more than the threshold.
+ * Records of a window the statistical detectors flagged count as escalated;
+ * with `--route=suspicious` only those reach the LLM.
+ *
+ * @param rs state of the calling consumer
+ * @param line formatted NN output line
+ * @param meta metadata of the record the line belongs to (may be NULL)
+ */
+void represent_line(represent_state_t *rs, const char *line, const rec_meta_t *meta){
+    long long t_trace = meta ? TRACE_BEGIN(meta) : 0;
+    perf_mark_t pm;
+    perfctr_enter(&pm);
+    int is_pred = strncmp(line, "pred,", 5) == 0;
+    LOG_DEBUG("[represent] %s\n", line);
+    int suspicious = meta && (meta->flags & REC_SUSPICIOUS);
+    if(suspicious && is_pred) stats_record_tier(STATS_TIER_ESCALATED, 0);
+    /* Optionally ask OpenAI to interpret the line. This block is compiled
+     * only when `OPENAI_ENABLED` is defined (Makefile: `USE_OPENAI=1`). */
 #ifdef OPENAI_ENABLED
+    if(suspicious || strcmp(g_config.route, "suspicious") != 0){
         char *llm_reply = openai_interpret_with_system(
             "You are an AI assistant. Please look at this data and say one sentence, about what is going on. Norm is export_bytes: 32640.250000, export_flows: 10.033334, export_packets: 64.343330, export_rtr: 0.050239, export_rtt: 16149.753906, export_srt: 71455.148438. If the data indicates stable internet connection, say: 'The internet connection looks stable for the next three minutes.' If it indicates instability, say: 'The internet connection may experience instability in the next three minutes.' If it indicates a high risk of approaching anomalies, say: 'HIGH RISK OF APPROACHING ANOMALIES DETECTED.'. If you cannot tell, say: 'The data is inconclusive regarding internet stability.'. If it will be around that values, say 'Speed of internet in next three minutes will be fast.' Only respond with one sentence. Maximum length of your response is 100 characters. Here is the data:\n",
             line,
             "o4-mini");
         if(llm_reply){
             LOG_INFO("[LLM] %s\n", llm_reply);
-            free(llm_reply);
+            mem_free(llm_reply);
         }
+    }
 #endif
-        char *tpos = strstr(line, "target,");
-        if(tpos){
-            char *numstart = tpos + strlen("target,");
-            while(*numstart == ' ') numstart++;
-            char *endptr = NULL;
-            double v = strtod(numstart, &endptr);
-            if(endptr != numstart){
-                last_target_first = v;
-                have_last_target = 1;
-            }
+    const char *tpos = strstr(line, "target,");
+    if(tpos){
+        const char *numstart = tpos + strlen("target,");
+        while(*numstart == ' ') numstart++;
+        char *endptr = NULL;
+        double v = strtod(numstart, &endptr);
+        if(endptr != numstart){
+            rs->last_target_first = v;
+            rs->have_last_target = 1;
         }
-        if(have_last_target && strncmp(line, "pred,", 5) == 0){
-            char *first_comma = strchr(line, ',');
-            if(first_comma){
-                char *tok = first_comma + 1;
-                while(*tok == ' ') tok++;
-                char *endptr = NULL;
-                double pred = strtod(tok, &endptr);
-                if(endptr != tok){
-                    if(pred > last_target_first && (pred - last_target_first) > 100000.0){
-                        LOG_ERROR("\x1b[31mHIGH RISK OF APPROACHING ANOMALIES: last_target=%.6f, prediction=%.6f, diff=%.6f\x1b[0m\n",
-                                  last_target_first, pred, pred - last_target_first);
-                    }
+    }
+    if(rs->have_last_target && is_pred){
+        const char *first_comma = strchr(line, ',');
+        if(first_comma){
+            const char *tok = first_comma + 1;
+            while(*tok == ' ') tok++;
+            char *endptr = NULL;
+            double pred = strtod(tok, &endptr);
+            if(endptr != tok){
+                if(pred > rs->last_target_first && (pred - rs->last_target_first) > 100000.0){
+                    LOG_ERROR("\x1b[31mHIGH RISK OF APPROACHING ANOMALIES: last_target=%.6f, prediction=%.6f, diff=%.6f\x1b[0m\n",
+                              rs->last_target_first, pred, pred - rs->last_target_first);
                 }
             }
         }
+    }
+    /* the `pred` line is the last output of a record */
+    if(is_pred && meta && meta->ingest_ns){
+        long long now = platform_monotonic_ns();
+        lat_record(LAT_REPRESENT, now - meta->hop_ns);
+        lat_record(LAT_E2E, now - meta->ingest_ns);
+    }
+    perfctr_exit(&pm, PERF_REPRESENT, is_pred);
+    TRACE_END(meta, TRACE_REPRESENT, t_trace);
+}
 
+/**
+ * Representation thread.
+ *
+ * Reads formatted strings from `repr_queue` and writes them to the log for
+ * human-readable representation. Returns when the queue is closed.
+ *
+ * @param arg unused thread argument
+ */
+void* represent_thread(void* arg){
+    (void)arg;
+    represent_state_t rs;
+    represent_state_init(&rs);
+
+    while(1){
+        rec_meta_t meta;
+        char *line = queue_pop_meta(&repr_queue, &meta);
+        if(!line) break;
+        trace_wait(&meta);
+        represent_line(&rs, line, &meta);
         free(line);
     }
     return NULL;
@@ -7,6 +7,21 @@
 #ifndef REPRESENT_H
 #define REPRESENT_H
 
+#include "../common.h"
+
+/**
+ * Per-consumer state of the representation stage.
+ *
+ * double last_target_first: first value of the most recent "target," line
+ * int have_last_target: non-zero once last_target_first is valid
+ */
+typedef struct {
+    double last_target_first;
+    int have_last_target;
+} represent_state_t;
+
+void represent_state_init(represent_state_t *rs);
+void represent_line(represent_state_t *rs, const char *line, const rec_meta_t *meta);
 void* represent_thread(void* arg);
 
 #endif
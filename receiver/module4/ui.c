@@ -8,10 +8,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <limits.h>
 
 #include "../common.h"
 #include "../queues.h"
 #include "../log.h"
+#include "../config.h"
+#include "../shard.h"
+#include "../task_pipeline.h"
+#include "../platform.h"
+#include "../state.h"
+#include "../tsdb.h"
+#include "../latency.h"
+#include "../perfctr.h"
+#include "../memstat.h"
 #include <math.h>
 
 #ifdef _WIN32
@@ -19,7 +29,131 @@
 #endif
 
 /**
- * Simple ASCII dashboard UI.
+ * Format a duration with a unit that keeps three significant digits.
+ *
+ * @param ns duration in nanoseconds
+ * @param buf output buffer
+ * @param len size of `buf`
+ * @return buf
+ */
+static const char* ui_fmt_ns(double ns, char *buf, size_t len){
+    if(ns < 1e3) snprintf(buf, len, "%.0fns", ns);
+    else if(ns < 1e6) snprintf(buf, len, "%.3gus", ns / 1e3);
+    else if(ns < 1e9) snprintf(buf, len, "%.3gms", ns / 1e6);
+    else snprintf(buf, len, "%.3gs", ns / 1e9);
+    return buf;
+}
+
+/**
+ * Print the percentiles of the latencies recorded since the previous refresh.
+ *
+ * @param prev snapshots of the previous refresh (LAT_STAGES entries), updated
+ * @param cur, win scratch histograms
+ */
+static void ui_print_latency(lat_hist_t *prev, lat_hist_t *cur, lat_hist_t *win){
+    int header = 0;
+    for(int s=0;s<LAT_STAGES;s++){
+        lat_snapshot(s, cur);
+        lat_hist_diff(win, cur, &prev[s]);
+        prev[s] = *cur;
+        if(win->count <= 0) continue;
+        if(!header){
+            printf(" Latency     : %9s %9s %9s %9s %9s %9s   (since the last refresh)\n", "mean", "p50", "p90", "p99", "p99.9", "records");
+            header = 1;
+        }
+        char b[6][32];
+        printf("   %-10s: %9s %9s %9s %9s %9s %9lld\n", lat_stage_names[s],
+               ui_fmt_ns((double)win->sum / (double)win->count, b[0], sizeof(b[0])),
+               ui_fmt_ns((double)lat_hist_quantile(win, 0.50), b[1], sizeof(b[1])),
+               ui_fmt_ns((double)lat_hist_quantile(win, 0.90), b[2], sizeof(b[2])),
+               ui_fmt_ns((double)lat_hist_quantile(win, 0.99), b[3], sizeof(b[3])),
+               ui_fmt_ns((double)lat_hist_quantile(win, 0.999), b[4], sizeof(b[4])), win->count);
+    }
+}
+
+/**
+ * Format a per-record count, "-" when the event is not counted.
+ */
+static const char* ui_fmt_count(int counted, double v, char *buf, size_t len){
+    if(!counted) snprintf(buf, len, "-");
+    else if(v < 1e4) snprintf(buf, len, "%.3g", v);
+    else if(v < 1e6) snprintf(buf, len, "%.3gk", v / 1e3);
+    else snprintf(buf, len, "%.3gM", v / 1e6);
+    return buf;
+}
+
+/**
+ * Print the CPU counters per record of each stage since the previous
+ * refresh (with `--perf-counters`).
+ *
+ * @param prev counts of the previous refresh (PERF_STAGES entries), updated
+ */
+static void ui_print_perf(perf_counts_t *prev){
+    int mask = perfctr_events();
+    if(!mask) return;
+    int header = 0;
+    for(int s=0;s<PERF_STAGES;s++){
+        perf_counts_t cur;
+        perfctr_snapshot(s, &cur);
+        double n = (double)(cur.records - prev[s].records);
+        double d[PERF_EVENTS];
+        for(int ev=0;ev<PERF_EVENTS;ev++) d[ev] = (double)(cur.v[ev] - prev[s].v[ev]);
+        prev[s] = cur;
+        if(n <= 0) continue;
+        if(!header){
+            printf(" CPU/record  : %9s %9s %9s %9s %9s %9s   (since the last refresh)\n", "time", "cycles", "instr", "IPC", "cache-mis", "br-miss");
+            header = 1;
+        }
+        int have_ipc = (mask & (1 << PERF_EV_CYCLES)) && (mask & (1 << PERF_EV_INSTRUCTIONS)) && d[PERF_EV_CYCLES] > 0;
+        char b[6][32];
+        printf("   %-10s: %9s %9s %9s %9s %9s %9s\n", perf_stage_names[s],
+               (mask & (1 << PERF_EV_TASK_CLOCK)) ? ui_fmt_ns(d[PERF_EV_TASK_CLOCK] / n, b[0], sizeof(b[0])) : "-",
+               ui_fmt_count(mask & (1 << PERF_EV_CYCLES), d[PERF_EV_CYCLES] / n, b[1], sizeof(b[1])),
+               ui_fmt_count(mask & (1 << PERF_EV_INSTRUCTIONS), d[PERF_EV_INSTRUCTIONS] / n, b[2], sizeof(b[2])),
+               ui_fmt_count(have_ipc, have_ipc ? d[PERF_EV_INSTRUCTIONS] / d[PERF_EV_CYCLES] : 0.0, b[3], sizeof(b[3])),
+               ui_fmt_count(mask & (1 << PERF_EV_CACHE_MISSES), d[PERF_EV_CACHE_MISSES] / n, b[4], sizeof(b[4])),
+               ui_fmt_count(mask & (1 << PERF_EV_BRANCH_MISSES), d[PERF_EV_BRANCH_MISSES] / n, b[5], sizeof(b[5])));
+    }
+}
+
+/**
+ * Format a size in bytes with a binary unit.
+ */
+static const char* ui_fmt_bytes(double v, char *buf, size_t len){
+    if(v < 1024.0) snprintf(buf, len, "%.0fB", v);
+    else if(v < 1048576.0) snprintf(buf, len, "%.1fKiB", v / 1024.0);
+    else if(v < 1073741824.0) snprintf(buf, len, "%.1fMiB", v / 1048576.0);
+    else snprintf(buf, len, "%.2fGiB", v / 1073741824.0);
+    return buf;
+}
+
+/**
+ * Print the resident memory, the budget and the accounted memory of each
+ * subsystem (see memstat.c).
+ */
+static void ui_print_memory(void){
+    char b[4][32];
+    long long rss = -1, hwm = -1, budget = mem_budget();
+    platform_memory_status(&rss, &hwm);
+    mem_usage_t all;
+    mem_get_usage(MEM_TAGS, &all);
+    printf(" Memory      : resident %s (peak %s)   accounted %s (peak %s)",
+           rss >= 0 ? ui_fmt_bytes((double)rss, b[0], sizeof(b[0])) : "?", hwm >= 0 ? ui_fmt_bytes((double)hwm, b[1], sizeof(b[1])) : "?",
+           ui_fmt_bytes((double)all.bytes, b[2], sizeof(b[2])), ui_fmt_bytes((double)all.peak, b[3], sizeof(b[3])));
+    if(budget > 0) printf("   budget %s (%.0f%% used)\n", ui_fmt_bytes((double)budget, b[0], sizeof(b[0])),
+                          100.0 * (double)(rss > all.bytes ? rss : all.bytes) / (double)budget);
+    else printf("\n");
+    printf("   %-10s: %9s %9s %9s %9s\n", "subsystem", "now", "peak", "blocks", "allocs");
+    for(int t=0;t<MEM_TAGS;t++){
+        mem_usage_t u;
+        mem_get_usage(t, &u);
+        printf("   %-10s: %9s %9s %9lld %9lld\n", mem_tag_names[t], ui_fmt_bytes((double)u.bytes, b[0], sizeof(b[0])),
+               ui_fmt_bytes((double)u.peak, b[1], sizeof(b[1])), u.allocs - u.frees, u.allocs);
+    }
+}
+
+/**
+ * Simple ASCII dashboard UI. Returns once a stop signal was received.
  *
  * arg: unused thread argument
  */
@@ -27,9 +161,18 @@ void* ui_thread(void* arg){
     (void)arg;
     char *last_error = NULL;
     long long prev_received = 0, prev_processed = 0, prev_represented = 0;
+    /* totals restored from --state-dir are not traffic of the first interval */
+    stats_get_counts(&prev_received, &prev_processed, &prev_represented);
     const double ema_alpha = 0.3; 
     double smooth_rps = 0.0, smooth_pps = 0.0, smooth_reps = 0.0;
-    while(1){
+    pool_worker_stats_t prev_workers[POOL_MAX_WORKERS];
+    memset(prev_workers, 0, sizeof(prev_workers));
+    long long prev_tick_ns = platform_monotonic_ns();
+    /* previous latency snapshots and two scratch histograms */
+    lat_hist_t *lat_prev = (lat_hist_t*)calloc(LAT_STAGES + 2, sizeof(lat_hist_t));
+    perf_counts_t perf_prev[PERF_STAGES];
+    for(int s=0;s<PERF_STAGES;s++) perfctr_snapshot(s, &perf_prev[s]);
+    while(!platform_stop_requested()){
         char *e;
         while((e = queue_try_pop(&error_queue)) != NULL){
             if(last_error) free(last_error);
@@ -53,6 +196,17 @@ void* ui_thread(void* arg){
     stats_get_window_rates(window, &w_recv, &w_proc, &w_repr);
     double avg_err = NAN;
     stats_get_avg_error(window, &avg_err);
+    double train_frac = 0.0; long long trained = 0, deferred = 0, dropped = 0; int backlog = 0;
+    stats_get_train(window, &train_frac, &trained, &deferred, &dropped, &backlog);
+    long long models_resident = 0, models_bytes = 0, models_loads = 0, models_spills = 0;
+    stats_get_model_cache(&models_resident, &models_bytes, &models_loads, &models_spills);
+    long long hz_refreshes = 0, hz_reused = 0, hz_steps = 0;
+    stats_get_horizon(&hz_refreshes, &hz_reused, &hz_steps);
+    long long tiers[STATS_TIERS], alarms[STATS_DETECTORS];
+    stats_get_tiers(tiers, alarms);
+    char budget_buf[32];
+    if(g_config.train_cpu_budget > 0.0) snprintf(budget_buf, sizeof(budget_buf), "%.1f%%", g_config.train_cpu_budget * 100.0);
+    else snprintf(budget_buf, sizeof(budget_buf), "unlimited");
 
     printf("\x1b[2J\x1b[H");
         printf("+------------------------------------------------------+\n");
@@ -60,23 +214,104 @@ void* ui_thread(void* arg){
         printf("+------------------------------------------------------+\n");
     printf(" Raw queue   : %4d   total: %lld   r/s: %.1f   win(%ds): %lld\n", queue_length(&raw_queue), tot_recv, smooth_rps, window, w_recv);
     printf(" Proc queue  : %4d   total: %lld   p/s: %.1f   win(%ds): %lld\n", queue_length(&proc_queue), tot_proc, smooth_pps, window, w_proc);
+    printf(" Feat queue  : %4d\n", queue_length(&feat_queue));
     printf(" Repr queue  : %4d   total: %lld   r/s: %.1f   win(%ds): %lld\n", queue_length(&repr_queue), tot_repr, smooth_reps, window, w_repr);
     printf(" Error queue : %4d\n", queue_length(&error_queue));
+    printf(" Training    : %.2f%% of a core (budget %s)   steps: %lld   deferred: %lld   dropped: %lld   backlog: %d\n",
+           train_frac * 100.0, budget_buf, trained, deferred, dropped, backlog);
+    printf(" Models      : %lld resident (%.1f MiB)   loaded: %lld   spilled: %lld\n",
+           models_resident, (double)models_bytes / (1024.0 * 1024.0), models_loads, models_spills);
+    if(tiers[STATS_TIER_DETECTOR] + tiers[STATS_TIER_MODEL] > 0)
+        printf(" Detectors   : detector only: %lld   model: %lld   escalated: %lld   alarms ewma/cusum/hw: %lld/%lld/%lld\n",
+               tiers[STATS_TIER_DETECTOR], tiers[STATS_TIER_MODEL], tiers[STATS_TIER_ESCALATED], alarms[0], alarms[1], alarms[2]);
+    if(g_config.horizon > 1)
+        printf(" Horizon     : %d steps   reused: %.1f%%   extra steps/record: %.2f\n", g_config.horizon,
+               hz_refreshes ? 100.0 * (double)hz_reused / (double)hz_refreshes : 0.0,
+               hz_refreshes ? (double)hz_steps / (double)hz_refreshes : 0.0);
+    if(g_config.fed_port > 0){
+        long long fed_sent = 0, fed_recv = 0, fed_rounds = 0, fed_merged = 0;
+        int fed_peers = 0;
+        stats_get_federation(&fed_sent, &fed_recv, &fed_rounds, &fed_merged, &fed_peers);
+        printf(" Federation  : rounds: %lld   peers live: %d   models merged: %lld   sent: %.1f KiB   received: %.1f KiB\n",
+               fed_rounds, fed_peers, fed_merged, (double)fed_sent / 1024.0, (double)fed_recv / 1024.0);
+    }
+    if(g_config.wal_dir[0]){
+        long long wal_records = 0, wal_bytes = 0, wal_syncs = 0, wal_sync_ns = 0, wal_replayed = 0;
+        stats_get_wal(&wal_records, &wal_bytes, &wal_syncs, &wal_sync_ns, &wal_replayed);
+        printf(" WAL         : records: %lld   synced: %.1f KiB   fsyncs: %lld (avg %.2f ms)   replayed: %lld\n",
+               wal_records, (double)wal_bytes / 1024.0, wal_syncs,
+               wal_syncs ? (double)wal_sync_ns / (double)wal_syncs / 1e6 : 0.0, wal_replayed);
+    }
+    if(g_store){
+        long long st_points = 0, st_bytes = 0;
+        tsdb_usage(g_store, &st_points, &st_bytes);
+        printf(" Store       : %lld points   %.1f MiB   %.2f bytes/point\n", st_points, (double)st_bytes / (1024.0 * 1024.0),
+               st_points ? (double)st_bytes / (double)st_points : 0.0);
+        /* bytes over the last hour / day of the first few sources, answered from the rollups */
+        char st_src[3][64];
+        int n_src = tsdb_sources(g_store, st_src, 3);
+        for(int i=0;i<n_src && i<3;i++){
+            long long last = tsdb_last(g_store, st_src[i], TSDB_COL_METRICS);
+            if(last == LLONG_MIN) continue;
+            tsdb_agg_t h, d;
+            tsdb_query(g_store, st_src[i], TSDB_COL_METRICS, last - 3600000 + 1, last + 1, TSDB_TIERS - 1, &h);
+            tsdb_query(g_store, st_src[i], TSDB_COL_METRICS, last - 86400000 + 1, last + 1, TSDB_TIERS - 1, &d);
+            printf("   %-10.10s: bytes 1h: %lld pts mean %.4g max %.4g   24h: %lld pts mean %.4g max %.4g\n", st_src[i],
+                   h.count, h.count ? h.sum / (double)h.count : 0.0, h.count ? (double)h.max : 0.0,
+                   d.count, d.count ? d.sum / (double)d.count : 0.0, d.count ? (double)d.max : 0.0);
+        }
+    }
+    int n_shards = shard_count();
+    for(int i=0;i<n_shards;i++){
+        long long sh_recv = 0, sh_repr = 0;
+        shard_get_counts(i, &sh_recv, &sh_repr);
+        printf(" Shard %-5d : received: %lld   represented: %lld\n", i, sh_recv, sh_repr);
+    }
+    long long now_ns = platform_monotonic_ns();
+    double tick_ns = (double)(now_ns - prev_tick_ns);
+    prev_tick_ns = now_ns;
+    pool_t *pool = task_pipeline_pool();
+    int n_workers = pool ? pool_worker_count(pool) : 0;
+    for(int i=0;i<n_workers;i++){
+        pool_worker_stats_t ws;
+        pool_get_worker_stats(pool, i, &ws);
+        double util = tick_ns > 0.0 ? (double)(ws.busy_ns - prev_workers[i].busy_ns) / tick_ns : 0.0;
+        printf(" Worker %-4d : util: %5.1f%%   tasks: %lld   steals: %lld   parks: %lld\n",
+               i, util * 100.0, ws.tasks, ws.steals, ws.parks);
+        prev_workers[i] = ws;
+    }
+    if(lat_prev) ui_print_latency(lat_prev, &lat_prev[LAT_STAGES], &lat_prev[LAT_STAGES + 1]);
+    ui_print_perf(perf_prev);
+    ui_print_memory();
         printf("\n");
     if(isnan(avg_err)) printf(" Last error  : %s\n", last_error ? last_error : "(none)");
     else printf(" Avg pred abs err (last %ds): %.6f\n", window, avg_err);
+    for(int k=0, header=0;k<STATS_ERR_SERIES;k++){
+        stats_err_agg_t ea;
+        stats_get_error_agg(window, k, &ea);
+        if(ea.count <= 0) continue;
+        if(!header++) printf(" Pred error  : %9s %9s %9s %9s %9s %9s   (last %ds)\n", "mean", "p50", "p95", "p99", "max", "samples", window);
+        printf("   %-10s: %9.4g %9.4g %9.4g %9.4g %9.4g %9lld\n", k < STATS_ERR_ALL ? tsdb_column_names[TSDB_COL_METRICS + k] : "average",
+               ea.mean, ea.p50, ea.p95, ea.p99, ea.max, ea.count);
+    }
         printf("\n");
         printf(" (UI updates every 5s; press Ctrl-C to quit)\n");
         fflush(stdout);
 
+        /* sleep in short steps so a shutdown does not wait for the next refresh,
+         * checking the resident memory against the budget on every step */
+        for(int t=0; t<5000 && !platform_stop_requested(); t+=STATE_STOP_POLL_MS){
+            mem_check();
 #ifdef _WIN32
-        Sleep(5000);
+            Sleep(STATE_STOP_POLL_MS);
 #else
-        struct timespec ts = {5, 0};
-        nanosleep(&ts, NULL);
+            struct timespec ts = {0, STATE_STOP_POLL_MS * 1000000L};
+            nanosleep(&ts, NULL);
 #endif
+        }
     }
 
     if(last_error) free(last_error);
+    free(lat_prev);
     return NULL;
 }
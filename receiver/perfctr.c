@@ -0,0 +1,311 @@
+/*
+ * perfctr.c
+ *
+ * Per-stage CPU counters. Each thread that enters a stage opens one
+ * perf_event_open() group for itself (user space only): the task clock as
+ * leader and the hardware events as members, so one read() returns all of
+ * them. A hardware event the kernel refuses (perf_event_paranoid, no PMU in
+ * a VM) is left out and only the others are counted; without even the task
+ * clock the counters stay off. perfctr_exit() adds the deltas since
+ * perfctr_enter() to the thread's own counts, written without locked
+ * instructions like the latency histograms; threads beyond PERF_SLOTS
+ * share one set updated with atomic adds.
+ *
+ * Each marker pair costs two read() system calls, which is why the counters
+ * are off unless `--perf-counters=1`. Deferred training run while a stage
+ * is idle is not attributed to a stage.
+ */
+#ifndef PERFCTR_C_HEADER
+#define PERFCTR_C_HEADER
+
+#include "perfctr.h"
+
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "log.h"
+
+/* Threads with a set of counts of their own */
+#define PERF_SLOTS 64
+
+const char *const perf_stage_names[PERF_STAGES] = { "preproc", "infer", "train", "represent" };
+const char *const perf_event_names[PERF_EVENTS] = { "cpu_ns", "cycles", "instructions", "cache_misses", "branch_misses" };
+
+/**
+ * Counts of a stage as recorded (see perf_counts_t).
+ */
+typedef struct {
+    atomic_llong records;
+    atomic_llong v[PERF_EVENTS];
+} perf_live_t;
+
+/**
+ * Counts of one thread, on their own cache lines.
+ */
+typedef struct {
+    _Alignas(64) perf_live_t s[PERF_STAGES];
+} perf_set_t;
+
+/**
+ * Counter group of one thread.
+ *
+ * n: events in the group, fd[0] is the leader
+ * fd, ev: descriptor and PERF_EV_* event of each group member, in read order
+ * set: counts the thread adds to
+ */
+typedef struct {
+    int n;
+    int fd[PERF_EVENTS];
+    int ev[PERF_EVENTS];
+    perf_set_t *set;
+} perf_group_t;
+
+static atomic_int perf_on;
+static atomic_int perf_mask;
+static _Atomic(perf_set_t*) perf_sets[PERF_SLOTS];
+static atomic_int perf_claimed;
+static perf_set_t perf_shared;
+static pthread_key_t perf_key;
+static pthread_once_t perf_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local perf_group_t *perf_own;
+static _Thread_local int perf_no_group;
+
+#ifdef __linux__
+static const struct { unsigned int type; unsigned long long config; } perf_defs[PERF_EVENTS] = {
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+/**
+ * Open one counter of the calling thread.
+ *
+ * @param ev PERF_EV_* event
+ * @param group leader descriptor, -1 to open a leader
+ * @return descriptor or -1 (errno set)
+ */
+static int perf_open(int ev, int group){
+    struct perf_event_attr a;
+    memset(&a, 0, sizeof(a));
+    a.size = sizeof(a);
+    a.type = perf_defs[ev].type;
+    a.config = perf_defs[ev].config;
+    a.exclude_kernel = 1;
+    a.exclude_hv = 1;
+    a.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(SYS_perf_event_open, &a, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+/**
+ * Open the counter group of the calling thread.
+ *
+ * @param g receives the group (g->n = 0 when not even the leader opened)
+ * @param err receives the errno of the first event that failed (0 = none)
+ */
+static void perf_group_open(perf_group_t *g, int *err){
+    g->n = 0;
+    *err = 0;
+    for(int ev=0;ev<PERF_EVENTS;ev++){
+        int fd = perf_open(ev, g->n ? g->fd[0] : -1);
+        if(fd < 0){
+            if(!*err) *err = errno;
+            if(!g->n) return;
+            continue;
+        }
+        g->fd[g->n] = fd;
+        g->ev[g->n] = ev;
+        g->n++;
+    }
+}
+
+static void perf_group_close(perf_group_t *g){
+    for(int i=g->n-1;i>=0;i--) close(g->fd[i]);
+    g->n = 0;
+}
+
+/**
+ * Read the group's counters.
+ *
+ * @param v receives the value of every event of the group
+ * @return 0 on success, -1 on error
+ */
+static int perf_group_read(perf_group_t *g, long long *v){
+    unsigned long long buf[1 + PERF_EVENTS];
+    ssize_t n = read(g->fd[0], buf, sizeof(buf));
+    if(n < (ssize_t)((1 + g->n) * sizeof(buf[0])) || buf[0] != (unsigned long long)g->n) return -1;
+    for(int i=0;i<g->n;i++) v[g->ev[i]] = (long long)buf[1 + i];
+    return 0;
+}
+#else
+static void perf_group_open(perf_group_t *g, int *err){ g->n = 0; *err = 0; }
+static void perf_group_close(perf_group_t *g){ g->n = 0; }
+static int perf_group_read(perf_group_t *g, long long *v){ (void)g; (void)v; return -1; }
+#endif
+
+/**
+ * Thread exit: close the thread's counters. Its counts stay in place.
+ *
+ * @param group the thread's perf_group_t
+ */
+static void perf_thread_exit(void *group){
+    perf_group_close((perf_group_t*)group);
+    free(group);
+    perf_own = NULL;
+    perf_no_group = 1;
+}
+
+static void perf_key_create(void){
+    pthread_key_create(&perf_key, perf_thread_exit);
+}
+
+/**
+ * Get the calling thread's counter group, opening it and claiming a set of
+ * counts on first use.
+ *
+ * @return group or NULL when the thread has no counters
+ */
+static perf_group_t* perf_group(void){
+    if(perf_own) return perf_own;
+    if(perf_no_group) return NULL;
+    perf_no_group = 1;
+    perf_group_t *g = (perf_group_t*)calloc(1, sizeof(perf_group_t));
+    if(!g) return NULL;
+    int err;
+    perf_group_open(g, &err);
+    if(!g->n){ free(g); return NULL; }
+    int i = atomic_fetch_add(&perf_claimed, 1);
+    perf_set_t *s = NULL;
+    if(i < PERF_SLOTS){
+        s = (perf_set_t*)aligned_alloc(_Alignof(perf_set_t), sizeof(perf_set_t));
+        if(s) memset(s, 0, sizeof(*s));
+        atomic_store_explicit(&perf_sets[i], s, memory_order_release);
+    }
+    g->set = s ? s : &perf_shared;
+    pthread_once(&perf_key_once, perf_key_create);
+    pthread_setspecific(perf_key, g);
+    perf_no_group = 0;
+    perf_own = g;
+    return g;
+}
+
+/**
+ * Turn the counters on. The calling thread probes which events the kernel
+ * allows and logs them; when not even the task clock can be opened the
+ * counters stay off.
+ *
+ * @param enabled `--perf-counters`
+ */
+void perfctr_start(int enabled){
+    if(!enabled) return;
+#ifdef __linux__
+    perf_group_t probe;
+    int err;
+    perf_group_open(&probe, &err);
+    if(!probe.n){
+        LOG_WARN("[perf] CPU counters unavailable (%s), --perf-counters ignored\n", strerror(err));
+        return;
+    }
+    int mask = 0;
+    char names[128] = "", missing[128] = "";
+    for(int i=0;i<probe.n;i++) mask |= 1 << probe.ev[i];
+    perf_group_close(&probe);
+    for(int ev=0;ev<PERF_EVENTS;ev++){
+        char *dst = (mask & (1 << ev)) ? names : missing;
+        size_t len = strlen(dst);
+        snprintf(dst + len, sizeof(names) - len, "%s%s", len ? ", " : "", perf_event_names[ev]);
+    }
+    if(missing[0]) LOG_WARN("[perf] counting %s per stage; %s unavailable (%s)\n", names, missing, strerror(err));
+    else LOG_INFO("[perf] counting %s per stage\n", names);
+    atomic_store(&perf_mask, mask);
+    atomic_store(&perf_on, 1);
+#else
+    LOG_WARN("[perf] CPU counters need Linux perf_event_open(), --perf-counters ignored\n");
+#endif
+}
+
+/**
+ * Stop attributing counts. The threads close their counters when they exit.
+ */
+void perfctr_stop(void){
+    atomic_store(&perf_on, 0);
+}
+
+/**
+ * Events being counted.
+ *
+ * @return bit mask of PERF_EV_* events, 0 while the counters are off
+ */
+int perfctr_events(void){
+    return atomic_load(&perf_on) ? atomic_load(&perf_mask) : 0;
+}
+
+/**
+ * Mark the start of a stage's work on the calling thread.
+ *
+ * @param m receives the counter values
+ */
+void perfctr_enter(perf_mark_t *m){
+    m->ok = 0;
+    if(!atomic_load_explicit(&perf_on, memory_order_relaxed)) return;
+    perf_group_t *g = perf_group();
+    if(g && perf_group_read(g, m->v) == 0) m->ok = 1;
+}
+
+/**
+ * Mark the end of a stage's work and add the counts since perfctr_enter().
+ *
+ * @param m values of perfctr_enter() on the same thread
+ * @param stage PERF_* stage
+ * @param records records the work completed (0 for part of a record)
+ */
+void perfctr_exit(perf_mark_t *m, int stage, int records){
+    if(!m->ok || stage < 0 || stage >= PERF_STAGES) return;
+    m->ok = 0;
+    perf_group_t *g = perf_own;
+    long long now[PERF_EVENTS];
+    if(!g || perf_group_read(g, now) != 0) return;
+    perf_live_t *s = &g->set->s[stage];
+    if(g->set == &perf_shared){
+        atomic_fetch_add_explicit(&s->records, records, memory_order_relaxed);
+        for(int i=0;i<g->n;i++) atomic_fetch_add_explicit(&s->v[g->ev[i]], now[g->ev[i]] - m->v[g->ev[i]], memory_order_relaxed);
+        return;
+    }
+    /* single writer: plain read-modify-write through relaxed atomics */
+    atomic_store_explicit(&s->records, atomic_load_explicit(&s->records, memory_order_relaxed) + records, memory_order_relaxed);
+    for(int i=0;i<g->n;i++){
+        atomic_llong *c = &s->v[g->ev[i]];
+        atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + now[g->ev[i]] - m->v[g->ev[i]], memory_order_relaxed);
+    }
+}
+
+/**
+ * Sum the counts of all threads for one stage.
+ *
+ * @param stage PERF_* stage
+ * @param out receives the counts
+ */
+void perfctr_snapshot(int stage, perf_counts_t *out){
+    memset(out, 0, sizeof(*out));
+    if(stage < 0 || stage >= PERF_STAGES) return;
+    int n = atomic_load(&perf_claimed);
+    if(n > PERF_SLOTS) n = PERF_SLOTS;
+    for(int i=0;i<=n;i++){
+        perf_set_t *set = i < n ? atomic_load_explicit(&perf_sets[i], memory_order_acquire) : &perf_shared;
+        if(!set) continue;
+        out->records += atomic_load_explicit(&set->s[stage].records, memory_order_relaxed);
+        for(int ev=0;ev<PERF_EVENTS;ev++) out->v[ev] += atomic_load_explicit(&set->s[stage].v[ev], memory_order_relaxed);
+    }
+}
@@ -0,0 +1,62 @@
+/**
+ * perfctr.h
+ *
+ * Declarations for the per-stage CPU counters. With `--perf-counters=1`
+ * every thread running a stage opens a perf_event_open() group (task clock,
+ * cycles, instructions, cache and branch misses) and the stages bracket
+ * their per-record work with perfctr_enter() / perfctr_exit(); the counts
+ * are summed per stage, so IPC and misses per record can be compared
+ * between builds.
+ */
+
+#ifndef RECEIVER_PERFCTR_H
+#define RECEIVER_PERFCTR_H
+
+/* Stages the counts are attributed to */
+#define PERF_PREPROC 0   /* parsing a datagram (and logging / forwarding it) */
+#define PERF_INFER 1     /* model lookup, inference and forecast of a record */
+#define PERF_TRAIN 2     /* training step on the record's path (or handing it over) */
+#define PERF_REPRESENT 3 /* representing a record's output lines */
+#define PERF_STAGES 4
+
+/* Counted events */
+#define PERF_EV_TASK_CLOCK 0   /* CPU time of the thread in ns (software event) */
+#define PERF_EV_CYCLES 1
+#define PERF_EV_INSTRUCTIONS 2
+#define PERF_EV_CACHE_MISSES 3
+#define PERF_EV_BRANCH_MISSES 4
+#define PERF_EVENTS 5
+
+/**
+ * Counter values at perfctr_enter().
+ *
+ * ok: 1 when the values were read (perfctr_exit() does nothing otherwise)
+ * v: value per PERF_EV_* event
+ */
+typedef struct {
+    int ok;
+    long long v[PERF_EVENTS];
+} perf_mark_t;
+
+/**
+ * Counts of one stage.
+ *
+ * records: records the counts cover
+ * v: total per PERF_EV_* event (meaningful for the events in perfctr_events())
+ */
+typedef struct {
+    long long records;
+    long long v[PERF_EVENTS];
+} perf_counts_t;
+
+extern const char *const perf_stage_names[PERF_STAGES];
+extern const char *const perf_event_names[PERF_EVENTS];
+
+void perfctr_start(int enabled);
+void perfctr_stop(void);
+int perfctr_events(void);
+void perfctr_enter(perf_mark_t *m);
+void perfctr_exit(perf_mark_t *m, int stage, int records);
+void perfctr_snapshot(int stage, perf_counts_t *out);
+
+#endif
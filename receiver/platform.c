@@ -15,6 +15,20 @@
 #include <string.h>
 #include <time.h>
 
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <direct.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
 
 /**
  * Initialize platform-specific socket subsystem.
@@ -40,3 +54,227 @@ void platform_socket_cleanup(void){
     WSACleanup();
 #endif
 }
+
+/**
+ * Read a monotonic clock in nanoseconds.
+ *
+ * The value is only meaningful as a difference between two calls; it is not
+ * related to wall-clock time and never goes backwards.
+ *
+ * @return monotonic timestamp in nanoseconds
+ */
+long long platform_monotonic_ns(void){
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if(freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (long long)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Read the CPU time consumed by the calling thread in nanoseconds.
+ *
+ * Unlike platform_monotonic_ns() this does not advance while the thread is
+ * blocked or preempted, so it measures work actually done by the thread.
+ *
+ * @return thread CPU time in nanoseconds
+ */
+long long platform_thread_cpu_ns(void){
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if(!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) return platform_monotonic_ns();
+    unsigned long long k = ((unsigned long long)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    unsigned long long u = ((unsigned long long)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (long long)((k + u) * 100ULL);
+#else
+    struct timespec ts;
+    if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return platform_monotonic_ns();
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Read the resident set size and its high-water mark (VmRSS / VmHWM of
+ * /proc/self/status on Linux).
+ *
+ * @param rss receives the resident memory in bytes (-1 when not reported)
+ * @param hwm receives the largest resident memory so far in bytes (-1 when not reported)
+ * @return 0 when the resident memory was read, -1 otherwise
+ */
+int platform_memory_status(long long *rss, long long *hwm){
+    *rss = -1;
+    *hwm = -1;
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return -1;
+    *rss = (long long)pmc.WorkingSetSize;
+    *hwm = (long long)pmc.PeakWorkingSetSize;
+    return 0;
+#elif defined(__linux__)
+    FILE *f = fopen("/proc/self/status", "r");
+    if(!f) return -1;
+    char line[128];
+    long long kb;
+    while(fgets(line, sizeof(line), f)){
+        if(sscanf(line, "VmRSS: %lld kB", &kb) == 1) *rss = kb * 1024;
+        else if(sscanf(line, "VmHWM: %lld kB", &kb) == 1) *hwm = kb * 1024;
+    }
+    fclose(f);
+    return *rss < 0 ? -1 : 0;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * Create a directory and all missing parent directories.
+ *
+ * @param path directory path ('/' separated; '\\' is accepted on Windows)
+ * @return 0 on success or when the directory already exists, -1 on error
+ */
+int platform_mkdir_p(const char *path){
+    char buf[512];
+    size_t len = strlen(path);
+    if(len == 0 || len >= sizeof(buf)) return -1;
+    memcpy(buf, path, len + 1);
+    for(size_t i=1;i<=len;i++){
+        if(buf[i] != '/' && buf[i] != '\\' && buf[i] != '\0') continue;
+        char saved = buf[i];
+        buf[i] = '\0';
+#ifdef _WIN32
+        int rc = _mkdir(buf);
+#else
+        int rc = mkdir(buf, 0755);
+#endif
+        if(rc != 0 && errno != EEXIST) return -1;
+        buf[i] = saved;
+    }
+    return 0;
+}
+
+/**
+ * Flush the data of a file to stable storage (metadata only where needed
+ * to read the data back).
+ *
+ * @param fd file descriptor
+ * @return 0 on success, -1 on error
+ */
+int platform_fsync_data(int fd){
+#ifdef _WIN32
+    return _commit(fd) == 0 ? 0 : -1;
+#elif defined(__APPLE__)
+    return fsync(fd) == 0 ? 0 : -1;
+#else
+    return fdatasync(fd) == 0 ? 0 : -1;
+#endif
+}
+
+/**
+ * Map a file into memory. A writable mapping creates the file if needed and
+ * extends it (with zeros) to `size` bytes first; a read-only mapping needs
+ * the file to hold at least `size` bytes.
+ *
+ * @param path file path
+ * @param size number of bytes to map
+ * @param writable non-zero for a shared read-write mapping
+ * @return mapped address or NULL on error
+ */
+void* platform_map_file(const char *path, size_t size, int writable){
+#ifdef _WIN32
+    HANDLE f = CreateFileA(path, writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                           NULL, writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(f == INVALID_HANDLE_VALUE) return NULL;
+    unsigned long long sz = (unsigned long long)size;
+    HANDLE m = CreateFileMappingA(f, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)(sz >> 32), (DWORD)sz, NULL);
+    CloseHandle(f);
+    if(!m) return NULL;
+    void *p = MapViewOfFile(m, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+    CloseHandle(m);
+    return p;
+#else
+    int fd = open(path, writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if(fd < 0) return NULL;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (st.st_size < (off_t)size && (!writable || ftruncate(fd, (off_t)size) != 0))){
+        close(fd);
+        return NULL;
+    }
+    void *p = mmap(NULL, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return p == MAP_FAILED ? NULL : p;
+#endif
+}
+
+/**
+ * Write the modified pages of a mapping back to its file.
+ *
+ * @param addr address returned by platform_map_file()
+ * @param size mapped size
+ * @return 0 on success, -1 on error
+ */
+int platform_sync_map(void *addr, size_t size){
+#ifdef _WIN32
+    return FlushViewOfFile(addr, size) ? 0 : -1;
+#else
+    return msync(addr, size, MS_SYNC) == 0 ? 0 : -1;
+#endif
+}
+
+/**
+ * Unmap a mapping of platform_map_file().
+ *
+ * @param addr mapped address (may be NULL)
+ * @param size mapped size
+ */
+void platform_unmap_file(void *addr, size_t size){
+    if(!addr) return;
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(addr);
+#else
+    munmap(addr, size);
+#endif
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+
+/**
+ * Signal handler of platform_catch_stop_signals(): records the request and
+ * restores the default action, so a second signal ends the process at once.
+ */
+static void platform_on_stop_signal(int sig){
+    stop_requested = 1;
+    signal(sig, SIG_DFL);
+}
+
+/**
+ * Turn SIGINT and SIGTERM into a shutdown request that the receive loops
+ * poll with platform_stop_requested().
+ */
+void platform_catch_stop_signals(void){
+    signal(SIGINT, platform_on_stop_signal);
+    signal(SIGTERM, platform_on_stop_signal);
+}
+
+/**
+ * Check whether SIGINT / SIGTERM asked the process to shut down.
+ *
+ * @return non-zero once a stop signal was received
+ */
+int platform_stop_requested(void){
+    return stop_requested != 0;
+}
+
+/**
+ * Ask the process to shut down as if SIGINT had been received, e.g. when a
+ * pipeline stage cannot run.
+ */
+void platform_request_stop(void){
+    stop_requested = 1;
+}
@@ -7,6 +7,8 @@
 #ifndef PLATFORM_H
 #define PLATFORM_H
 
+#include <stddef.h>
+
 #ifdef _WIN32
   #ifndef WIN32_LEAN_AND_MEAN
     #define WIN32_LEAN_AND_MEAN
@@ -39,4 +41,19 @@
 int platform_socket_init(void);
 void platform_socket_cleanup(void);
 
+long long platform_monotonic_ns(void);
+long long platform_thread_cpu_ns(void);
+int platform_memory_status(long long *rss, long long *hwm);
+
+int platform_mkdir_p(const char *path);
+int platform_fsync_data(int fd);
+
+void* platform_map_file(const char *path, size_t size, int writable);
+int platform_sync_map(void *addr, size_t size);
+void platform_unmap_file(void *addr, size_t size);
+
+void platform_catch_stop_signals(void);
+int platform_stop_requested(void);
+void platform_request_stop(void);
+
 #endif
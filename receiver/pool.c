@@ -0,0 +1,483 @@
+/*
+ * pool.c
+ *
+ * Small work-stealing thread pool. Every worker owns a deque: tasks submitted
+ * from a worker are pushed to and popped from the bottom of its own deque
+ * (LIFO, cache friendly), idle workers steal from the top of a random
+ * victim's deque (FIFO). Workers that find no work park on a condition
+ * variable and are woken by the next submission.
+ *
+ * Strands are serial executors on top of the pool: tasks posted to the same
+ * strand run one at a time in posting order, on whichever worker is free.
+ */
+
+#ifndef POOL_C_HEADER
+#define POOL_C_HEADER
+#include "pool.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "platform.h"
+#include "log.h"
+#include "memstat.h"
+
+#define DEQUE_INITIAL_CAP 64
+#define STRAND_BATCH 32
+
+/**
+ * Task: function and argument.
+ */
+typedef struct {
+    task_fn fn;
+    void *arg;
+} task_t;
+
+/**
+ * Mutex-protected ring buffer deque. Items live in [top, bottom).
+ *
+ * m: protects all fields
+ * buf: ring storage of `cap` tasks (power of two)
+ * top, bottom: steal end / owner end (monotonic counters, masked on access)
+ */
+typedef struct {
+    pthread_mutex_t m;
+    task_t *buf;
+    size_t cap;
+    size_t top, bottom;
+} deque_t;
+
+/**
+ * Worker state.
+ *
+ * pool: owning pool
+ * index: worker number
+ * thread: worker thread
+ * dq: the worker's deque
+ * rng: xorshift state used to pick steal victims
+ * busy_ns, tasks, steals, parks: counters reported by pool_get_worker_stats()
+ */
+typedef struct {
+    pool_t *pool;
+    int index;
+    pthread_t thread;
+    deque_t dq;
+    unsigned rng;
+    atomic_llong busy_ns, tasks, steals, parks;
+} worker_t;
+
+/**
+ * Pool structure definition.
+ *
+ * n: number of workers
+ * workers: worker array
+ * self_key: thread-specific pointer to the calling worker (NULL outside the pool)
+ * park_m, park_c: mutex / condition workers park on
+ * sleepers: number of parked (or parking) workers
+ * stop: set by pool_destroy(); workers exit once no work is left
+ * next_victim: round-robin counter for submissions from outside the pool
+ */
+struct pool_s {
+    int n;
+    worker_t *workers;
+    pthread_key_t self_key;
+    pthread_mutex_t park_m;
+    pthread_cond_t park_c;
+    atomic_int sleepers;
+    atomic_int stop;
+    atomic_uint next_victim;
+};
+
+/**
+ * Queued strand task.
+ */
+typedef struct strand_item_s {
+    task_t task;
+    struct strand_item_s *next;
+} strand_item_t;
+
+/**
+ * Strand structure definition.
+ *
+ * pool: pool the strand runs on
+ * m: protects the list and `running`
+ * head, tail: posted tasks not yet run
+ * running: non-zero while a drain task for the strand is submitted or running
+ */
+struct strand_s {
+    pool_t *pool;
+    pthread_mutex_t m;
+    strand_item_t *head, *tail;
+    int running;
+};
+
+static int deque_init(deque_t *d){
+    pthread_mutex_init(&d->m, NULL);
+    d->cap = DEQUE_INITIAL_CAP;
+    d->top = d->bottom = 0;
+    d->buf = (task_t*)mem_alloc(MEM_QUEUE, sizeof(task_t) * d->cap);
+    return d->buf ? 0 : -1;
+}
+
+static void deque_free(deque_t *d){
+    mem_free(d->buf);
+    pthread_mutex_destroy(&d->m);
+}
+
+/**
+ * Push a task at the owner end, growing the ring when full.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+static int deque_push_bottom(deque_t *d, task_t t){
+    pthread_mutex_lock(&d->m);
+    if(d->bottom - d->top == d->cap){
+        size_t ncap = d->cap * 2;
+        task_t *nbuf = (task_t*)mem_alloc(MEM_QUEUE, sizeof(task_t) * ncap);
+        if(!nbuf){ pthread_mutex_unlock(&d->m); return -1; }
+        for(size_t i = d->top; i != d->bottom; i++) nbuf[i & (ncap-1)] = d->buf[i & (d->cap-1)];
+        mem_free(d->buf);
+        d->buf = nbuf;
+        d->cap = ncap;
+    }
+    d->buf[d->bottom & (d->cap-1)] = t;
+    d->bottom++;
+    pthread_mutex_unlock(&d->m);
+    return 0;
+}
+
+/**
+ * Pop the newest task (owner end).
+ *
+ * @return 1 when a task was taken, 0 when the deque is empty
+ */
+static int deque_pop_bottom(deque_t *d, task_t *t){
+    int ok = 0;
+    pthread_mutex_lock(&d->m);
+    if(d->bottom != d->top){
+        d->bottom--;
+        *t = d->buf[d->bottom & (d->cap-1)];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&d->m);
+    return ok;
+}
+
+/**
+ * Take the oldest task (steal end).
+ *
+ * @return 1 when a task was taken, 0 when the deque is empty
+ */
+static int deque_pop_top(deque_t *d, task_t *t){
+    int ok = 0;
+    pthread_mutex_lock(&d->m);
+    if(d->bottom != d->top){
+        *t = d->buf[d->top & (d->cap-1)];
+        d->top++;
+        ok = 1;
+    }
+    pthread_mutex_unlock(&d->m);
+    return ok;
+}
+
+static int deque_is_empty(deque_t *d){
+    pthread_mutex_lock(&d->m);
+    int empty = d->bottom == d->top;
+    pthread_mutex_unlock(&d->m);
+    return empty;
+}
+
+/**
+ * Try to steal one task from the other workers, starting at a random victim.
+ *
+ * @return 1 when a task was stolen, 0 otherwise
+ */
+static int pool_steal(pool_t *p, worker_t *w, task_t *t){
+    w->rng ^= w->rng << 13; w->rng ^= w->rng >> 17; w->rng ^= w->rng << 5;
+    int start = (int)(w->rng % (unsigned)p->n);
+    for(int k=0;k<p->n;k++){
+        int v = (start + k) % p->n;
+        if(v == w->index) continue;
+        if(deque_pop_top(&p->workers[v].dq, t)){
+            atomic_fetch_add_explicit(&w->steals, 1, memory_order_relaxed);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int pool_has_work(pool_t *p){
+    for(int i=0;i<p->n;i++) if(!deque_is_empty(&p->workers[i].dq)) return 1;
+    return 0;
+}
+
+/**
+ * Worker thread: run own tasks, steal when empty, park when nothing is left.
+ *
+ * @param arg worker_t of this thread
+ * @return NULL
+ */
+static void* pool_worker(void *arg){
+    worker_t *w = (worker_t*)arg;
+    pool_t *p = w->pool;
+    pthread_setspecific(p->self_key, w);
+    while(1){
+        task_t t;
+        if(deque_pop_bottom(&w->dq, &t) || pool_steal(p, w, &t)){
+            long long t0 = platform_monotonic_ns();
+            t.fn(t.arg);
+            atomic_fetch_add_explicit(&w->busy_ns, platform_monotonic_ns() - t0, memory_order_relaxed);
+            atomic_fetch_add_explicit(&w->tasks, 1, memory_order_relaxed);
+            continue;
+        }
+        /* Announce the intent to sleep before the final check, so a concurrent
+         * pool_submit() either sees `sleepers` or its task is found here. */
+        pthread_mutex_lock(&p->park_m);
+        atomic_fetch_add(&p->sleepers, 1);
+        int stop = atomic_load(&p->stop);
+        if(!pool_has_work(p)){
+            if(stop){
+                atomic_fetch_sub(&p->sleepers, 1);
+                pthread_mutex_unlock(&p->park_m);
+                break;
+            }
+            atomic_fetch_add_explicit(&w->parks, 1, memory_order_relaxed);
+            pthread_cond_wait(&p->park_c, &p->park_m);
+        }
+        atomic_fetch_sub(&p->sleepers, 1);
+        pthread_mutex_unlock(&p->park_m);
+    }
+    return NULL;
+}
+
+/**
+ * Stop the workers that were started and free the pool.
+ *
+ * @param p pool
+ * @param n_deques number of worker deques initialized
+ * @param n_threads number of worker threads started
+ */
+static void pool_release(pool_t *p, int n_deques, int n_threads){
+    pthread_mutex_lock(&p->park_m);
+    atomic_store(&p->stop, 1);
+    pthread_cond_broadcast(&p->park_c);
+    pthread_mutex_unlock(&p->park_m);
+    for(int i=0;i<n_threads;i++) pthread_join(p->workers[i].thread, NULL);
+    for(int i=0;i<n_deques;i++) deque_free(&p->workers[i].dq);
+    pthread_cond_destroy(&p->park_c);
+    pthread_mutex_destroy(&p->park_m);
+    pthread_key_delete(p->self_key);
+    mem_free(p->workers);
+    mem_free(p);
+}
+
+/**
+ * Create a pool and start its workers.
+ *
+ * @param n_workers number of worker threads (1..POOL_MAX_WORKERS)
+ * @return allocated pool or NULL on error (nothing is left running then)
+ */
+pool_t* pool_create(int n_workers){
+    if(n_workers < 1 || n_workers > POOL_MAX_WORKERS) return NULL;
+    pool_t *p = (pool_t*)mem_calloc(MEM_QUEUE, 1, sizeof(pool_t));
+    if(!p) return NULL;
+    p->n = n_workers;
+    p->workers = (worker_t*)mem_calloc(MEM_QUEUE, (size_t)n_workers, sizeof(worker_t));
+    if(!p->workers){ mem_free(p); return NULL; }
+    pthread_key_create(&p->self_key, NULL);
+    pthread_mutex_init(&p->park_m, NULL);
+    pthread_cond_init(&p->park_c, NULL);
+    atomic_init(&p->sleepers, 0);
+    atomic_init(&p->stop, 0);
+    atomic_init(&p->next_victim, 0);
+    for(int i=0;i<n_workers;i++){
+        worker_t *w = &p->workers[i];
+        w->pool = p;
+        w->index = i;
+        w->rng = 2463534242u + (unsigned)i * 7919u;
+        atomic_init(&w->busy_ns, 0);
+        atomic_init(&w->tasks, 0);
+        atomic_init(&w->steals, 0);
+        atomic_init(&w->parks, 0);
+        if(deque_init(&w->dq) != 0){
+            LOG_ERROR("[pool] deque allocation failed\n");
+            pthread_mutex_destroy(&w->dq.m);
+            pool_release(p, i, 0);
+            return NULL;
+        }
+    }
+    for(int i=0;i<n_workers;i++){
+        if(pthread_create(&p->workers[i].thread, NULL, pool_worker, &p->workers[i]) != 0){
+            perror("pthread_create pool worker");
+            pool_release(p, n_workers, i);
+            return NULL;
+        }
+    }
+    return p;
+}
+
+/**
+ * Stop the pool. Already submitted tasks (and tasks they submit) are run
+ * before the workers exit.
+ *
+ * @param p pool to destroy (may be NULL)
+ */
+void pool_destroy(pool_t *p){
+    if(!p) return;
+    pool_release(p, p->n, p->n);
+}
+
+/**
+ * Submit a task. From a worker the task goes to that worker's deque,
+ * otherwise the deques are filled round-robin. A parked worker is woken.
+ *
+ * @param p pool
+ * @param fn task function
+ * @param arg argument passed to `fn`
+ * @return 0 on success, -1 on error
+ */
+int pool_submit(pool_t *p, task_fn fn, void *arg){
+    task_t t = { fn, arg };
+    worker_t *w = (worker_t*)pthread_getspecific(p->self_key);
+    if(!w) w = &p->workers[atomic_fetch_add_explicit(&p->next_victim, 1, memory_order_relaxed) % (unsigned)p->n];
+    if(deque_push_bottom(&w->dq, t) != 0) return -1;
+    if(atomic_load(&p->sleepers) > 0){
+        pthread_mutex_lock(&p->park_m);
+        pthread_cond_signal(&p->park_c);
+        pthread_mutex_unlock(&p->park_m);
+    }
+    return 0;
+}
+
+int pool_worker_count(const pool_t *p){
+    return p->n;
+}
+
+/**
+ * Read the cumulative counters of one worker.
+ *
+ * @param p pool
+ * @param worker worker index
+ * @param out output counters (zeroed for an invalid index)
+ */
+void pool_get_worker_stats(pool_t *p, int worker, pool_worker_stats_t *out){
+    memset(out, 0, sizeof(*out));
+    if(worker < 0 || worker >= p->n) return;
+    worker_t *w = &p->workers[worker];
+    out->busy_ns = atomic_load_explicit(&w->busy_ns, memory_order_relaxed);
+    out->tasks = atomic_load_explicit(&w->tasks, memory_order_relaxed);
+    out->steals = atomic_load_explicit(&w->steals, memory_order_relaxed);
+    out->parks = atomic_load_explicit(&w->parks, memory_order_relaxed);
+}
+
+/**
+ * Create a strand on a pool.
+ *
+ * @param p pool the strand's tasks run on
+ * @return allocated strand or NULL on error
+ */
+strand_t* strand_create(pool_t *p){
+    strand_t *s = (strand_t*)mem_calloc(MEM_QUEUE, 1, sizeof(strand_t));
+    if(!s) return NULL;
+    s->pool = p;
+    pthread_mutex_init(&s->m, NULL);
+    return s;
+}
+
+/**
+ * Free a strand. The strand must be idle; tasks that never ran are dropped.
+ *
+ * @param s strand to free (may be NULL)
+ */
+void strand_free(strand_t *s){
+    if(!s) return;
+    while(s->head){ strand_item_t *it = s->head; s->head = it->next; mem_free(it); }
+    pthread_mutex_destroy(&s->m);
+    mem_free(s);
+}
+
+/**
+ * Drain task of a strand: runs up to STRAND_BATCH posted tasks in order and
+ * resubmits itself when more are left, so one busy strand cannot keep a
+ * worker away from other work for long.
+ *
+ * @param arg strand
+ */
+static void strand_run(void *arg){
+    strand_t *s = (strand_t*)arg;
+    for(int k=0;k<STRAND_BATCH;k++){
+        pthread_mutex_lock(&s->m);
+        strand_item_t *it = s->head;
+        if(!it){
+            s->running = 0;
+            pthread_mutex_unlock(&s->m);
+            return;
+        }
+        s->head = it->next;
+        if(!s->head) s->tail = NULL;
+        pthread_mutex_unlock(&s->m);
+        it->task.fn(it->task.arg);
+        mem_free(it);
+    }
+    pthread_mutex_lock(&s->m);
+    int more = s->head != NULL;
+    if(!more) s->running = 0;
+    pthread_mutex_unlock(&s->m);
+    if(more && pool_submit(s->pool, strand_run, s) != 0){
+        /* the tasks left wait for the next strand_post(), which submits a new drain task */
+        LOG_ERROR("[pool] cannot resubmit a strand, its tasks wait for the next post\n");
+        pthread_mutex_lock(&s->m);
+        s->running = 0;
+        pthread_mutex_unlock(&s->m);
+    }
+}
+
+/**
+ * Post a task to a strand. Tasks of one strand never run concurrently and
+ * run in posting order.
+ *
+ * @param s strand
+ * @param fn task function
+ * @param arg argument passed to `fn`
+ * @return 0 on success, -1 on error (the task was not posted)
+ */
+int strand_post(strand_t *s, task_fn fn, void *arg){
+    strand_item_t *it = (strand_item_t*)mem_alloc(MEM_QUEUE, sizeof(strand_item_t));
+    if(!it) return -1;
+    it->task.fn = fn;
+    it->task.arg = arg;
+    it->next = NULL;
+    pthread_mutex_lock(&s->m);
+    if(s->tail) s->tail->next = it; else s->head = it;
+    s->tail = it;
+    int start = !s->running;
+    if(start) s->running = 1;
+    pthread_mutex_unlock(&s->m);
+    if(!start || pool_submit(s->pool, strand_run, s) == 0) return 0;
+    /* no drain task: take the task back (the caller keeps `arg`) and let the next post start one */
+    pthread_mutex_lock(&s->m);
+    strand_item_t **pp = &s->head, *prev = NULL;
+    while(*pp && *pp != it){ prev = *pp; pp = &(*pp)->next; }
+    if(*pp){
+        *pp = it->next;
+        if(s->tail == it) s->tail = prev;
+    }
+    s->running = 0;
+    pthread_mutex_unlock(&s->m);
+    mem_free(it);
+    return -1;
+}
+
+/**
+ * Return non-zero when tasks are waiting on the strand.
+ */
+int strand_pending(strand_t *s){
+    pthread_mutex_lock(&s->m);
+    int pending = s->head != NULL;
+    pthread_mutex_unlock(&s->m);
+    return pending;
+}
@@ -0,0 +1,44 @@
+/**
+ * pool.h
+ *
+ * Declarations for the work-stealing task pool and serial executors (strands)
+ * used to run the pipeline stages as tasks instead of fixed threads.
+ */
+
+#ifndef RECEIVER_POOL_H
+#define RECEIVER_POOL_H
+
+#define POOL_MAX_WORKERS 64
+
+typedef void (*task_fn)(void *arg);
+
+typedef struct pool_s pool_t;
+typedef struct strand_s strand_t;
+
+/**
+ * Cumulative counters of one pool worker.
+ *
+ * long long busy_ns: monotonic time spent running tasks
+ * long long tasks: tasks executed
+ * long long steals: tasks taken from other workers' deques
+ * long long parks: times the worker went to sleep for lack of work
+ */
+typedef struct {
+    long long busy_ns;
+    long long tasks;
+    long long steals;
+    long long parks;
+} pool_worker_stats_t;
+
+pool_t* pool_create(int n_workers);
+void pool_destroy(pool_t *p);
+int pool_submit(pool_t *p, task_fn fn, void *arg);
+int pool_worker_count(const pool_t *p);
+void pool_get_worker_stats(pool_t *p, int worker, pool_worker_stats_t *out);
+
+strand_t* strand_create(pool_t *p);
+void strand_free(strand_t *s);
+int strand_post(strand_t *s, task_fn fn, void *arg);
+int strand_pending(strand_t *s);
+
+#endif
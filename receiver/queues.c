@@ -14,5 +14,6 @@
 
 str_queue_t raw_queue;
 str_queue_t proc_queue;
+str_queue_t feat_queue;
 str_queue_t repr_queue;
 str_queue_t error_queue;
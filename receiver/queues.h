@@ -11,6 +11,7 @@
 
 extern str_queue_t raw_queue;
 extern str_queue_t proc_queue;
+extern str_queue_t feat_queue;
 extern str_queue_t repr_queue;
 extern str_queue_t error_queue;
 
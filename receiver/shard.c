@@ -0,0 +1,325 @@
+/*
+ * shard.c
+ *
+ * Thread-per-core receive path. Each shard opens its own UDP socket on --port
+ * with SO_REUSEPORT. The kernel's default flow hash covers the source port
+ * too, so on Linux a classic BPF program (SO_ATTACH_REUSEPORT_CBPF) picks the
+ * shard from a hash of the source address alone: every datagram of a source
+ * lands on the same shard, whatever port it is sent from. A shard keeps
+ * its own feature streams, model cache, training scheduler and representation state, so the
+ * hot path takes no cross-thread locks except the global stats counters.
+ */
+
+#ifndef SHARD_C_HEADER
+#define SHARD_C_HEADER
+#include "shard.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <sys/select.h>
+#endif
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
+#include "platform.h"
+#include "common.h"
+#include "config.h"
+#include "log.h"
+#include "module1/data_processor.h"
+#include "module1/feature_stage.h"
+#include "module2/nn_stage.h"
+#include "module3/represent.h"
+#include "module4/ui.h"
+#include "state.h"
+#include "latency.h"
+#include "trace.h"
+#include "perfctr.h"
+
+/**
+ * Per-shard state.
+ *
+ * index: shard number (also its stats gauge slot)
+ * sock: the shard's SO_REUSEPORT socket
+ * thread: thread running shard_thread()
+ * m: protects the counters below (read by the UI)
+ * received, represented: datagrams received / output lines represented by this shard
+ */
+typedef struct {
+    int index;
+    socket_t sock;
+    pthread_t thread;
+    pthread_mutex_t m;
+    long long received, represented;
+} shard_t;
+
+static shard_t shards[SHARD_MAX];
+static int n_active_shards = 0;
+
+/**
+ * Open a UDP socket on --port that shares the port with the other shards.
+ *
+ * @return socket or INVALID_SOCKET on error
+ */
+static socket_t shard_open_socket(void){
+#ifdef SO_REUSEPORT
+    socket_t sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sock == INVALID_SOCKET) { perror("socket"); return INVALID_SOCKET; }
+    int one = 1;
+    if(setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&one, sizeof(one)) != 0){
+        perror("setsockopt SO_REUSEPORT");
+        CLOSESOCKET(sock);
+        return INVALID_SOCKET;
+    }
+    struct sockaddr_in me;
+    memset(&me, 0, sizeof(me));
+    me.sin_family = AF_INET;
+    me.sin_port = htons((unsigned short)g_config.port);
+    me.sin_addr.s_addr = INADDR_ANY;
+    if(bind(sock, (struct sockaddr*)&me, sizeof(me)) < 0){ perror("bind"); CLOSESOCKET(sock); return INVALID_SOCKET; }
+    return sock;
+#else
+    LOG_ERROR("[shard] SO_REUSEPORT is not supported on this platform, use --shards=0\n");
+    return INVALID_SOCKET;
+#endif
+}
+
+/**
+ * Steer the datagrams of the shards' reuseport group by source address: the
+ * program hashes the IPv4 source address and returns the index of the
+ * socket in the group, which is the shard index since the shards bind in
+ * order. Without it a source sending from several ports is split over
+ * shards, each with its own model and streams for it.
+ *
+ * @param sock socket of any shard, after all shards are bound
+ * @param n_shards number of shards
+ * @return 0 on success, -1 when the platform cannot steer by address
+ */
+static int shard_steer_by_source(socket_t sock, int n_shards){
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    /* the program sees the UDP payload, the IPv4 source address is at offset 12 of the network header */
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (unsigned)SKF_NET_OFF + 12),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x45d9f3bu),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (unsigned)n_shards),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog = { (unsigned short)(sizeof(code) / sizeof(code[0])), code };
+    if(setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0){
+        perror("setsockopt SO_ATTACH_REUSEPORT_CBPF");
+        return -1;
+    }
+    return 0;
+#else
+    (void)sock;
+    (void)n_shards;
+    return -1;
+#endif
+}
+
+/**
+ * Wait until the socket is readable.
+ *
+ * @param sock socket to watch
+ * @param timeout_ms maximum wait in milliseconds (-1 = forever, 0 = poll)
+ * @return 1 when readable, 0 on timeout, -1 on error
+ */
+static int shard_wait_readable(socket_t sock, int timeout_ms){
+    fd_set rd;
+    FD_ZERO(&rd);
+    FD_SET(sock, &rd);
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    int rc = select((int)sock + 1, &rd, NULL, NULL, timeout_ms < 0 ? NULL : &tv);
+    if(rc < 0) return -1;
+    return rc > 0 ? 1 : 0;
+}
+
+/**
+ * Pending-input predicate for the training scheduler: datagrams waiting on
+ * the shard socket take priority over deferred training.
+ *
+ * @param ctx shard
+ * @return non-zero when a datagram is waiting
+ */
+static int shard_input_pending(void *ctx){
+    return shard_wait_readable(((shard_t*)ctx)->sock, 0) > 0;
+}
+
+/**
+ * Shard thread: receive, preprocess, compute features, predict/train and
+ * represent inline.
+ *
+ * The NN stage writes its output lines into a shard-local queue that is
+ * drained right after each record, so the existing stage interface is kept
+ * without handing records to another thread. The thread returns after a
+ * stop signal, saving its feature streams and models.
+ *
+ * @param arg shard_t of this thread
+ * @return NULL, or STATE_STAGE_FAILED when the shard's stages could not be created
+ */
+static void* shard_thread(void *arg){
+    shard_t *sh = (shard_t*)arg;
+    int n = n_active_shards;
+    char spill_dir[320];
+    snprintf(spill_dir, sizeof(spill_dir), "%s/shard%d", g_config.model_spill_dir, sh->index);
+    double budget = g_config.train_cpu_budget > 0.0 ? g_config.train_cpu_budget / n : 0.0;
+    size_t cache_bytes = (size_t)(g_config.model_cache_mb * 1024.0 * 1024.0 / n);
+    nn_stage_t *st = nn_stage_create(sh->index, budget, cache_bytes, spill_dir);
+    if(!st){ LOG_ERROR("[shard %d] nn_stage_create failed, stopping\n", sh->index); platform_request_stop(); return STATE_STAGE_FAILED; }
+    feature_set_t fs;
+    detect_set_t ds;
+    feature_stage_t *feat = feature_set_parse(g_config.features, &fs) == 0 && detect_set_parse(g_config.detectors, &ds) == 0
+                          ? feature_stage_create(&fs, &ds, 0) : NULL;
+    if(!feat){
+        LOG_ERROR("[shard %d] feature_stage_create failed, stopping\n", sh->index);
+        nn_stage_free(st);
+        platform_request_stop();
+        return STATE_STAGE_FAILED;
+    }
+    str_queue_t out_q;
+    queue_init(&out_q);
+    represent_state_t rs;
+    represent_state_init(&rs);
+
+    state_restore_features(feat, sh->index);
+    while(!platform_stop_requested()){
+        int wait_ms = nn_stage_wait_ms(st);
+        if(wait_ms < 0 || wait_ms > STATE_STOP_POLL_MS) wait_ms = STATE_STOP_POLL_MS;
+        int ready = shard_wait_readable(sh->sock, wait_ms);
+        if(ready < 0) continue;
+        if(ready == 0){
+            nn_stage_idle(st, shard_input_pending, sh);
+            continue;
+        }
+        char buf[8192];
+        struct sockaddr_in from; socklen_t flen = sizeof(from);
+        int n_read = (int)recvfrom(sh->sock, buf, (int)sizeof(buf)-1, 0, (struct sockaddr*)&from, &flen);
+        if(n_read <= 0) continue;
+        buf[n_read] = '\0';
+        stats_inc_received();
+
+        rec_meta_t meta;
+        memset(&meta, 0, sizeof(meta));
+        inet_ntop(AF_INET, &from.sin_addr, meta.src, sizeof(meta.src));
+        lat_stamp(&meta);
+        trace_stamp(&meta);
+        char csv[512], feat_line[2048];
+        long long t_trace = TRACE_BEGIN(&meta);
+        perf_mark_t pm;
+        perfctr_enter(&pm);
+        const char *line = preproc_line(buf, csv, sizeof(csv)) ? csv : buf;
+        perfctr_exit(&pm, PERF_PREPROC, 1);
+        TRACE_END(&meta, TRACE_PARSE, t_trace);
+        stats_inc_processed();
+        lat_hop(&meta, LAT_PREPROC);
+        t_trace = TRACE_BEGIN(&meta);
+        if(feature_stage_line(feat, line, &meta, feat_line, sizeof(feat_line))) line = feat_line;
+        TRACE_END(&meta, TRACE_FEATURES, t_trace);
+        lat_hop(&meta, LAT_FEATURES);
+        if(!(meta.flags & REC_BYPASS)) nn_stage_process(st, line, &meta, &out_q);
+
+        long long represented = 0;
+        char *out;
+        while((out = queue_try_pop(&out_q)) != NULL){
+            represent_line(&rs, out, &meta);
+            free(out);
+            represented++;
+        }
+        pthread_mutex_lock(&sh->m);
+        sh->received++;
+        sh->represented += represented;
+        pthread_mutex_unlock(&sh->m);
+        nn_stage_idle(st, shard_input_pending, sh);
+    }
+    state_save_features(feat, sh->index);
+    feature_stage_free(feat);
+    nn_stage_free(st);
+    return NULL;
+}
+
+/**
+ * Start `n_shards` shard threads plus the UI thread and wait for them to
+ * stop.
+ *
+ * Sockets, queues and stats must be initialized by the caller
+ * (see run_receiver()).
+ *
+ * @param n_shards number of shards (1..SHARD_MAX)
+ * @return 0 on success, -1 when the shards could not be started or a shard failed
+ */
+int run_shards(int n_shards){
+    if(n_shards < 1 || n_shards > SHARD_MAX){
+        LOG_ERROR("[shard] shard count must be between 1 and %d\n", SHARD_MAX);
+        return -1;
+    }
+    for(int i=0;i<n_shards;i++){
+        shards[i].index = i;
+        shards[i].sock = shard_open_socket();
+        pthread_mutex_init(&shards[i].m, NULL);
+        if(shards[i].sock == INVALID_SOCKET){
+            for(int k=0;k<i;k++) CLOSESOCKET(shards[k].sock);
+            return -1;
+        }
+    }
+    if(shard_steer_by_source(shards[0].sock, n_shards) != 0)
+        LOG_WARN("[shard] cannot steer datagrams by source address, a source sending from several ports is split over shards\n");
+    n_active_shards = n_shards;
+    int started[SHARD_MAX], rc = 0;
+    for(int i=0;i<n_shards;i++){
+        started[i] = pthread_create(&shards[i].thread, NULL, shard_thread, &shards[i]) == 0;
+        if(!started[i]){ perror("pthread_create shard"); rc = -1; }
+    }
+    pthread_t t_ui;
+    int ui_started = 0;
+    if(rc != 0){
+        /* the socket of a shard without a thread would still get its share of the datagrams */
+        LOG_ERROR("[shard] cannot start all %d shards, stopping\n", n_shards);
+        platform_request_stop();
+    } else {
+        ui_started = pthread_create(&t_ui, NULL, ui_thread, NULL) == 0;
+        if(!ui_started){ perror("pthread_create ui"); }
+        LOG_INFO("Receiver listening on UDP port %d with %d SO_REUSEPORT shards\n", g_config.port, n_shards);
+    }
+    for(int i=0;i<n_shards;i++){
+        void *ret = NULL;
+        if(started[i]) pthread_join(shards[i].thread, &ret);
+        if(ret == STATE_STAGE_FAILED) rc = -1;
+    }
+    if(ui_started) pthread_join(t_ui, NULL);
+    for(int i=0;i<n_shards;i++) CLOSESOCKET(shards[i].sock);
+    return rc;
+}
+
+/**
+ * Number of running shards (0 when the classic pipeline is used).
+ */
+int shard_count(void){
+    return n_active_shards;
+}
+
+/**
+ * Read the counters of one shard.
+ *
+ * @param shard shard index
+ * @param received output: datagrams received by the shard
+ * @param represented output: output lines represented by the shard
+ */
+void shard_get_counts(int shard, long long *received, long long *represented){
+    if(shard < 0 || shard >= n_active_shards){ *received = 0; *represented = 0; return; }
+    pthread_mutex_lock(&shards[shard].m);
+    *received = shards[shard].received;
+    *represented = shards[shard].represented;
+    pthread_mutex_unlock(&shards[shard].m);
+}
@@ -0,0 +1,18 @@
+/**
+ * shard.h
+ *
+ * Declarations for the shared-nothing receiver shards: every shard owns a
+ * UDP socket bound to the same port with SO_REUSEPORT and runs the whole
+ * pipeline (preprocess -> NN -> represent) inline on its own thread.
+ */
+
+#ifndef RECEIVER_SHARD_H
+#define RECEIVER_SHARD_H
+
+#define SHARD_MAX 64
+
+int run_shards(int n_shards);
+int shard_count(void);
+void shard_get_counts(int shard, long long *received, long long *represented);
+
+#endif
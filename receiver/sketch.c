@@ -0,0 +1,63 @@
+/*
+ * sketch.c
+ *
+ * Quantile sketch of non-negative values. Bin i >= 1 holds the values in
+ * [SKETCH_MIN * gamma^(i-1), SKETCH_MIN * gamma^i) with
+ * gamma = (1 + SKETCH_ALPHA) / (1 - SKETCH_ALPHA); every value of a bin is
+ * within SKETCH_ALPHA of the bin's representative, so any quantile is too.
+ * The caller owns the bin counts, which lets it keep them in whatever
+ * storage (plain or atomic, one per time slice) it needs and merge them.
+ */
+#ifndef SKETCH_C_HEADER
+#define SKETCH_C_HEADER
+
+#include "sketch.h"
+
+#endif
+
+#include <math.h>
+
+/**
+ * Bin of a value.
+ *
+ * @param v value (negative values count as 0)
+ * @return bin index in [0, SKETCH_BINS)
+ */
+int sketch_bin(double v){
+    if(!(v >= SKETCH_MIN)) return 0; /* also NAN */
+    /* the logarithm of the constant gamma folds at compile time */
+    double b = floor(log(v / SKETCH_MIN) / log((1.0 + SKETCH_ALPHA) / (1.0 - SKETCH_ALPHA))) + 1.0;
+    return b >= (double)(SKETCH_BINS - 1) ? SKETCH_BINS - 1 : (int)b;
+}
+
+/**
+ * Representative value of a bin: the point with the same relative distance
+ * to both bin edges.
+ *
+ * @param bin bin index
+ * @return value
+ */
+double sketch_value(int bin){
+    if(bin <= 0) return 0.0;
+    const double gamma = (1.0 + SKETCH_ALPHA) / (1.0 - SKETCH_ALPHA);
+    return SKETCH_MIN * pow(gamma, (double)(bin - 1)) * 2.0 * gamma / (1.0 + gamma);
+}
+
+/**
+ * Value at a quantile.
+ *
+ * @param bins SKETCH_BINS counts
+ * @param count sum of the counts
+ * @param q quantile in [0, 1]
+ * @return value, NAN without values
+ */
+double sketch_quantile(const long long *bins, long long count, double q){
+    if(count <= 0) return NAN;
+    long long rank = (long long)(q * (double)(count - 1));
+    long long seen = 0;
+    for(int i=0;i<SKETCH_BINS;i++){
+        seen += bins[i];
+        if(seen > rank) return sketch_value(i);
+    }
+    return sketch_value(SKETCH_BINS - 1);
+}
@@ -0,0 +1,23 @@
+/**
+ * sketch.h
+ *
+ * Declarations for the quantile sketch of non-negative values (DDSketch
+ * style): logarithmic bins with a fixed relative accuracy, so sketches of
+ * the same layout merge by adding their bin counts.
+ */
+
+#ifndef RECEIVER_SKETCH_H
+#define RECEIVER_SKETCH_H
+
+/** Relative accuracy of a quantile (values are returned within 2%). */
+#define SKETCH_ALPHA 0.02
+/** Values below this land in bin 0 and are reported as 0. */
+#define SKETCH_MIN 1e-4
+/** Number of bins; the top bin takes everything above SKETCH_MIN * gamma^(SKETCH_BINS-1) (about 8e9). */
+#define SKETCH_BINS 800
+
+int sketch_bin(double v);
+double sketch_value(int bin);
+double sketch_quantile(const long long *bins, long long count, double q);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * state.c
+ *
+ * Warm-restart snapshot of the pipeline. A shutdown writes
+ *   stats.bin           counters, one-second windows and the error ring
+ *   features<N>.bin     stream history, feature and detector state of feature stage N
+ * into `--state-dir`; the models are spilled by their caches (the shared
+ * model to `<state-dir>/models<N>/`, per-source models to
+ * `--model-spill-dir` as during eviction). Files are written under a
+ * temporary name and renamed, so a crash during the save leaves the previous
+ * snapshot intact. Everything is read back with a few large freads, which
+ * takes milliseconds even for thousands of streams.
+ */
+
+#ifndef STATE_C_HEADER
+#define STATE_C_HEADER
+#include "state.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "platform.h"
+#include "common.h"
+#include "config.h"
+#include "log.h"
+
+/**
+ * Build the path of a snapshot file.
+ *
+ * @param name file name prefix
+ * @param slot stage number appended to the name, or -1 for none
+ * @param out output buffer
+ * @param out_len size of the output buffer
+ * @return 0 on success, -1 when snapshots are disabled (`--state-dir ""`)
+ */
+static int state_path(const char *name, int slot, char *out, size_t out_len){
+    if(!g_config.state_dir || !g_config.state_dir[0]) return -1;
+    if(slot < 0) snprintf(out, out_len, "%s/%s.bin", g_config.state_dir, name);
+    else snprintf(out, out_len, "%s/%s%d.bin", g_config.state_dir, name, slot);
+    return 0;
+}
+
+/**
+ * Open a snapshot file for writing under a temporary name.
+ *
+ * @param path final path
+ * @param tmp receives the temporary path
+ * @param tmp_len size of `tmp`
+ * @return open file or NULL on error
+ */
+static FILE* state_open_write(const char *path, char *tmp, size_t tmp_len){
+    if(platform_mkdir_p(g_config.state_dir) != 0){
+        LOG_ERROR("[state] cannot create %s\n", g_config.state_dir);
+        return NULL;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if(!f) LOG_ERROR("[state] cannot write %s\n", tmp);
+    return f;
+}
+
+/**
+ * Close a file opened by state_open_write() and move it into place.
+ *
+ * @param f file
+ * @param ok non-zero when everything was written
+ * @param tmp temporary path
+ * @param path final path
+ * @return 0 on success, -1 on error (the temporary file is removed)
+ */
+static int state_commit(FILE *f, int ok, const char *tmp, const char *path){
+    if(fclose(f) != 0) ok = 0;
+#ifdef _WIN32
+    if(ok) remove(path);
+#endif
+    if(!ok || rename(tmp, path) != 0){
+        remove(tmp);
+        LOG_ERROR("[state] failed to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Restore the stats counters and windows saved by the last shutdown.
+ * Must run after stats_init().
+ */
+void state_restore_stats(void){
+    char path[512];
+    if(state_path("stats", -1, path, sizeof(path)) != 0) return;
+    FILE *f = fopen(path, "rb");
+    if(!f) return;
+    long long t0 = platform_monotonic_ns();
+    if(stats_read(f) == 0) LOG_INFO("[state] restored stats from %s in %.2f ms\n", path, (double)(platform_monotonic_ns() - t0) / 1e6);
+    else LOG_ERROR("[state] ignoring incompatible %s\n", path);
+    fclose(f);
+}
+
+/**
+ * Save the stats counters and windows. Call once all stages have stopped,
+ * or at a write-ahead log checkpoint.
+ *
+ * @return 0 on success, -1 when snapshots are disabled or the file could not be written
+ */
+int state_save_stats(void){
+    char path[512], tmp[520];
+    if(state_path("stats", -1, path, sizeof(path)) != 0) return -1;
+    FILE *f = state_open_write(path, tmp, sizeof(tmp));
+    if(!f) return -1;
+    if(state_commit(f, stats_write(f) == 0, tmp, path) != 0) return -1;
+    LOG_INFO("[state] saved stats to %s\n", path);
+    return 0;
+}
+
+/**
+ * Restore the streams of a feature stage saved by the last shutdown.
+ *
+ * @param fst freshly created stage
+ * @param slot stage number (0 for the classic pipeline, the shard / strand index otherwise)
+ */
+void state_restore_features(feature_stage_t *fst, int slot){
+    char path[512];
+    if(state_path("features", slot, path, sizeof(path)) != 0) return;
+    FILE *f = fopen(path, "rb");
+    if(!f) return;
+    long long t0 = platform_monotonic_ns();
+    int n = feature_stage_read(fst, f);
+    if(n >= 0) LOG_INFO("[state] restored %d feature streams from %s in %.2f ms\n", n, path, (double)(platform_monotonic_ns() - t0) / 1e6);
+    else LOG_ERROR("[state] ignoring incompatible %s (other --features / --detectors?)\n", path);
+    fclose(f);
+}
+
+/**
+ * Save the streams of a feature stage. Call after the stage's last record,
+ * or at a write-ahead log checkpoint.
+ *
+ * @param fst stage
+ * @param slot stage number, as passed to state_restore_features()
+ * @return 0 on success, -1 when snapshots are disabled or the file could not be written
+ */
+int state_save_features(const feature_stage_t *fst, int slot){
+    char path[512], tmp[520];
+    if(state_path("features", slot, path, sizeof(path)) != 0) return -1;
+    FILE *f = state_open_write(path, tmp, sizeof(tmp));
+    if(!f) return -1;
+    if(state_commit(f, feature_stage_write(fst, f) == 0, tmp, path) != 0) return -1;
+    LOG_INFO("[state] saved feature streams to %s\n", path);
+    return 0;
+}
@@ -0,0 +1,27 @@
+/**
+ * state.h
+ *
+ * Declarations for the warm-restart snapshot: on SIGINT / SIGTERM the
+ * receiver drains its queues and writes the pipeline state to `--state-dir`,
+ * and the next start restores it before the first record is read.
+ */
+
+#ifndef RECEIVER_STATE_H
+#define RECEIVER_STATE_H
+
+#include "module1/feature_stage.h"
+
+/** Longest wait of a receive loop before it checks for a stop request, in milliseconds. */
+#define STATE_STOP_POLL_MS 200
+
+/** Return value of a stage thread that could not save its state on shutdown (NULL when it did). */
+#define STATE_NOT_SAVED ((void*)1)
+/** Return value of a stage thread that could not start; it requested a stop and the process exits with a failure. */
+#define STATE_STAGE_FAILED ((void*)2)
+
+void state_restore_stats(void);
+int state_save_stats(void);
+void state_restore_features(feature_stage_t *fst, int slot);
+int state_save_features(const feature_stage_t *fst, int slot);
+
+#endif
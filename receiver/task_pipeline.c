@@ -0,0 +1,292 @@
+/*
+ * task_pipeline.c
+ *
+ * Pipeline driven by the work-stealing pool. Sources are hashed onto a fixed
+ * set of NN strands, each owning a feature stage and an nn_stage; the receive
+ * loop posts every datagram to its source's strand, where it is
+ * preprocessed and run through the feature and NN stages. Preprocessing runs
+ * on the strand too: as separate pool tasks it would finish out of order
+ * (workers pop their own deque newest first), and the NN stage trains on
+ * consecutive records of a source. Records of one source therefore keep their
+ * order while different sources are processed in parallel. Output lines are
+ * represented on a single strand because the representation state is shared.
+ */
+
+#ifndef TASK_PIPELINE_C_HEADER
+#define TASK_PIPELINE_C_HEADER
+#include "task_pipeline.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <sys/select.h>
+#endif
+
+#include "platform.h"
+#include "common.h"
+#include "config.h"
+#include "log.h"
+#include "module1/data_processor.h"
+#include "module1/feature_stage.h"
+#include "module2/nn_stage.h"
+#include "module3/represent.h"
+#include "module4/ui.h"
+#include "state.h"
+#include "latency.h"
+#include "trace.h"
+#include "perfctr.h"
+#include "memstat.h"
+
+#define IDLE_TICK_MS 100
+
+/**
+ * A record travelling between tasks.
+ *
+ * meta: record metadata
+ * line: record text (allocated together with the struct)
+ */
+typedef struct {
+    rec_meta_t meta;
+    char line[];
+} task_rec_t;
+
+/**
+ * NN strand: serial executor plus the feature and NN stages it owns.
+ *
+ * strand: serial executor the stage's tasks run on
+ * features: feature streams of the strand's sources
+ * stage: NN stage (models, training scheduler) of this strand
+ * out_q: stage output, drained after every record
+ */
+typedef struct {
+    strand_t *strand;
+    feature_stage_t *features;
+    nn_stage_t *stage;
+    str_queue_t out_q;
+} nn_strand_t;
+
+static pool_t *g_pool = NULL;
+static nn_strand_t *nn_strands = NULL;
+static int n_nn_strands = 0;
+static strand_t *repr_strand = NULL;
+static represent_state_t repr_state;
+
+/**
+ * Allocate a record holding a copy of `line`.
+ */
+static task_rec_t* task_rec_new(const char *line, const rec_meta_t *meta){
+    size_t len = strlen(line);
+    task_rec_t *r = (task_rec_t*)mem_alloc(MEM_QUEUE, sizeof(task_rec_t) + len + 1);
+    if(!r) return NULL;
+    r->meta = *meta;
+    memcpy(r->line, line, len + 1);
+    return r;
+}
+
+/**
+ * Pick the NN strand of a source (FNV-1a of the source address).
+ */
+static nn_strand_t* nn_strand_for(const char *src){
+    uint32_t h = 2166136261u;
+    for(const unsigned char *p = (const unsigned char*)src; *p; p++){ h ^= *p; h *= 16777619u; }
+    return &nn_strands[h % (uint32_t)n_nn_strands];
+}
+
+/**
+ * Representation task (runs on `repr_strand`).
+ *
+ * @param arg task_rec_t with the output line
+ */
+static void represent_task(void *arg){
+    task_rec_t *r = (task_rec_t*)arg;
+    trace_wait(&r->meta);
+    represent_line(&repr_state, r->line, &r->meta);
+    mem_free(r);
+}
+
+/**
+ * Pending-input predicate for the training scheduler: records posted to the
+ * strand take priority over deferred training.
+ */
+static int nn_strand_pending(void *ctx){
+    return strand_pending((strand_t*)ctx);
+}
+
+/**
+ * Preprocess a raw datagram.
+ *
+ * @param r task_rec_t with the raw datagram (consumed)
+ * @return record with the preprocessed line, or the raw one when it is not a
+ *         data point; NULL on allocation failure
+ */
+static task_rec_t* preproc_rec(task_rec_t *r){
+    trace_wait(&r->meta);
+    char csv[512];
+    task_rec_t *out = r;
+    long long t_trace = TRACE_BEGIN(&r->meta);
+    perf_mark_t pm;
+    perfctr_enter(&pm);
+    int parsed = preproc_line(r->line, csv, sizeof(csv));
+    perfctr_exit(&pm, PERF_PREPROC, 1);
+    TRACE_END(&r->meta, TRACE_PARSE, t_trace);
+    if(parsed){
+        out = task_rec_new(csv, &r->meta);
+        mem_free(r);
+        if(!out) return NULL;
+    }
+    stats_inc_processed();
+    lat_hop(&out->meta, LAT_PREPROC);
+    return out;
+}
+
+/**
+ * Record task (runs on the record's NN strand): preprocessing, features and
+ * the NN stage.
+ *
+ * @param arg task_rec_t with the raw datagram
+ */
+static void nn_task(void *arg){
+    task_rec_t *r = preproc_rec((task_rec_t*)arg);
+    if(!r) return;
+    nn_strand_t *ns = nn_strand_for(r->meta.src);
+    char feat_line[2048];
+    long long t_trace = TRACE_BEGIN(&r->meta);
+    const char *line = feature_stage_line(ns->features, r->line, &r->meta, feat_line, sizeof(feat_line)) ? feat_line : r->line;
+    TRACE_END(&r->meta, TRACE_FEATURES, t_trace);
+    lat_hop(&r->meta, LAT_FEATURES);
+    if(!(r->meta.flags & REC_BYPASS)) nn_stage_process(ns->stage, line, &r->meta, &ns->out_q);
+    char *out;
+    while((out = queue_try_pop(&ns->out_q)) != NULL){
+        task_rec_t *o = task_rec_new(out, &r->meta);
+        free(out);
+        if(o && strand_post(repr_strand, represent_task, o) != 0) mem_free(o);
+    }
+    mem_free(r);
+    nn_stage_idle(ns->stage, nn_strand_pending, ns->strand);
+}
+
+/**
+ * Idle task (runs on an NN strand): drains deferred training once the
+ * budget allows.
+ *
+ * @param arg nn_strand_t
+ */
+static void nn_idle_task(void *arg){
+    nn_strand_t *ns = (nn_strand_t*)arg;
+    if(nn_stage_wait_ms(ns->stage) == 0) nn_stage_idle(ns->stage, nn_strand_pending, ns->strand);
+}
+
+/**
+ * Run the receiver on the task pool: start `n_workers` pool workers and the
+ * UI thread, then receive datagrams on the calling thread until a stop
+ * signal. The pool then runs every record already submitted before the
+ * stages save their state.
+ *
+ * Sockets, queues and stats must be initialized by the caller
+ * (see run_receiver()).
+ *
+ * @param n_workers number of pool workers (1..POOL_MAX_WORKERS)
+ * @return 0 on success, -1 on error
+ */
+int run_task_pipeline(int n_workers){
+    socket_t sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sock == INVALID_SOCKET){ perror("socket"); return -1; }
+    struct sockaddr_in me;
+    memset(&me, 0, sizeof(me));
+    me.sin_family = AF_INET;
+    me.sin_port = htons((unsigned short)g_config.port);
+    me.sin_addr.s_addr = INADDR_ANY;
+    if(bind(sock, (struct sockaddr*)&me, sizeof(me)) < 0){ perror("bind"); CLOSESOCKET(sock); return -1; }
+
+    g_pool = pool_create(n_workers);
+    if(!g_pool){ LOG_ERROR("[pool] cannot create pool with %d workers\n", n_workers); CLOSESOCKET(sock); return -1; }
+    int rc = -1, n_restored = 0, ui_started = 0;
+    pthread_t t_ui;
+    pool_t *pool;
+    /* One global model cannot be split; per-source models are spread over one strand per worker. */
+    n_nn_strands = g_config.per_source_models ? n_workers : 1;
+    nn_strands = (nn_strand_t*)mem_calloc(MEM_QUEUE, (size_t)n_nn_strands, sizeof(nn_strand_t));
+    represent_state_init(&repr_state);
+    repr_strand = strand_create(g_pool);
+    if(!nn_strands || !repr_strand){ LOG_ERROR("[pool] allocation failed\n"); goto done; }
+    feature_set_t fs;
+    if(feature_set_parse(g_config.features, &fs) != 0){ LOG_ERROR("invalid --features '%s'\n", g_config.features); goto done; }
+    detect_set_t ds;
+    if(detect_set_parse(g_config.detectors, &ds) != 0){ LOG_ERROR("invalid --detectors '%s'\n", g_config.detectors); goto done; }
+    for(int i=0;i<n_nn_strands;i++){
+        nn_strand_t *ns = &nn_strands[i];
+        char spill_dir[320];
+        snprintf(spill_dir, sizeof(spill_dir), "%s/strand%d", g_config.model_spill_dir, i);
+        double budget = g_config.train_cpu_budget > 0.0 ? g_config.train_cpu_budget / n_nn_strands : 0.0;
+        size_t cache_bytes = (size_t)(g_config.model_cache_mb * 1024.0 * 1024.0 / n_nn_strands);
+        ns->strand = strand_create(g_pool);
+        ns->features = feature_stage_create(&fs, &ds, 0);
+        ns->stage = nn_stage_create(i, budget, cache_bytes, g_config.per_source_models ? spill_dir : NULL);
+        queue_init(&ns->out_q);
+        if(!ns->strand || !ns->features || !ns->stage){ LOG_ERROR("[pool] cannot create NN strand %d\n", i); goto done; }
+        state_restore_features(ns->features, i);
+        n_restored++;
+    }
+
+    rc = 0;
+    ui_started = pthread_create(&t_ui, NULL, ui_thread, NULL) == 0;
+    if(!ui_started){ perror("pthread_create ui"); }
+    LOG_INFO("Receiver listening on UDP port %d (%d pool workers, %d NN strands)\n", g_config.port, n_workers, n_nn_strands);
+    while(!platform_stop_requested()){
+        fd_set rd;
+        FD_ZERO(&rd);
+        FD_SET(sock, &rd);
+        struct timeval tv = { 0, IDLE_TICK_MS * 1000 };
+        int ready = select((int)sock + 1, &rd, NULL, NULL, &tv);
+        if(ready < 0) continue;
+        if(ready == 0){
+            for(int i=0;i<n_nn_strands;i++) strand_post(nn_strands[i].strand, nn_idle_task, &nn_strands[i]);
+            continue;
+        }
+        char buf[8192];
+        struct sockaddr_in from; socklen_t flen = sizeof(from);
+        int n = (int)recvfrom(sock, buf, (int)sizeof(buf)-1, 0, (struct sockaddr*)&from, &flen);
+        if(n <= 0) continue;
+        buf[n] = '\0';
+        stats_inc_received();
+        rec_meta_t meta;
+        memset(&meta, 0, sizeof(meta));
+        inet_ntop(AF_INET, &from.sin_addr, meta.src, sizeof(meta.src));
+        lat_stamp(&meta);
+        trace_stamp(&meta);
+        task_rec_t *r = task_rec_new(buf, &meta);
+        if(r && strand_post(nn_strand_for(meta.src)->strand, nn_task, r) != 0) mem_free(r);
+    }
+    /* the UI reads the pool's counters, stop it first; destroying the pool runs every queued task */
+    if(ui_started) pthread_join(t_ui, NULL);
+    LOG_INFO("Stop requested, draining the pool\n");
+done:
+    pool = g_pool;
+    g_pool = NULL;
+    pool_destroy(pool);
+    /* strands that failed before restoring their streams must not overwrite the saved ones */
+    for(int i=0;nn_strands && i<n_nn_strands;i++){
+        nn_strand_t *ns = &nn_strands[i];
+        if(i < n_restored) state_save_features(ns->features, i);
+        feature_stage_free(ns->features);
+        nn_stage_free(ns->stage);
+        strand_free(ns->strand);
+    }
+    strand_free(repr_strand);
+    repr_strand = NULL;
+    mem_free(nn_strands);
+    nn_strands = NULL;
+    CLOSESOCKET(sock);
+    return rc;
+}
+
+/**
+ * Pool of the running task pipeline (NULL when the thread pipeline is used).
+ */
+pool_t* task_pipeline_pool(void){
+    return g_pool;
+}
@@ -0,0 +1,16 @@
+/**
+ * task_pipeline.h
+ *
+ * Declarations for the task-based pipeline: the stages run as tasks on the
+ * work-stealing pool instead of on one fixed thread each.
+ */
+
+#ifndef RECEIVER_TASK_PIPELINE_H
+#define RECEIVER_TASK_PIPELINE_H
+
+#include "pool.h"
+
+int run_task_pipeline(int n_workers);
+pool_t* task_pipeline_pool(void);
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * trace.c
+ *
+ * Record trace. trace_start() maps `--trace-file` and spans are written
+ * straight into the mapping: a header of TRACE_HDR_BYTES followed by a ring
+ * of trace_rec_t slots. A writer claims the next slot with one atomic add,
+ * so the oldest spans are overwritten once the ring is full and the file
+ * stays readable even if the process dies. Unused slots have tid 0; readers
+ * scan every slot and order the spans by time.
+ *
+ * Only sampled records carry a trace ID: the receive threads count records
+ * in a thread-local countdown and stamp every `--trace-sample`th one, so an
+ * unsampled record costs a test of its trace ID per stage.
+ */
+#ifndef TRACE_C_HEADER
+#define TRACE_C_HEADER
+
+#include "trace.h"
+
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+#define TRACE_MAGIC "ANTRACE1"
+#define TRACE_VERSION 1
+
+/**
+ * Header of the trace file.
+ *
+ * magic, version, rec_size: TRACE_MAGIC, TRACE_VERSION and sizeof(trace_rec_t)
+ * capacity: span slots after the header
+ * written: spans written, the ring holds the last `capacity` of them (set by trace_stop(), 0 while running)
+ * origin_wall_us: wall-clock time (microseconds since the epoch) of begin_ns 0
+ * sample_every, stages: `--trace-sample` and TRACE_STAGES
+ * traced: records that got a trace ID (set by trace_stop())
+ */
+typedef struct {
+    char magic[8];
+    unsigned int version, rec_size;
+    unsigned long long capacity;
+    unsigned long long written;
+    long long origin_wall_us;
+    unsigned int sample_every, stages;
+    unsigned long long traced;
+    char reserved[8];
+} trace_hdr_t;
+
+_Static_assert(sizeof(trace_hdr_t) == TRACE_HDR_BYTES, "trace header size");
+_Static_assert(sizeof(trace_rec_t) == 32, "trace span size");
+
+const char *const trace_stage_names[TRACE_STAGES] = { "queue", "parse", "features", "predict", "train", "represent", "checkpoint" };
+
+_Atomic(trace_rec_t*) trace_ring;
+static unsigned char *trace_base;
+static size_t trace_bytes;
+static unsigned long long trace_cap;
+static int trace_every;
+static long long trace_origin;
+static atomic_ullong trace_next;
+static atomic_ullong trace_sampled;
+static atomic_uint trace_tids;
+static _Thread_local unsigned int trace_tid;
+static _Thread_local int trace_countdown;
+
+/**
+ * Start tracing into a file; an existing file is replaced.
+ *
+ * @param path trace file ("" or NULL = tracing off)
+ * @param sample_every trace one received record in this many (>= 1)
+ * @param size_mb file size in MiB, header included
+ * @return 0 on success (or tracing off), -1 on error
+ */
+int trace_start(const char *path, int sample_every, double size_mb){
+    if(!path || !path[0]) return 0;
+    double slots = (size_mb * 1024.0 * 1024.0 - TRACE_HDR_BYTES) / (double)sizeof(trace_rec_t);
+    if(sample_every < 1 || slots < 1.0){ LOG_ERROR("[trace] invalid sampling or size for %s\n", path); return -1; }
+    unsigned long long cap = (unsigned long long)slots;
+    size_t bytes = TRACE_HDR_BYTES + (size_t)cap * sizeof(trace_rec_t);
+    /* a fresh ring: spans of an earlier run would mix with this one's */
+    remove(path);
+    unsigned char *base = (unsigned char*)platform_map_file(path, bytes, 1);
+    if(!base){ LOG_ERROR("[trace] cannot map %s\n", path); return -1; }
+    trace_hdr_t *h = (trace_hdr_t*)base;
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, TRACE_MAGIC, sizeof(h->magic));
+    h->version = TRACE_VERSION;
+    h->rec_size = (unsigned int)sizeof(trace_rec_t);
+    h->capacity = cap;
+    h->sample_every = (unsigned int)sample_every;
+    h->stages = TRACE_STAGES;
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    trace_origin = platform_monotonic_ns();
+    h->origin_wall_us = (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+
+    trace_base = base;
+    trace_bytes = bytes;
+    trace_cap = cap;
+    trace_every = sample_every;
+    atomic_store(&trace_next, 0);
+    atomic_store(&trace_sampled, 0);
+    atomic_store_explicit(&trace_ring, (trace_rec_t*)(base + TRACE_HDR_BYTES), memory_order_release);
+    LOG_INFO("[trace] tracing 1 in %d records to %s (%llu spans)\n", sample_every, path, cap);
+    return 0;
+}
+
+/**
+ * Stop tracing: fill in the header counts and write the file back. Called
+ * once the pipeline threads have exited.
+ */
+void trace_stop(void){
+    trace_rec_t *ring = atomic_exchange(&trace_ring, NULL);
+    if(!ring) return;
+    trace_hdr_t *h = (trace_hdr_t*)trace_base;
+    unsigned long long written = atomic_load(&trace_next), traced = atomic_load(&trace_sampled);
+    h->written = written;
+    h->traced = traced;
+    if(platform_sync_map(trace_base, trace_bytes) != 0) LOG_ERROR("[trace] cannot write the trace file back\n");
+    platform_unmap_file(trace_base, trace_bytes);
+    trace_base = NULL;
+    LOG_INFO("[trace] %llu spans of %llu records written\n", written, traced);
+}
+
+/**
+ * Stamp a record received now with a trace ID if it is sampled (0 if not).
+ *
+ * @param meta record metadata
+ */
+void trace_stamp(rec_meta_t *meta){
+    meta->trace_id = 0;
+    if(!atomic_load_explicit(&trace_ring, memory_order_acquire)) return;
+    if(trace_countdown > 1){ trace_countdown--; return; }
+    trace_countdown = trace_every;
+    meta->trace_id = atomic_fetch_add_explicit(&trace_sampled, 1, memory_order_relaxed) + 1;
+}
+
+/**
+ * Write a span.
+ *
+ * @param trace_id record the span belongs to (0 = none)
+ * @param stage TRACE_* step
+ * @param begin_ns monotonic start (platform_monotonic_ns())
+ * @param end_ns monotonic end
+ */
+void trace_span(unsigned long long trace_id, int stage, long long begin_ns, long long end_ns){
+    trace_rec_t *ring = atomic_load_explicit(&trace_ring, memory_order_acquire);
+    if(!ring || stage < 0 || stage >= TRACE_STAGES) return;
+    if(!trace_tid) trace_tid = atomic_fetch_add(&trace_tids, 1) + 1;
+    unsigned long long seq = atomic_fetch_add_explicit(&trace_next, 1, memory_order_relaxed);
+    trace_rec_t *r = &ring[seq % trace_cap];
+    r->begin_ns = begin_ns - trace_origin;
+    r->end_ns = end_ns - trace_origin;
+    r->trace_id = trace_id;
+    r->stage = (unsigned short)stage;
+    r->reserved = 0;
+    r->tid = trace_tid;
+}
+
+/**
+ * Write the queue wait of a sampled record: from when it left its previous
+ * stage (rec_meta_t.hop_ns) until now.
+ *
+ * @param meta metadata of the record just taken from a queue
+ */
+void trace_wait(const rec_meta_t *meta){
+    if(meta->trace_id && meta->hop_ns) trace_span(meta->trace_id, TRACE_QUEUE, meta->hop_ns, platform_monotonic_ns());
+}
+
+/**
+ * Get the trace counters.
+ *
+ * @param traced receives the number of records that got a trace ID
+ * @param spans receives the number of spans written
+ */
+void trace_get_counts(long long *traced, long long *spans){
+    *traced = (long long)atomic_load_explicit(&trace_sampled, memory_order_relaxed);
+    *spans = (long long)atomic_load_explicit(&trace_next, memory_order_relaxed);
+}
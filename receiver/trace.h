@@ -0,0 +1,67 @@
+/**
+ * trace.h
+ *
+ * Declarations for the record trace. With `--trace-file` every
+ * `--trace-sample`th received record gets a trace ID (rec_meta_t.trace_id)
+ * and the stages write a span (begin and end time, stage, thread) for each
+ * step of it into a binary ring file; tools/trace_export.py turns the file
+ * into Chrome / Perfetto trace-event JSON.
+ */
+
+#ifndef RECEIVER_TRACE_H
+#define RECEIVER_TRACE_H
+
+#include <stdatomic.h>
+
+#include "common.h"
+#include "platform.h"
+
+/* Steps a span can cover (keep in sync with tools/trace_export.py) */
+#define TRACE_QUEUE 0      /* waiting in front of a stage: queue or task pool */
+#define TRACE_PARSE 1      /* datagram -> preprocessed record */
+#define TRACE_FEATURES 2   /* feature computation and detectors */
+#define TRACE_PREDICT 3    /* model lookup and inference */
+#define TRACE_TRAIN 4      /* training step (or handing it to the scheduler) */
+#define TRACE_REPRESENT 5  /* one output line represented */
+#define TRACE_CHECKPOINT 6 /* a stage saving its state (not tied to a record) */
+#define TRACE_STAGES 7
+
+/** Size of the trace file header; spans follow it. */
+#define TRACE_HDR_BYTES 64
+
+/**
+ * Span as stored in the trace file (32 bytes, host byte order).
+ *
+ * begin_ns, end_ns: monotonic time since the trace was started
+ * trace_id: record the span belongs to (0 = none, e.g. a checkpoint)
+ * tid: thread that wrote the span (1, 2, ... in order of first use; 0 = unused slot)
+ * stage: TRACE_* step
+ */
+typedef struct {
+    long long begin_ns, end_ns;
+    unsigned long long trace_id;
+    unsigned int tid;
+    unsigned short stage;
+    unsigned short reserved;
+} trace_rec_t;
+
+extern const char *const trace_stage_names[TRACE_STAGES];
+extern _Atomic(trace_rec_t*) trace_ring;
+
+int trace_start(const char *path, int sample_every, double size_mb);
+void trace_stop(void);
+void trace_stamp(rec_meta_t *meta);
+void trace_span(unsigned long long trace_id, int stage, long long begin_ns, long long end_ns);
+void trace_wait(const rec_meta_t *meta);
+void trace_get_counts(long long *traced, long long *spans);
+
+/* Non-zero while spans are written. */
+#define TRACE_ACTIVE() (atomic_load_explicit(&trace_ring, memory_order_relaxed) != NULL)
+/* Start of a span of a sampled record, 0 for the others. */
+#define TRACE_BEGIN(meta) ((meta)->trace_id ? platform_monotonic_ns() : 0)
+/* Write the span started by TRACE_BEGIN() (nothing for t0 == 0). */
+#define TRACE_END(meta, stage, t0) do { \
+    if(t0) trace_span((meta)->trace_id, (stage), (t0), platform_monotonic_ns()); \
+} while(0)
+
+#endif
@@ -0,0 +1,1004 @@
+/*
+ * tsdb.c
+ *
+ * Embedded append-only store of the received metrics and the predictions
+ * made for them, so history can be queried and trained on without the
+ * export CSV files.
+ *
+ * Every (source, column) pair is a series of (timestamp, float) points,
+ * compressed as in Facebook's Gorilla: timestamps as delta-of-delta with
+ * variable-length buckets (one bit for a regular interval), values as the XOR
+ * with the previous value, storing only the bits between the leading and
+ * trailing zeros (one bit for a repeated value). A series is written into
+ * fixed-size blocks of TSDB_BLOCK bytes; each block starts with a header
+ * holding its series, point count, bit length and min/max of time and value,
+ * which is also kept in memory as the block index so range reads skip
+ * blocks outside the range without touching them.
+ *
+ * Blocks live in segment files `seg-<seq>.ts` of TSDB_SEG_BLOCKS blocks that
+ * are memory-mapped; appends write the bits into the mapping and update the
+ * block header last, so a crashed process leaves every block readable up to
+ * its last complete point. `sources.cat` lists the sources in the order their
+ * series ids were assigned (id = source index * TSDB_COLUMNS + column).
+ * Integers are stored in host byte order.
+ *
+ * Every series also keeps rollup tiers of 1 min, 5 min, 1 h and 1 day
+ * buckets (count / sum / min / max / last), updated in O(1) by each append
+ * and bounded to the last TIER_KEEP buckets (the daily tier is unbounded).
+ * tsdb_query() answers a range from the coarsest tier whose buckets fit
+ * inside it and the finer tiers / raw points for the edges. The tiers are
+ * saved to `rollups.bin` on close and rebuilt from the blocks when that file
+ * does not match the stored points (e.g. after a crash). Points older than
+ * the newest bucket of a tier that fall into a gap between its buckets are
+ * not rolled up; only raw queries (`max_tier` -1) count them.
+ */
+
+#ifndef TSDB_C_HEADER
+#define TSDB_C_HEADER
+#include "tsdb.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <limits.h>
+#include <math.h>
+
+#include "platform.h"
+#include "log.h"
+#include "memstat.h"
+
+#define TSDB_MAGIC 0x42445354u /* "TSDB" */
+#define TSDB_VERSION 1u
+#define TSDB_BLOCK 4096
+#define TSDB_SEG_BLOCKS 1024
+#define TSDB_SEG_BYTES ((size_t)TSDB_BLOCK * TSDB_SEG_BLOCKS)
+#define TSDB_HDR 48
+#define TSDB_PAYLOAD_BITS ((uint32_t)(TSDB_BLOCK - TSDB_HDR) * 8u)
+/* largest encoding of one point: 4 + 32 timestamp bits, 2 + 5 + 5 + 32 value bits */
+#define TSDB_POINT_BITS_MAX 80u
+#define TSDB_BUCKETS 1024
+#define TSDB_SRC_LEN 64
+#define TSDB_ROLLUP_MAGIC 0x55525354u /* "TSRU" */
+
+const long long tsdb_tier_ms[TSDB_TIERS] = { 60000LL, 300000LL, 3600000LL, 86400000LL };
+/* buckets kept per tier (0 = all): a day of minutes, a week of 5 minutes, 90 days of hours */
+static const int TIER_KEEP[TSDB_TIERS] = { 1440, 2016, 2160, 0 };
+
+const char *const tsdb_column_names[TSDB_COLUMNS] = {
+    "bytes", "flows", "packets", "rtr", "rtt", "srt",
+    "pred_bytes", "pred_flows", "pred_packets", "pred_rtr", "pred_rtt", "pred_srt"
+};
+
+tsdb_t *g_store = NULL;
+
+/**
+ * Header of a segment file, stored in its first block.
+ *
+ * used: blocks allocated so far, including this header block
+ */
+typedef struct {
+    uint32_t magic, version, block_size, n_blocks, used;
+} tsdb_seg_hdr_t;
+
+/**
+ * Header of a data block; the compressed points follow it.
+ *
+ * series: series id (0 = free block)
+ * count: number of points
+ * bits: length of the compressed points in bits
+ * t_first: timestamp of the first point
+ * t_min, t_max, v_min, v_max: ranges of the block's timestamps and values
+ */
+typedef struct {
+    uint32_t series, count, bits, reserved;
+    int64_t t_first, t_min, t_max;
+    float v_min, v_max;
+} tsdb_block_hdr_t;
+
+typedef char tsdb_block_hdr_size_check[sizeof(tsdb_block_hdr_t) == TSDB_HDR ? 1 : -1];
+
+/**
+ * Index entry of a block.
+ *
+ * seg, block: location of the block
+ * t_min, t_max, v_min, v_max, count: copy of the block header
+ */
+typedef struct {
+    int seg, block;
+    long long t_min, t_max;
+    float v_min, v_max;
+    unsigned count;
+} tsdb_ref_t;
+
+/**
+ * Encoder / decoder state of a block.
+ *
+ * ts, delta: last timestamp and the difference to the one before
+ * val: bits of the last value
+ * lead, trail: zero bits around the meaningful bits of the last stored XOR (-1 = none yet)
+ * pos: position in the payload in bits
+ * n: points encoded / decoded
+ */
+typedef struct {
+    long long ts, delta;
+    uint32_t val;
+    int lead, trail;
+    uint32_t pos, n;
+} tsdb_codec_t;
+
+/**
+ * Rollup bucket.
+ *
+ * start: first timestamp of the bucket (a multiple of the tier width)
+ * first_ts: timestamp of the oldest point
+ * last, last_ts: value and timestamp of the newest point
+ */
+typedef struct {
+    long long start, first_ts, last_ts;
+    double sum;
+    float min, max, last;
+    unsigned count;
+} tsdb_bucket_t;
+
+/**
+ * Non-empty buckets of a tier in time order, kept as a ring once TIER_KEEP is reached.
+ *
+ * b, cap, n, head: storage, its capacity, buckets in use and index of the oldest
+ * horizon: end of the newest dropped bucket (LLONG_MIN = nothing dropped)
+ */
+typedef struct {
+    tsdb_bucket_t *b;
+    int cap, n, head;
+    long long horizon;
+} tsdb_ring_t;
+
+/**
+ * Series of one source and column.
+ *
+ * refs, n_refs, cap_refs: index of its blocks in append order
+ * active: non-zero when the last block takes further points
+ * enc: encoder state of the last block
+ * tiers: rollups of the series
+ */
+typedef struct {
+    tsdb_ref_t *refs;
+    int n_refs, cap_refs;
+    int active;
+    tsdb_codec_t enc;
+    tsdb_ring_t tiers[TSDB_TIERS];
+} tsdb_series_t;
+
+/**
+ * Source with its series.
+ *
+ * index: position in `sources.cat`
+ * next: hash chain
+ */
+typedef struct tsdb_source_s {
+    char src[TSDB_SRC_LEN];
+    int index;
+    tsdb_series_t col[TSDB_COLUMNS];
+    struct tsdb_source_s *next;
+} tsdb_source_t;
+
+/**
+ * Store.
+ *
+ * segs, n_segs, cap_segs: mapped segment files in sequence order
+ * sources, n_sources, cap_sources: sources in catalog order
+ * catalog: `sources.cat` opened for appending (writable stores)
+ * points, blocks: totals for tsdb_usage()
+ */
+struct tsdb_s {
+    char dir[256];
+    int writable;
+    pthread_mutex_t m;
+    unsigned char **segs;
+    int n_segs, cap_segs;
+    tsdb_source_t *buckets[TSDB_BUCKETS];
+    tsdb_source_t **sources;
+    int n_sources, cap_sources;
+    FILE *catalog;
+    long long points, blocks;
+};
+
+/* Bits are stored most significant first; the payload starts zeroed, so writes only OR. */
+static void put_bits(unsigned char *p, uint32_t *pos, uint64_t v, int n){
+    uint32_t at = *pos;
+    while(n > 0){
+        int off = (int)(at & 7u), take = 8 - off;
+        if(take > n) take = n;
+        unsigned chunk = (unsigned)(v >> (n - take)) & ((1u << take) - 1u);
+        p[at >> 3] |= (unsigned char)(chunk << (8 - off - take));
+        at += (uint32_t)take;
+        n -= take;
+    }
+    *pos = at;
+}
+
+static uint64_t get_bits(const unsigned char *p, uint32_t *pos, int n){
+    uint64_t v = 0;
+    uint32_t at = *pos;
+    while(n > 0){
+        int off = (int)(at & 7u), take = 8 - off;
+        if(take > n) take = n;
+        v = (v << take) | ((p[at >> 3] >> (8 - off - take)) & ((1u << take) - 1u));
+        at += (uint32_t)take;
+        n -= take;
+    }
+    *pos = at;
+    return v;
+}
+
+static int clz32(uint32_t x){
+    int n = 0;
+    while(!(x & 0x80000000u)){ x <<= 1; n++; }
+    return n;
+}
+
+static int ctz32(uint32_t x){
+    int n = 0;
+    while(!(x & 1u)){ x >>= 1; n++; }
+    return n;
+}
+
+static uint32_t float_bits(float v){
+    uint32_t b;
+    memcpy(&b, &v, sizeof(b));
+    return b;
+}
+
+static float bits_float(uint32_t b){
+    float v;
+    memcpy(&v, &b, sizeof(v));
+    return v;
+}
+
+/**
+ * Decode the next point of a block.
+ *
+ * @param h block header
+ * @param c decoder state, zeroed before the first point
+ * @param ts output timestamp
+ * @param v output value
+ * @return 1 when a point was decoded, 0 at the end of the block
+ */
+static int tsdb_decode(const tsdb_block_hdr_t *h, tsdb_codec_t *c, long long *ts, float *v){
+    if(c->n >= h->count) return 0;
+    const unsigned char *p = (const unsigned char*)h + TSDB_HDR;
+    if(c->n == 0){
+        c->ts = h->t_first;
+        c->delta = 0;
+        c->val = (uint32_t)get_bits(p, &c->pos, 32);
+        c->lead = -1;
+    } else {
+        long long dod;
+        if(!get_bits(p, &c->pos, 1)) dod = 0;
+        else if(!get_bits(p, &c->pos, 1)) dod = (long long)get_bits(p, &c->pos, 7) - 63;
+        else if(!get_bits(p, &c->pos, 1)) dod = (long long)get_bits(p, &c->pos, 9) - 255;
+        else if(!get_bits(p, &c->pos, 1)) dod = (long long)get_bits(p, &c->pos, 12) - 2047;
+        else dod = (int32_t)(uint32_t)get_bits(p, &c->pos, 32);
+        c->delta += dod;
+        c->ts += c->delta;
+        if(get_bits(p, &c->pos, 1)){
+            if(get_bits(p, &c->pos, 1)){
+                c->lead = (int)get_bits(p, &c->pos, 5);
+                int len = (int)get_bits(p, &c->pos, 5) + 1;
+                c->trail = 32 - c->lead - len;
+            }
+            if(c->lead < 0 || c->trail < 0) return 0; /* damaged block */
+            int len = 32 - c->lead - c->trail;
+            c->val ^= (uint32_t)get_bits(p, &c->pos, len) << c->trail;
+        }
+    }
+    c->n++;
+    *ts = c->ts;
+    *v = bits_float(c->val);
+    return 1;
+}
+
+/**
+ * Encode a point into a block. The caller checked that the payload has room
+ * for TSDB_POINT_BITS_MAX more bits.
+ *
+ * @return 0 on success, -1 when the timestamp step does not fit the encoding (start a new block)
+ */
+static int tsdb_encode(tsdb_block_hdr_t *h, tsdb_codec_t *c, long long ts, float v){
+    unsigned char *p = (unsigned char*)h + TSDB_HDR;
+    uint32_t b = float_bits(v);
+    if(c->n == 0){
+        h->t_first = ts;
+        c->ts = ts;
+        c->delta = 0;
+        c->lead = -1;
+        put_bits(p, &c->pos, b, 32);
+    } else {
+        long long delta = ts - c->ts, dod = delta - c->delta;
+        if(dod < INT32_MIN || dod > INT32_MAX) return -1;
+        if(dod == 0) put_bits(p, &c->pos, 0u, 1);
+        else if(dod >= -63 && dod <= 64){ put_bits(p, &c->pos, 2u, 2); put_bits(p, &c->pos, (uint64_t)(dod + 63), 7); }
+        else if(dod >= -255 && dod <= 256){ put_bits(p, &c->pos, 6u, 3); put_bits(p, &c->pos, (uint64_t)(dod + 255), 9); }
+        else if(dod >= -2047 && dod <= 2048){ put_bits(p, &c->pos, 14u, 4); put_bits(p, &c->pos, (uint64_t)(dod + 2047), 12); }
+        else { put_bits(p, &c->pos, 15u, 4); put_bits(p, &c->pos, (uint32_t)(int32_t)dod, 32); }
+        c->ts = ts;
+        c->delta = delta;
+        uint32_t x = b ^ c->val;
+        if(x == 0) put_bits(p, &c->pos, 0u, 1);
+        else {
+            int lead = clz32(x), trail = ctz32(x);
+            if(c->lead >= 0 && lead >= c->lead && trail >= c->trail){
+                put_bits(p, &c->pos, 2u, 2);
+                put_bits(p, &c->pos, x >> c->trail, 32 - c->lead - c->trail);
+            } else {
+                int len = 32 - lead - trail;
+                put_bits(p, &c->pos, 3u, 2);
+                put_bits(p, &c->pos, (uint64_t)lead, 5);
+                put_bits(p, &c->pos, (uint64_t)(len - 1), 5);
+                put_bits(p, &c->pos, x >> trail, len);
+                c->lead = lead;
+                c->trail = trail;
+            }
+        }
+    }
+    c->val = b;
+    c->n++;
+    return 0;
+}
+
+static long long floor_div(long long a, long long b){
+    long long q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+static tsdb_bucket_t* ring_at(const tsdb_ring_t *r, int i){
+    return &r->b[(r->head + i) % r->cap];
+}
+
+/**
+ * Index of the first bucket starting at or after `start`.
+ */
+static int ring_lower_bound(const tsdb_ring_t *r, long long start){
+    int lo = 0, hi = r->n;
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+        if(ring_at(r, mid)->start < start) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * Append an empty bucket, dropping the oldest one when the tier is full.
+ *
+ * @return new bucket or NULL on error
+ */
+static tsdb_bucket_t* ring_push(tsdb_ring_t *r, int tier, long long start){
+    int keep = TIER_KEEP[tier];
+    if(keep > 0 && r->n == keep){
+        r->horizon = ring_at(r, 0)->start + tsdb_tier_ms[tier];
+        r->head = (r->head + 1) % r->cap;
+        r->n--;
+    }
+    if(r->n == r->cap){
+        /* the ring only wraps once it reached TIER_KEEP, so growing keeps head at 0 */
+        int cap = r->cap ? r->cap * 2 : 16;
+        if(keep > 0 && cap > keep) cap = keep;
+        tsdb_bucket_t *b = (tsdb_bucket_t*)mem_realloc(MEM_STATS, r->b, sizeof(tsdb_bucket_t) * (size_t)cap);
+        if(!b) return NULL;
+        r->b = b;
+        r->cap = cap;
+    }
+    tsdb_bucket_t *b = ring_at(r, r->n++);
+    memset(b, 0, sizeof(*b));
+    b->start = start;
+    return b;
+}
+
+static void bucket_add(tsdb_bucket_t *b, long long ts, float v){
+    if(b->count == 0 || v < b->min) b->min = v;
+    if(b->count == 0 || v > b->max) b->max = v;
+    if(b->count == 0 || ts >= b->last_ts){ b->last = v; b->last_ts = ts; }
+    if(b->count == 0 || ts < b->first_ts) b->first_ts = ts;
+    b->sum += v;
+    b->count++;
+}
+
+/**
+ * Roll a point up into every tier of its series: O(1) for points in or
+ * after the newest bucket, a binary search for late points.
+ */
+static void tsdb_rollup(tsdb_series_t *se, long long ts, float v){
+    for(int k=0;k<TSDB_TIERS;k++){
+        tsdb_ring_t *r = &se->tiers[k];
+        long long start = floor_div(ts, tsdb_tier_ms[k]) * tsdb_tier_ms[k];
+        tsdb_bucket_t *b = r->n ? ring_at(r, r->n - 1) : NULL;
+        if(!b || start > b->start) b = ring_push(r, k, start);
+        else if(start < b->start){
+            int i = ring_lower_bound(r, start);
+            b = (i < r->n && ring_at(r, i)->start == start) ? ring_at(r, i) : NULL;
+        }
+        if(b) bucket_add(b, ts, v);
+    }
+}
+
+static void agg_merge(tsdb_agg_t *a, long long count, double sum, float min, float max, float last, long long last_ts){
+    if(count == 0) return;
+    if(a->count == 0 || min < a->min) a->min = min;
+    if(a->count == 0 || max > a->max) a->max = max;
+    if(a->count == 0 || last_ts >= a->last_ts){ a->last = last; a->last_ts = last_ts; }
+    a->count += count;
+    a->sum += sum;
+}
+
+static tsdb_block_hdr_t* tsdb_block(const tsdb_t *db, int seg, int block){
+    return (tsdb_block_hdr_t*)(db->segs[seg] + (size_t)block * TSDB_BLOCK);
+}
+
+static unsigned tsdb_hash(const char *s){
+    unsigned h = 2166136261u;
+    for(; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h % TSDB_BUCKETS;
+}
+
+static tsdb_source_t* tsdb_find(const tsdb_t *db, const char *src){
+    for(tsdb_source_t *s = db->buckets[tsdb_hash(src)]; s; s = s->next)
+        if(strcmp(s->src, src) == 0) return s;
+    return NULL;
+}
+
+/**
+ * Register a source in memory (and in the catalog when `persist`).
+ *
+ * @return source or NULL on error
+ */
+static tsdb_source_t* tsdb_add_source(tsdb_t *db, const char *src, int persist){
+    if(db->n_sources == db->cap_sources){
+        int cap = db->cap_sources ? db->cap_sources * 2 : 64;
+        tsdb_source_t **s = (tsdb_source_t**)mem_realloc(MEM_STATS, db->sources, sizeof(tsdb_source_t*) * (size_t)cap);
+        if(!s) return NULL;
+        db->sources = s;
+        db->cap_sources = cap;
+    }
+    tsdb_source_t *s = (tsdb_source_t*)mem_calloc(MEM_STATS, 1, sizeof(tsdb_source_t));
+    if(!s) return NULL;
+    snprintf(s->src, sizeof(s->src), "%s", src);
+    for(int k=0;k<TSDB_COLUMNS;k++)
+        for(int t=0;t<TSDB_TIERS;t++) s->col[k].tiers[t].horizon = LLONG_MIN;
+    if(persist){
+        char rec[TSDB_SRC_LEN];
+        memset(rec, 0, sizeof(rec));
+        memcpy(rec, s->src, strlen(s->src));
+        if(!db->catalog || fwrite(rec, sizeof(rec), 1, db->catalog) != 1 || fflush(db->catalog) != 0){
+            LOG_ERROR("[tsdb] cannot add source '%s' to %s/sources.cat\n", src, db->dir);
+            mem_free(s);
+            return NULL;
+        }
+    }
+    s->index = db->n_sources;
+    db->sources[db->n_sources++] = s;
+    unsigned h = tsdb_hash(s->src);
+    s->next = db->buckets[h];
+    db->buckets[h] = s;
+    return s;
+}
+
+static int tsdb_add_ref(tsdb_series_t *se, int seg, int block){
+    if(se->n_refs == se->cap_refs){
+        int cap = se->cap_refs ? se->cap_refs * 2 : 8;
+        tsdb_ref_t *r = (tsdb_ref_t*)mem_realloc(MEM_STATS, se->refs, sizeof(tsdb_ref_t) * (size_t)cap);
+        if(!r) return -1;
+        se->refs = r;
+        se->cap_refs = cap;
+    }
+    tsdb_ref_t *r = &se->refs[se->n_refs++];
+    memset(r, 0, sizeof(*r));
+    r->seg = seg;
+    r->block = block;
+    return 0;
+}
+
+static void tsdb_seg_path(const tsdb_t *db, int seq, char *out, size_t out_len){
+    snprintf(out, out_len, "%s/seg-%06d.ts", db->dir, seq);
+}
+
+/**
+ * Map the next segment file, creating it when the store is writable.
+ *
+ * @return 0 on success, -1 when it does not exist or cannot be mapped
+ */
+static int tsdb_map_segment(tsdb_t *db, int create){
+    if(db->n_segs == db->cap_segs){
+        int cap = db->cap_segs ? db->cap_segs * 2 : 16;
+        unsigned char **s = (unsigned char**)mem_realloc(MEM_STATS, db->segs, sizeof(unsigned char*) * (size_t)cap);
+        if(!s) return -1;
+        db->segs = s;
+        db->cap_segs = cap;
+    }
+    char path[320];
+    tsdb_seg_path(db, db->n_segs + 1, path, sizeof(path));
+    if(!create){
+        FILE *f = fopen(path, "rb");
+        if(!f) return -1;
+        fclose(f);
+    }
+    unsigned char *base = (unsigned char*)platform_map_file(path, TSDB_SEG_BYTES, db->writable);
+    if(!base) return -1;
+    tsdb_seg_hdr_t *sh = (tsdb_seg_hdr_t*)base;
+    if(create){
+        sh->magic = TSDB_MAGIC;
+        sh->version = TSDB_VERSION;
+        sh->block_size = TSDB_BLOCK;
+        sh->n_blocks = TSDB_SEG_BLOCKS;
+        sh->used = 1;
+    } else if(sh->magic != TSDB_MAGIC || sh->version != TSDB_VERSION || sh->block_size != TSDB_BLOCK
+              || sh->n_blocks != TSDB_SEG_BLOCKS || sh->used > TSDB_SEG_BLOCKS){
+        LOG_ERROR("[tsdb] ignoring incompatible segment %s\n", path);
+        platform_unmap_file(base, TSDB_SEG_BYTES);
+        return -1;
+    }
+    db->segs[db->n_segs++] = base;
+    return 0;
+}
+
+/**
+ * Start a new block for a series.
+ *
+ * @return 0 on success, -1 when no segment could be mapped
+ */
+static int tsdb_new_block(tsdb_t *db, tsdb_source_t *s, int col){
+    tsdb_seg_hdr_t *sh = db->n_segs ? (tsdb_seg_hdr_t*)db->segs[db->n_segs - 1] : NULL;
+    if(!sh || sh->used >= sh->n_blocks){
+        /* a full segment never changes again: flush it now instead of at close */
+        if(sh) platform_sync_map(sh, TSDB_SEG_BYTES);
+        if(tsdb_map_segment(db, 1) != 0){
+            LOG_ERROR("[tsdb] cannot create a segment in %s\n", db->dir);
+            return -1;
+        }
+        sh = (tsdb_seg_hdr_t*)db->segs[db->n_segs - 1];
+    }
+    tsdb_series_t *se = &s->col[col];
+    if(tsdb_add_ref(se, db->n_segs - 1, (int)sh->used) != 0) return -1;
+    tsdb_block_hdr_t *h = tsdb_block(db, db->n_segs - 1, (int)sh->used);
+    h->series = (uint32_t)(s->index * TSDB_COLUMNS + col) + 1u;
+    sh->used++;
+    memset(&se->enc, 0, sizeof(se->enc));
+    se->active = 1;
+    db->blocks++;
+    return 0;
+}
+
+/**
+ * Continue the last block of a series after a restart: decode it to restore
+ * the encoder state and clear whatever a crash left behind its last point.
+ */
+static void tsdb_resume(tsdb_t *db, tsdb_series_t *se){
+    tsdb_ref_t *r = &se->refs[se->n_refs - 1];
+    tsdb_block_hdr_t *h = tsdb_block(db, r->seg, r->block);
+    tsdb_codec_t c;
+    memset(&c, 0, sizeof(c));
+    long long ts;
+    float v;
+    while(tsdb_decode(h, &c, &ts, &v)){}
+    if(c.pos != h->bits || c.pos + TSDB_POINT_BITS_MAX > TSDB_PAYLOAD_BITS) return;
+    unsigned char *p = (unsigned char*)h + TSDB_HDR;
+    if(c.pos & 7u) p[c.pos >> 3] &= (unsigned char)(0xffu << (8u - (c.pos & 7u)));
+    uint32_t first_free = (c.pos + 7u) >> 3;
+    memset(p + first_free, 0, TSDB_BLOCK - TSDB_HDR - first_free);
+    se->enc = c;
+    se->active = 1;
+}
+
+static void tsdb_rollup_path(const tsdb_t *db, char *out, size_t out_len){
+    snprintf(out, out_len, "%s/rollups.bin", db->dir);
+}
+
+/**
+ * Save the rollup tiers with the number of points they cover.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int tsdb_save_rollups(const tsdb_t *db){
+    char path[320], tmp[328];
+    tsdb_rollup_path(db, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if(!f) return -1;
+    uint32_t hdr[4] = { TSDB_ROLLUP_MAGIC, TSDB_VERSION, (uint32_t)db->n_sources, TSDB_TIERS };
+    int64_t points = db->points;
+    int ok = fwrite(hdr, sizeof(hdr), 1, f) == 1 && fwrite(&points, sizeof(points), 1, f) == 1;
+    for(int i=0;ok && i<db->n_sources;i++)
+        for(int k=0;ok && k<TSDB_COLUMNS;k++)
+            for(int t=0;ok && t<TSDB_TIERS;t++){
+                const tsdb_ring_t *r = &db->sources[i]->col[k].tiers[t];
+                int32_t n = r->n;
+                int64_t horizon = r->horizon;
+                ok = fwrite(&n, sizeof(n), 1, f) == 1 && fwrite(&horizon, sizeof(horizon), 1, f) == 1;
+                for(int j=0;ok && j<r->n;j++) ok = fwrite(ring_at(r, j), sizeof(tsdb_bucket_t), 1, f) == 1;
+            }
+    if(fclose(f) != 0) ok = 0;
+#ifdef _WIN32
+    if(ok) remove(path);
+#endif
+    if(!ok || rename(tmp, path) != 0){ remove(tmp); return -1; }
+    return 0;
+}
+
+/**
+ * Load the rollup tiers saved by the last close, if they cover exactly the
+ * stored points.
+ *
+ * @return 0 when loaded, -1 when they have to be rebuilt
+ */
+static int tsdb_load_rollups(tsdb_t *db){
+    char path[320];
+    tsdb_rollup_path(db, path, sizeof(path));
+    FILE *f = fopen(path, "rb");
+    if(!f) return -1;
+    uint32_t hdr[4];
+    int64_t points;
+    int ok = fread(hdr, sizeof(hdr), 1, f) == 1 && fread(&points, sizeof(points), 1, f) == 1
+          && hdr[0] == TSDB_ROLLUP_MAGIC && hdr[1] == TSDB_VERSION && hdr[2] == (uint32_t)db->n_sources
+          && hdr[3] == TSDB_TIERS && points == db->points;
+    for(int i=0;ok && i<db->n_sources;i++)
+        for(int k=0;ok && k<TSDB_COLUMNS;k++)
+            for(int t=0;ok && t<TSDB_TIERS;t++){
+                tsdb_ring_t *r = &db->sources[i]->col[k].tiers[t];
+                int32_t n;
+                int64_t horizon;
+                ok = fread(&n, sizeof(n), 1, f) == 1 && fread(&horizon, sizeof(horizon), 1, f) == 1
+                  && n >= 0 && (TIER_KEEP[t] == 0 || n <= TIER_KEEP[t]);
+                if(!ok) break;
+                r->horizon = horizon;
+                for(int j=0;ok && j<n;j++){
+                    tsdb_bucket_t b;
+                    tsdb_bucket_t *dst = fread(&b, sizeof(b), 1, f) == 1 ? ring_push(r, t, b.start) : NULL;
+                    if(dst) *dst = b;
+                    else ok = 0;
+                }
+            }
+    fclose(f);
+    if(ok) return 0;
+    for(int i=0;i<db->n_sources;i++)
+        for(int k=0;k<TSDB_COLUMNS;k++)
+            for(int t=0;t<TSDB_TIERS;t++){
+                tsdb_ring_t *r = &db->sources[i]->col[k].tiers[t];
+                r->n = r->head = 0;
+                r->horizon = LLONG_MIN;
+            }
+    return -1;
+}
+
+/**
+ * Rebuild the rollup tiers of every series from its blocks.
+ */
+static void tsdb_rebuild_rollups(tsdb_t *db){
+    long long t0 = platform_monotonic_ns();
+    for(int i=0;i<db->n_sources;i++)
+        for(int k=0;k<TSDB_COLUMNS;k++){
+            tsdb_series_t *se = &db->sources[i]->col[k];
+            for(int j=0;j<se->n_refs;j++){
+                const tsdb_block_hdr_t *h = tsdb_block(db, se->refs[j].seg, se->refs[j].block);
+                tsdb_codec_t c;
+                memset(&c, 0, sizeof(c));
+                long long ts;
+                float v;
+                while(tsdb_decode(h, &c, &ts, &v)) tsdb_rollup(se, ts, v);
+            }
+        }
+    LOG_INFO("[tsdb] rebuilt the rollups of %lld points in %.1f ms\n", db->points, (double)(platform_monotonic_ns() - t0) / 1e6);
+}
+
+/**
+ * Open a store: read the catalog, map the segments and build the block index.
+ *
+ * @param dir directory of the store (created when writable)
+ * @param writable non-zero to append, 0 to only read (the store must exist)
+ * @return store or NULL on error
+ */
+tsdb_t* tsdb_open(const char *dir, int writable){
+    if(!dir || !dir[0]) return NULL;
+    if(writable && platform_mkdir_p(dir) != 0){ LOG_ERROR("[tsdb] cannot create %s\n", dir); return NULL; }
+    char path[320];
+    snprintf(path, sizeof(path), "%s/sources.cat", dir);
+    FILE *cat = fopen(path, writable ? "a+b" : "rb");
+    if(!cat) return NULL;
+    tsdb_t *db = (tsdb_t*)mem_calloc(MEM_STATS, 1, sizeof(tsdb_t));
+    if(!db){ fclose(cat); return NULL; }
+    snprintf(db->dir, sizeof(db->dir), "%s", dir);
+    db->writable = writable;
+    pthread_mutex_init(&db->m, NULL);
+
+    fseek(cat, 0, SEEK_SET);
+    char rec[TSDB_SRC_LEN];
+    while(fread(rec, sizeof(rec), 1, cat) == 1){
+        rec[sizeof(rec) - 1] = '\0';
+        if(!tsdb_add_source(db, rec, 0)){ fclose(cat); tsdb_close(db); return NULL; }
+    }
+    if(writable) db->catalog = cat;
+    else fclose(cat);
+
+    while(tsdb_map_segment(db, 0) == 0){
+        const tsdb_seg_hdr_t *sh = (const tsdb_seg_hdr_t*)db->segs[db->n_segs - 1];
+        for(uint32_t b=1;b<sh->used;b++){
+            const tsdb_block_hdr_t *h = tsdb_block(db, db->n_segs - 1, (int)b);
+            db->blocks++;
+            uint32_t id = h->series;
+            if(id == 0 || id > (uint32_t)db->n_sources * TSDB_COLUMNS || h->bits > TSDB_PAYLOAD_BITS) continue;
+            tsdb_series_t *se = &db->sources[(id - 1) / TSDB_COLUMNS]->col[(id - 1) % TSDB_COLUMNS];
+            if(tsdb_add_ref(se, db->n_segs - 1, (int)b) != 0){ tsdb_close(db); return NULL; }
+            tsdb_ref_t *r = &se->refs[se->n_refs - 1];
+            r->t_min = h->t_min;
+            r->t_max = h->t_max;
+            r->v_min = h->v_min;
+            r->v_max = h->v_max;
+            r->count = h->count;
+            db->points += h->count;
+        }
+    }
+    for(int i=0;writable && i<db->n_sources;i++)
+        for(int k=0;k<TSDB_COLUMNS;k++)
+            if(db->sources[i]->col[k].n_refs > 0) tsdb_resume(db, &db->sources[i]->col[k]);
+    if(tsdb_load_rollups(db) != 0) tsdb_rebuild_rollups(db);
+    LOG_INFO("[tsdb] %s: %d sources, %lld points in %lld blocks\n", db->dir, db->n_sources, db->points, db->blocks);
+    return db;
+}
+
+/**
+ * Flush the segments and close the store.
+ *
+ * @param db store (may be NULL)
+ */
+void tsdb_close(tsdb_t *db){
+    if(!db) return;
+    if(db->writable && tsdb_save_rollups(db) != 0) LOG_ERROR("[tsdb] cannot save the rollups of %s\n", db->dir);
+    for(int i=0;i<db->n_segs;i++){
+        if(db->writable) platform_sync_map(db->segs[i], TSDB_SEG_BYTES);
+        platform_unmap_file(db->segs[i], TSDB_SEG_BYTES);
+    }
+    for(int i=0;i<db->n_sources;i++){
+        for(int k=0;k<TSDB_COLUMNS;k++){
+            mem_free(db->sources[i]->col[k].refs);
+            for(int t=0;t<TSDB_TIERS;t++) mem_free(db->sources[i]->col[k].tiers[t].b);
+        }
+        mem_free(db->sources[i]);
+    }
+    if(db->catalog) fclose(db->catalog);
+    pthread_mutex_destroy(&db->m);
+    mem_free(db->sources);
+    mem_free(db->segs);
+    mem_free(db);
+}
+
+/**
+ * Append one point to each of `n` consecutive columns of a source.
+ *
+ * @param db writable store
+ * @param src source address
+ * @param first_col first column (TSDB_COL_METRICS or TSDB_COL_PREDICTIONS)
+ * @param ts timestamp of the points
+ * @param v values, one per column
+ * @param n number of columns
+ * @return 0 on success, -1 on error
+ */
+int tsdb_append(tsdb_t *db, const char *src, int first_col, long long ts, const float *v, int n){
+    if(!db->writable || first_col < 0 || first_col + n > TSDB_COLUMNS) return -1;
+    int rc = 0;
+    pthread_mutex_lock(&db->m);
+    tsdb_source_t *s = tsdb_find(db, src);
+    if(!s) s = tsdb_add_source(db, src, 1);
+    for(int k=0;s && k<n;k++){
+        tsdb_series_t *se = &s->col[first_col + k];
+        if(se->active && se->enc.pos + TSDB_POINT_BITS_MAX > TSDB_PAYLOAD_BITS) se->active = 0;
+        if(!se->active && tsdb_new_block(db, s, first_col + k) != 0){ rc = -1; break; }
+        tsdb_ref_t *r = &se->refs[se->n_refs - 1];
+        tsdb_block_hdr_t *h = tsdb_block(db, r->seg, r->block);
+        if(tsdb_encode(h, &se->enc, ts, v[k]) != 0){
+            /* timestamp jump too large for the delta encoding: continue in a fresh block */
+            if(tsdb_new_block(db, s, first_col + k) != 0){ rc = -1; break; }
+            r = &se->refs[se->n_refs - 1];
+            h = tsdb_block(db, r->seg, r->block);
+            tsdb_encode(h, &se->enc, ts, v[k]);
+        }
+        if(h->count == 0){ h->t_min = h->t_max = ts; h->v_min = h->v_max = v[k]; }
+        if(ts < h->t_min) h->t_min = ts;
+        if(ts > h->t_max) h->t_max = ts;
+        if(v[k] < h->v_min) h->v_min = v[k];
+        if(v[k] > h->v_max) h->v_max = v[k];
+        h->bits = se->enc.pos;
+        /* the count is written last: readers of the mapping never see a partial point */
+        h->count = se->enc.n;
+        r->t_min = h->t_min;
+        r->t_max = h->t_max;
+        r->v_min = h->v_min;
+        r->v_max = h->v_max;
+        r->count = h->count;
+        tsdb_rollup(se, ts, v[k]);
+        db->points++;
+    }
+    if(!s) rc = -1;
+    pthread_mutex_unlock(&db->m);
+    return rc;
+}
+
+/**
+ * Read the points of a series with t0 <= timestamp < t1, in append order.
+ * Blocks whose index range lies outside [t0, t1) are skipped.
+ *
+ * @param db store
+ * @param src source address
+ * @param col column (0..TSDB_COLUMNS-1)
+ * @param t0 first timestamp
+ * @param t1 end of the range (exclusive)
+ * @param ts output timestamps (NULL = only count)
+ * @param v output values (NULL = only count)
+ * @param max capacity of the outputs
+ * @return number of points written (at most `max`), -1 for an unknown source or column
+ */
+long long tsdb_read(tsdb_t *db, const char *src, int col, long long t0, long long t1, long long *ts, float *v, long long max){
+    if(col < 0 || col >= TSDB_COLUMNS) return -1;
+    pthread_mutex_lock(&db->m);
+    tsdb_source_t *s = tsdb_find(db, src);
+    if(!s){ pthread_mutex_unlock(&db->m); return -1; }
+    const tsdb_series_t *se = &s->col[col];
+    long long n = 0;
+    for(int i=0;i<se->n_refs && n<max;i++){
+        const tsdb_ref_t *r = &se->refs[i];
+        if(r->count == 0 || r->t_max < t0 || r->t_min >= t1) continue;
+        if(r->t_min >= t0 && r->t_max < t1 && (!ts || !v)){ /* counting a block that lies inside */
+            n += r->count;
+            continue;
+        }
+        const tsdb_block_hdr_t *h = tsdb_block(db, r->seg, r->block);
+        tsdb_codec_t c;
+        memset(&c, 0, sizeof(c));
+        long long t;
+        float x;
+        while(n < max && tsdb_decode(h, &c, &t, &x)){
+            if(t < t0 || t >= t1) continue;
+            if(ts && v){ ts[n] = t; v[n] = x; }
+            n++;
+        }
+    }
+    pthread_mutex_unlock(&db->m);
+    return n < max ? n : max;
+}
+
+/**
+ * List the sources of a store in the order they were first stored.
+ *
+ * @param db store
+ * @param out output names (may be NULL)
+ * @param max capacity of `out`
+ * @return total number of sources
+ */
+int tsdb_sources(tsdb_t *db, char (*out)[64], int max){
+    pthread_mutex_lock(&db->m);
+    int n = db->n_sources;
+    for(int i=0;out && i<n && i<max;i++) snprintf(out[i], 64, "%s", db->sources[i]->src);
+    pthread_mutex_unlock(&db->m);
+    return n;
+}
+
+/**
+ * Size of the stored history.
+ *
+ * @param db store
+ * @param points output: number of stored points (all series)
+ * @param bytes output: bytes taken by the allocated blocks
+ */
+void tsdb_usage(tsdb_t *db, long long *points, long long *bytes){
+    pthread_mutex_lock(&db->m);
+    if(points) *points = db->points;
+    if(bytes) *bytes = db->blocks * TSDB_BLOCK;
+    pthread_mutex_unlock(&db->m);
+}
+
+/**
+ * Aggregate the raw points of a series in [t0, t1).
+ */
+static void tsdb_raw_agg(const tsdb_t *db, const tsdb_series_t *se, long long t0, long long t1, tsdb_agg_t *out){
+    for(int i=0;i<se->n_refs;i++){
+        const tsdb_ref_t *r = &se->refs[i];
+        if(r->count == 0 || r->t_max < t0 || r->t_min >= t1) continue;
+        const tsdb_block_hdr_t *h = tsdb_block(db, r->seg, r->block);
+        tsdb_codec_t c;
+        memset(&c, 0, sizeof(c));
+        long long t;
+        float v;
+        while(tsdb_decode(h, &c, &t, &v))
+            if(t >= t0 && t < t1) agg_merge(out, 1, v, v, v, v, t);
+    }
+}
+
+/**
+ * Aggregate [t0, t1) from the coarsest tier up to `tier` whose whole buckets
+ * fit inside the range (and are still kept), and the edges left over from
+ * the finer tiers, down to the raw points.
+ */
+static void tsdb_agg_range(const tsdb_t *db, const tsdb_series_t *se, long long t0, long long t1, int tier, tsdb_agg_t *out){
+    if(t0 >= t1) return;
+    for(; tier >= 0; tier--){
+        long long w = tsdb_tier_ms[tier];
+        long long a = -floor_div(-t0, w) * w, b = floor_div(t1, w) * w;
+        const tsdb_ring_t *r = &se->tiers[tier];
+        if(a >= b || a < r->horizon) continue;
+        tsdb_agg_range(db, se, t0, a, tier - 1, out);
+        for(int i = ring_lower_bound(r, a); i < r->n && ring_at(r, i)->start < b; i++){
+            const tsdb_bucket_t *bk = ring_at(r, i);
+            agg_merge(out, bk->count, bk->sum, bk->min, bk->max, bk->last, bk->last_ts);
+        }
+        if(tier > out->tier) out->tier = tier;
+        tsdb_agg_range(db, se, b, t1, tier - 1, out);
+        return;
+    }
+    /* edges narrower than a bucket: only the buckets of the finest tier still
+       kept whose points straddle a range boundary need their raw points decoded */
+    int k = 0;
+    while(k < TSDB_TIERS && t0 < se->tiers[k].horizon) k++;
+    if(k == TSDB_TIERS){
+        tsdb_raw_agg(db, se, t0, t1, out);
+        return;
+    }
+    const tsdb_ring_t *r = &se->tiers[k];
+    long long w = tsdb_tier_ms[k];
+    for(int i = ring_lower_bound(r, floor_div(t0, w) * w); i < r->n && ring_at(r, i)->start < t1; i++){
+        const tsdb_bucket_t *bk = ring_at(r, i);
+        if(bk->last_ts < t0 || bk->first_ts >= t1) continue;
+        if(bk->first_ts >= t0 && bk->last_ts < t1) agg_merge(out, bk->count, bk->sum, bk->min, bk->max, bk->last, bk->last_ts);
+        else tsdb_raw_agg(db, se, t0 > bk->start ? t0 : bk->start, t1 < bk->start + w ? t1 : bk->start + w, out);
+    }
+}
+
+/**
+ * Aggregate the points of a series with t0 <= timestamp < t1.
+ *
+ * @param db store
+ * @param src source address
+ * @param col column (0..TSDB_COLUMNS-1)
+ * @param t0 first timestamp
+ * @param t1 end of the range (exclusive)
+ * @param max_tier coarsest tier to use (TSDB_TIERS - 1 normally, -1 = raw points only)
+ * @param out output aggregate
+ * @return 0 on success, -1 for an unknown source or column
+ */
+int tsdb_query(tsdb_t *db, const char *src, int col, long long t0, long long t1, int max_tier, tsdb_agg_t *out){
+    memset(out, 0, sizeof(*out));
+    out->min = out->max = out->last = NAN;
+    out->last_ts = LLONG_MIN;
+    out->tier = -1;
+    if(col < 0 || col >= TSDB_COLUMNS) return -1;
+    if(max_tier >= TSDB_TIERS) max_tier = TSDB_TIERS - 1;
+    pthread_mutex_lock(&db->m);
+    tsdb_source_t *s = tsdb_find(db, src);
+    if(s) tsdb_agg_range(db, &s->col[col], t0, t1, max_tier, out);
+    pthread_mutex_unlock(&db->m);
+    return s ? 0 : -1;
+}
+
+/**
+ * Newest timestamp of a series.
+ *
+ * @return timestamp, LLONG_MIN when the series is empty or unknown
+ */
+long long tsdb_last(tsdb_t *db, const char *src, int col){
+    long long t = LLONG_MIN;
+    if(col < 0 || col >= TSDB_COLUMNS) return t;
+    pthread_mutex_lock(&db->m);
+    tsdb_source_t *s = tsdb_find(db, src);
+    for(int i=0;s && i<s->col[col].n_refs;i++)
+        if(s->col[col].refs[i].count > 0 && s->col[col].refs[i].t_max > t) t = s->col[col].refs[i].t_max;
+    pthread_mutex_unlock(&db->m);
+    return t;
+}
+
+/**
+ * Look up a column by name ("bytes", ..., "pred_srt").
+ *
+ * @return column index, -1 when unknown
+ */
+int tsdb_column(const char *name){
+    for(int i=0;i<TSDB_COLUMNS;i++) if(strcmp(tsdb_column_names[i], name) == 0) return i;
+    return -1;
+}
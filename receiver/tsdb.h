@@ -0,0 +1,58 @@
+/**
+ * tsdb.h
+ *
+ * Declarations for the embedded time-series store of the received metrics
+ * and the model's predictions. Every source has TSDB_COLUMNS series stored
+ * Gorilla-compressed in fixed-size blocks of memory-mapped segment files.
+ * Timestamps are the pipeline's record timestamps in milliseconds.
+ */
+
+#ifndef RECEIVER_TSDB_H
+#define RECEIVER_TSDB_H
+
+#include "types.h"
+
+/** First column of the received metrics (N_METRICS columns, data_point_t order). */
+#define TSDB_COL_METRICS 0
+/** First column of the predictions made for the received metrics (N_METRICS columns). */
+#define TSDB_COL_PREDICTIONS N_METRICS
+/** Number of series per source. */
+#define TSDB_COLUMNS (2 * N_METRICS)
+
+/** Number of rollup tiers (1 min, 5 min, 1 h, 1 day). */
+#define TSDB_TIERS 4
+
+typedef struct tsdb_s tsdb_t;
+
+/**
+ * Aggregate of the points of a series in a time range.
+ *
+ * count, sum, min, max: over all points (min / max are NAN without points)
+ * last, last_ts: value and timestamp of the newest point
+ * tier: coarsest rollup tier the answer used (-1 = raw points only)
+ */
+typedef struct {
+    long long count;
+    double sum;
+    float min, max, last;
+    long long last_ts;
+    int tier;
+} tsdb_agg_t;
+
+extern const char *const tsdb_column_names[TSDB_COLUMNS];
+extern const long long tsdb_tier_ms[TSDB_TIERS];
+
+/* Store of the running analyzer, NULL without `--store-dir`. */
+extern tsdb_t *g_store;
+
+tsdb_t* tsdb_open(const char *dir, int writable);
+void tsdb_close(tsdb_t *db);
+int tsdb_append(tsdb_t *db, const char *src, int first_col, long long ts, const float *v, int n);
+long long tsdb_read(tsdb_t *db, const char *src, int col, long long t0, long long t1, long long *ts, float *v, long long max);
+int tsdb_sources(tsdb_t *db, char (*out)[64], int max);
+void tsdb_usage(tsdb_t *db, long long *points, long long *bytes);
+int tsdb_query(tsdb_t *db, const char *src, int col, long long t0, long long t1, int max_tier, tsdb_agg_t *out);
+long long tsdb_last(tsdb_t *db, const char *src, int col);
+int tsdb_column(const char *name);
+
+#endif
@@ -8,6 +8,13 @@
 #define RECEIVER_TYPES_H
 
 #include <math.h>
+#include <stddef.h>
+
+/** Number of metrics carried by a data point. */
+#define N_METRICS 6
+
+/** Upper bound on the width of a feature vector (see module1/feature_stage.h). */
+#define FEATURE_MAX 64
 
 /**
  * Data point structure representing a single measurement.
@@ -30,17 +37,28 @@ typedef struct {
   float export_srt;
 } data_point_t;
 
+/**
+ * Network input built from one or more data points of a stream.
+ *
+ * n: number of features in use
+ * v: feature values in the raw (not normalized) domain
+ */
+typedef struct {
+  size_t n;
+  double v[FEATURE_MAX];
+} feature_vec_t;
+
 /**
  * Received message structure representing a message received by the receiver.
  *
  * ts: timestamp in milliseconds
- * payload: raw message payload
+ * payload: raw message payload (points into the receive buffer, not copied)
  * src_addr: source IP address as string
  * src_port: source port number
  */
 typedef struct {
   long long ts;
-  char payload[8192]; 
+  const char *payload;
   char src_addr[64];
   int src_port;
 } recv_msg_t;
@@ -0,0 +1,500 @@
+/*
+ * wal.c
+ *
+ * Write-ahead log of ingested records. wal_append() only copies the record
+ * into a memory buffer under a mutex; a writer thread swaps the buffer every
+ * `--wal-sync-ms` and commits the whole group with one write() and one
+ * fdatasync(), so the cost of durability is shared by all records of the
+ * interval instead of paid per datagram. A crash loses at most the records of
+ * the last interval.
+ *
+ * The log is a sequence of numbered segments `wal-<seq>.log` in `--wal-dir`.
+ * A segment starts with magic, version (uint32) and the sequence number of
+ * its first record (uint64); records are payload length, CRC-32 of sequence
+ * number and payload (uint32), sequence number (uint64) and the payload
+ * "<source>\0<preprocessed line>". A new segment is started once the active
+ * one exceeds `--wal-segment-mb`. Integers are stored in host byte order;
+ * the log is meant to be replayed on the machine that wrote it.
+ *
+ * `wal.ckpt` holds the sequence number of the last record the saved pipeline
+ * state covers and the oldest segment still needed. wal_checkpoint() writes
+ * it first and only then deletes the covered segments, so a crash in between
+ * leaves extra segments, never a gap. Replay stops at the first torn or
+ * corrupted record of a segment.
+ */
+
+#ifndef WAL_C_HEADER
+#define WAL_C_HEADER
+#include "wal.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <io.h>
+#define WAL_OPEN_FLAGS (_O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY)
+#else
+#include <unistd.h>
+#define WAL_OPEN_FLAGS (O_WRONLY | O_CREAT | O_TRUNC)
+#endif
+
+#include "platform.h"
+#include "log.h"
+#include "memstat.h"
+
+#define WAL_SEG_MAGIC 0x4c415752u  /* "RWAL" */
+#define WAL_CKPT_MAGIC 0x4b434157u /* "WACK" */
+#define WAL_VERSION 1u
+#define WAL_SEG_HDR 16
+#define WAL_REC_HDR 16
+#define WAL_REC_MAX (1u << 20)
+
+/**
+ * Segment of the log.
+ *
+ * seq: number in the file name
+ * first_lsn: sequence number of the segment's first record
+ */
+typedef struct {
+    unsigned seq;
+    unsigned long long first_lsn;
+} wal_seg_t;
+
+/**
+ * Write-ahead log.
+ *
+ * dir: directory of the segments and the checkpoint file
+ * sync_ms: group commit interval
+ * segment_bytes: size after which a new segment is started
+ * fd, seg_size: active segment (-1 = none yet) and its size
+ * segs, n_segs, cap_segs: segments on disk, oldest first (the active one last)
+ * next_seq: number of the next segment
+ * ckpt_lsn: sequence number covered by the last written checkpoint
+ * The writer thread owns the fields above after wal_replay(). Protected by m:
+ * buf, len, cap: records appended since the last commit
+ * buf_first_lsn, buf_records: sequence number of the first of them and their count
+ * next_lsn: sequence number of the next appended record
+ * want_ckpt: newest checkpoint requested by wal_checkpoint()
+ * stop: set by wal_close()
+ */
+struct wal_s {
+    char dir[256];
+    int sync_ms;
+    size_t segment_bytes;
+    int fd;
+    size_t seg_size;
+    wal_seg_t *segs;
+    int n_segs, cap_segs;
+    unsigned next_seq;
+    unsigned long long ckpt_lsn;
+    pthread_mutex_t m;
+    pthread_cond_t c;
+    char *buf;
+    size_t len, cap;
+    unsigned long long buf_first_lsn;
+    long long buf_records;
+    unsigned long long next_lsn;
+    unsigned long long want_ckpt;
+    int stop;
+    pthread_t thread;
+    int thread_started;
+};
+
+static uint32_t crc_table[256];
+
+/** Fill the CRC-32 (IEEE, reflected) table. */
+static void wal_crc_init(void){
+    for(uint32_t i=0;i<256;i++){
+        uint32_t c = i;
+        for(int k=0;k<8;k++) c = (c & 1u) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+/**
+ * Continue a CRC-32 over `len` bytes.
+ *
+ * @param crc CRC of the preceding bytes (0 to start)
+ */
+static uint32_t wal_crc(uint32_t crc, const void *data, size_t len){
+    const unsigned char *p = (const unsigned char*)data;
+    crc = ~crc;
+    for(size_t i=0;i<len;i++) crc = crc_table[(crc ^ p[i]) & 0xffu] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void wal_seg_path(const wal_t *w, unsigned seq, char *out, size_t out_len){
+    snprintf(out, out_len, "%s/wal-%08u.log", w->dir, seq);
+}
+
+/**
+ * Write all bytes to a file descriptor.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int wal_write_all(int fd, const char *p, size_t n){
+    while(n > 0){
+        int chunk = n > (1u << 30) ? (1 << 30) : (int)n;
+        int k = (int)write(fd, p, chunk);
+        if(k <= 0) return -1;
+        p += k;
+        n -= (size_t)k;
+    }
+    return 0;
+}
+
+/**
+ * Persist the checkpoint: last covered sequence number and oldest needed segment.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int wal_write_ckpt(wal_t *w, unsigned long long lsn, unsigned first_seq){
+    char path[320], tmp[328];
+    snprintf(path, sizeof(path), "%s/wal.ckpt", w->dir);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if(!f) return -1;
+    uint32_t hdr[3] = { WAL_CKPT_MAGIC, WAL_VERSION, first_seq };
+    uint64_t l = lsn;
+    int ok = fwrite(hdr, sizeof(hdr), 1, f) == 1 && fwrite(&l, sizeof(l), 1, f) == 1 && fflush(f) == 0
+          && platform_fsync_data(fileno(f)) == 0;
+    if(fclose(f) != 0) ok = 0;
+#ifdef _WIN32
+    if(ok) remove(path);
+#endif
+    if(!ok || rename(tmp, path) != 0){ remove(tmp); return -1; }
+    return 0;
+}
+
+/**
+ * Start a new active segment.
+ *
+ * @param first_lsn sequence number of its first record
+ * @return 0 on success, -1 on error
+ */
+static int wal_open_segment(wal_t *w, unsigned long long first_lsn){
+    if(w->n_segs == w->cap_segs){
+        int cap = w->cap_segs ? w->cap_segs * 2 : 16;
+        wal_seg_t *s = (wal_seg_t*)mem_realloc(MEM_IO, w->segs, sizeof(wal_seg_t) * (size_t)cap);
+        if(!s) return -1;
+        w->segs = s;
+        w->cap_segs = cap;
+    }
+    char path[320];
+    wal_seg_path(w, w->next_seq, path, sizeof(path));
+    int fd = open(path, WAL_OPEN_FLAGS, 0644);
+    if(fd < 0) return -1;
+    uint32_t hdr[2] = { WAL_SEG_MAGIC, WAL_VERSION };
+    uint64_t l = first_lsn;
+    char head[WAL_SEG_HDR];
+    memcpy(head, hdr, sizeof(hdr));
+    memcpy(head + sizeof(hdr), &l, sizeof(l));
+    if(wal_write_all(fd, head, sizeof(head)) != 0){ close(fd); remove(path); return -1; }
+    w->segs[w->n_segs].seq = w->next_seq;
+    w->segs[w->n_segs].first_lsn = first_lsn;
+    w->n_segs++;
+    w->next_seq++;
+    w->fd = fd;
+    w->seg_size = WAL_SEG_HDR;
+    return 0;
+}
+
+/**
+ * Commit one group of records: rotate if needed, write and fdatasync.
+ *
+ * @param data records
+ * @param n bytes
+ * @param first_lsn sequence number of the first record
+ * @param records number of records
+ */
+static void wal_commit(wal_t *w, const char *data, size_t n, unsigned long long first_lsn, long long records){
+    if(w->fd >= 0 && w->seg_size >= w->segment_bytes){
+        close(w->fd);
+        w->fd = -1;
+    }
+    if(w->fd < 0 && wal_open_segment(w, first_lsn) != 0){
+        LOG_ERROR("[wal] cannot open a segment in %s, %lld records not logged\n", w->dir, records);
+        return;
+    }
+    long long t0 = platform_monotonic_ns();
+    if(wal_write_all(w->fd, data, n) != 0 || platform_fsync_data(w->fd) != 0){
+        LOG_ERROR("[wal] write to %s failed, %lld records not logged\n", w->dir, records);
+        return;
+    }
+    w->seg_size += n;
+    stats_record_wal(records, (long long)n, 1, platform_monotonic_ns() - t0, 0);
+}
+
+/**
+ * Record a checkpoint and delete the segments it covers. The active segment
+ * is only deleted when `closing` and everything in it is covered.
+ *
+ * @param lsn last sequence number covered by the saved state
+ * @param last_lsn last sequence number appended so far
+ * @param closing non-zero from wal_close()
+ */
+static void wal_apply_checkpoint(wal_t *w, unsigned long long lsn, unsigned long long last_lsn, int closing){
+    int drop = 0;
+    while(drop < w->n_segs - 1 && w->segs[drop + 1].first_lsn <= lsn + 1) drop++;
+    int drop_active = closing && w->n_segs > 0 && drop == w->n_segs - 1 && lsn >= last_lsn;
+    if(drop_active) drop++;
+    unsigned first_seq = drop < w->n_segs ? w->segs[drop].seq : w->next_seq;
+    if(wal_write_ckpt(w, lsn, first_seq) != 0){
+        LOG_ERROR("[wal] cannot write the checkpoint in %s\n", w->dir);
+        return;
+    }
+    w->ckpt_lsn = lsn;
+    if(drop_active && w->fd >= 0){ close(w->fd); w->fd = -1; }
+    for(int i=0;i<drop;i++){
+        char path[320];
+        wal_seg_path(w, w->segs[i].seq, path, sizeof(path));
+        remove(path);
+    }
+    memmove(w->segs, w->segs + drop, sizeof(wal_seg_t) * (size_t)(w->n_segs - drop));
+    w->n_segs -= drop;
+}
+
+/**
+ * Writer thread: commit the appended records every sync interval and apply
+ * requested checkpoints.
+ *
+ * @param arg wal_t
+ * @return NULL
+ */
+static void* wal_thread(void *arg){
+    wal_t *w = (wal_t*)arg;
+    char *out = NULL;
+    size_t out_cap = 0;
+    pthread_mutex_lock(&w->m);
+    while(1){
+        if(!w->stop){
+            struct timespec dl;
+            clock_gettime(CLOCK_REALTIME, &dl);
+            long long ns = dl.tv_nsec + (long long)w->sync_ms * 1000000LL;
+            dl.tv_sec += (time_t)(ns / 1000000000LL);
+            dl.tv_nsec = (long)(ns % 1000000000LL);
+            pthread_cond_timedwait(&w->c, &w->m, &dl);
+        }
+        int stop = w->stop;
+        /* swap buffers so appends go on while the group is written */
+        char *grp = w->buf;
+        size_t grp_cap = w->cap, n = w->len;
+        unsigned long long first = w->buf_first_lsn, last = w->next_lsn - 1, ckpt = w->want_ckpt;
+        long long records = w->buf_records;
+        w->buf = out;
+        w->cap = out_cap;
+        w->len = 0;
+        w->buf_records = 0;
+        out = grp;
+        out_cap = grp_cap;
+        pthread_mutex_unlock(&w->m);
+        if(n > 0) wal_commit(w, out, n, first, records);
+        if(ckpt > w->ckpt_lsn || (stop && ckpt >= last)) wal_apply_checkpoint(w, ckpt, last, stop);
+        pthread_mutex_lock(&w->m);
+        if(stop) break;
+    }
+    pthread_mutex_unlock(&w->m);
+    mem_free(out);
+    return NULL;
+}
+
+/**
+ * Open the log: read the checkpoint, find the segments after it and start
+ * the writer thread. Call wal_replay() before the first wal_append().
+ *
+ * @param dir directory of the log (created if missing)
+ * @param sync_ms group commit interval in milliseconds
+ * @param segment_bytes size after which a new segment is started
+ * @return log or NULL on error
+ */
+wal_t* wal_open(const char *dir, int sync_ms, size_t segment_bytes){
+    if(!dir || !dir[0] || sync_ms < 1 || segment_bytes < 4096) return NULL;
+    if(platform_mkdir_p(dir) != 0){ LOG_ERROR("[wal] cannot create %s\n", dir); return NULL; }
+    wal_t *w = (wal_t*)mem_calloc(MEM_IO, 1, sizeof(wal_t));
+    if(!w) return NULL;
+    wal_crc_init();
+    snprintf(w->dir, sizeof(w->dir), "%s", dir);
+    w->sync_ms = sync_ms;
+    w->segment_bytes = segment_bytes;
+    w->fd = -1;
+    w->next_seq = 1;
+    pthread_mutex_init(&w->m, NULL);
+    pthread_cond_init(&w->c, NULL);
+
+    char path[320];
+    snprintf(path, sizeof(path), "%s/wal.ckpt", w->dir);
+    FILE *f = fopen(path, "rb");
+    if(f){
+        uint32_t hdr[3];
+        uint64_t l;
+        if(fread(hdr, sizeof(hdr), 1, f) == 1 && fread(&l, sizeof(l), 1, f) == 1 && hdr[0] == WAL_CKPT_MAGIC && hdr[1] == WAL_VERSION){
+            w->ckpt_lsn = l;
+            w->next_seq = hdr[2];
+        } else {
+            LOG_ERROR("[wal] ignoring damaged checkpoint %s\n", path);
+        }
+        fclose(f);
+    }
+    /* segments left behind by a crash between checkpoint and deletion */
+    for(unsigned seq = w->next_seq - 1; seq > 0; seq--){
+        wal_seg_path(w, seq, path, sizeof(path));
+        if(remove(path) != 0) break;
+    }
+    for(;; w->next_seq++){
+        wal_seg_path(w, w->next_seq, path, sizeof(path));
+        f = fopen(path, "rb");
+        if(!f) break;
+        uint32_t hdr[2];
+        uint64_t l;
+        int ok = fread(hdr, sizeof(hdr), 1, f) == 1 && fread(&l, sizeof(l), 1, f) == 1 && hdr[0] == WAL_SEG_MAGIC && hdr[1] == WAL_VERSION;
+        fclose(f);
+        if(!ok){ LOG_ERROR("[wal] stopping at damaged segment %s\n", path); w->next_seq++; break; }
+        if(w->n_segs == w->cap_segs){
+            int cap = w->cap_segs ? w->cap_segs * 2 : 16;
+            wal_seg_t *s = (wal_seg_t*)mem_realloc(MEM_IO, w->segs, sizeof(wal_seg_t) * (size_t)cap);
+            if(!s){ wal_close(w); return NULL; }
+            w->segs = s;
+            w->cap_segs = cap;
+        }
+        w->segs[w->n_segs].seq = w->next_seq;
+        w->segs[w->n_segs].first_lsn = l;
+        w->n_segs++;
+    }
+    w->next_lsn = w->ckpt_lsn + 1;
+    return w;
+}
+
+/**
+ * Replay the records after the last checkpoint in order and start the
+ * writer thread. New records continue the sequence in a new segment.
+ *
+ * @param w log
+ * @param fn called for every record after the checkpoint (NULL = only find the end of the log)
+ * @param ctx passed to `fn`
+ * @return number of records replayed, or -1 when the writer could not be started
+ */
+long long wal_replay(wal_t *w, wal_replay_fn fn, void *ctx){
+    long long replayed = 0;
+    unsigned long long max_lsn = w->ckpt_lsn;
+    char *payload = (char*)mem_alloc(MEM_IO, WAL_REC_MAX + 1);
+    for(int i=0;i<w->n_segs && payload;i++){
+        char path[320];
+        wal_seg_path(w, w->segs[i].seq, path, sizeof(path));
+        FILE *f = fopen(path, "rb");
+        if(!f) continue;
+        fseek(f, WAL_SEG_HDR, SEEK_SET);
+        while(1){
+            uint32_t rh[2];
+            uint64_t lsn;
+            if(fread(rh, sizeof(rh), 1, f) != 1 || fread(&lsn, sizeof(lsn), 1, f) != 1) break;
+            if(rh[0] > WAL_REC_MAX || fread(payload, 1, rh[0], f) != rh[0]) break;
+            if(wal_crc(wal_crc(0, &lsn, sizeof(lsn)), payload, rh[0]) != rh[1]){
+                LOG_ERROR("[wal] torn record after sequence number %llu in %s\n", max_lsn, path);
+                break;
+            }
+            if(lsn > max_lsn) max_lsn = lsn;
+            if(lsn <= w->ckpt_lsn) continue;
+            payload[rh[0]] = '\0';
+            size_t src_len = strnlen(payload, rh[0]);
+            if(src_len >= rh[0]) continue;
+            if(fn) fn(payload, payload + src_len + 1, lsn, ctx);
+            replayed++;
+        }
+        fclose(f);
+    }
+    mem_free(payload);
+    w->next_lsn = max_lsn + 1;
+    w->want_ckpt = w->ckpt_lsn;
+    if(pthread_create(&w->thread, NULL, wal_thread, w) != 0) return -1;
+    w->thread_started = 1;
+    if(replayed > 0) stats_record_wal(0, 0, 0, 0, replayed);
+    LOG_INFO("[wal] %s: checkpoint at record %llu, %lld records replayed, %d segments\n", w->dir, w->ckpt_lsn, replayed, w->n_segs);
+    return replayed;
+}
+
+/**
+ * Append a record. It is written and synced by the next group commit.
+ *
+ * @param w log
+ * @param src source address of the record
+ * @param line preprocessed record
+ * @return sequence number of the record, 0 when it is too large to log
+ */
+unsigned long long wal_append(wal_t *w, const char *src, const char *line){
+    size_t src_len = strlen(src), line_len = strlen(line);
+    size_t len = src_len + 1 + line_len;
+    if(len > WAL_REC_MAX) return 0;
+    pthread_mutex_lock(&w->m);
+    if(w->len + WAL_REC_HDR + len > w->cap){
+        size_t cap = w->cap ? w->cap : 65536;
+        while(cap < w->len + WAL_REC_HDR + len) cap *= 2;
+        char *b = (char*)mem_realloc(MEM_IO, w->buf, cap);
+        if(!b){ pthread_mutex_unlock(&w->m); return 0; }
+        w->buf = b;
+        w->cap = cap;
+    }
+    uint64_t lsn = w->next_lsn++;
+    if(w->buf_records == 0) w->buf_first_lsn = lsn;
+    char *p = w->buf + w->len;
+    uint32_t rh[2] = { (uint32_t)len, 0 };
+    memcpy(p + WAL_REC_HDR - sizeof(lsn), &lsn, sizeof(lsn));
+    memcpy(p + WAL_REC_HDR, src, src_len + 1);
+    memcpy(p + WAL_REC_HDR + src_len + 1, line, line_len);
+    rh[1] = wal_crc(wal_crc(0, &lsn, sizeof(lsn)), p + WAL_REC_HDR, len);
+    memcpy(p, rh, sizeof(rh));
+    w->len += WAL_REC_HDR + len;
+    w->buf_records++;
+    pthread_mutex_unlock(&w->m);
+    return lsn;
+}
+
+/**
+ * Sequence number of the last appended (or replayed) record.
+ */
+unsigned long long wal_last_lsn(wal_t *w){
+    pthread_mutex_lock(&w->m);
+    unsigned long long lsn = w->next_lsn - 1;
+    pthread_mutex_unlock(&w->m);
+    return lsn;
+}
+
+/**
+ * Report that the saved pipeline state covers every record up to `lsn`.
+ * The writer records the checkpoint and deletes the covered segments at its
+ * next commit.
+ *
+ * @param w log
+ * @param lsn last record reflected in the saved state
+ */
+void wal_checkpoint(wal_t *w, unsigned long long lsn){
+    pthread_mutex_lock(&w->m);
+    if(lsn > w->want_ckpt) w->want_ckpt = lsn;
+    pthread_mutex_unlock(&w->m);
+}
+
+/**
+ * Commit the remaining records, apply the last checkpoint and close the log.
+ *
+ * @param w log (may be NULL)
+ */
+void wal_close(wal_t *w){
+    if(!w) return;
+    if(w->thread_started){
+        pthread_mutex_lock(&w->m);
+        w->stop = 1;
+        pthread_cond_signal(&w->c);
+        pthread_mutex_unlock(&w->m);
+        pthread_join(w->thread, NULL);
+    }
+    if(w->fd >= 0) close(w->fd);
+    pthread_cond_destroy(&w->c);
+    pthread_mutex_destroy(&w->m);
+    mem_free(w->buf);
+    mem_free(w->segs);
+    mem_free(w);
+}
@@ -0,0 +1,30 @@
+/**
+ * wal.h
+ *
+ * Declarations for the write-ahead log of ingested records. The preprocessing
+ * stage appends every parsed record; a writer thread commits the appended
+ * records in groups (one write and one fdatasync per `--wal-sync-ms`), and a
+ * checkpoint of the pipeline state truncates the segments it covers. On
+ * start the records after the last checkpoint are replayed into the model.
+ */
+
+#ifndef RECEIVER_WAL_H
+#define RECEIVER_WAL_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+typedef struct wal_s wal_t;
+
+/* Called for every replayed record with its source, preprocessed line and sequence number. */
+typedef void (*wal_replay_fn)(const char *src, const char *line, unsigned long long lsn, void *ctx);
+
+wal_t* wal_open(const char *dir, int sync_ms, size_t segment_bytes);
+long long wal_replay(wal_t *w, wal_replay_fn fn, void *ctx);
+unsigned long long wal_append(wal_t *w, const char *src, const char *line);
+unsigned long long wal_last_lsn(wal_t *w);
+void wal_checkpoint(wal_t *w, unsigned long long lsn);
+void wal_close(wal_t *w);
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ * backfill.c
+ *
+ * Rescores a history of the `data/` exports with one model: every sample's
+ * next-sample prediction is computed with the batch inference path
+ * (nn_predict_batch(), nn_backfill()) and compared with the per-sample path
+ * (nn_predict_and_maybe_train() without a target). Reports throughput in
+ * samples/s and in bytes of history read per second, the largest difference
+ * between the two paths and the mean squared error (normalized domain) of
+ * the predictions against the next sample. `--repeat` tiles the series to
+ * emulate a longer history; `--out` writes the predictions as CSV.
+ *
+ * usage: backfill [--data DIR] [--weights FILE] [--threads N] [--limit N] [--repeat N] [--out FILE]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../receiver/platform.h"
+#include "../receiver/types.h"
+#include "../receiver/module2/nn.h"
+#include "../receiver/module2/nn_params.h"
+#include "../receiver/module2/util.h"
+#include "../receiver/module2/backfill.h"
+#include "replay.h"
+
+/**
+ * Print one throughput line.
+ */
+static void report(const char *name, size_t n, long long ns){
+    double s = (double)ns / 1e9;
+    double gbs = (double)(n * sizeof(data_point_t)) / s / 1e9;
+    printf("%-16s %8.3f s   %11.0f samples/s   %6.3f GB/s history\n", name, s, (double)n / s, gbs);
+}
+
+/**
+ * Largest absolute difference between two prediction arrays relative to the output scales.
+ */
+static double max_diff(const float *a, const float *b, size_t n, const nn_params_t *p){
+    double m = 0.0;
+    for(size_t i=0;i<n;i++)
+        for(int k=0;k<OUTPUT_SIZE;k++){
+            double d = fabs((double)a[i * OUTPUT_SIZE + k] - (double)b[i * OUTPUT_SIZE + k]) / p->scales[k];
+            if(d > m) m = d;
+        }
+    return m;
+}
+
+int main(int argc, char **argv){
+    const char *dir = "data", *weights = NULL, *out_path = NULL;
+    int threads = 4, limit = 0, repeat = 1;
+    for(int i=1;i+1<argc;i+=2){
+        if(strcmp(argv[i], "--data") == 0) dir = argv[i+1];
+        else if(strcmp(argv[i], "--weights") == 0) weights = argv[i+1];
+        else if(strcmp(argv[i], "--threads") == 0) threads = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--limit") == 0) limit = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--repeat") == 0) repeat = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--out") == 0) out_path = argv[i+1];
+        else { fprintf(stderr, "usage: %s [--data DIR] [--weights FILE] [--threads N] [--limit N] [--repeat N] [--out FILE]\n", argv[0]); return 1; }
+    }
+    if(threads < 1 || threads > BACKFILL_MAX_THREADS || repeat < 1){ fprintf(stderr, "invalid --threads or --repeat\n"); return 1; }
+
+    data_point_t *series = NULL;
+    float *series_vals = NULL;
+    int n0 = replay_load(dir, limit, &series, &series_vals);
+    if(n0 < 0) return 1;
+    if(n0 < 2){ fprintf(stderr, "not enough samples\n"); return 1; }
+    size_t n = (size_t)n0 * (size_t)repeat;
+    data_point_t *dps = (data_point_t*)malloc(sizeof(data_point_t) * n);
+    feature_vec_t *xs = (feature_vec_t*)malloc(sizeof(feature_vec_t) * n);
+    float *ref = (float*)malloc(sizeof(float) * OUTPUT_SIZE * n);
+    float *batch = (float*)malloc(sizeof(float) * OUTPUT_SIZE * n);
+    float *par = (float*)malloc(sizeof(float) * OUTPUT_SIZE * n);
+    if(!dps || !xs || !ref || !batch || !par){ fprintf(stderr, "out of memory\n"); return 1; }
+    for(int r=0;r<repeat;r++) memcpy(dps + (size_t)r * n0, series, sizeof(data_point_t) * (size_t)n0);
+    for(size_t i=0;i<n;i++) features_from_datapoint(&dps[i], &xs[i]);
+
+    nn_params_t p = default_nn_params();
+    p.weights_path = NULL;
+    nn_t *nn = nn_create(&p);
+    if(!nn){ fprintf(stderr, "cannot create model\n"); return 1; }
+    if(weights && nn_load_weights(nn, weights) != 0){ fprintf(stderr, "cannot load %s\n", weights); return 1; }
+    printf("%zu samples (%d x %d), %zu parameters, %s weights\n\n", n, n0, repeat, nn_param_count(nn), weights ? weights : "random");
+
+    long long t0 = platform_monotonic_ns();
+    for(size_t i=0;i<n;i++) nn_predict_and_maybe_train(nn, &xs[i], NULL, ref + i * OUTPUT_SIZE);
+    report("per-sample", n, platform_monotonic_ns() - t0);
+
+    t0 = platform_monotonic_ns();
+    if(nn_predict_batch(nn, xs, n, batch) != 0){ fprintf(stderr, "batch inference failed\n"); return 1; }
+    report("batch", n, platform_monotonic_ns() - t0);
+
+    char label[32];
+    snprintf(label, sizeof(label), "backfill x%d", threads);
+    t0 = platform_monotonic_ns();
+    if(nn_backfill(nn, dps, n, par, threads) != 0){ fprintf(stderr, "backfill failed\n"); return 1; }
+    report(label, n, platform_monotonic_ns() - t0);
+
+    double sum = 0.0;
+    for(size_t i=0;i+1<n;i++)
+        for(int k=0;k<OUTPUT_SIZE;k++){
+            double d = ((double)par[i * OUTPUT_SIZE + k] - (double)series_vals[((i + 1) % (size_t)n0) * OUTPUT_SIZE + k]) / p.scales[k];
+            sum += d * d;
+        }
+    printf("\nmax |batch - per-sample|    %.3e\n", max_diff(batch, ref, n, &p));
+    printf("max |backfill - per-sample| %.3e\n", max_diff(par, ref, n, &p));
+    printf("next-sample mse             %.6e\n", sum / (double)((n - 1) * OUTPUT_SIZE));
+
+    if(out_path){
+        FILE *f = fopen(out_path, "w");
+        if(!f){ fprintf(stderr, "cannot write %s\n", out_path); return 1; }
+        fprintf(f, "timestamp,bytes,flows,packets,rtr,rtt,srt\n");
+        for(size_t i=0;i<n;i++){
+            const float *o = par + i * OUTPUT_SIZE;
+            fprintf(f, "%.0f,%g,%g,%g,%g,%g,%g\n", dps[i].timestamp, o[0], o[1], o[2], o[3], o[4], o[5]);
+        }
+        fclose(f);
+    }
+
+    nn_free(nn);
+    free(par);
+    free(batch);
+    free(ref);
+    free(xs);
+    free(dps);
+    free(series_vals);
+    free(series);
+    return 0;
+}
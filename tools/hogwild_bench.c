@@ -0,0 +1,120 @@
+/*
+ * hogwild_bench.c
+ *
+ * Benchmark of the parallel trainers against the single-thread training path
+ * on a replay of the `data/` exports. Every run starts from the same initial
+ * weights, trains for a number of epochs on the first 80 % of the series
+ * (predict sample t+1 from sample t) and reports training throughput and the
+ * mean squared error (normalized domain) on the remaining 20 % after each
+ * epoch.
+ *
+ * usage: hogwild_bench [--data DIR] [--epochs N] [--threads N] [--limit N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../receiver/platform.h"
+#include "../receiver/types.h"
+#include "../receiver/module2/nn.h"
+#include "../receiver/module2/nn_params.h"
+#include "../receiver/module2/util.h"
+#include "../receiver/module2/hogwild.h"
+#include "replay.h"
+
+/**
+ * Mean squared error of the next-sample prediction on [from, to).
+ */
+static double evaluate(nn_t *nn, const feature_vec_t *xs, const float *vals, int from, int to, const nn_params_t *p){
+    double sum = 0.0;
+    int n = 0;
+    for(int i=from;i+1<to;i++){
+        float out[OUTPUT_SIZE];
+        nn_predict_and_maybe_train(nn, &xs[i], NULL, out);
+        const float *t = &vals[(size_t)(i+1) * OUTPUT_SIZE];
+        for(int k=0;k<OUTPUT_SIZE;k++){
+            double d = ((double)out[k] - (double)t[k]) / p->scales[k];
+            sum += d * d;
+        }
+        n++;
+    }
+    return n ? sum / (double)(n * OUTPUT_SIZE) : NAN;
+}
+
+/**
+ * Train a copy of the initial weights and print one line per epoch.
+ *
+ * @param name label of the run
+ * @param threads 0 = single-thread path, otherwise trainer threads
+ * @param mode trainer synchronization (threads > 0)
+ */
+static void run(const char *name, int threads, hogwild_mode_t mode, const double *init, const nn_params_t *p,
+                const feature_vec_t *xs, const float *vals, int n_train, int n_total, int epochs){
+    nn_t *nn = nn_create(p);
+    nn_import_params(nn, init);
+    hogwild_t *hw = threads > 0 ? hogwild_create(nn, threads, mode, n_train) : NULL;
+    if(threads > 0 && !hw){ fprintf(stderr, "%s: cannot create trainer\n", name); nn_free(nn); return; }
+    double total_s = 0.0;
+    for(int e=1;e<=epochs;e++){
+        long long t0 = platform_monotonic_ns();
+        for(int i=0;i+1<n_train;i++){
+            const float *target = &vals[(size_t)(i+1) * OUTPUT_SIZE];
+            if(hw) hogwild_submit(hw, &xs[i], target);
+            else nn_train_sample(nn, &xs[i], target, NULL);
+        }
+        if(hw) hogwild_wait_idle(hw);
+        double s = (double)(platform_monotonic_ns() - t0) / 1e9;
+        total_s += s;
+        double mse = evaluate(nn, xs, vals, n_train, n_total, p);
+        printf("%-14s epoch %2d   %9.0f samples/s   test mse %.6e\n", name, e, (double)(n_train - 1) / s, mse);
+    }
+    printf("%-14s total %.2f s\n\n", name, total_s);
+    hogwild_free(hw);
+    nn_free(nn);
+}
+
+int main(int argc, char **argv){
+    const char *dir = "data";
+    int epochs = 3, threads = 4, limit = 0;
+    for(int i=1;i+1<argc;i+=2){
+        if(strcmp(argv[i], "--data") == 0) dir = argv[i+1];
+        else if(strcmp(argv[i], "--epochs") == 0) epochs = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--threads") == 0) threads = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--limit") == 0) limit = atoi(argv[i+1]);
+        else { fprintf(stderr, "usage: %s [--data DIR] [--epochs N] [--threads N] [--limit N]\n", argv[0]); return 1; }
+    }
+
+    data_point_t *dps = NULL;
+    float *vals = NULL;
+    int n = replay_load(dir, limit, &dps, &vals);
+    if(n < 0) return 1;
+    if(n < 10){ fprintf(stderr, "not enough samples\n"); return 1; }
+    int n_train = n * 8 / 10;
+    feature_vec_t *xs = (feature_vec_t*)malloc(sizeof(feature_vec_t) * (size_t)n);
+    if(!xs){ fprintf(stderr, "out of memory\n"); return 1; }
+    for(int i=0;i<n;i++) features_from_datapoint(&dps[i], &xs[i]);
+
+    nn_params_t p = default_nn_params();
+    p.weights_path = NULL;
+    nn_t *ref = nn_create(&p);
+    size_t n_params = nn_param_count(ref);
+    double *init = (double*)malloc(sizeof(double) * n_params);
+    nn_export_params(ref, init);
+    nn_free(ref);
+
+    printf("%d samples (%d train / %d test), %zu parameters, %d epochs\n\n", n, n_train, n - n_train, n_params, epochs);
+    char label[32];
+    run("single", 0, HOGWILD_LOCKFREE, init, &p, xs, vals, n_train, n, epochs);
+    snprintf(label, sizeof(label), "hogwild x%d", threads);
+    run(label, threads, HOGWILD_LOCKFREE, init, &p, xs, vals, n_train, n, epochs);
+    snprintf(label, sizeof(label), "striped x%d", threads);
+    run(label, threads, HOGWILD_STRIPED, init, &p, xs, vals, n_train, n, epochs);
+
+    free(init);
+    free(xs);
+    free(vals);
+    free(dps);
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * metrics_scrape.c
+ *
+ * Stand-in for a Prometheus scraper of the analyzer's metrics endpoint
+ * (`--metrics-port` / `--metrics-socket`, see receiver/metrics.c). Fetches
+ * GET /metrics over TCP or a Unix domain socket and checks the answer
+ * against the text exposition format: every sample line is
+ * `name{label="value",...} number`, every family is declared by a TYPE line
+ * before its samples, and histogram buckets are cumulative and end with
+ * `le="+Inf"` equal to `_count`. Prints the text, or with `--summary 1` the
+ * number of families and samples and the time the scrape took. `--require
+ * NAME` fails unless the family NAME has at least one sample.
+ *
+ * usage: metrics_scrape [--addr IP] [--port N | --socket PATH] [--path /metrics] [--summary 0|1] [--require NAME]
+ *
+ * Exits 0 when the answer is well-formed, 1 otherwise, 2 when the endpoint
+ * cannot be reached.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#ifndef _WIN32
+#include <sys/un.h>
+#endif
+
+#include "../receiver/platform.h"
+
+#define SCRAPE_MAX_FAMILIES 256
+
+/**
+ * Family declared by a TYPE line.
+ */
+typedef struct {
+    char name[128];
+    char type[16];
+    long long samples;
+} family_t;
+
+static family_t families[SCRAPE_MAX_FAMILIES];
+static int n_families;
+
+/**
+ * Connect to the endpoint.
+ *
+ * @return connected socket or INVALID_SOCKET
+ */
+static socket_t scrape_connect(const char *addr, int port, const char *sock_path){
+#ifndef _WIN32
+    if(sock_path){
+        struct sockaddr_un un;
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        if(strlen(sock_path) >= sizeof(un.sun_path)) return INVALID_SOCKET;
+        strcpy(un.sun_path, sock_path);
+        socket_t s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(s != INVALID_SOCKET && connect(s, (struct sockaddr*)&un, sizeof(un)) < 0){ CLOSESOCKET(s); s = INVALID_SOCKET; }
+        return s;
+    }
+#else
+    if(sock_path) return INVALID_SOCKET;
+#endif
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons((unsigned short)port);
+    if(inet_pton(AF_INET, addr, &to.sin_addr) != 1) return INVALID_SOCKET;
+    socket_t s = socket(AF_INET, SOCK_STREAM, 0);
+    if(s != INVALID_SOCKET && connect(s, (struct sockaddr*)&to, sizeof(to)) < 0){ CLOSESOCKET(s); s = INVALID_SOCKET; }
+    return s;
+}
+
+/**
+ * Find the family a sample belongs to: the sample name itself, or for
+ * histograms and summaries the name without its _bucket/_sum/_count suffix.
+ */
+static family_t* find_family(const char *name, size_t len){
+    for(int i=0;i<n_families;i++){
+        size_t fl = strlen(families[i].name);
+        if(strncmp(families[i].name, name, fl) != 0) continue;
+        if(fl == len) return &families[i];
+        const char *rest = name + fl;
+        size_t rl = len - fl;
+        if((rl == 7 && strncmp(rest, "_bucket", 7) == 0) || (rl == 4 && strncmp(rest, "_sum", 4) == 0)
+           || (rl == 6 && strncmp(rest, "_count", 6) == 0)) return &families[i];
+    }
+    return NULL;
+}
+
+static int is_name_char(int c, int first){
+    return isalpha(c) || c == '_' || c == ':' || (!first && isdigit(c));
+}
+
+/**
+ * Parse a sample value.
+ *
+ * @return 0 when the whole string is a number, NaN or an infinity
+ */
+static int parse_value(const char *p, double *v){
+    if(strcmp(p, "NaN") == 0){ *v = NAN; return 0; }
+    if(strcmp(p, "+Inf") == 0){ *v = INFINITY; return 0; }
+    if(strcmp(p, "-Inf") == 0){ *v = -INFINITY; return 0; }
+    char *end;
+    *v = strtod(p, &end);
+    return end != p && *end == '\0' ? 0 : -1;
+}
+
+/**
+ * Check one line of the exposition text and account its sample. Histogram
+ * series are checked in the order the endpoint writes them: buckets,
+ * then _sum, then _count.
+ *
+ * @param line NUL-terminated line without the newline
+ * @param lineno line number for messages
+ * @return 0 when the line is well-formed
+ */
+static int check_line(char *line, int lineno){
+    static char series[512];
+    static double last_bucket = -1.0;
+    static int saw_inf = 0;
+    if(line[0] == '\0') return 0;
+    if(line[0] == '#'){
+        char name[128], type[16];
+        if(strncmp(line, "# TYPE ", 7) != 0) return 0;
+        if(sscanf(line + 7, "%127s %15s", name, type) != 2 || n_families >= SCRAPE_MAX_FAMILIES){
+            fprintf(stderr, "line %d: bad TYPE line\n", lineno);
+            return -1;
+        }
+        if(strcmp(type, "counter") && strcmp(type, "gauge") && strcmp(type, "histogram") && strcmp(type, "summary") && strcmp(type, "untyped")){
+            fprintf(stderr, "line %d: unknown type '%s'\n", lineno, type);
+            return -1;
+        }
+        snprintf(families[n_families].name, sizeof(families[0].name), "%s", name);
+        snprintf(families[n_families].type, sizeof(families[0].type), "%s", type);
+        families[n_families].samples = 0;
+        n_families++;
+        return 0;
+    }
+    char *p = line;
+    if(!is_name_char((unsigned char)*p, 1)){ fprintf(stderr, "line %d: bad metric name\n", lineno); return -1; }
+    while(is_name_char((unsigned char)*p, 0)) p++;
+    size_t name_len = (size_t)(p - line);
+    char *labels = p;
+    char le[64] = "";
+    if(*p == '{'){
+        p++;
+        while(*p != '}'){
+            char *key = p;
+            if(!is_name_char((unsigned char)*p, 1)){ fprintf(stderr, "line %d: bad label name\n", lineno); return -1; }
+            while(is_name_char((unsigned char)*p, 0)) p++;
+            size_t key_len = (size_t)(p - key);
+            if(p[0] != '=' || p[1] != '"'){ fprintf(stderr, "line %d: expected =\" after a label name\n", lineno); return -1; }
+            p += 2;
+            char *val = p;
+            while(*p && *p != '"'){ if(*p == '\\' && p[1]) p++; p++; }
+            if(*p != '"'){ fprintf(stderr, "line %d: unterminated label value\n", lineno); return -1; }
+            if(key_len == 2 && strncmp(key, "le", 2) == 0) snprintf(le, sizeof(le), "%.*s", (int)(p - val), val);
+            p++;
+            if(*p == ',') p++;
+            else if(*p != '}'){ fprintf(stderr, "line %d: expected , or } after a label\n", lineno); return -1; }
+        }
+        p++;
+    }
+    size_t labels_len = (size_t)(p - labels);
+    if(*p != ' '){ fprintf(stderr, "line %d: expected a space before the value\n", lineno); return -1; }
+    double v;
+    if(parse_value(p + 1, &v) != 0){ fprintf(stderr, "line %d: bad value '%s'\n", lineno, p + 1); return -1; }
+    family_t *f = find_family(line, name_len);
+    if(!f){ fprintf(stderr, "line %d: sample of an undeclared family\n", lineno); return -1; }
+    f->samples++;
+    if(strcmp(f->type, "histogram") != 0) return 0;
+    /* the series key is the labels without le; buckets must grow up to +Inf, which must match _count */
+    char key[512];
+    int is_bucket = name_len > 7 && strncmp(line + name_len - 7, "_bucket", 7) == 0;
+    int is_count = name_len > 6 && strncmp(line + name_len - 6, "_count", 6) == 0;
+    if(is_bucket){
+        const char *le_at = strstr(labels, "le=\"");
+        size_t cut = le_at && (size_t)(le_at - labels) < labels_len ? (size_t)(le_at - labels) : labels_len;
+        snprintf(key, sizeof(key), "%.*s", (int)cut, labels);
+        if(!le[0]){ fprintf(stderr, "line %d: bucket without le\n", lineno); return -1; }
+        if(strcmp(key, series) != 0){ snprintf(series, sizeof(series), "%s", key); last_bucket = -1.0; saw_inf = 0; }
+        if(v < last_bucket){ fprintf(stderr, "line %d: bucket counts are not cumulative\n", lineno); return -1; }
+        last_bucket = v;
+        if(strcmp(le, "+Inf") == 0) saw_inf = 1;
+    } else if(is_count){
+        if(!saw_inf){ fprintf(stderr, "line %d: histogram without an le=\"+Inf\" bucket\n", lineno); return -1; }
+        if(v != last_bucket){ fprintf(stderr, "line %d: _count %g differs from the +Inf bucket %g\n", lineno, v, last_bucket); return -1; }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv){
+    const char *addr = "127.0.0.1", *sock_path = NULL, *path = "/metrics", *require = NULL;
+    int port = 9100, summary = 0;
+    for(int i=1;i+1<argc;i+=2){
+        if(strcmp(argv[i], "--addr") == 0) addr = argv[i+1];
+        else if(strcmp(argv[i], "--port") == 0) port = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--socket") == 0) sock_path = argv[i+1];
+        else if(strcmp(argv[i], "--path") == 0) path = argv[i+1];
+        else if(strcmp(argv[i], "--summary") == 0) summary = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--require") == 0) require = argv[i+1];
+        else { fprintf(stderr, "unknown option %s\n", argv[i]); return 2; }
+    }
+    if(platform_socket_init() != 0) return 2;
+    long long t0 = platform_monotonic_ns();
+    socket_t s = scrape_connect(addr, port, sock_path);
+    if(s == INVALID_SOCKET){
+        if(sock_path) fprintf(stderr, "cannot connect to %s\n", sock_path);
+        else fprintf(stderr, "cannot connect to %s:%d\n", addr, port);
+        platform_socket_cleanup();
+        return 2;
+    }
+    char req[512];
+    int rlen = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s\r\nAccept: text/plain\r\nConnection: close\r\n\r\n", path, sock_path ? "localhost" : addr);
+    if(send(s, req, rlen, 0) != rlen){ fprintf(stderr, "send failed\n"); CLOSESOCKET(s); platform_socket_cleanup(); return 2; }
+    size_t len = 0, cap = 65536;
+    char *buf = (char*)malloc(cap);
+    for(;;){
+        if(buf && len + 1 >= cap){ char *nb = (char*)realloc(buf, cap * 2); if(!nb){ free(buf); buf = NULL; } else { buf = nb; cap *= 2; } }
+        if(!buf) break;
+        int n = (int)recv(s, buf + len, (int)(cap - 1 - len), 0);
+        if(n <= 0) break;
+        len += (size_t)n;
+    }
+    CLOSESOCKET(s);
+    platform_socket_cleanup();
+    long long t1 = platform_monotonic_ns();
+    if(!buf){ fprintf(stderr, "out of memory\n"); return 2; }
+    buf[len] = '\0';
+
+    int status = 0;
+    char *body = strstr(buf, "\r\n\r\n");
+    if(sscanf(buf, "HTTP/1.%*d %d", &status) != 1 || !body){ fprintf(stderr, "malformed HTTP response\n"); free(buf); return 1; }
+    *body = '\0';
+    body += 4;
+    if(status != 200){ fprintf(stderr, "HTTP status %d\n", status); free(buf); return 1; }
+    if(!strstr(buf, "Content-Type: text/plain")){ fprintf(stderr, "unexpected content type\n"); free(buf); return 1; }
+
+    size_t body_len = strlen(body);
+    int bad = 0, lineno = 0;
+    long long samples = 0;
+    for(char *line = body; *line; ){
+        char *nl = strchr(line, '\n');
+        if(!nl){ fprintf(stderr, "line %d: missing final newline\n", lineno + 1); bad = 1; break; }
+        *nl = '\0';
+        ++lineno;
+        if(check_line(line, lineno) != 0) bad = 1;
+        else if(line[0] && line[0] != '#') samples++;
+        if(!summary) printf("%s\n", line);
+        line = nl + 1;
+    }
+    if(require){
+        family_t *f = find_family(require, strlen(require));
+        if(!f || f->samples == 0){ fprintf(stderr, "no samples of %s\n", require); bad = 1; }
+    }
+    if(summary) printf("%s: %d families, %lld samples, %zu bytes in %.2f ms\n", bad ? "malformed" : "ok",
+                       n_families, samples, body_len, (double)(t1 - t0) / 1e6);
+    free(buf);
+    return bad ? 1 : 0;
+}
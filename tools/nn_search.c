@@ -0,0 +1,299 @@
+/*
+ * nn_search.c
+ *
+ * Offline search over the MLP's topology, learning rate and hidden
+ * activation on a replay of the `data/` exports. The history is loaded once
+ * and shared read-only by all threads; every thread takes the next untried
+ * candidate and evaluates it with walk-forward validation: the series is cut
+ * into folds+1 segments, the model trains on the first one, then every
+ * following segment is predicted (next sample, normalized domain) before the
+ * model trains on it, as the analyzer would see it online.
+ *
+ * After the search every candidate's inference cost (ns per sample on the
+ * per-sample path, measured on one quiet thread) and memory are measured.
+ * The winner is the fastest candidate whose error meets the target (--target,
+ * or within --slack of the best error); it is written as an analyzer
+ * configuration file (`analyzer --config FILE`) and a weight file.
+ *
+ * usage: nn_search [--data DIR] [--limit N] [--threads N] [--folds N] [--epochs N]
+ *                  [--target MSE] [--slack F] [--out-config FILE] [--out-weights FILE]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "../receiver/platform.h"
+#include "../receiver/types.h"
+#include "../receiver/module2/nn.h"
+#include "../receiver/module2/nn_params.h"
+#include "../receiver/module2/util.h"
+#include "replay.h"
+
+#define SEARCH_MAX_THREADS 64
+#define SEARCH_LATENCY_SAMPLES 4096
+
+static const char *search_layers[] = { "none", "8", "16", "32", "16,16", "32,16", "16,32,16", "64,32", "16,32,64,32,16" };
+static const double search_rates[] = { 0.01, 0.03, 0.1, 0.3 };
+static const act_t search_acts[] = { ACT_SIGMOID, ACT_TANH, ACT_RELU };
+
+#define N_LAYERS (sizeof(search_layers) / sizeof(search_layers[0]))
+#define N_RATES (sizeof(search_rates) / sizeof(search_rates[0]))
+#define N_ACTS (sizeof(search_acts) / sizeof(search_acts[0]))
+
+/**
+ * One configuration under evaluation.
+ *
+ * layers: hidden layer spec (see nn_parse_layers())
+ * sizes: parsed layer sizes, referenced by params
+ * params: network parameters of the candidate
+ * nn: trained network
+ * mse: walk-forward mean squared error (normalized domain)
+ * ns: inference cost in ns per sample
+ * bytes: memory of the network
+ */
+typedef struct {
+    const char *layers;
+    size_t sizes[NN_LAYERS_MAX];
+    nn_params_t params;
+    nn_t *nn;
+    double mse;
+    double ns;
+    size_t bytes;
+} candidate_t;
+
+/**
+ * Search shared by the worker threads; the history is read-only.
+ */
+typedef struct {
+    const feature_vec_t *xs;
+    const float *vals;
+    int n;
+    int folds;
+    int epochs;
+    const double *scales;
+    candidate_t *cands;
+    int n_cands;
+    atomic_int next;
+    atomic_int done;
+} search_t;
+
+/**
+ * Train a network on [from, to) (predict sample i+1 from sample i).
+ */
+static void train_segment(nn_t *nn, const search_t *s, int from, int to, int epochs){
+    for(int e=0;e<epochs;e++){
+        for(int i=from;i<to && i+1<s->n;i++){
+            if(e == 0) nn_observe(nn, &s->xs[i], &s->vals[(size_t)i * OUTPUT_SIZE]);
+            nn_train_sample(nn, &s->xs[i], &s->vals[(size_t)(i+1) * OUTPUT_SIZE], NULL);
+        }
+    }
+}
+
+/**
+ * Walk-forward validation of one candidate.
+ *
+ * @return mean squared error over all predicted segments
+ */
+static double walk_forward(nn_t *nn, const search_t *s){
+    int seg = s->n / (s->folds + 1);
+    train_segment(nn, s, 0, seg, s->epochs);
+    double sum = 0.0;
+    long long cnt = 0;
+    for(int f=1; f<=s->folds; f++){
+        int from = f * seg, to = f == s->folds ? s->n : from + seg;
+        for(int i=from;i+1<to;i++){
+            float out[OUTPUT_SIZE];
+            nn_predict_and_maybe_train(nn, &s->xs[i], NULL, out);
+            const float *t = &s->vals[(size_t)(i+1) * OUTPUT_SIZE];
+            for(int k=0;k<OUTPUT_SIZE;k++){
+                double d = ((double)out[k] - (double)t[k]) / s->scales[k];
+                sum += d * d;
+            }
+            cnt++;
+        }
+        train_segment(nn, s, from, to, s->epochs);
+    }
+    return cnt ? sum / (double)(cnt * OUTPUT_SIZE) : NAN;
+}
+
+/**
+ * Search thread: evaluate candidates until none is left.
+ */
+static void* search_worker(void *arg){
+    search_t *s = (search_t*)arg;
+    while(1){
+        int i = atomic_fetch_add(&s->next, 1);
+        if(i >= s->n_cands) break;
+        candidate_t *c = &s->cands[i];
+        c->mse = walk_forward(c->nn, s);
+        int done = atomic_fetch_add(&s->done, 1) + 1;
+        fprintf(stderr, "\r%d / %d candidates", done, s->n_cands);
+    }
+    return NULL;
+}
+
+/**
+ * Inference cost of a trained network: best of three passes of the
+ * per-sample path over the end of the history.
+ */
+static double measure_ns(nn_t *nn, const search_t *s){
+    int from = s->n > SEARCH_LATENCY_SAMPLES ? s->n - SEARCH_LATENCY_SAMPLES : 0;
+    double best = INFINITY;
+    for(int rep=0;rep<3;rep++){
+        float out[OUTPUT_SIZE];
+        long long t0 = platform_monotonic_ns();
+        for(int i=from;i<s->n;i++) nn_predict_and_maybe_train(nn, &s->xs[i], NULL, out);
+        double ns = (double)(platform_monotonic_ns() - t0) / (double)(s->n - from);
+        if(ns < best) best = ns;
+    }
+    return best;
+}
+
+static double g_target;
+
+/**
+ * Ranking: candidates meeting the error target first, fastest (then
+ * smallest) first; the others by error.
+ */
+static int rank_cmp(const void *a, const void *b){
+    const candidate_t *x = (const candidate_t*)a, *y = (const candidate_t*)b;
+    int okx = x->mse <= g_target, oky = y->mse <= g_target;
+    if(okx != oky) return oky - okx;
+    if(okx){
+        if(x->ns != y->ns) return x->ns < y->ns ? -1 : 1;
+        return x->bytes < y->bytes ? -1 : x->bytes > y->bytes;
+    }
+    if(isnan(x->mse) || isnan(y->mse)) return isnan(x->mse) - isnan(y->mse);
+    return x->mse < y->mse ? -1 : x->mse > y->mse;
+}
+
+/**
+ * Write the winner as an analyzer configuration file.
+ */
+static int write_config(const char *path, const candidate_t *c, const char *weights, int n, int folds){
+    FILE *f = fopen(path, "w");
+    if(!f) return -1;
+    fprintf(f, "# nn_search: walk-forward mse %.6e over %d folds of %d samples, %.0f ns/sample, %zu bytes\n",
+            c->mse, folds, n, c->ns, c->bytes);
+    fprintf(f, "model=mlp\nfeatures=raw\n");
+    fprintf(f, "layers=%s\n", c->layers);
+    fprintf(f, "learning-rate=%g\n", c->params.learning_rate);
+    fprintf(f, "hidden-act=%s\n", nn_activation_name(c->params.hidden_activation));
+    fprintf(f, "output-act=%s\n", nn_activation_name(c->params.output_activation));
+    fprintf(f, "weights=%s\n", weights);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv){
+    const char *dir = "data", *out_config = "data/nn_search.conf", *out_weights = "data/nn_search_weights.bin";
+    int limit = 0, threads = 4, folds = 4, epochs = 1;
+    double target = 0.0, slack = 0.1;
+    for(int i=1;i+1<argc;i+=2){
+        if(strcmp(argv[i], "--data") == 0) dir = argv[i+1];
+        else if(strcmp(argv[i], "--limit") == 0) limit = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--threads") == 0) threads = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--folds") == 0) folds = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--epochs") == 0) epochs = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--target") == 0) target = atof(argv[i+1]);
+        else if(strcmp(argv[i], "--slack") == 0) slack = atof(argv[i+1]);
+        else if(strcmp(argv[i], "--out-config") == 0) out_config = argv[i+1];
+        else if(strcmp(argv[i], "--out-weights") == 0) out_weights = argv[i+1];
+        else {
+            fprintf(stderr, "usage: %s [--data DIR] [--limit N] [--threads N] [--folds N] [--epochs N]\n"
+                            "       [--target MSE] [--slack F] [--out-config FILE] [--out-weights FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(threads < 1 || threads > SEARCH_MAX_THREADS || folds < 1 || epochs < 1){ fprintf(stderr, "invalid --threads, --folds or --epochs\n"); return 1; }
+
+    data_point_t *dps = NULL;
+    float *vals = NULL;
+    int n = replay_load(dir, limit, &dps, &vals);
+    if(n < 0) return 1;
+    if(n < 10 * (folds + 1)){ fprintf(stderr, "not enough samples\n"); return 1; }
+    feature_vec_t *xs = (feature_vec_t*)malloc(sizeof(feature_vec_t) * (size_t)n);
+    int n_cands = (int)(N_LAYERS * N_RATES * N_ACTS);
+    candidate_t *cands = (candidate_t*)calloc((size_t)n_cands, sizeof(candidate_t));
+    if(!xs || !cands){ fprintf(stderr, "out of memory\n"); return 1; }
+    for(int i=0;i<n;i++) features_from_datapoint(&dps[i], &xs[i]);
+
+    /* networks are created up front: nn_create() seeds the shared random generator */
+    nn_params_t base = default_nn_params();
+    base.weights_path = NULL;
+    int k = 0;
+    for(size_t li=0; li<N_LAYERS; li++)
+        for(size_t ri=0; ri<N_RATES; ri++)
+            for(size_t ai=0; ai<N_ACTS; ai++, k++){
+                candidate_t *c = &cands[k];
+                c->layers = search_layers[li];
+                c->params = base;
+                c->params.n_hidden_layers = (size_t)nn_parse_layers(c->layers, c->sizes, NN_LAYERS_MAX);
+                c->params.neurons_per_layer = c->sizes;
+                c->params.learning_rate = search_rates[ri];
+                c->params.hidden_activation = search_acts[ai];
+                c->nn = nn_create(&c->params);
+                if(!c->nn){ fprintf(stderr, "cannot create candidate %d\n", k); return 1; }
+            }
+
+    search_t s;
+    s.xs = xs;
+    s.vals = vals;
+    s.n = n;
+    s.folds = folds;
+    s.epochs = epochs;
+    s.scales = base.scales;
+    s.cands = cands;
+    s.n_cands = n_cands;
+    atomic_init(&s.next, 0);
+    atomic_init(&s.done, 0);
+    printf("%d samples, %d folds, %d epochs, %d candidates on %d threads\n", n, folds, epochs, n_cands, threads);
+    long long t0 = platform_monotonic_ns();
+    pthread_t tids[SEARCH_MAX_THREADS];
+    int started = 0;
+    for(int i=1;i<threads;i++){
+        if(pthread_create(&tids[started], NULL, search_worker, &s) != 0) break;
+        started++;
+    }
+    search_worker(&s);
+    for(int i=0;i<started;i++) pthread_join(tids[i], NULL);
+    fprintf(stderr, "\n");
+    printf("search took %.1f s\n\n", (double)(platform_monotonic_ns() - t0) / 1e9);
+
+    double best = INFINITY;
+    for(int i=0;i<n_cands;i++){
+        cands[i].ns = measure_ns(cands[i].nn, &s);
+        cands[i].bytes = nn_memory_bytes(cands[i].nn);
+        if(cands[i].mse < best) best = cands[i].mse;
+    }
+    g_target = target > 0.0 ? target : best * (1.0 + slack);
+    qsort(cands, (size_t)n_cands, sizeof(candidate_t), rank_cmp);
+
+    printf("target mse %.6e%s\n\n", g_target, target > 0.0 ? "" : " (best + slack)");
+    printf("%-16s %6s %-8s %13s %10s %9s\n", "layers", "lr", "act", "mse", "ns/sample", "bytes");
+    for(int i=0;i<n_cands;i++){
+        const candidate_t *c = &cands[i];
+        printf("%-16s %6g %-8s %13.6e %10.0f %9zu%s\n", c->layers, c->params.learning_rate,
+               nn_activation_name(c->params.hidden_activation), c->mse, c->ns, c->bytes, c->mse <= g_target ? "" : "  (misses target)");
+    }
+
+    const candidate_t *win = &cands[0];
+    int rc = 0;
+    if(nn_save_weights(win->nn, out_weights) != 0 || write_config(out_config, win, out_weights, n, folds) != 0){
+        fprintf(stderr, "cannot write %s / %s\n", out_config, out_weights);
+        rc = 1;
+    } else {
+        printf("\nwinner: layers=%s learning-rate=%g hidden-act=%s -> %s, %s\n", win->layers, win->params.learning_rate,
+               nn_activation_name(win->params.hidden_activation), out_config, out_weights);
+    }
+
+    for(int i=0;i<n_cands;i++) nn_free(cands[i].nn);
+    free(cands);
+    free(xs);
+    free(vals);
+    free(dps);
+    return rc;
+}
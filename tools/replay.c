@@ -0,0 +1,144 @@
+/*
+ * replay.c
+ *
+ * Loads the six exported feature series (`<dir>/export_<feature>.csv`, one
+ * `timestamp,cnt` row per sample) into datapoints for offline replays. A
+ * directory holding an analyzer `--store-dir` store is read directly from the
+ * compressed blocks instead (see receiver/tsdb.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "replay.h"
+#include "../receiver/module2/nn_params.h"
+#include "../receiver/tsdb.h"
+
+static const char *feature_files[OUTPUT_SIZE] = { "bytes", "flows", "packets", "rtr", "rtt", "srt" };
+
+/**
+ * Load one `timestamp,cnt` export column.
+ *
+ * @param path CSV file path
+ * @param ts output timestamps (may be NULL), at most `cap` values
+ * @param val output values, at most `cap` values
+ * @param cap capacity of the output arrays
+ * @return number of rows read, -1 when the file cannot be opened
+ */
+static int load_column(const char *path, double *ts, float *val, int cap){
+    FILE *f = fopen(path, "r");
+    if(!f) return -1;
+    char line[256];
+    int n = 0;
+    if(!fgets(line, sizeof(line), f)){ fclose(f); return 0; } /* header */
+    while(n < cap && fgets(line, sizeof(line), f)){
+        char *comma = strchr(line, ',');
+        if(!comma) continue;
+        if(ts) ts[n] = atof(line);
+        val[n] = (float)atof(comma + 1);
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+/**
+ * Load the metrics of the source with the most stored records from a store.
+ *
+ * @param db store opened read-only
+ * @param limit maximum number of samples (<= 0 = all)
+ * @param dps output: allocated datapoints (caller frees)
+ * @param vals output: allocated row-major copy of the six metrics (caller frees)
+ * @return number of samples, -1 on error
+ */
+static int load_store(tsdb_t *db, int limit, data_point_t **dps, float **vals){
+    int n_src = tsdb_sources(db, NULL, 0);
+    char (*names)[64] = (char(*)[64])malloc(sizeof(*names) * (size_t)(n_src > 0 ? n_src : 1));
+    if(!names) return -1;
+    tsdb_sources(db, names, n_src);
+    int best = -1;
+    long long n = 0;
+    for(int i=0;i<n_src;i++){
+        long long c = tsdb_read(db, names[i], TSDB_COL_METRICS, LLONG_MIN, LLONG_MAX, NULL, NULL, LLONG_MAX);
+        if(c > n){ n = c; best = i; }
+    }
+    if(limit > 0 && limit < n) n = limit;
+    long long *ts = (long long*)malloc(sizeof(long long) * (size_t)(n > 0 ? n : 1));
+    float *col = (float*)malloc(sizeof(float) * (size_t)(n > 0 ? n : 1));
+    *dps = (data_point_t*)calloc((size_t)(n > 0 ? n : 1), sizeof(data_point_t));
+    *vals = (float*)malloc(sizeof(float) * (size_t)(n > 0 ? n : 1) * OUTPUT_SIZE);
+    if(!ts || !col || !*dps || !*vals){ free(ts); free(col); free(*dps); free(*vals); free(names); return -1; }
+    /* the metrics of a record are appended together, so the columns line up */
+    for(int k=0;k<OUTPUT_SIZE && best >= 0;k++){
+        long long got = tsdb_read(db, names[best], TSDB_COL_METRICS + k, LLONG_MIN, LLONG_MAX, ts, col, n);
+        if(got < n) n = got;
+        for(long long i=0;i<n;i++) (*vals)[(size_t)i * OUTPUT_SIZE + k] = col[i];
+    }
+    for(long long i=0;i<n;i++){
+        const float *v = &(*vals)[(size_t)i * OUTPUT_SIZE];
+        data_point_t *d = &(*dps)[i];
+        d->timestamp = (double)ts[i] / 1000.0; /* the store keeps the pipeline's milliseconds */
+        d->export_bytes = v[0];
+        d->export_flows = v[1];
+        d->export_packets = v[2];
+        d->export_rtr = v[3];
+        d->export_rtt = v[4];
+        d->export_srt = v[5];
+    }
+    if(best >= 0) fprintf(stderr, "loaded %lld records of source '%s' from the store\n", n, names[best]);
+    free(ts);
+    free(col);
+    free(names);
+    return (int)n;
+}
+
+/**
+ * Load the exported series.
+ *
+ * @param dir directory with the export CSV files, or an analyzer store (`--store-dir`)
+ * @param limit maximum number of samples (<= 0 = all)
+ * @param dps output: allocated datapoints (caller frees)
+ * @param vals output: allocated row-major copy of the six features, OUTPUT_SIZE per sample (caller frees)
+ * @return number of samples (rows common to all files), -1 on error
+ */
+int replay_load(const char *dir, int limit, data_point_t **dps, float **vals){
+    tsdb_t *db = tsdb_open(dir, 0);
+    if(db){
+        int n = load_store(db, limit, dps, vals);
+        tsdb_close(db);
+        return n;
+    }
+    int cap = 1 << 20;
+    double *ts = (double*)malloc(sizeof(double) * cap);
+    float *cols = (float*)malloc(sizeof(float) * (size_t)cap * OUTPUT_SIZE);
+    if(!ts || !cols){ free(ts); free(cols); return -1; }
+    int n = cap;
+    for(int k=0;k<OUTPUT_SIZE;k++){
+        char path[512];
+        snprintf(path, sizeof(path), "%s/export_%s.csv", dir, feature_files[k]);
+        int rows = load_column(path, k == 0 ? ts : NULL, cols + (size_t)k * cap, cap);
+        if(rows < 0){ fprintf(stderr, "cannot open %s\n", path); free(ts); free(cols); return -1; }
+        if(rows < n) n = rows;
+    }
+    if(limit > 0 && limit < n) n = limit;
+    *dps = (data_point_t*)malloc(sizeof(data_point_t) * (size_t)(n > 0 ? n : 1));
+    *vals = (float*)malloc(sizeof(float) * (size_t)(n > 0 ? n : 1) * OUTPUT_SIZE);
+    if(!*dps || !*vals){ free(*dps); free(*vals); free(ts); free(cols); return -1; }
+    for(int i=0;i<n;i++){
+        float *v = &(*vals)[(size_t)i * OUTPUT_SIZE];
+        for(int k=0;k<OUTPUT_SIZE;k++) v[k] = cols[(size_t)k * cap + i];
+        data_point_t *d = &(*dps)[i];
+        d->timestamp = ts[i];
+        d->export_bytes = v[0];
+        d->export_flows = v[1];
+        d->export_packets = v[2];
+        d->export_rtr = v[3];
+        d->export_rtt = v[4];
+        d->export_srt = v[5];
+    }
+    free(ts);
+    free(cols);
+    return n;
+}
@@ -0,0 +1,14 @@
+/**
+ * replay.h
+ *
+ * Loader of the `data/export_*.csv` series shared by the offline tools.
+ */
+
+#ifndef TOOLS_REPLAY_H
+#define TOOLS_REPLAY_H
+
+#include "../receiver/types.h"
+
+int replay_load(const char *dir, int limit, data_point_t **dps, float **vals);
+
+#endif
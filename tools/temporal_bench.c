@@ -0,0 +1,119 @@
+/*
+ * temporal_bench.c
+ *
+ * Per-message cost and accuracy of the recurrent (GRU) model against the MLP
+ * on a replay of the `data/` exports. Both models run the online loop of the
+ * analyzer: predict the next sample, then train on the previous -> current
+ * pair. The reported error is the prequential mean squared error (normalized
+ * domain) over the last 20 % of the replay, i.e. every prediction is scored
+ * before the model has trained on its target.
+ *
+ * usage: temporal_bench [--data DIR] [--limit N] [--hidden N] [--window N] [--passes N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../receiver/platform.h"
+#include "../receiver/types.h"
+#include "../receiver/module2/nn.h"
+#include "../receiver/module2/nn_params.h"
+#include "../receiver/module2/util.h"
+#include "../receiver/module2/gru.h"
+#include "replay.h"
+
+/**
+ * Squared error of a prediction in the normalized domain, summed over the features.
+ */
+static double sq_err(const float *pred, const float *target, const nn_params_t *p){
+    double s = 0.0;
+    for(int k=0;k<OUTPUT_SIZE;k++){
+        double d = ((double)pred[k] - (double)target[k]) / p->scales[k];
+        s += d * d;
+    }
+    return s;
+}
+
+/**
+ * Print one result line.
+ */
+static void report(const char *name, size_t n_params, long long ns, long long msgs, double sum_err, long long n_err){
+    printf("%-10s %7zu params   %8.2f us/message   prequential mse %.6e\n",
+           name, n_params, (double)ns / 1000.0 / (double)msgs, sum_err / (double)(n_err * OUTPUT_SIZE));
+}
+
+int main(int argc, char **argv){
+    const char *dir = "data";
+    int limit = 0, hidden = 16, window = 16, passes = 1;
+    for(int i=1;i+1<argc;i+=2){
+        if(strcmp(argv[i], "--data") == 0) dir = argv[i+1];
+        else if(strcmp(argv[i], "--limit") == 0) limit = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--hidden") == 0) hidden = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--window") == 0) window = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--passes") == 0) passes = atoi(argv[i+1]);
+        else { fprintf(stderr, "usage: %s [--data DIR] [--limit N] [--hidden N] [--window N] [--passes N]\n", argv[0]); return 1; }
+    }
+    data_point_t *dps = NULL;
+    float *vals = NULL;
+    int n = replay_load(dir, limit, &dps, &vals);
+    if(n < 10){ fprintf(stderr, "not enough samples\n"); return 1; }
+    int score_from = n * 8 / 10;
+    long long msgs = (long long)n * passes;
+    feature_vec_t *xs = (feature_vec_t*)malloc(sizeof(feature_vec_t) * (size_t)n);
+    if(!xs){ fprintf(stderr, "out of memory\n"); return 1; }
+    for(int i=0;i<n;i++) features_from_datapoint(&dps[i], &xs[i]);
+    printf("%d samples x %d passes, error scored on the last %d samples of the final pass\n\n", n, passes, n - score_from);
+
+    nn_params_t p = default_nn_params();
+    p.weights_path = NULL;
+
+    /* MLP: predict current, train previous -> current */
+    nn_t *nn = nn_create(&p);
+    double err = 0.0; long long n_err = 0;
+    long long t0 = platform_monotonic_ns();
+    for(int pass=0; pass<passes; pass++){
+        float out[OUTPUT_SIZE], prev_out[OUTPUT_SIZE];
+        for(int i=0;i<n;i++){
+            nn_predict_and_maybe_train(nn, &xs[i], NULL, out);
+            const float *cur = &vals[(size_t)i * OUTPUT_SIZE];
+            if(i > 0){
+                if(pass == passes-1 && i >= score_from){ err += sq_err(prev_out, cur, &p); n_err++; }
+                nn_train_sample(nn, &xs[i-1], cur, NULL);
+            }
+            memcpy(prev_out, out, sizeof(out));
+        }
+    }
+    report("mlp", nn_param_count(nn), platform_monotonic_ns() - t0, msgs, err, n_err);
+    nn_free(nn);
+
+    /* GRU: one cell update per message, train the previous prediction with truncated BPTT */
+    gru_t *g = gru_create(&p, (size_t)hidden, (size_t)window);
+    if(!g){ fprintf(stderr, "cannot create GRU\n"); return 1; }
+    err = 0.0; n_err = 0;
+    t0 = platform_monotonic_ns();
+    for(int pass=0; pass<passes; pass++){
+        gru_stream_t *s = gru_stream_create(g);
+        float out[OUTPUT_SIZE], prev_out[OUTPUT_SIZE];
+        for(int i=0;i<n;i++){
+            gru_stream_step(g, s, &xs[i], out);
+            const float *cur = &vals[(size_t)i * OUTPUT_SIZE];
+            if(i > 0){
+                if(pass == passes-1 && i >= score_from){ err += sq_err(prev_out, cur, &p); n_err++; }
+                gru_stream_train_prev(g, s, cur);
+            }
+            memcpy(prev_out, out, sizeof(out));
+        }
+        gru_stream_free(s);
+    }
+    char label[32];
+    snprintf(label, sizeof(label), "gru h%d w%d", hidden, window);
+    report(label, gru_param_count(g), platform_monotonic_ns() - t0, msgs, err, n_err);
+    gru_free(g);
+
+    free(xs);
+    free(vals);
+    free(dps);
+    return 0;
+}
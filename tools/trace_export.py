@@ -0,0 +1,165 @@
+"""
+trace_export.py
+
+Convert a trace file written by the analyzer (`--trace-file`, see
+receiver/trace.c) into Chrome / Perfetto trace-event JSON. Open the output
+in chrome://tracing or https://ui.perfetto.dev.
+
+Two groups of tracks are written:
+    threads: one track per analyzer thread with the work it did (parse,
+        features, predict, train, represent, checkpoint).
+    records: one track per traced record with all of its spans, including
+        the time it waited in queues, from ingest to its last output line
+        (spans running in parallel, like training, get a lane of their own).
+
+usage: python3 tools/trace_export.py TRACE_FILE [-o OUT.json] [--record ID]
+"""
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b'ANTRACE1'
+HDR = struct.Struct('<8sIIQQqIIQ8x')
+REC = struct.Struct('<qqQIHH')
+# keep in sync with TRACE_* in receiver/trace.h
+STAGES = ['queue', 'parse', 'features', 'predict', 'train', 'represent', 'checkpoint']
+PID_THREADS = 1
+PID_RECORDS = 2
+# track IDs reserved per record (one per lane)
+RECORD_LANES = 100
+
+def read_trace(path):
+    """
+    Read the header and the spans of a trace file.
+
+    args:
+        path (str): trace file.
+    returns:
+        (header dict, list of (begin_ns, end_ns, trace_id, tid, stage)) with
+        the spans ordered by begin time.
+    """
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < HDR.size:
+        raise ValueError('%s: too short for a trace header' % path)
+    magic, version, rec_size, capacity, written, origin_wall_us, sample_every, stages, traced = HDR.unpack_from(data, 0)
+    if magic != MAGIC or version != 1 or rec_size != REC.size:
+        raise ValueError('%s: not a version 1 trace file' % path)
+    header = {'capacity': capacity, 'written': written, 'origin_wall_us': origin_wall_us,
+              'sample_every': sample_every, 'traced': traced}
+    spans = []
+    end = min(len(data), HDR.size + capacity * REC.size)
+    for off in range(HDR.size, end - REC.size + 1, REC.size):
+        begin_ns, end_ns, trace_id, tid, stage, _ = REC.unpack_from(data, off)
+        # unused slots have tid 0
+        if tid == 0 or stage >= len(STAGES) or end_ns < begin_ns:
+            continue
+        spans.append((begin_ns, end_ns, trace_id, tid, stage))
+    spans.sort()
+    return header, spans
+
+def assign_lanes(intervals):
+    """
+    Spread intervals over lanes in which each one either nests inside or
+    follows the ones before it, the layout trace viewers expect of a track.
+
+    args:
+        intervals (list): (begin, end) pairs ordered by begin, longer ones first.
+    returns:
+        List with the lane (0, 1, ...) of every interval.
+    """
+    lanes = []  # per lane: ends of the intervals still open
+    out = []
+    for begin, end in intervals:
+        for i, open_ends in enumerate(lanes):
+            while open_ends and open_ends[-1] <= begin:
+                open_ends.pop()
+            if not open_ends or end <= open_ends[-1]:
+                open_ends.append(end)
+                out.append(i)
+                break
+        else:
+            lanes.append([end])
+            out.append(len(lanes) - 1)
+    return out
+
+def to_events(spans, only_record=None):
+    """
+    Build the trace events of the spans. The spans of a record can overlap
+    without nesting (training runs while the output waits to be represented),
+    so a record's track is split into lanes where needed.
+
+    args:
+        spans (list): spans as returned by read_trace().
+        only_record (int): keep the spans of this trace ID only (None = all).
+    returns:
+        List of trace-event dicts.
+    """
+    events = []
+    tids = {}
+    records = {}
+    for begin_ns, end_ns, trace_id, tid, stage in spans:
+        if only_record is not None and trace_id != only_record:
+            continue
+        name = STAGES[stage]
+        args = {'trace_id': trace_id, 'thread': tid} if trace_id else {'thread': tid}
+        # a queue wait starts on the producing thread, it only belongs on the record's track
+        if stage != 0:
+            events.append({'name': name, 'cat': 'stage', 'ph': 'X', 'pid': PID_THREADS, 'tid': tid,
+                           'ts': begin_ns / 1000.0, 'dur': (end_ns - begin_ns) / 1000.0, 'args': args})
+            tids.setdefault(tid, set()).add(name)
+        if trace_id:
+            records.setdefault(trace_id, []).append((begin_ns, end_ns, name, args))
+    meta = [{'name': 'process_name', 'ph': 'M', 'pid': PID_THREADS, 'args': {'name': 'threads'}},
+            {'name': 'process_name', 'ph': 'M', 'pid': PID_RECORDS, 'args': {'name': 'records'}}]
+    for tid, ran in sorted(tids.items()):
+        # threads are named after the steps they ran, in pipeline order
+        role = '+'.join(n for n in STAGES if n in ran)
+        meta.append({'name': 'thread_name', 'ph': 'M', 'pid': PID_THREADS, 'tid': tid,
+                     'args': {'name': '%s (thread %d)' % (role, tid)}})
+    for trace_id in sorted(records):
+        rs = records[trace_id]
+        # the whole record, from ingest to its last span, encloses the rest on the first lane
+        rs.append((min(r[0] for r in rs), max(r[1] for r in rs), 'record %d' % trace_id, {'trace_id': trace_id}))
+        rs.sort(key=lambda r: (r[0], -r[1]))
+        lanes = assign_lanes([(r[0], r[1]) for r in rs])
+        for (begin_ns, end_ns, name, args), lane in zip(rs, lanes):
+            events.append({'name': name, 'cat': 'record', 'ph': 'X', 'pid': PID_RECORDS, 'tid': trace_id * RECORD_LANES + lane,
+                           'ts': begin_ns / 1000.0, 'dur': (end_ns - begin_ns) / 1000.0, 'args': args})
+        for lane in range(max(lanes) + 1):
+            tid = trace_id * RECORD_LANES + lane
+            meta.append({'name': 'thread_name', 'ph': 'M', 'pid': PID_RECORDS, 'tid': tid,
+                         'args': {'name': 'record %d' % trace_id if lane == 0 else 'record %d (%d)' % (trace_id, lane + 1)}})
+            meta.append({'name': 'thread_sort_index', 'ph': 'M', 'pid': PID_RECORDS, 'tid': tid, 'args': {'sort_index': tid}})
+    # enclosing spans first, so viewers nest the ones starting at the same time
+    events.sort(key=lambda e: (e['pid'], e['tid'], e['ts'], -e['dur']))
+    return meta + events
+
+def main():
+    ap = argparse.ArgumentParser(description='Convert an analyzer trace file to Chrome trace-event JSON.')
+    ap.add_argument('trace', help='trace file written with --trace-file')
+    ap.add_argument('-o', '--output', help='output JSON file (default: stdout)')
+    ap.add_argument('--record', type=int, help='export the spans of this trace ID only')
+    opts = ap.parse_args()
+    try:
+        header, spans = read_trace(opts.trace)
+    except (OSError, ValueError) as e:
+        print('trace_export: %s' % e, file=sys.stderr)
+        return 1
+    doc = {'traceEvents': to_events(spans, opts.record), 'displayTimeUnit': 'ns',
+           'otherData': {'origin_wall_us': header['origin_wall_us'], 'sample_every': header['sample_every'],
+                         'spans_written': header['written'], 'records_traced': header['traced'],
+                         'spans_kept': len(spans)}}
+    out = open(opts.output, 'w') if opts.output else sys.stdout
+    json.dump(doc, out)
+    if opts.output:
+        out.close()
+    else:
+        out.write('\n')
+    print('trace_export: %d spans of %d records (1 in %d sampled)' % (len(spans), header['traced'], header['sample_every']),
+          file=sys.stderr)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,111 @@
+/*
+ * tsdb_query.c
+ *
+ * Range queries on an analyzer store (`--store-dir`, see receiver/tsdb.c).
+ * Without `--source` lists the stored sources. With one, prints the
+ * count / sum / min / max / last / mean of a column over [from, to) as CSV,
+ * one row per `--step` seconds or a single row for the whole range, and the
+ * rollup tier each row was answered from. `--raw 1` answers from the raw
+ * points only, `--verify 1` compares every row with the raw answer; both
+ * report the query time on stderr.
+ *
+ * usage: tsdb_query [--store DIR] [--source SRC] [--column NAME] [--from SEC] [--to SEC] [--step SEC] [--raw 0|1] [--verify 0|1]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "../receiver/platform.h"
+#include "../receiver/tsdb.h"
+
+static const char *const tier_names[TSDB_TIERS] = { "1m", "5m", "1h", "1d" };
+
+/**
+ * List the sources with their number of records and time range.
+ */
+static int list_sources(tsdb_t *db){
+    int n = tsdb_sources(db, NULL, 0);
+    char (*names)[64] = (char(*)[64])malloc(sizeof(*names) * (size_t)(n > 0 ? n : 1));
+    if(!names) return 1;
+    tsdb_sources(db, names, n);
+    printf("source,records,first,last\n");
+    for(int i=0;i<n;i++){
+        tsdb_agg_t a;
+        tsdb_query(db, names[i], TSDB_COL_METRICS, LLONG_MIN, LLONG_MAX, TSDB_TIERS - 1, &a);
+        long long last = tsdb_last(db, names[i], TSDB_COL_METRICS);
+        long long first = LLONG_MIN;
+        long long t;
+        float v;
+        if(tsdb_read(db, names[i], TSDB_COL_METRICS, LLONG_MIN, LLONG_MAX, &t, &v, 1) == 1) first = t;
+        printf("%s,%lld,%.3f,%.3f\n", names[i], a.count, (double)first / 1000.0, (double)last / 1000.0);
+    }
+    free(names);
+    return 0;
+}
+
+int main(int argc, char **argv){
+    const char *dir = "data/store", *src = NULL, *column = "bytes";
+    double from = NAN, to = NAN, step = 0.0;
+    int raw = 0, verify = 0;
+    for(int i=1;i+1<argc;i+=2){
+        if(strcmp(argv[i], "--store") == 0) dir = argv[i+1];
+        else if(strcmp(argv[i], "--source") == 0) src = argv[i+1];
+        else if(strcmp(argv[i], "--column") == 0) column = argv[i+1];
+        else if(strcmp(argv[i], "--from") == 0) from = atof(argv[i+1]);
+        else if(strcmp(argv[i], "--to") == 0) to = atof(argv[i+1]);
+        else if(strcmp(argv[i], "--step") == 0) step = atof(argv[i+1]);
+        else if(strcmp(argv[i], "--raw") == 0) raw = atoi(argv[i+1]);
+        else if(strcmp(argv[i], "--verify") == 0) verify = atoi(argv[i+1]);
+        else {
+            fprintf(stderr, "usage: %s [--store DIR] [--source SRC] [--column NAME] [--from SEC] [--to SEC] [--step SEC] [--raw 0|1] [--verify 0|1]\n", argv[0]);
+            return 1;
+        }
+    }
+    int col = tsdb_column(column);
+    if(col < 0){ fprintf(stderr, "unknown --column '%s'\n", column); return 1; }
+    tsdb_t *db = tsdb_open(dir, 0);
+    if(!db){ fprintf(stderr, "cannot open the store in %s\n", dir); return 1; }
+    if(!src){
+        int rc = list_sources(db);
+        tsdb_close(db);
+        return rc;
+    }
+    long long last = tsdb_last(db, src, col);
+    if(last == LLONG_MIN){ fprintf(stderr, "no '%s' points of source '%s'\n", column, src); tsdb_close(db); return 1; }
+    /* timestamps are given in seconds, the store keeps milliseconds */
+    long long t0 = isnan(from) ? 0 : (long long)(from * 1000.0);
+    long long t1 = isnan(to) ? last + 1 : (long long)(to * 1000.0);
+    long long dt = step > 0.0 ? (long long)(step * 1000.0) : t1 - t0;
+    if(dt <= 0 || t1 <= t0){ fprintf(stderr, "empty range\n"); tsdb_close(db); return 1; }
+
+    printf("from,to,count,sum,min,max,last,mean,tier\n");
+    long long rows = 0, mismatches = 0, ns = 0, raw_ns = 0;
+    for(long long t = t0; t < t1; t += dt){
+        long long e = t + dt < t1 ? t + dt : t1;
+        tsdb_agg_t a;
+        long long q0 = platform_monotonic_ns();
+        tsdb_query(db, src, col, t, e, raw ? -1 : TSDB_TIERS - 1, &a);
+        ns += platform_monotonic_ns() - q0;
+        rows++;
+        if(verify){
+            tsdb_agg_t r;
+            q0 = platform_monotonic_ns();
+            tsdb_query(db, src, col, t, e, -1, &r);
+            raw_ns += platform_monotonic_ns() - q0;
+            int same = a.count == r.count && fabs(a.sum - r.sum) <= 1e-6 * (fabs(r.sum) + 1.0)
+                    && (a.count == 0 || (a.min == r.min && a.max == r.max && a.last == r.last));
+            if(!same) mismatches++;
+        }
+        if(a.count == 0) continue;
+        printf("%.3f,%.3f,%lld,%.6g,%.6g,%.6g,%.6g,%.6g,%s\n", (double)t / 1000.0, (double)e / 1000.0, a.count, a.sum,
+               (double)a.min, (double)a.max, (double)a.last, a.sum / (double)a.count, a.tier >= 0 ? tier_names[a.tier] : "raw");
+    }
+    fprintf(stderr, "%lld queries in %.3f ms", rows, (double)ns / 1e6);
+    if(verify) fprintf(stderr, " (raw points: %.3f ms, %lld rows differ)", (double)raw_ns / 1e6, mismatches);
+    fprintf(stderr, "\n");
+    tsdb_close(db);
+    return mismatches ? 2 : 0;
+}